@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "http-parser.h"
+#include "http-parser-replay.h"
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-n iterations] capture...\n", name);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Parses the captures on a single thread, iterations times over, and\n");
+  fprintf(stderr, "reports the parser's throughput. Defaults to 20 iterations.\n");
+}
+
+int main(int argc, char *argv[]) {
+  struct http_parser_replay replay = { .threads = 1 };
+  const char **paths;
+  int iterations = 20;
+  int count;
+  int opt;
+  int i;
+
+  while((opt = getopt(argc, argv, "n:h")) != -1) {
+    switch(opt) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc || iterations < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Every iteration replays the whole corpus, the pages stay cached
+  count = (argc - optind) * iterations;
+  paths = malloc(count * sizeof(const char *));
+  for(i = 0; i < count; i++) {
+    paths[i] = argv[optind + (i % (argc - optind))];
+  }
+
+  if (http_parser_replay_run(&replay, paths, count)) {
+    perror("bench");
+    free(paths);
+    return 1;
+  }
+  free(paths);
+
+  if (replay.errors) {
+    fprintf(stderr, "%lu captures could not be parsed\n", (unsigned long)replay.errors);
+    return 2;
+  }
+  printf("%-24s %8.1f MB/s %10.0f messages/s %8.1f ns/message\n",
+    argv[0],
+    (replay.bytes / 1e6) / (replay.parseTime / 1e9),
+    (replay.requests + replay.responses) / (replay.parseTime / 1e9),
+    (double)replay.parseTime / (replay.requests + replay.responses)
+  );
+  return 0;
+}
@@ -1 +1,15 @@
 SRC+=__DIRNAME/src/http-parser.c
+SRC+=__DIRNAME/src/http-parser-cache.c
+SRC+=__DIRNAME/src/http-parser-conditional.c
+SRC+=__DIRNAME/src/http-parser-encoding.c
+SRC+=__DIRNAME/src/http-parser-h2.c
+SRC+=__DIRNAME/src/http-parser-multipart.c
+SRC+=__DIRNAME/src/http-parser-pool.c
+SRC+=__DIRNAME/src/http-parser-queue.c
+SRC+=__DIRNAME/src/http-parser-range.c
+SRC+=__DIRNAME/src/http-parser-replay.c
+SRC+=__DIRNAME/src/http-parser-snapshot.c
+SRC+=__DIRNAME/src/http-parser-stats.c
+SRC+=__DIRNAME/src/http-parser-template.c
+SRC+=__DIRNAME/src/http-parser-uring.c
+SRC+=__DIRNAME/src/http-parser-websocket.c
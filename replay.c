@@ -0,0 +1,85 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "http-parser.h"
+#include "http-parser-replay.h"
+
+static pthread_mutex_t outputLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-t threads] [-v] capture...\n", name);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Parses captured HTTP/1.x connections, one file per direction of each\n");
+  fprintf(stderr, "connection, holding the raw bytes sent.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "  -t threads  Threads to parse on, defaults to one per processor\n");
+  fprintf(stderr, "  -v          Print a line per message: capture, kind, start line,\n");
+  fprintf(stderr, "              bytes, headers, body bytes and parse time in microseconds\n");
+}
+
+static void onMessage(const struct http_parser_replay_record *record, void *udata) {
+  struct http_parser_message *message = record->message;
+  (void)udata;
+
+  pthread_mutex_lock(&outputLock);
+  if (record->isResponse) {
+    printf("%s\tresponse\t%d", record->path, message->status);
+  } else {
+    printf("%s\trequest\t%s %s", record->path, message->method ? message->method : "-", message->path ? message->path : "-");
+  }
+  printf("\t%lu\t%d\t%lu\t%.3f\n",
+    (unsigned long)record->length, record->headerCount, (unsigned long)record->bodyLength,
+    record->parseTime / 1000.0
+  );
+  pthread_mutex_unlock(&outputLock);
+}
+
+int main(int argc, char *argv[]) {
+  struct http_parser_replay replay = {0};
+  double seconds;
+  double parseSeconds;
+  int opt;
+
+  while((opt = getopt(argc, argv, "t:vh")) != -1) {
+    switch(opt) {
+      case 't':
+        replay.threads = atoi(optarg);
+        break;
+      case 'v':
+        replay.onMessage = onMessage;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (http_parser_replay_run(&replay, (const char *const *)(argv + optind), argc - optind)) {
+    perror("replay");
+    return 1;
+  }
+
+  seconds      = replay.elapsed / 1e9;
+  parseSeconds = replay.parseTime / 1e9;
+  fprintf(stderr, "captures   %d\n", argc - optind);
+  fprintf(stderr, "requests   %lu\n", (unsigned long)replay.requests);
+  fprintf(stderr, "responses  %lu\n", (unsigned long)replay.responses);
+  fprintf(stderr, "errors     %lu\n", (unsigned long)replay.errors);
+  fprintf(stderr, "bytes      %lu\n", (unsigned long)replay.bytes);
+  fprintf(stderr, "elapsed    %.3f s\n", seconds);
+  fprintf(stderr, "parsing    %.3f s over all threads\n", parseSeconds);
+  if (seconds > 0) {
+    fprintf(stderr, "throughput %.1f MB/s, %.0f messages/s\n",
+      (replay.bytes / 1e6) / seconds,
+      (replay.requests + replay.responses) / seconds
+    );
+  }
+  return replay.errors ? 2 : 0;
+}
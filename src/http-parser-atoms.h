@@ -0,0 +1,73 @@
+#ifndef _HTTP_PARSER_ATOMS_H_
+#define _HTTP_PARSER_ATOMS_H_
+
+// Atoms of the header names interned by the parser, see http_parser_header_atom
+// Headers with other names have atom HTTP_PARSER_ATOM_NONE
+
+#define HTTP_PARSER_ATOM_NONE                        0
+#define HTTP_PARSER_ATOM_ACCEPT                      1
+#define HTTP_PARSER_ATOM_ACCEPT_CHARSET              2
+#define HTTP_PARSER_ATOM_ACCEPT_ENCODING             3
+#define HTTP_PARSER_ATOM_ACCEPT_LANGUAGE             4
+#define HTTP_PARSER_ATOM_ACCEPT_RANGES               5
+#define HTTP_PARSER_ATOM_ACCESS_CONTROL_ALLOW_ORIGIN 6
+#define HTTP_PARSER_ATOM_AGE                         7
+#define HTTP_PARSER_ATOM_ALLOW                       8
+#define HTTP_PARSER_ATOM_AUTHORIZATION               9
+#define HTTP_PARSER_ATOM_CACHE_CONTROL               10
+#define HTTP_PARSER_ATOM_CONNECTION                  11
+#define HTTP_PARSER_ATOM_CONTENT_DISPOSITION         12
+#define HTTP_PARSER_ATOM_CONTENT_ENCODING            13
+#define HTTP_PARSER_ATOM_CONTENT_LANGUAGE            14
+#define HTTP_PARSER_ATOM_CONTENT_LENGTH              15
+#define HTTP_PARSER_ATOM_CONTENT_LOCATION            16
+#define HTTP_PARSER_ATOM_CONTENT_RANGE               17
+#define HTTP_PARSER_ATOM_CONTENT_TYPE                18
+#define HTTP_PARSER_ATOM_COOKIE                      19
+#define HTTP_PARSER_ATOM_DATE                        20
+#define HTTP_PARSER_ATOM_ETAG                        21
+#define HTTP_PARSER_ATOM_EXPECT                      22
+#define HTTP_PARSER_ATOM_EXPIRES                     23
+#define HTTP_PARSER_ATOM_FORWARDED                   24
+#define HTTP_PARSER_ATOM_FROM                        25
+#define HTTP_PARSER_ATOM_HOST                        26
+#define HTTP_PARSER_ATOM_HTTP2_SETTINGS              27
+#define HTTP_PARSER_ATOM_IF_MATCH                    28
+#define HTTP_PARSER_ATOM_IF_MODIFIED_SINCE           29
+#define HTTP_PARSER_ATOM_IF_NONE_MATCH               30
+#define HTTP_PARSER_ATOM_IF_RANGE                    31
+#define HTTP_PARSER_ATOM_IF_UNMODIFIED_SINCE         32
+#define HTTP_PARSER_ATOM_KEEP_ALIVE                  33
+#define HTTP_PARSER_ATOM_LAST_MODIFIED               34
+#define HTTP_PARSER_ATOM_LINK                        35
+#define HTTP_PARSER_ATOM_LOCATION                    36
+#define HTTP_PARSER_ATOM_ORIGIN                      37
+#define HTTP_PARSER_ATOM_PROXY_AUTHENTICATE          38
+#define HTTP_PARSER_ATOM_PROXY_AUTHORIZATION         39
+#define HTTP_PARSER_ATOM_PROXY_CONNECTION            40
+#define HTTP_PARSER_ATOM_RANGE                       41
+#define HTTP_PARSER_ATOM_REFERER                     42
+#define HTTP_PARSER_ATOM_RETRY_AFTER                 43
+#define HTTP_PARSER_ATOM_SEC_WEBSOCKET_ACCEPT        44
+#define HTTP_PARSER_ATOM_SEC_WEBSOCKET_EXTENSIONS    45
+#define HTTP_PARSER_ATOM_SEC_WEBSOCKET_KEY           46
+#define HTTP_PARSER_ATOM_SEC_WEBSOCKET_PROTOCOL      47
+#define HTTP_PARSER_ATOM_SEC_WEBSOCKET_VERSION       48
+#define HTTP_PARSER_ATOM_SERVER                      49
+#define HTTP_PARSER_ATOM_SET_COOKIE                  50
+#define HTTP_PARSER_ATOM_STRICT_TRANSPORT_SECURITY   51
+#define HTTP_PARSER_ATOM_TE                          52
+#define HTTP_PARSER_ATOM_TRAILER                     53
+#define HTTP_PARSER_ATOM_TRANSFER_ENCODING           54
+#define HTTP_PARSER_ATOM_UPGRADE                     55
+#define HTTP_PARSER_ATOM_USER_AGENT                  56
+#define HTTP_PARSER_ATOM_VARY                        57
+#define HTTP_PARSER_ATOM_VIA                         58
+#define HTTP_PARSER_ATOM_WWW_AUTHENTICATE            59
+#define HTTP_PARSER_ATOM_X_FORWARDED_FOR             60
+#define HTTP_PARSER_ATOM_X_FORWARDED_HOST            61
+#define HTTP_PARSER_ATOM_X_FORWARDED_PROTO           62
+#define HTTP_PARSER_ATOM_X_REQUESTED_WITH            63
+#define HTTP_PARSER_ATOM_COUNT                       64
+
+#endif // _HTTP_PARSER_ATOMS_H_
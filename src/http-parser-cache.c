@@ -0,0 +1,297 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "finwo/strnstr.h"
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-cache.h"
+#include "http-parser-internal.h"
+
+// Length of an IMF-fixdate as formatted by http_parser_date
+static const size_t _HTTP_PARSER_CACHE_DATE_LENGTH = 29;
+
+// Keys {{{
+
+static uint64_t http_parser_cache_hash_string(uint64_t hash, const char *str) {
+  while(*str) {
+    hash ^= (unsigned char)*(str++);
+    hash *= 0x100000001b3ULL;
+  }
+  hash ^= 0xff;
+  return hash * 0x100000001b3ULL;
+}
+
+/**
+ * FNV-1a over method, path and query
+ */
+static uint64_t http_parser_cache_hash(const char *method, const char *path, const char *query) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = http_parser_cache_hash_string(hash, method);
+  hash = http_parser_cache_hash_string(hash, path);
+  return http_parser_cache_hash_string(hash, query);
+}
+
+/**
+ * Collects the request's values of the headers named in a Vary list,
+ * one per line
+ */
+static void http_parser_cache_vary_values(struct buf *out, const char *vary, struct http_parser_message *request) {
+  struct http_parser_list_item item;
+  const char *value;
+  char name[128];
+
+  out->len = 0;
+  while((vary = http_parser_list_next(vary, &item))) {
+    if (!item.tokenLength || item.tokenLength >= sizeof(name)) continue;
+    memcpy(name, item.token, item.tokenLength);
+    name[item.tokenLength] = '\0';
+    value = http_parser_header_get(request, name);
+    if (value) buf_append(out, value, strlen(value));
+    buf_append(out, "\n", 1);
+  }
+  buf_append(out, "", 1);
+}
+
+static int http_parser_cache_matches(struct http_parser_cache *cache, struct http_parser_cache_entry *entry, uint64_t hash, const char *method, const char *path, const char *query, struct http_parser_message *request) {
+  if (entry->hash != hash) return 0;
+  if (strcmp(entry->path, path) || strcmp(entry->method, method) || strcmp(entry->query, query)) return 0;
+  if (!entry->vary) return 1;
+  http_parser_cache_vary_values(cache->_scratch, entry->vary, request);
+  return !strcmp(entry->varyValues, cache->_scratch->data);
+}
+
+/**
+ * Whether the response must not be shared: Cache-Control no-store or
+ * private, or setting a cookie
+ */
+static int http_parser_cache_forbidden(struct http_parser_message *response) {
+  const struct http_parser_header *header = NULL;
+  if (http_parser_header_get_atom(response, HTTP_PARSER_ATOM_SET_COOKIE)) return 1;
+  while((header = http_parser_header_next_atom(response, HTTP_PARSER_ATOM_CACHE_CONTROL, header))) {
+    if (http_parser_list_contains(header->value, "no-store") || http_parser_list_contains(header->value, "private")) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Offset of the Date value the serializer added to the head, or 0
+ */
+static size_t http_parser_cache_date_offset(const struct buf *data) {
+  const char *end  = strnstr(data->data, "\r\n\r\n", data->len);
+  const char *date = end ? strnstr(data->data, "\r\nDate: ", (end - data->data) + 2) : NULL;
+  if (!date || (size_t)(end - date) < (8 + _HTTP_PARSER_CACHE_DATE_LENGTH)) return 0;
+  return (date - data->data) + 8;
+}
+
+// }}}
+
+// Entries {{{
+
+static void http_parser_cache_unlink(struct http_parser_cache *cache, struct http_parser_cache_entry *entry) {
+  struct http_parser_cache_entry **ref = &(cache->_buckets[entry->hash & (cache->_bucketCount - 1)]);
+  while(*ref != entry) ref = &((*ref)->next);
+  *ref = entry->next;
+  if (entry->newer) entry->newer->older = entry->older; else cache->_newest = entry->older;
+  if (entry->older) entry->older->newer = entry->newer; else cache->_oldest = entry->newer;
+  cache->size -= entry->size;
+  cache->count--;
+}
+
+static void http_parser_cache_remove(struct http_parser_cache *cache, struct http_parser_cache_entry *entry) {
+  http_parser_cache_unlink(cache, entry);
+  buf_clear(entry->data);
+  free(entry->data);
+  free(entry->method);
+  free(entry);
+}
+
+/**
+ * Moves an entry to the front of the eviction order
+ */
+static void http_parser_cache_touch(struct http_parser_cache *cache, struct http_parser_cache_entry *entry) {
+  if (cache->_newest == entry) return;
+  if (entry->newer) entry->newer->older = entry->older;
+  if (entry->older) entry->older->newer = entry->newer; else cache->_oldest = entry->newer;
+  entry->older = cache->_newest;
+  entry->newer = NULL;
+  cache->_newest->newer = entry;
+  cache->_newest = entry;
+}
+
+static void http_parser_cache_grow(struct http_parser_cache *cache) {
+  struct http_parser_cache_entry **buckets = calloc(cache->_bucketCount * 2, sizeof(struct http_parser_cache_entry *));
+  struct http_parser_cache_entry *entry;
+  struct http_parser_cache_entry *next;
+  int i;
+  for(i=0; i<cache->_bucketCount; i++) {
+    for(entry = cache->_buckets[i]; entry; entry = next) {
+      next = entry->next;
+      entry->next = buckets[entry->hash & ((cache->_bucketCount * 2) - 1)];
+      buckets[entry->hash & ((cache->_bucketCount * 2) - 1)] = entry;
+    }
+  }
+  free(cache->_buckets);
+  cache->_buckets     = buckets;
+  cache->_bucketCount = cache->_bucketCount * 2;
+}
+
+// }}}
+
+/**
+ * Initializes a cache holding at most maxSize bytes of responses
+ */
+struct http_parser_cache * http_parser_cache_init(size_t maxSize) {
+  struct http_parser_cache *cache = calloc(1, sizeof(struct http_parser_cache));
+  cache->maxSize      = maxSize;
+  cache->_bucketCount = 64;
+  cache->_buckets     = calloc(cache->_bucketCount, sizeof(struct http_parser_cache_entry *));
+  cache->_scratch     = calloc(1, sizeof(struct buf));
+  return cache;
+}
+
+/**
+ * Returns the serialized response stored for the request, or NULL
+ *
+ * The bytes remain valid until the next store, invalidation or clear. The
+ * Date the serializer added is brought up to date in place.
+ */
+const struct buf * http_parser_cache_lookup(struct http_parser_cache *cache, struct http_parser_message *request) {
+  const char *method = request->method ? request->method : "GET";
+  const char *path   = request->path   ? request->path   : "/";
+  const char *query  = request->query  ? request->query  : "";
+  uint64_t hash      = http_parser_cache_hash(method, path, query);
+  struct http_parser_cache_entry *entry = cache->_buckets[hash & (cache->_bucketCount - 1)];
+  const char *date;
+
+  for(; entry; entry = entry->next) {
+    if (!http_parser_cache_matches(cache, entry, hash, method, path, query, request)) continue;
+    if (entry->dateOffset) {
+      date = http_parser_date();
+      if (strlen(date) == _HTTP_PARSER_CACHE_DATE_LENGTH) memcpy(entry->data->data + entry->dateOffset, date, _HTTP_PARSER_CACHE_DATE_LENGTH);
+    }
+    http_parser_cache_touch(cache, entry);
+    cache->hits++;
+    return entry->data;
+  }
+  cache->misses++;
+  return NULL;
+}
+
+/**
+ * Serializes the response and stores it for the request's method, path and
+ * query, and the request headers named in the response's Vary header. For
+ * HEAD the body is left out, as http_parser_sprint_pair_response does
+ *
+ * Returns -1 if the response can't be cached: Vary: *, a spilled body,
+ * larger than the whole cache, or not to be shared at all
+ */
+int http_parser_cache_store(struct http_parser_cache *cache, struct http_parser_message *request, struct http_parser_message *response) {
+  const char *method = request->method ? request->method : "GET";
+  const char *path   = request->path   ? request->path   : "/";
+  const char *query  = request->query  ? request->query  : "";
+  const char *vary   = http_parser_header_get(response, "vary");
+  uint64_t hash      = http_parser_cache_hash(method, path, query);
+  struct http_parser_cache_entry *entry;
+  struct buf *data;
+  size_t lengths[5];
+  char *strings;
+
+  if (response->bodyFd >= 0) return -1;
+  if (vary && strchr(vary, '*')) return -1;
+  if (http_parser_cache_forbidden(response)) return -1;
+
+  // Replace what's stored for the same request
+  for(entry = cache->_buckets[hash & (cache->_bucketCount - 1)]; entry; entry = entry->next) {
+    if (http_parser_cache_matches(cache, entry, hash, method, path, query, request)) {
+      http_parser_cache_remove(cache, entry);
+      break;
+    }
+  }
+
+  if (vary) http_parser_cache_vary_values(cache->_scratch, vary, request);
+  lengths[0] = strlen(method) + 1;
+  lengths[1] = strlen(path) + 1;
+  lengths[2] = strlen(query) + 1;
+  lengths[3] = vary ? strlen(vary) + 1 : 0;
+  lengths[4] = vary ? cache->_scratch->len : 0;
+
+  data = calloc(1, sizeof(struct buf));
+  _http_parser_sprint_response(data, response, !strcmp(method, "HEAD"));
+  entry = calloc(1, sizeof(struct http_parser_cache_entry));
+  entry->size = sizeof(struct http_parser_cache_entry) + data->cap + lengths[0] + lengths[1] + lengths[2] + lengths[3] + lengths[4];
+  if (entry->size > cache->maxSize) {
+    buf_clear(data);
+    free(data);
+    free(entry);
+    return -1;
+  }
+
+  // Key strings share one allocation
+  strings       = malloc(lengths[0] + lengths[1] + lengths[2] + lengths[3] + lengths[4]);
+  entry->method = memcpy(strings, method, lengths[0]);
+  entry->path   = memcpy(strings += lengths[0], path, lengths[1]);
+  entry->query  = memcpy(strings += lengths[1], query, lengths[2]);
+  strings += lengths[2];
+  if (vary) {
+    entry->vary       = memcpy(strings, vary, lengths[3]);
+    entry->varyValues = memcpy(strings + lengths[3], cache->_scratch->data, lengths[4]);
+  }
+  entry->hash = hash;
+  entry->data = data;
+  if (!http_parser_header_get_atom(response, HTTP_PARSER_ATOM_DATE)) entry->dateOffset = http_parser_cache_date_offset(data);
+
+  if (cache->count >= cache->_bucketCount) http_parser_cache_grow(cache);
+  entry->next  = cache->_buckets[hash & (cache->_bucketCount - 1)];
+  cache->_buckets[hash & (cache->_bucketCount - 1)] = entry;
+  entry->older = cache->_newest;
+  if (cache->_newest) cache->_newest->newer = entry; else cache->_oldest = entry;
+  cache->_newest = entry;
+  cache->size   += entry->size;
+  cache->count++;
+
+  // Evict the least recently used responses beyond the cap
+  while(cache->size > cache->maxSize) http_parser_cache_remove(cache, cache->_oldest);
+  return 0;
+}
+
+/**
+ * Removes every stored response for the path, whatever the method, query or
+ * varying headers, returning how many were removed
+ */
+int http_parser_cache_invalidate(struct http_parser_cache *cache, const char *path) {
+  struct http_parser_cache_entry *entry = cache->_newest;
+  struct http_parser_cache_entry *older;
+  int removed = 0;
+  for(; entry; entry = older) {
+    older = entry->older;
+    if (strcmp(entry->path, path)) continue;
+    http_parser_cache_remove(cache, entry);
+    removed++;
+  }
+  return removed;
+}
+
+void http_parser_cache_clear(struct http_parser_cache *cache) {
+  while(cache->_newest) http_parser_cache_remove(cache, cache->_newest);
+}
+
+void http_parser_cache_free(struct http_parser_cache *cache) {
+  http_parser_cache_clear(cache);
+  free(cache->_buckets);
+  buf_clear(cache->_scratch);
+  free(cache->_scratch);
+  free(cache);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,52 @@
+#ifndef _HTTP_PARSER_CACHE_H_
+#define _HTTP_PARSER_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http-parser.h"
+
+struct http_parser_cache_entry {
+  char *method;
+  char *path;
+  char *query;
+  char *vary;
+  char *varyValues;
+  uint64_t hash;
+  size_t size;
+  size_t dateOffset;
+  struct buf *data;
+  struct http_parser_cache_entry *next;
+  struct http_parser_cache_entry *newer;
+  struct http_parser_cache_entry *older;
+};
+
+struct http_parser_cache {
+  size_t size;
+  size_t maxSize;
+  int count;
+  uint64_t hits;
+  uint64_t misses;
+  struct http_parser_cache_entry **_buckets;
+  int _bucketCount;
+  struct http_parser_cache_entry *_newest;
+  struct http_parser_cache_entry *_oldest;
+  struct buf *_scratch;
+};
+
+struct http_parser_cache * http_parser_cache_init(size_t maxSize);
+int http_parser_cache_store(struct http_parser_cache *cache, struct http_parser_message *request, struct http_parser_message *response);
+const struct buf * http_parser_cache_lookup(struct http_parser_cache *cache, struct http_parser_message *request);
+int http_parser_cache_invalidate(struct http_parser_cache *cache, const char *path);
+void http_parser_cache_clear(struct http_parser_cache *cache);
+void http_parser_cache_free(struct http_parser_cache *cache);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_CACHE_H_
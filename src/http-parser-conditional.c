@@ -0,0 +1,279 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-conditional.h"
+
+// HTTP-date {{{
+
+static int http_parser_date_digits(const char **cursor, int min, int max, int *result) {
+  const char *p = *cursor;
+  int count = 0;
+  *result = 0;
+  while(*p >= '0' && *p <= '9' && count < max) {
+    *result = (*result * 10) + (*(p++) - '0');
+    count++;
+  }
+  if (count < min) return -1;
+  *cursor = p;
+  return 0;
+}
+
+static int http_parser_date_month(const char **cursor) {
+  static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  int month;
+  for(month = 0; month < 12; month++) {
+    if (!strncmp(*cursor, months + (month * 3), 3)) {
+      *cursor += 3;
+      return month;
+    }
+  }
+  return -1;
+}
+
+static int http_parser_date_clock(const char **cursor, int *hour, int *minute, int *second) {
+  if (http_parser_date_digits(cursor, 2, 2, hour) || *((*cursor)++) != ':') return -1;
+  if (http_parser_date_digits(cursor, 2, 2, minute) || *((*cursor)++) != ':') return -1;
+  if (http_parser_date_digits(cursor, 2, 2, second)) return -1;
+  return (*hour > 23 || *minute > 59 || *second > 60) ? -1 : 0;
+}
+
+/**
+ * Parses an HTTP-date in any of the three formats HTTP allows: IMF-fixdate,
+ * RFC 850 and asctime
+ *
+ * Returns the time in seconds since the epoch, or -1 if the date is invalid
+ */
+time_t http_parser_date_parse(const char *value) {
+  const char *cursor = value;
+  int day, month, year, hour, minute, second;
+  long long days;
+  int era, yoe, doy;
+
+  if (!value) return -1;
+
+  // Day name, a comma follows it in all but asctime
+  while((*cursor >= 'A' && *cursor <= 'Z') || (*cursor >= 'a' && *cursor <= 'z')) cursor++;
+  if (*cursor == ',') {
+    cursor++;
+    while(*cursor == ' ') cursor++;
+    if (http_parser_date_digits(&cursor, 1, 2, &day)) return -1;
+    if (*cursor != ' ' && *cursor != '-') return -1;
+    cursor++;
+    if ((month = http_parser_date_month(&cursor)) < 0) return -1;
+    if (*cursor != ' ' && *cursor != '-') return -1;
+    cursor++;
+    if (http_parser_date_digits(&cursor, 2, 4, &year)) return -1;
+    if (year < 100) year += (year < 70) ? 2000 : 1900;
+    if (*(cursor++) != ' ') return -1;
+    if (http_parser_date_clock(&cursor, &hour, &minute, &second)) return -1;
+    if (strcmp(cursor, " GMT")) return -1;
+  } else {
+    while(*cursor == ' ') cursor++;
+    if ((month = http_parser_date_month(&cursor)) < 0) return -1;
+    while(*cursor == ' ') cursor++;
+    if (http_parser_date_digits(&cursor, 1, 2, &day)) return -1;
+    if (*(cursor++) != ' ') return -1;
+    if (http_parser_date_clock(&cursor, &hour, &minute, &second)) return -1;
+    if (*(cursor++) != ' ') return -1;
+    if (http_parser_date_digits(&cursor, 4, 4, &year) || *cursor) return -1;
+  }
+  if (day < 1 || day > 31) return -1;
+
+  // Days since the epoch of the civil date, with March as the first month
+  if (month < 2) year--;
+  era  = year / 400;
+  yoe  = year - (era * 400);
+  doy  = ((153 * (month + (month > 1 ? -2 : 10)) + 2) / 5) + day - 1;
+  days = ((long long)era * 146097) + (yoe * 365) + (yoe / 4) - (yoe / 100) + doy - 719468;
+  return (time_t)((days * 86400) + (hour * 3600) + (minute * 60) + second);
+}
+
+// }}}
+
+// Entity tags {{{
+
+/**
+ * Reads the next entity tag of a list, skipping separators
+ *
+ * Sets tag to the opaque tag without its quotes, or NULL for "*". Returns the
+ * position after the entry, or NULL at the end of the list or when it's
+ * malformed.
+ */
+static const char * http_parser_etag_next(const char *cursor, const char **tag, size_t *len, int *weak) {
+  const char *end;
+  while(*cursor == ' ' || *cursor == '\t' || *cursor == ',') cursor++;
+  if (!*cursor) return NULL;
+  *weak = 0;
+  if (*cursor == '*') {
+    *tag = NULL;
+    *len = 0;
+    return cursor + 1;
+  }
+  if (cursor[0] == 'W' && cursor[1] == '/') {
+    *weak   = 1;
+    cursor += 2;
+  }
+  if (*cursor != '"') return NULL;
+  end = strchr(cursor + 1, '"');
+  if (!end) return NULL;
+  *tag = cursor + 1;
+  *len = end - cursor - 1;
+  return end + 1;
+}
+
+/**
+ * Whether a list of entity tags, like If-Match or If-None-Match, matches the
+ * etag of the current representation
+ *
+ * Uses the weak comparison when weak is set, where W/ prefixes are ignored,
+ * or the strong comparison otherwise. "*" matches any etag, a NULL etag
+ * matches nothing but "*".
+ */
+int http_parser_etag_match(const char *list, const char *etag, int weak) {
+  const char *tag = NULL, *entry;
+  size_t len = 0, entryLen;
+  int isWeak = 0, entryWeak;
+
+  if (etag && !http_parser_etag_next(etag, &tag, &len, &isWeak)) return 0;
+  while((list = http_parser_etag_next(list, &entry, &entryLen, &entryWeak))) {
+    if (!entry) return 1;
+    if (!tag) continue;
+    if (!weak && (isWeak || entryWeak)) continue;
+    if (entryLen == len && !memcmp(entry, tag, len)) return 1;
+  }
+  return 0;
+}
+
+// }}}
+
+// Evaluation {{{
+
+/**
+ * Evaluates the request's preconditions against the current representation,
+ * in the order RFC 9110 section 13.2.2 prescribes
+ *
+ * Returns 304 or 412 when the request should be answered with that status,
+ * or 0 to handle the request normally. Validators that are left out only
+ * satisfy "*".
+ */
+int http_parser_conditional_evaluate(struct http_parser_message *request, const struct http_parser_validators *validators) {
+  const char *method = request->method;
+  int safe           = method && (!strcmp(method, "GET") || !strcmp(method, "HEAD"));
+  const char *value;
+  time_t since;
+
+  if ((value = http_parser_header_get_atom(request, HTTP_PARSER_ATOM_IF_MATCH))) {
+    if (!http_parser_etag_match(value, validators->etag, 0)) return 412;
+  } else if ((value = http_parser_header_get_atom(request, HTTP_PARSER_ATOM_IF_UNMODIFIED_SINCE)) && validators->lastModified > 0) {
+    since = http_parser_date_parse(value);
+    if (since >= 0 && validators->lastModified > since) return 412;
+  }
+
+  if ((value = http_parser_header_get_atom(request, HTTP_PARSER_ATOM_IF_NONE_MATCH))) {
+    if (http_parser_etag_match(value, validators->etag, 1)) return safe ? 304 : 412;
+  } else if (safe && (value = http_parser_header_get_atom(request, HTTP_PARSER_ATOM_IF_MODIFIED_SINCE)) && validators->lastModified > 0) {
+    since = http_parser_date_parse(value);
+    if (since >= 0 && validators->lastModified <= since) return 304;
+  }
+
+  return 0;
+}
+
+/**
+ * Whether a Range header should be honored, given the request's If-Range
+ *
+ * An If-Range etag must match strongly and an If-Range date exactly, else the
+ * whole representation is to be sent
+ */
+int http_parser_conditional_range(struct http_parser_message *request, const struct http_parser_validators *validators) {
+  const char *value = http_parser_header_get_atom(request, HTTP_PARSER_ATOM_IF_RANGE);
+  time_t date;
+  if (!value) return 1;
+  while(*value == ' ') value++;
+  if (*value == '"' || (value[0] == 'W' && value[1] == '/')) {
+    return validators->etag && *value == '"' && http_parser_etag_match(value, validators->etag, 0);
+  }
+  date = http_parser_date_parse(value);
+  return date >= 0 && validators->lastModified > 0 && date == validators->lastModified;
+}
+
+// }}}
+
+// 304 Not Modified {{{
+
+static void http_parser_sprint_line(struct buf *result, const char *key, const char *value) {
+  buf_append(result, key, strlen(key));
+  buf_append(result, ": ", 2);
+  buf_append(result, value, strlen(value));
+  buf_append(result, "\r\n", 2);
+}
+
+struct buf * http_parser_sprint_not_modified(struct http_parser_message *response, const struct http_parser_validators *validators) {
+  struct buf *result = calloc(1, sizeof(struct buf));
+  http_parser_sprint_not_modified_into(result, response, validators);
+  return result;
+}
+
+/**
+ * Appends a complete 304 response carrying the validators
+ *
+ * Of the response the 200 would have been, only the headers a 304 must
+ * repeat are kept: Cache-Control, Content-Location, Date, Expires and Vary,
+ * and ETag or Last-Modified when not given as validators. The response may
+ * be NULL.
+ */
+void http_parser_sprint_not_modified_into(struct buf *result, struct http_parser_message *response, const struct http_parser_validators *validators) {
+  const char *version = (response && response->version) ? response->version : "1.1";
+  const char *date    = response ? http_parser_header_get_atom(response, HTTP_PARSER_ATOM_DATE) : NULL;
+  struct http_parser_header *header;
+  char formatted[32];
+  int i;
+
+  buf_append(result, "HTTP/", 5);
+  buf_append(result, version, strlen(version));
+  buf_append(result, " 304 Not Modified\r\n", 19);
+  http_parser_sprint_line(result, "Date", date ? date : http_parser_date());
+  if (validators->etag) http_parser_sprint_line(result, "ETag", validators->etag);
+  if (validators->lastModified > 0 && http_parser_date_format(validators->lastModified, formatted, sizeof(formatted))) {
+    http_parser_sprint_line(result, "Last-Modified", formatted);
+  }
+
+  for(i = 0; response && i < response->headerCount; i++) {
+    header = &(response->headers[i]);
+    switch(header->atom) {
+      case HTTP_PARSER_ATOM_ETAG:
+        if (validators->etag) continue;
+        break;
+      case HTTP_PARSER_ATOM_LAST_MODIFIED:
+        if (validators->lastModified > 0) continue;
+        break;
+      case HTTP_PARSER_ATOM_CACHE_CONTROL:
+      case HTTP_PARSER_ATOM_CONTENT_LOCATION:
+      case HTTP_PARSER_ATOM_EXPIRES:
+      case HTTP_PARSER_ATOM_VARY:
+        break;
+      default:
+        continue;
+    }
+    http_parser_sprint_line(result, header->key, header->value);
+  }
+
+  buf_append(result, "\r\n", 2);
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
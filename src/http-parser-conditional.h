@@ -0,0 +1,29 @@
+#ifndef _HTTP_PARSER_CONDITIONAL_H_
+#define _HTTP_PARSER_CONDITIONAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+
+#include "http-parser.h"
+
+// The current representation's validators, either may be left out
+struct http_parser_validators {
+  const char *etag;
+  time_t lastModified;
+};
+
+time_t http_parser_date_parse(const char *value);
+int http_parser_etag_match(const char *list, const char *etag, int weak);
+int http_parser_conditional_evaluate(struct http_parser_message *request, const struct http_parser_validators *validators);
+int http_parser_conditional_range(struct http_parser_message *request, const struct http_parser_validators *validators);
+struct buf * http_parser_sprint_not_modified(struct http_parser_message *response, const struct http_parser_validators *validators);
+void http_parser_sprint_not_modified_into(struct buf *result, struct http_parser_message *response, const struct http_parser_validators *validators);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_CONDITIONAL_H_
@@ -0,0 +1,304 @@
+#ifndef _HTTP_PARSER_CORO_HPP_
+#define _HTTP_PARSER_CORO_HPP_
+
+// C++20 coroutine adapter over http-parser.hpp
+//
+// A connection task awaits the next request's head, its body chunks or its
+// whole body, resumed by connection::feed as bytes arrive. Frames of tasks
+// taking the connection as their first parameter are allocated from a pool
+// inside the connection.
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "http-parser.hpp"
+
+namespace http_parser {
+
+  /**
+   * Fixed blocks for coroutine frames, falling back to the heap for frames
+   * that don't fit or when all blocks are in use
+   */
+  class frame_pool {
+    public:
+      static constexpr std::size_t block_size  = 1024;
+      static constexpr std::size_t block_count = 4;
+
+      frame_pool() noexcept {
+        for (std::size_t i = 0; i < block_count; i++) {
+          _blocks[i].next = _free;
+          _free           = &_blocks[i];
+        }
+      }
+      frame_pool(const frame_pool&) = delete;
+      frame_pool& operator=(const frame_pool&) = delete;
+
+      void * allocate(std::size_t size) {
+        header *frame;
+        if (_free && (size + sizeof(header)) <= block_size) {
+          block *taken = _free;
+          _free        = taken->next;
+          frame        = reinterpret_cast<header *>(taken->bytes);
+          frame->pool  = this;
+        } else {
+          frame       = static_cast<header *>(::operator new(size + sizeof(header)));
+          frame->pool = nullptr;
+        }
+        return frame + 1;
+      }
+
+      static void * allocate_heap(std::size_t size) {
+        header *frame = static_cast<header *>(::operator new(size + sizeof(header)));
+        frame->pool   = nullptr;
+        return frame + 1;
+      }
+
+      static void release(void *ptr) noexcept {
+        header *frame = static_cast<header *>(ptr) - 1;
+        if (!frame->pool) {
+          _heap_free(frame);
+          return;
+        }
+        block *freed        = reinterpret_cast<block *>(frame);
+        freed->next         = frame->pool->_free;
+        frame->pool->_free  = freed;
+      }
+
+      std::size_t available() const noexcept {
+        std::size_t count = 0;
+        for (block *b = _free; b; b = b->next) count++;
+        return count;
+      }
+
+    private:
+      struct alignas(std::max_align_t) header {
+        frame_pool *pool;
+      };
+
+      // Kept out of line, inlined into a frame's deallocation GCC can't tell
+      // a pooled frame never reaches it
+#if defined(__GNUC__)
+      __attribute__((noinline))
+#endif
+      static void _heap_free(header *frame) noexcept { ::operator delete(frame); }
+      union block {
+        block *next;
+        alignas(std::max_align_t) unsigned char bytes[block_size];
+      };
+
+      block _blocks[block_count];
+      block *_free = nullptr;
+  };
+
+  class connection;
+
+  /**
+   * Coroutine started eagerly and kept until destroyed, so its completion and
+   * any exception can be inspected
+   */
+  class task {
+    public:
+      struct promise_type {
+        std::exception_ptr exception;
+
+        template<class... Args>
+        static void * operator new(std::size_t size, connection &conn, Args&&...);
+        static void * operator new(std::size_t size) { return frame_pool::allocate_heap(size); }
+        static void operator delete(void *frame) noexcept { frame_pool::release(frame); }
+
+        task get_return_object() noexcept { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { exception = std::current_exception(); }
+      };
+
+      task(const task&) = delete;
+      task& operator=(const task&) = delete;
+      task(task &&other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+      task& operator=(task &&other) noexcept {
+        if (this != &other) {
+          if (_handle) _handle.destroy();
+          _handle = std::exchange(other._handle, nullptr);
+        }
+        return *this;
+      }
+      ~task() { if (_handle) _handle.destroy(); }
+
+      bool done() const noexcept { return !_handle || _handle.done(); }
+
+      // Rethrows what escaped the coroutine, if anything
+      void rethrow() const {
+        if (_handle && _handle.promise().exception) std::rethrow_exception(_handle.promise().exception);
+      }
+
+    private:
+      explicit task(std::coroutine_handle<promise_type> handle) noexcept : _handle(handle) {}
+      std::coroutine_handle<promise_type> _handle;
+  };
+
+  /**
+   * Parses the requests arriving on one connection for a single task
+   *
+   * Body data is streamed through the request's onChunk and kept until the
+   * task has seen it, so the task may await chunks or the whole body. A view
+   * returned by an await is valid until the task's next await on the
+   * connection.
+   */
+  class connection {
+    public:
+      connection() = default;
+      connection(const connection&) = delete;
+      connection& operator=(const connection&) = delete;
+
+      // Passes received bytes in, resuming the waiting task when it can proceed
+      void feed(std::string_view data) {
+        if (!_current) _start();
+        _current.feed(data);
+        _pump();
+      }
+
+      // Signals the peer closed the connection, ending any await
+      void close() {
+        _closed = true;
+        _pump();
+      }
+
+      bool closed() const noexcept { return _closed; }
+      bool failed() const noexcept { return _current && http_parser_message_head_complete(_current.get()) < 0; }
+      message_view current() const noexcept { return _current; }
+      frame_pool & frames() noexcept { return _frames; }
+
+      template<class Result>
+      struct awaiter {
+        connection *conn;
+        int want;
+        bool await_ready() { return conn->_try(want); }
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+          conn->_waiting = handle;
+          conn->_want    = want;
+        }
+        Result await_resume() const noexcept {
+          if constexpr (std::is_same_v<Result, message_view>) return conn->_head;
+          else return conn->_chunk;
+        }
+      };
+
+      // Next request, once its head is complete; empty once the connection
+      // is closed or the request is malformed
+      awaiter<message_view> request() noexcept { return { this, _want_request }; }
+
+      // Next piece of the current request's body; empty at its end
+      awaiter<std::string_view> chunk() noexcept { return { this, _want_chunk }; }
+
+      // Rest of the current request's body, once complete
+      awaiter<std::string_view> body() noexcept { return { this, _want_body }; }
+
+    private:
+      static constexpr int _want_request = 1;
+      static constexpr int _want_chunk   = 2;
+      static constexpr int _want_body    = 3;
+
+      frame_pool _frames;
+      message _current{ nullptr, true };
+      buffer _pending;
+      std::size_t _delivered = 0;
+      bool _headDelivered    = false;
+      bool _closed           = false;
+      std::coroutine_handle<> _waiting;
+      int _want = 0;
+      message_view _head;
+      std::string_view _chunk;
+
+      static void _onChunk(struct http_parser_event *ev) {
+        connection *self = static_cast<connection *>(ev->udata);
+        buf_append(self->_pending.get(), ev->chunk->data, ev->chunk->len);
+      }
+
+      // Starts the next request, passing it what arrived after the last one
+      void _start() {
+        message next = message::request();
+        next.get()->onChunk = &connection::_onChunk;
+        next.get()->udata   = this;
+        struct buf *leftover = _current ? _current.get()->leftover : nullptr;
+        _pending.clear();
+        _delivered     = 0;
+        _headDelivered = false;
+        std::swap(_current, next);
+        if (leftover && leftover->len) {
+          _current.feed({ leftover->data, leftover->len });
+        }
+      }
+
+      // Drops the body data the task has seen
+      void _settle() {
+        if (!_delivered) return;
+        _pending.clear();
+        _delivered = 0;
+      }
+
+      bool _try(int want) {
+        int head;
+        _settle();
+        if (want == _want_request && (!_current || _headDelivered)) {
+
+          // Wait for the previous request's body, a malformed or unfinished
+          // one ends the connection
+          if (_current && !_current.ready()) {
+            if (!_closed && http_parser_message_head_complete(_current.get()) > 0) return false;
+            _head = message_view();
+            return true;
+          }
+          _start();
+        }
+        head = _current ? http_parser_message_head_complete(_current.get()) : 0;
+
+        switch (want) {
+          case _want_request:
+            if (head > 0) {
+              _head          = _current;
+              _headDelivered = true;
+              return true;
+            }
+            if (head < 0 || _closed) {
+              _head = message_view();
+              return true;
+            }
+            return false;
+          case _want_chunk:
+            if (!_pending.empty()) {
+              _chunk     = _pending.view();
+              _delivered = _pending.size();
+              return true;
+            }
+            [[fallthrough]];
+          default:
+            if (head < 0 || _closed || (_current && _current.ready())) {
+              _chunk     = _pending.view();
+              _delivered = _pending.size();
+              return true;
+            }
+            return false;
+        }
+      }
+
+      void _pump() {
+        while (_waiting && _try(_want)) {
+          std::exchange(_waiting, nullptr).resume();
+        }
+      }
+  };
+
+  template<class... Args>
+  void * task::promise_type::operator new(std::size_t size, connection &conn, Args&&...) {
+    return conn.frames().allocate(size);
+  }
+
+}
+
+#endif // _HTTP_PARSER_CORO_HPP_
@@ -0,0 +1,343 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HTTP_PARSER_ZLIB
+#include <zlib.h>
+#endif
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-encoding.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strncasecmp
+#define strncasecmp _strnicmp
+#endif
+#endif
+
+// Size of the bounded output buffer each stream passes data on in
+#ifndef HTTP_PARSER_ZSTREAM_BUFSIZE
+#define HTTP_PARSER_ZSTREAM_BUFSIZE 16384
+#endif
+
+// Responses smaller than this are not worth compressing
+#ifndef HTTP_PARSER_ENCODE_MINSIZE
+#define HTTP_PARSER_ENCODE_MINSIZE 256
+#endif
+
+// Accept-Encoding negotiation {{{
+
+/**
+ * Picks the content coding to use for a response based on the request's
+ * Accept-Encoding header, preferring gzip over deflate on equal weight
+ *
+ * Returns NULL when no supported coding is acceptable
+ */
+const char * http_parser_encoding_negotiate(const char *acceptEncoding) {
+#ifdef HTTP_PARSER_ZLIB
+  static const char *const offers[] = { "gzip", "x-gzip", "deflate", NULL };
+  if (!acceptEncoding) return NULL;
+  switch(http_parser_list_negotiate(acceptEncoding, offers)) {
+    case 0:
+    case 1:
+      return "gzip";
+    case 2:
+      return "deflate";
+  }
+#else
+  (void)acceptEncoding;
+#endif
+  return NULL;
+}
+
+// }}}
+
+#ifdef HTTP_PARSER_ZLIB
+
+// zlib streams {{{
+
+struct http_parser_zstream {
+  z_stream z;
+  int encoder;
+  int initialized;
+  int done;
+  unsigned char sniff[2];
+  int sniffed;
+  void (*onChunk)(struct http_parser_event*);
+  void *udata;
+  unsigned char out[HTTP_PARSER_ZSTREAM_BUFSIZE];
+};
+
+static int http_parser_zstream_is(const char *contentEncoding, const char *name) {
+  size_t len = strlen(name);
+  while(*contentEncoding == ' ' || *contentEncoding == '\t') contentEncoding++;
+  if (strncasecmp(contentEncoding, name, len)) return 0;
+  contentEncoding += len;
+  while(*contentEncoding == ' ' || *contentEncoding == '\t') contentEncoding++;
+  return !*contentEncoding;
+}
+
+static void http_parser_zstream_emit(struct http_parser_zstream *stream, size_t len) {
+  struct buf chunk = {
+    .data = (char*)stream->out,
+    .len  = len,
+    .cap  = len,
+  };
+  struct http_parser_event ev = {
+    .chunk = &chunk,
+    .udata = stream->udata,
+  };
+  if (len) stream->onChunk(&ev);
+}
+
+/**
+ * Runs the available input through zlib, passing on output each time the
+ * bounded output buffer fills up
+ */
+static int http_parser_zstream_pump(struct http_parser_zstream *stream, int flush) {
+  int res;
+  while(1) {
+    stream->z.next_out  = stream->out;
+    stream->z.avail_out = sizeof(stream->out);
+    res = stream->encoder ? deflate(&stream->z, flush) : inflate(&stream->z, Z_NO_FLUSH);
+    if (res == Z_STREAM_ERROR || res == Z_DATA_ERROR || res == Z_MEM_ERROR || res == Z_NEED_DICT) {
+      return -1;
+    }
+    http_parser_zstream_emit(stream, sizeof(stream->out) - stream->z.avail_out);
+
+    if (res == Z_STREAM_END) {
+      stream->done = 1;
+      if (stream->encoder || !stream->z.avail_in) return 0;
+
+      // Concatenated gzip members
+      if (inflateReset(&stream->z) != Z_OK) return -1;
+      stream->done = 0;
+      continue;
+    }
+
+    // Output space left means zlib wants more input
+    if (stream->z.avail_out && (!stream->z.avail_in || res == Z_BUF_ERROR)) {
+      return 0;
+    }
+  }
+}
+
+/**
+ * Creates a decoder for the given Content-Encoding, passing decoded data to
+ * onChunk in pieces of at most HTTP_PARSER_ZSTREAM_BUFSIZE bytes
+ *
+ * Returns NULL for unsupported codings
+ */
+struct http_parser_zstream * http_parser_decoder_init(const char *contentEncoding, void (*onChunk)(struct http_parser_event*), void *udata) {
+  struct http_parser_zstream *stream;
+  int gzip = http_parser_zstream_is(contentEncoding, "gzip") || http_parser_zstream_is(contentEncoding, "x-gzip");
+  if (!gzip && !http_parser_zstream_is(contentEncoding, "deflate")) return NULL;
+
+  stream          = calloc(1, sizeof(struct http_parser_zstream));
+  stream->onChunk = onChunk;
+  stream->udata   = udata;
+
+  // Deflate is initialized once the first bytes tell zlib-wrapped from raw
+  if (gzip) {
+    if (inflateInit2(&stream->z, 15 + 16) != Z_OK) {
+      free(stream);
+      return NULL;
+    }
+    stream->initialized = 1;
+  }
+
+  return stream;
+}
+
+/**
+ * Creates an encoder for the given Content-Encoding, passing encoded data to
+ * onChunk in pieces of at most HTTP_PARSER_ZSTREAM_BUFSIZE bytes
+ *
+ * Level follows zlib, -1 selecting the default. Returns NULL for unsupported
+ * codings
+ */
+struct http_parser_zstream * http_parser_encoder_init(const char *contentEncoding, int level, void (*onChunk)(struct http_parser_event*), void *udata) {
+  struct http_parser_zstream *stream;
+  int windowBits;
+  if (http_parser_zstream_is(contentEncoding, "gzip") || http_parser_zstream_is(contentEncoding, "x-gzip")) {
+    windowBits = 15 + 16;
+  } else if (http_parser_zstream_is(contentEncoding, "deflate")) {
+    windowBits = 15;
+  } else {
+    return NULL;
+  }
+
+  stream          = calloc(1, sizeof(struct http_parser_zstream));
+  stream->encoder = 1;
+  stream->onChunk = onChunk;
+  stream->udata   = udata;
+  if (deflateInit2(&stream->z, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(stream);
+    return NULL;
+  }
+  stream->initialized = 1;
+  return stream;
+}
+
+/**
+ * Passes data into the stream
+ *
+ * Returns 0 on success or -1 on corrupt input
+ */
+int http_parser_zstream_write(struct http_parser_zstream *stream, const char *data, size_t len) {
+  int res;
+
+  // Deflate is sent both zlib-wrapped (as specified) and raw in the wild
+  if (!stream->initialized) {
+    while(len && stream->sniffed < 2) {
+      stream->sniff[stream->sniffed++] = *(data++);
+      len--;
+    }
+    if (stream->sniffed < 2) return 0;
+    res = (
+      ((stream->sniff[0] & 0x0f) == 8) &&
+      ((stream->sniff[0] >> 4) <= 7) &&
+      (!(((stream->sniff[0] << 8) | stream->sniff[1]) % 31))
+    ) ? 15 : -15;
+    if (inflateInit2(&stream->z, res) != Z_OK) return -1;
+    stream->initialized = 1;
+    stream->z.next_in   = stream->sniff;
+    stream->z.avail_in  = 2;
+    if (http_parser_zstream_pump(stream, Z_NO_FLUSH)) return -1;
+  }
+
+  if (!len) return 0;
+  stream->z.next_in  = (unsigned char *)data;
+  stream->z.avail_in = len;
+  return http_parser_zstream_pump(stream, Z_NO_FLUSH);
+}
+
+/**
+ * Flushes an encoder, or verifies a decoder reached the end of the data
+ *
+ * Returns 0 on success or -1 on incomplete input
+ */
+int http_parser_zstream_finish(struct http_parser_zstream *stream) {
+  if (!stream->encoder) return stream->done ? 0 : -1;
+  stream->z.next_in  = NULL;
+  stream->z.avail_in = 0;
+  return http_parser_zstream_pump(stream, Z_FINISH);
+}
+
+void http_parser_zstream_free(struct http_parser_zstream *stream) {
+  if (stream->initialized) {
+    if (stream->encoder) {
+      deflateEnd(&stream->z);
+    } else {
+      inflateEnd(&stream->z);
+    }
+  }
+  free(stream);
+}
+
+// }}}
+
+#else
+
+// Built without zlib, no content codings are supported {{{
+
+struct http_parser_zstream * http_parser_decoder_init(const char *contentEncoding, void (*onChunk)(struct http_parser_event*), void *udata) {
+  return NULL;
+}
+
+struct http_parser_zstream * http_parser_encoder_init(const char *contentEncoding, int level, void (*onChunk)(struct http_parser_event*), void *udata) {
+  return NULL;
+}
+
+int http_parser_zstream_write(struct http_parser_zstream *stream, const char *data, size_t len) {
+  return -1;
+}
+
+int http_parser_zstream_finish(struct http_parser_zstream *stream) {
+  return -1;
+}
+
+void http_parser_zstream_free(struct http_parser_zstream *stream) {
+}
+
+// }}}
+
+#endif
+
+// Response encoding {{{
+
+static void http_parser_encoding_collect(struct http_parser_event *ev) {
+  buf_append(ev->udata, ev->chunk->data, ev->chunk->len);
+}
+
+/**
+ * Compresses the response body according to the request's Accept-Encoding
+ *
+ * Returns 1 if the body was encoded, 0 if left as-is or -1 on failure
+ */
+int http_parser_response_encode(struct http_parser_message *response, struct http_parser_message *request) {
+  struct http_parser_zstream *stream;
+  struct buf *encoded;
+  const char *encoding;
+  const char *aVary;
+  char *vary;
+  char aContentLength[32];
+
+  if (!request || !response->body || response->body->len < HTTP_PARSER_ENCODE_MINSIZE) return 0;
+  if (http_parser_header_get(response, "content-encoding")) return 0;
+  if (response->status < 200 || response->status == 204 || response->status == 206 || response->status == 304) return 0;
+
+  // The representation now depends on Accept-Encoding, caches need to know
+  aVary = http_parser_header_get(response, "vary");
+  if (!aVary) {
+    http_parser_header_set(response, "Vary", "Accept-Encoding");
+  } else if (!http_parser_list_contains(aVary, "*") && !http_parser_list_contains(aVary, "accept-encoding")) {
+    vary = calloc(1, strlen(aVary) + 18);
+    strcpy(vary, aVary);
+    strcat(vary, ", Accept-Encoding");
+    http_parser_header_set(response, "Vary", vary);
+    free(vary);
+  }
+
+  encoding = http_parser_encoding_negotiate(http_parser_header_get(request, "accept-encoding"));
+  if (!encoding) return 0;
+
+  encoded = calloc(1, sizeof(struct buf));
+  stream  = http_parser_encoder_init(encoding, -1, http_parser_encoding_collect, encoded);
+  if (!stream) {
+    free(encoded);
+    return 0;
+  }
+  if (http_parser_zstream_write(stream, response->body->data, response->body->len) || http_parser_zstream_finish(stream)) {
+    http_parser_zstream_free(stream);
+    buf_clear(encoded);
+    free(encoded);
+    return -1;
+  }
+  http_parser_zstream_free(stream);
+
+  buf_clear(response->body);
+  free(response->body);
+  response->body = encoded;
+
+  http_parser_header_set(response, "Content-Encoding", encoding);
+  if (http_parser_header_get(response, "content-length")) {
+    snprintf(aContentLength, sizeof(aContentLength), "%lu", (unsigned long)encoded->len);
+    http_parser_header_set(response, "Content-Length", aContentLength);
+  }
+  return 1;
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,26 @@
+#ifndef _HTTP_PARSER_ENCODING_H_
+#define _HTTP_PARSER_ENCODING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "http-parser.h"
+
+// Content-Encoding stage, only functional when built with HTTP_PARSER_ZLIB
+struct http_parser_zstream * http_parser_decoder_init(const char *contentEncoding, void (*onChunk)(struct http_parser_event*), void *udata);
+struct http_parser_zstream * http_parser_encoder_init(const char *contentEncoding, int level, void (*onChunk)(struct http_parser_event*), void *udata);
+int http_parser_zstream_write(struct http_parser_zstream *stream, const char *data, size_t len);
+int http_parser_zstream_finish(struct http_parser_zstream *stream);
+void http_parser_zstream_free(struct http_parser_zstream *stream);
+
+const char * http_parser_encoding_negotiate(const char *acceptEncoding);
+int http_parser_response_encode(struct http_parser_message *response, struct http_parser_message *request);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_ENCODING_H_
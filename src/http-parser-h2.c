@@ -0,0 +1,1443 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-h2.h"
+#include "http-parser-internal.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strcasecmp
+#define strcasecmp _stricmp
+#endif
+#ifndef strncasecmp
+#define strncasecmp _strnicmp
+#endif
+#endif
+
+static const int _HTTP_PARSER_H2_INIT  = 0;
+static const int _HTTP_PARSER_H2_OPEN  = 1;
+static const int _HTTP_PARSER_H2_PANIC = 666;
+
+// Fields seen in a header block, each pseudo-header may appear once
+static const int _HTTP_PARSER_HPACK_SEEN_REGULAR   = 0x01;
+static const int _HTTP_PARSER_HPACK_SEEN_METHOD    = 0x02;
+static const int _HTTP_PARSER_HPACK_SEEN_PATH      = 0x04;
+static const int _HTTP_PARSER_HPACK_SEEN_SCHEME    = 0x08;
+static const int _HTTP_PARSER_HPACK_SEEN_AUTHORITY = 0x10;
+static const int _HTTP_PARSER_HPACK_SEEN_STATUS    = 0x20;
+
+static const int _HTTP_PARSER_H2_STREAM_OPEN        = 0;
+static const int _HTTP_PARSER_H2_STREAM_HALF_CLOSED = 1;
+
+static const int _HTTP_PARSER_H2_FLAG_END_STREAM  = 0x01;
+static const int _HTTP_PARSER_H2_FLAG_ACK         = 0x01;
+static const int _HTTP_PARSER_H2_FLAG_END_HEADERS = 0x04;
+static const int _HTTP_PARSER_H2_FLAG_PADDED      = 0x08;
+static const int _HTTP_PARSER_H2_FLAG_PRIORITY    = 0x20;
+
+static const size_t _HTTP_PARSER_H2_FRAME_SIZE  = 16384;
+static const long   _HTTP_PARSER_H2_WINDOW      = 65535;
+static const long   _HTTP_PARSER_H2_WINDOW_MAX  = 0x7fffffff;
+static const size_t _HTTP_PARSER_HPACK_SIZE     = 4096;
+
+// Huffman {{{
+
+// RFC 7541 appendix B, indexed by symbol. The code is canonical, so the
+// decoder only needs the symbols ordered by code and the count per length.
+static const uint32_t http_parser_hpack_huffman_code[257] = {
+  0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+  0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+  0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+  0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+  0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+  0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+  0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+  0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+  0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+  0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+  0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+  0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+  0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+  0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+  0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+  0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+  0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+  0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+  0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+  0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+  0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+  0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+  0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+  0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+  0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+  0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+  0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+  0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+  0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+  0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+  0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+  0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee,
+  0x3fffffff
+};
+
+static const uint8_t http_parser_hpack_huffman_length[257] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+  28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+   6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+   5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+  13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+   7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+  15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+   6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+  20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+  24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+  22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+  21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+  26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+  19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+  20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+  26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+  30
+};
+
+static const uint16_t http_parser_hpack_huffman_symbol[257] = {
+   48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,  45,  46,  47,  51,
+   52,  53,  54,  55,  56,  57,  61,  65,  95,  98, 100, 102, 103, 104, 108, 109,
+  110, 112, 114, 117,  58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+   77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89, 106, 107, 113, 118,
+  119, 120, 121, 122,  38,  42,  44,  59,  88,  90,  33,  34,  40,  41,  63,  39,
+   43, 124,  35,  62,   0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+  195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+  179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+  163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+  233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+  158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239,   9, 142,
+  144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+  200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+  212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2,   3,   4,   5,   6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+   21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220, 249,  10,  13,  22,
+  256
+};
+
+static const uint16_t http_parser_hpack_huffman_count[31] = {
+  0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+  0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+
+/**
+ * Appends the Huffman-decoded string to out
+ *
+ * Returns -1 on an invalid code, EOS inside the string or bad padding
+ */
+static int http_parser_hpack_huffman_decode(struct buf *out, const unsigned char *data, size_t len) {
+  char decoded[256];
+  size_t n = 0;
+  size_t i;
+  int bit;
+  int code   = 0;
+  int first  = 0;
+  int index  = 0;
+  int length = 0;
+  int count;
+  uint32_t bits = 0;
+
+  for(i=0; i<len; i++) {
+    for(bit=7; bit>=0; bit--) {
+      code |= (data[i] >> bit) & 1;
+      bits  = (bits << 1) | ((data[i] >> bit) & 1);
+      length++;
+      count = http_parser_hpack_huffman_count[length];
+      if ((code - count) < first) {
+        if (http_parser_hpack_huffman_symbol[index + (code - first)] == 256) return -1;
+        decoded[n++] = (char)http_parser_hpack_huffman_symbol[index + (code - first)];
+        if (n == sizeof(decoded)) {
+          buf_append(out, decoded, n);
+          n = 0;
+        }
+        code = first = index = length = 0;
+        bits = 0;
+        continue;
+      }
+      if (length == 30) return -1;
+      index += count;
+      first += count;
+      first <<= 1;
+      code  <<= 1;
+    }
+  }
+
+  // Padding must be a prefix of EOS, so at most 7 one-bits
+  if (length > 7 || bits != ((1u << length) - 1)) return -1;
+  if (n) buf_append(out, decoded, n);
+  return 0;
+}
+
+static size_t http_parser_hpack_huffman_size(const char *str, size_t len, int lower) {
+  size_t bits = 0;
+  size_t i;
+  for(i=0; i<len; i++) {
+    bits += http_parser_hpack_huffman_length[(unsigned char)(lower ? tolower((unsigned char)str[i]) : str[i])];
+  }
+  return (bits + 7) / 8;
+}
+
+static void http_parser_hpack_huffman_encode(struct buf *out, const char *str, size_t len, int lower) {
+  char encoded[256];
+  size_t n = 0;
+  size_t i;
+  uint64_t acc = 0;
+  int bits = 0;
+  unsigned char c;
+
+  for(i=0; i<len; i++) {
+    c     = lower ? tolower((unsigned char)str[i]) : (unsigned char)str[i];
+    acc   = (acc << http_parser_hpack_huffman_length[c]) | http_parser_hpack_huffman_code[c];
+    bits += http_parser_hpack_huffman_length[c];
+    while(bits >= 8) {
+      bits -= 8;
+      encoded[n++] = (char)(acc >> bits);
+      if (n == sizeof(encoded)) {
+        buf_append(out, encoded, n);
+        n = 0;
+      }
+    }
+  }
+
+  // Pad with the most significant bits of EOS
+  if (bits) encoded[n++] = (char)((acc << (8 - bits)) | (0xff >> bits));
+  if (n) buf_append(out, encoded, n);
+}
+
+// }}}
+
+// Header table {{{
+
+// RFC 7541 appendix A
+static const char *http_parser_hpack_static[61][2] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" }
+};
+
+
+/**
+ * Dynamic table entry by its 0-based position, newest first
+ */
+static struct http_parser_hpack_entry * http_parser_hpack_nth(struct http_parser_hpack *hpack, int n) {
+  return &(hpack->_entries[(hpack->_first + hpack->_count - 1 - n) % hpack->_cap]);
+}
+
+static void http_parser_hpack_evict(struct http_parser_hpack *hpack, size_t size) {
+  struct http_parser_hpack_entry *entry;
+  while(hpack->_count && hpack->size > size) {
+    entry = &(hpack->_entries[hpack->_first]);
+    hpack->size -= entry->size;
+    free(entry->name);
+    hpack->_first = (hpack->_first + 1) % hpack->_cap;
+    hpack->_count--;
+  }
+}
+
+static void http_parser_hpack_insert(struct http_parser_hpack *hpack, const char *name, size_t namelen, const char *value, size_t valuelen) {
+  struct http_parser_hpack_entry *entries;
+  size_t size = namelen + valuelen + 32;
+  char *mem;
+  int i;
+
+  // An entry larger than the table empties it
+  if (size > hpack->maxSize) {
+    http_parser_hpack_evict(hpack, 0);
+    return;
+  }
+
+  // Copy first, the name may reference an entry about to be evicted
+  mem = malloc(namelen + valuelen + 2);
+  memcpy(mem, name, namelen);
+  mem[namelen] = '\0';
+  memcpy(mem + namelen + 1, value, valuelen);
+  mem[namelen + valuelen + 1] = '\0';
+  http_parser_hpack_evict(hpack, hpack->maxSize - size);
+
+  if (hpack->_count == hpack->_cap) {
+    entries = malloc(sizeof(struct http_parser_hpack_entry) * (hpack->_cap ? hpack->_cap * 2 : 16));
+    for(i=0; i<hpack->_count; i++) {
+      entries[i] = hpack->_entries[(hpack->_first + i) % hpack->_cap];
+    }
+    free(hpack->_entries);
+    hpack->_entries = entries;
+    hpack->_cap     = hpack->_cap ? hpack->_cap * 2 : 16;
+    hpack->_first   = 0;
+  }
+
+  entries        = &(hpack->_entries[(hpack->_first + hpack->_count) % hpack->_cap]);
+  entries->name  = mem;
+  entries->value = mem + namelen + 1;
+  entries->size  = size;
+  hpack->_count++;
+  hpack->size += size;
+}
+
+/**
+ * Resolves a 1-based index into the static or dynamic table
+ */
+static int http_parser_hpack_lookup(struct http_parser_hpack *hpack, size_t index, const char **name, const char **value) {
+  struct http_parser_hpack_entry *entry;
+  if (!index) return -1;
+  if (index <= 61) {
+    *name  = http_parser_hpack_static[index - 1][0];
+    *value = http_parser_hpack_static[index - 1][1];
+    return 0;
+  }
+  if ((index - 62) >= (size_t)hpack->_count) return -1;
+  entry  = http_parser_hpack_nth(hpack, index - 62);
+  *name  = entry->name;
+  *value = entry->value;
+  return 0;
+}
+
+/**
+ * Initializes a header table of the given maximum size
+ */
+struct http_parser_hpack * http_parser_hpack_init(size_t maxSize) {
+  struct http_parser_hpack *hpack = calloc(1, sizeof(struct http_parser_hpack));
+  hpack->maxSize  = maxSize;
+  hpack->limit    = maxSize;
+  hpack->_scratch = calloc(1, sizeof(struct buf));
+  return hpack;
+}
+
+/**
+ * Applies the size limit set by the decoding peer
+ *
+ * Shrinks the table if needed, signalling the new size at the start of the
+ * next encoded header block
+ */
+int http_parser_hpack_resize(struct http_parser_hpack *hpack, size_t limit) {
+  hpack->limit = limit;
+  if (hpack->maxSize > limit) {
+    hpack->maxSize = limit;
+    hpack->_update = 1;
+    http_parser_hpack_evict(hpack, limit);
+  }
+  return 0;
+}
+
+void http_parser_hpack_free(struct http_parser_hpack *hpack) {
+  http_parser_hpack_evict(hpack, 0);
+  if (hpack->_entries) free(hpack->_entries);
+  buf_clear(hpack->_scratch);
+  free(hpack->_scratch);
+  free(hpack);
+}
+
+// }}}
+
+// HPACK {{{
+
+static int http_parser_hpack_int_read(const unsigned char **pos, const unsigned char *end, int prefix, size_t *value) {
+  size_t max = (1u << prefix) - 1;
+  size_t result;
+  int shift = 0;
+  unsigned char byte;
+
+  if (*pos >= end) return -1;
+  result = **pos & max;
+  (*pos)++;
+  if (result < max) {
+    *value = result;
+    return 0;
+  }
+  while(*pos < end) {
+    byte = **pos;
+    (*pos)++;
+    if (shift > 28) return -1;
+    result += (size_t)(byte & 0x7f) << shift;
+    shift  += 7;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static void http_parser_hpack_int_write(struct buf *out, unsigned char first, int prefix, size_t value) {
+  unsigned char encoded[16];
+  size_t max = (1u << prefix) - 1;
+  int n = 0;
+
+  if (value < max) {
+    encoded[n++] = first | (unsigned char)value;
+  } else {
+    encoded[n++] = first | (unsigned char)max;
+    value -= max;
+    while(value >= 128) {
+      encoded[n++] = (value & 0x7f) | 0x80;
+      value >>= 7;
+    }
+    encoded[n++] = (unsigned char)value;
+  }
+  buf_append(out, (char*)encoded, n);
+}
+
+/**
+ * Appends a (possibly Huffman-coded) string literal plus a null byte to out
+ */
+static int http_parser_hpack_string_read(struct buf *out, const unsigned char **pos, const unsigned char *end) {
+  size_t len;
+  int huffman;
+
+  if (*pos >= end) return -1;
+  huffman = **pos & 0x80;
+  if (http_parser_hpack_int_read(pos, end, 7, &len)) return -1;
+  if (len > (size_t)(end - *pos)) return -1;
+  if (huffman) {
+    if (http_parser_hpack_huffman_decode(out, *pos, len)) return -1;
+  } else if (len) {
+    buf_append(out, (const char *)*pos, len);
+  }
+  *pos += len;
+  buf_append(out, "", 1);
+  return 0;
+}
+
+static void http_parser_hpack_string_write(struct buf *out, const char *str, size_t len, int lower) {
+  size_t huffman = http_parser_hpack_huffman_size(str, len, lower);
+  size_t i;
+
+  if (huffman < len) {
+    http_parser_hpack_int_write(out, 0x80, 7, huffman);
+    http_parser_hpack_huffman_encode(out, str, len, lower);
+    return;
+  }
+
+  http_parser_hpack_int_write(out, 0x00, 7, len);
+  if (!len) return;
+  buf_append(out, str, len);
+  if (lower) {
+    for(i=out->len-len; i<out->len; i++) out->data[i] = tolower((unsigned char)out->data[i]);
+  }
+}
+
+static int http_parser_hpack_pseudo(const char *name) {
+  if (!strcmp(name, ":method"   )) return _HTTP_PARSER_HPACK_SEEN_METHOD;
+  if (!strcmp(name, ":path"     )) return _HTTP_PARSER_HPACK_SEEN_PATH;
+  if (!strcmp(name, ":scheme"   )) return _HTTP_PARSER_HPACK_SEEN_SCHEME;
+  if (!strcmp(name, ":authority")) return _HTTP_PARSER_HPACK_SEEN_AUTHORITY;
+  if (!strcmp(name, ":status"   )) return _HTTP_PARSER_HPACK_SEEN_STATUS;
+  return 0;
+}
+
+/**
+ * Stores a decoded field in the message, mapping the pseudo-headers onto
+ * the fields the 1.x parser fills
+ *
+ * Returns 1 if the field makes the message malformed
+ */
+static int http_parser_hpack_field(struct http_parser_message *message, const char *name, const char *value, int *seen) {
+  const char *existing;
+  char *joined;
+  char *query;
+  size_t i;
+  int pseudo;
+
+  if (strpbrk(value, "\r\n")) return 1;
+
+  // Pseudo-headers come first, each at most once
+  if (name[0] == ':') {
+    pseudo = http_parser_hpack_pseudo(name);
+    if (!pseudo || (*seen & (pseudo | _HTTP_PARSER_HPACK_SEEN_REGULAR))) return 1;
+    *seen |= pseudo;
+    if (pseudo == _HTTP_PARSER_HPACK_SEEN_METHOD) {
+      if (message->method) free(message->method);
+      message->method = strdup(value);
+    } else if (pseudo == _HTTP_PARSER_HPACK_SEEN_PATH) {
+      if (message->path) free(message->path);
+      message->path  = strdup(value);
+      message->query = NULL;
+      query = strchr(message->path, '?');
+      if (query) {
+        *query = '\0';
+        message->query = query + 1;
+      }
+    } else if (pseudo == _HTTP_PARSER_HPACK_SEEN_SCHEME) {
+      http_parser_meta_set(message, "scheme", value);
+    } else if (pseudo == _HTTP_PARSER_HPACK_SEEN_AUTHORITY) {
+      http_parser_header_add(message, "host", value);
+    } else {
+      message->status = atoi(value);
+    }
+    return 0;
+  }
+  *seen |= _HTTP_PARSER_HPACK_SEEN_REGULAR;
+
+  for(i=0; name[i]; i++) {
+    if (isupper((unsigned char)name[i])) return 1;
+  }
+
+  // Host may only repeat :authority, which already became the host header
+  if (!strcmp(name, "host") && (existing = http_parser_header_get(message, "host"))) {
+    return strcmp(existing, value) ? 1 : 0;
+  }
+
+  // Cookies may arrive split, 1.x handlers expect a single header
+  if (!strcmp(name, "cookie") && (existing = http_parser_header_get(message, "cookie"))) {
+    joined = malloc(strlen(existing) + strlen(value) + 3);
+    sprintf(joined, "%s; %s", existing, value);
+    http_parser_header_set(message, "cookie", joined);
+    free(joined);
+    return 0;
+  }
+
+  http_parser_header_add(message, name, value);
+  return 0;
+}
+
+/**
+ * Decodes a complete header block into the message
+ *
+ * Returns 0 on success, -1 on a compression error or a header list over
+ * maxListSize (fatal for the connection) and 1 if the block decoded fine but
+ * the resulting message is malformed
+ */
+int http_parser_hpack_decode(struct http_parser_hpack *hpack, struct http_parser_message *message, const char *data, size_t len) {
+  const unsigned char *pos = (const unsigned char *)data;
+  const unsigned char *end = pos + len;
+  struct buf *scratch = hpack->_scratch;
+  const char *name;
+  const char *value;
+  size_t listSize = 0;
+  size_t index;
+  size_t offset;
+  int seen      = 0;
+  int malformed = 0;
+  int indexing;
+
+  while(pos < end) {
+
+    // Indexed field, a single byte can name a large table entry
+    if (*pos & 0x80) {
+      if (http_parser_hpack_int_read(&pos, end, 7, &index)) return -1;
+      if (http_parser_hpack_lookup(hpack, index, &name, &value)) return -1;
+      listSize += strlen(name) + strlen(value) + 32;
+      if (hpack->maxListSize && listSize > hpack->maxListSize) return -1;
+      malformed |= http_parser_hpack_field(message, name, value, &seen);
+      continue;
+    }
+
+    // Dynamic table size update
+    if ((*pos & 0xe0) == 0x20) {
+      if (http_parser_hpack_int_read(&pos, end, 5, &index)) return -1;
+      if (index > hpack->limit) return -1;
+      hpack->maxSize = index;
+      http_parser_hpack_evict(hpack, index);
+      continue;
+    }
+
+    // Literal, with incremental indexing, without indexing or never indexed
+    indexing = (*pos & 0xc0) == 0x40;
+    if (http_parser_hpack_int_read(&pos, end, indexing ? 6 : 4, &index)) return -1;
+    scratch->len = 0;
+    if (index) {
+      if (http_parser_hpack_lookup(hpack, index, &name, &value)) return -1;
+      buf_append(scratch, name, strlen(name) + 1);
+    } else if (http_parser_hpack_string_read(scratch, &pos, end)) {
+      return -1;
+    }
+    offset = scratch->len;
+    if (http_parser_hpack_string_read(scratch, &pos, end)) return -1;
+
+    name  = scratch->data;
+    value = scratch->data + offset;
+    if (indexing) http_parser_hpack_insert(hpack, name, offset - 1, value, scratch->len - offset - 1);
+    listSize += scratch->len - 2 + 32;
+    if (hpack->maxListSize && listSize > hpack->maxListSize) return -1;
+    malformed |= http_parser_hpack_field(message, name, value, &seen);
+  }
+
+  return malformed ? 1 : 0;
+}
+
+static const char *http_parser_hpack_connection_specific[] = {
+  "connection",
+  "keep-alive",
+  "proxy-connection",
+  "transfer-encoding",
+  "upgrade",
+  NULL
+};
+
+static const char *http_parser_hpack_sensitive[] = {
+  "authorization",
+  "proxy-authorization",
+  "cookie",
+  "set-cookie",
+  NULL
+};
+
+static int http_parser_hpack_listed(const char **list, const char *name) {
+  int i;
+  for(i=0; list[i]; i++) {
+    if (!strcasecmp(list[i], name)) return 1;
+  }
+  return 0;
+}
+
+/**
+ * Encodes a single field, preferring a full table match, then a name match
+ *
+ * Credentials and cookies are never indexed
+ */
+static void http_parser_hpack_encode_field(struct http_parser_hpack *hpack, struct buf *out, const char *name, const char *value) {
+  struct http_parser_hpack_entry *entry;
+  size_t namelen  = strlen(name);
+  size_t valuelen = strlen(value);
+  size_t nameIndex = 0;
+  size_t index     = 0;
+  int sensitive;
+  int i;
+
+  for(i=0; i<61; i++) {
+    if (strcasecmp(http_parser_hpack_static[i][0], name)) continue;
+    if (!nameIndex) nameIndex = i + 1;
+    if (!strcmp(http_parser_hpack_static[i][1], value)) {
+      index = i + 1;
+      break;
+    }
+  }
+  for(i=0; !index && i<hpack->_count; i++) {
+    entry = http_parser_hpack_nth(hpack, i);
+    if (strcasecmp(entry->name, name)) continue;
+    if (!nameIndex) nameIndex = i + 62;
+    if (!strcmp(entry->value, value)) index = i + 62;
+  }
+
+  if (index) {
+    http_parser_hpack_int_write(out, 0x80, 7, index);
+    return;
+  }
+
+  sensitive = http_parser_hpack_listed(http_parser_hpack_sensitive, name);
+  http_parser_hpack_int_write(out, sensitive ? 0x10 : 0x40, sensitive ? 4 : 6, nameIndex);
+  if (!nameIndex) http_parser_hpack_string_write(out, name, namelen, 1);
+  http_parser_hpack_string_write(out, value, valuelen, 0);
+  if (sensitive) return;
+
+  // Index under the lowercase name the peer will see
+  hpack->_scratch->len = 0;
+  buf_append(hpack->_scratch, name, namelen);
+  for(i=0; i<(int)namelen; i++) hpack->_scratch->data[i] = tolower((unsigned char)hpack->_scratch->data[i]);
+  http_parser_hpack_insert(hpack, hpack->_scratch->data, namelen, value, valuelen);
+}
+
+/**
+ * Encodes the message's pseudo-headers and headers as a header block
+ *
+ * Requests (those with a method) get :method, :scheme, :path and :authority
+ * from the Host header, responses get :status. Connection-specific headers
+ * are left out as HTTP/2 forbids them.
+ */
+void http_parser_hpack_encode(struct http_parser_hpack *hpack, struct buf *out, struct http_parser_message *message) {
+  const char *scheme;
+  const char *host = NULL;
+  char status[16];
+  char *path;
+  int i;
+
+  if (hpack->_update) {
+    http_parser_hpack_int_write(out, 0x20, 5, hpack->maxSize);
+    hpack->_update = 0;
+  }
+
+  if (message->method) {
+    scheme = http_parser_meta_get(message, "scheme");
+    host   = http_parser_header_get(message, "host");
+    http_parser_hpack_encode_field(hpack, out, ":method", message->method);
+    http_parser_hpack_encode_field(hpack, out, ":scheme", scheme ? scheme : "http");
+    if (message->query) {
+      path = malloc(strlen(message->path ? message->path : "/") + strlen(message->query) + 2);
+      sprintf(path, "%s?%s", message->path ? message->path : "/", message->query);
+      http_parser_hpack_encode_field(hpack, out, ":path", path);
+      free(path);
+    } else {
+      http_parser_hpack_encode_field(hpack, out, ":path", message->path ? message->path : "/");
+    }
+    if (host) http_parser_hpack_encode_field(hpack, out, ":authority", host);
+  } else {
+    snprintf(status, sizeof(status), "%d", message->status);
+    http_parser_hpack_encode_field(hpack, out, ":status", status);
+  }
+
+  for(i=0; i<message->headerCount; i++) {
+    if (host && !strcasecmp(message->headers[i].key, "host")) continue;
+    if (http_parser_hpack_listed(http_parser_hpack_connection_specific, message->headers[i].key)) continue;
+    http_parser_hpack_encode_field(hpack, out, message->headers[i].key, message->headers[i].value);
+  }
+}
+
+// }}}
+
+// Frames {{{
+
+static void http_parser_h2_frame(struct http_parser_h2 *session, int type, int flags, uint32_t stream, const char *payload, size_t len) {
+  unsigned char head[9];
+  head[0] = (len >> 16) & 0xff;
+  head[1] = (len >>  8) & 0xff;
+  head[2] = len & 0xff;
+  head[3] = type;
+  head[4] = flags;
+  head[5] = (stream >> 24) & 0x7f;
+  head[6] = (stream >> 16) & 0xff;
+  head[7] = (stream >>  8) & 0xff;
+  head[8] = stream & 0xff;
+  buf_append(session->out, (char*)head, 9);
+  if (len) buf_append(session->out, payload, len);
+}
+
+static void http_parser_h2_frame_u32(struct http_parser_h2 *session, int type, uint32_t stream, uint32_t value) {
+  char payload[4];
+  payload[0] = (value >> 24) & 0xff;
+  payload[1] = (value >> 16) & 0xff;
+  payload[2] = (value >>  8) & 0xff;
+  payload[3] = value & 0xff;
+  http_parser_h2_frame(session, type, 0, stream, payload, 4);
+}
+
+static uint32_t http_parser_h2_u32(const unsigned char *data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+/**
+ * Queues our SETTINGS, which must be the first frame we send
+ */
+static void http_parser_h2_start(struct http_parser_h2 *session) {
+  char settings[12];
+  if (session->_state != _HTTP_PARSER_H2_INIT) return;
+  session->_state = _HTTP_PARSER_H2_OPEN;
+  session->_decoder->maxListSize = session->maxHeaderBlock;
+  settings[0]  = 0x00;
+  settings[1]  = 0x03;
+  settings[2]  = (session->maxStreams >> 24) & 0xff;
+  settings[3]  = (session->maxStreams >> 16) & 0xff;
+  settings[4]  = (session->maxStreams >>  8) & 0xff;
+  settings[5]  = session->maxStreams & 0xff;
+  settings[6]  = 0x00;
+  settings[7]  = 0x06;
+  settings[8]  = (session->maxHeaderBlock >> 24) & 0xff;
+  settings[9]  = (session->maxHeaderBlock >> 16) & 0xff;
+  settings[10] = (session->maxHeaderBlock >>  8) & 0xff;
+  settings[11] = session->maxHeaderBlock & 0xff;
+  http_parser_h2_frame(session, HTTP_PARSER_H2_SETTINGS, 0, 0, settings, 12);
+}
+
+/**
+ * Sends GOAWAY, after which no new streams are accepted
+ */
+void http_parser_h2_goaway(struct http_parser_h2 *session, uint32_t error) {
+  char payload[8];
+  if (session->_state == _HTTP_PARSER_H2_PANIC) return;
+  http_parser_h2_start(session);
+  payload[0] = (session->lastStreamId >> 24) & 0x7f;
+  payload[1] = (session->lastStreamId >> 16) & 0xff;
+  payload[2] = (session->lastStreamId >>  8) & 0xff;
+  payload[3] = session->lastStreamId & 0xff;
+  payload[4] = (error >> 24) & 0xff;
+  payload[5] = (error >> 16) & 0xff;
+  payload[6] = (error >>  8) & 0xff;
+  payload[7] = error & 0xff;
+  http_parser_h2_frame(session, HTTP_PARSER_H2_GOAWAY, 0, 0, payload, 8);
+  session->goaway = 1;
+}
+
+static int http_parser_h2_fail(struct http_parser_h2 *session, uint32_t error) {
+  http_parser_h2_goaway(session, error);
+  session->_state = _HTTP_PARSER_H2_PANIC;
+  return -1;
+}
+
+// }}}
+
+// Streams {{{
+
+static struct http_parser_h2_stream * http_parser_h2_stream_get(struct http_parser_h2 *session, uint32_t id) {
+  struct http_parser_h2_stream *stream = session->_streams;
+  while(stream && stream->id != id) stream = stream->next;
+  return stream;
+}
+
+static struct http_parser_h2_stream * http_parser_h2_stream_open(struct http_parser_h2 *session, uint32_t id, struct http_parser_pair *pair) {
+  struct http_parser_h2_stream *stream = calloc(1, sizeof(struct http_parser_h2_stream));
+  char aStream[16];
+  stream->id            = id;
+  stream->state         = _HTTP_PARSER_H2_STREAM_OPEN;
+  stream->window        = session->initialWindow;
+  stream->receiveWindow = _HTTP_PARSER_H2_WINDOW;
+  stream->pair          = pair;
+  stream->next          = session->_streams;
+  session->_streams = stream;
+  session->_streamCount++;
+  if (id > session->lastStreamId) session->lastStreamId = id;
+
+  // Handlers find their way back to the stream through the request
+  snprintf(aStream, sizeof(aStream), "%u", id);
+  http_parser_meta_set(pair->request, "stream", aStream);
+  return stream;
+}
+
+/**
+ * Forgets the stream, freeing its pair if it was never handed out
+ */
+static void http_parser_h2_stream_close(struct http_parser_h2 *session, struct http_parser_h2_stream *stream) {
+  struct http_parser_h2_stream **ref = &(session->_streams);
+  while(*ref && *ref != stream) ref = &((*ref)->next);
+  if (*ref) *ref = stream->next;
+  if (stream->pair) http_parser_pair_free(stream->pair);
+  if (stream->pending) {
+    buf_clear(stream->pending);
+    free(stream->pending);
+  }
+  session->_streamCount--;
+  free(stream);
+}
+
+static void http_parser_h2_reset(struct http_parser_h2 *session, uint32_t id, uint32_t error) {
+  struct http_parser_h2_stream *stream = http_parser_h2_stream_get(session, id);
+  http_parser_h2_frame_u32(session, HTTP_PARSER_H2_RST_STREAM, id, error);
+  if (stream) http_parser_h2_stream_close(session, stream);
+}
+
+/**
+ * Sends as much of the data as the flow-control windows allow, ending the
+ * stream with the last byte
+ *
+ * Returns the number of bytes sent
+ */
+static size_t http_parser_h2_send_data(struct http_parser_h2 *session, struct http_parser_h2_stream *stream, const char *data, size_t len) {
+  size_t sent = 0;
+  size_t n;
+  while(sent < len && stream->window > 0 && session->window > 0) {
+    n = len - sent;
+    if (n > session->maxFrameSize     ) n = session->maxFrameSize;
+    if (n > (size_t)stream->window    ) n = stream->window;
+    if (n > (size_t)session->window   ) n = session->window;
+    http_parser_h2_frame(session, HTTP_PARSER_H2_DATA, (sent + n) == len ? _HTTP_PARSER_H2_FLAG_END_STREAM : 0, stream->id, data + sent, n);
+    stream->window  -= n;
+    session->window -= n;
+    sent            += n;
+  }
+  return sent;
+}
+
+/**
+ * Continues sending a response body held back by flow control
+ */
+static void http_parser_h2_stream_flush(struct http_parser_h2 *session, struct http_parser_h2_stream *stream) {
+  if (!stream->pending) return;
+  stream->pendingOffset += http_parser_h2_send_data(session, stream, stream->pending->data + stream->pendingOffset, stream->pending->len - stream->pendingOffset);
+  if (stream->pendingOffset == stream->pending->len) http_parser_h2_stream_close(session, stream);
+}
+
+static void http_parser_h2_flush(struct http_parser_h2 *session) {
+  struct http_parser_h2_stream *stream = session->_streams;
+  struct http_parser_h2_stream *next;
+  while(stream && session->window > 0) {
+    next = stream->next;
+    http_parser_h2_stream_flush(session, stream);
+    stream = next;
+  }
+}
+
+/**
+ * Hands the completed request to onRequest, the handler owns the pair from
+ * then on
+ */
+static void http_parser_h2_dispatch(struct http_parser_h2 *session, struct http_parser_h2_stream *stream) {
+  struct http_parser_pair *pair = stream->pair;
+  struct http_parser_event ev = {0};
+  void (*cb)(struct http_parser_event*) = pair->onRequest;
+
+  stream->pair  = NULL;
+  stream->state = _HTTP_PARSER_H2_STREAM_HALF_CLOSED;
+  _http_parser_message_complete(pair->request);
+  if (!cb) {
+    http_parser_pair_free(pair);
+    http_parser_h2_reset(session, stream->id, HTTP_PARSER_H2_REFUSED_STREAM);
+    return;
+  }
+
+  pair->onRequest = NULL;
+  ev.request  = pair->request;
+  ev.response = pair->response;
+  ev.pair     = pair;
+  ev.udata    = pair->udata;
+  cb(&ev);
+}
+
+// }}}
+
+// Session {{{
+
+/**
+ * Applies the peer's SETTINGS, returning an error code or 0
+ */
+static uint32_t http_parser_h2_settings(struct http_parser_h2 *session, const unsigned char *data, size_t len) {
+  struct http_parser_h2_stream *stream;
+  uint32_t value;
+  int id;
+
+  if (len % 6) return HTTP_PARSER_H2_FRAME_SIZE_ERROR;
+  for(; len; data += 6, len -= 6) {
+    id    = (data[0] << 8) | data[1];
+    value = http_parser_h2_u32(data + 2);
+    if (id == 0x1) {
+      http_parser_hpack_resize(session->_encoder, value);
+    } else if (id == 0x2) {
+      if (value > 1) return HTTP_PARSER_H2_PROTOCOL_ERROR;
+    } else if (id == 0x4) {
+      if (value > (uint32_t)_HTTP_PARSER_H2_WINDOW_MAX) return HTTP_PARSER_H2_FLOW_CONTROL_ERROR;
+      for(stream = session->_streams; stream; stream = stream->next) {
+        stream->window += (long)value - session->initialWindow;
+      }
+      session->initialWindow = value;
+    } else if (id == 0x5) {
+      if (value < _HTTP_PARSER_H2_FRAME_SIZE || value > 0xffffff) return HTTP_PARSER_H2_PROTOCOL_ERROR;
+      session->maxFrameSize = value;
+    }
+  }
+  return 0;
+}
+
+static int http_parser_h2_unpad(int flags, const unsigned char **payload, size_t *length) {
+  size_t padding;
+  if (!(flags & _HTTP_PARSER_H2_FLAG_PADDED)) return 0;
+  if (!*length) return -1;
+  padding = **payload;
+  (*payload)++;
+  (*length)--;
+  if (padding > *length) return -1;
+  *length -= padding;
+  return 0;
+}
+
+/**
+ * Decodes a complete header block, opening a stream or adding trailers
+ */
+static int http_parser_h2_headers(struct http_parser_h2 *session, uint32_t id, int flags, const char *block, size_t len) {
+  struct http_parser_h2_stream *stream = http_parser_h2_stream_get(session, id);
+  struct http_parser_message *discard;
+  int res;
+
+  // The block must be decoded regardless, to keep the table in sync
+  if (!stream || !stream->pair) {
+    if (!stream && (!(id & 1) || id <= session->lastStreamId)) {
+      discard = http_parser_request_init();
+      res     = http_parser_hpack_decode(session->_decoder, discard, block, len);
+      http_parser_message_free(discard);
+      if (res < 0) return http_parser_h2_fail(session, HTTP_PARSER_H2_COMPRESSION_ERROR);
+      if (!(id & 1)) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      http_parser_h2_reset(session, id, HTTP_PARSER_H2_STREAM_CLOSED);
+      return 0;
+    }
+    if (!stream) {
+      stream = http_parser_h2_stream_open(session, id, http_parser_pair_init(session->udata));
+      stream->pair->onRequest = session->onRequest;
+      free(stream->pair->request->version);
+      stream->pair->request->version = strdup("2.0");
+    }
+  }
+
+  if (stream->pair) {
+    _http_parser_message_receive(stream->pair->request, len);
+    res = http_parser_hpack_decode(session->_decoder, stream->pair->request, block, len);
+  } else {
+    discard = http_parser_request_init();
+    res     = http_parser_hpack_decode(session->_decoder, discard, block, len);
+    http_parser_message_free(discard);
+  }
+  if (res < 0) return http_parser_h2_fail(session, HTTP_PARSER_H2_COMPRESSION_ERROR);
+
+  // Refuse what we can't or won't process, now the table is in sync
+  if (!stream->pair) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_STREAM_CLOSED);
+    return 0;
+  }
+  if (res || !stream->pair->request->method || (!stream->pair->request->path && strcmp(stream->pair->request->method, "CONNECT"))) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_PROTOCOL_ERROR);
+    return 0;
+  }
+  if (session->goaway || session->_streamCount > session->maxStreams) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_REFUSED_STREAM);
+    return 0;
+  }
+
+  if (flags & _HTTP_PARSER_H2_FLAG_END_STREAM) http_parser_h2_dispatch(session, stream);
+  return 0;
+}
+
+/**
+ * Collects a request body, up to maxBodySize bytes per stream
+ *
+ * The connection window is restored straight away, what a stream buffers is
+ * bounded by its own window. That is only opened up to one byte past
+ * maxBodySize, so a larger body is reset rather than left stalling.
+ */
+static int http_parser_h2_data_frame(struct http_parser_h2 *session, uint32_t id, int flags, const unsigned char *payload, size_t length) {
+  struct http_parser_h2_stream *stream = http_parser_h2_stream_get(session, id);
+  struct http_parser_message *request;
+  size_t received = length;
+  size_t allowed;
+  size_t increment;
+
+  if (!id) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+  if (http_parser_h2_unpad(flags, &payload, &length)) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+  if (!stream && id > session->lastStreamId) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+  if (received) http_parser_h2_frame_u32(session, HTTP_PARSER_H2_WINDOW_UPDATE, 0, received);
+
+  if (!stream || !stream->pair) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_STREAM_CLOSED);
+    return 0;
+  }
+  if (received > (size_t)stream->receiveWindow) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_FLOW_CONTROL_ERROR);
+    return 0;
+  }
+  stream->receiveWindow -= received;
+
+  request = stream->pair->request;
+  if (!request->body) request->body = calloc(1, sizeof(struct buf));
+  if ((request->body->len + length) > session->maxBodySize) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_ENHANCE_YOUR_CALM);
+    return 0;
+  }
+  _http_parser_message_receive(request, length);
+  if (length) buf_append(request->body, (const char *)payload, length);
+
+  if (flags & _HTTP_PARSER_H2_FLAG_END_STREAM) {
+    http_parser_h2_dispatch(session, stream);
+    return 0;
+  }
+
+  allowed = session->maxBodySize + 1 - request->body->len;
+  if ((size_t)stream->receiveWindow < allowed) {
+    increment = allowed - stream->receiveWindow;
+    if (increment > received) increment = received;
+    if (increment) http_parser_h2_frame_u32(session, HTTP_PARSER_H2_WINDOW_UPDATE, id, increment);
+    stream->receiveWindow += increment;
+  }
+  return 0;
+}
+
+static int http_parser_h2_window_update(struct http_parser_h2 *session, uint32_t id, const unsigned char *payload, size_t length) {
+  struct http_parser_h2_stream *stream;
+  uint32_t increment;
+
+  if (length != 4) return http_parser_h2_fail(session, HTTP_PARSER_H2_FRAME_SIZE_ERROR);
+  increment = http_parser_h2_u32(payload) & 0x7fffffff;
+
+  if (!id) {
+    if (!increment) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+    session->window += increment;
+    if (session->window > _HTTP_PARSER_H2_WINDOW_MAX) return http_parser_h2_fail(session, HTTP_PARSER_H2_FLOW_CONTROL_ERROR);
+    http_parser_h2_flush(session);
+    return 0;
+  }
+
+  stream = http_parser_h2_stream_get(session, id);
+  if (!stream) return 0;
+  if (!increment) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_PROTOCOL_ERROR);
+    return 0;
+  }
+  stream->window += increment;
+  if (stream->window > _HTTP_PARSER_H2_WINDOW_MAX) {
+    http_parser_h2_reset(session, id, HTTP_PARSER_H2_FLOW_CONTROL_ERROR);
+    return 0;
+  }
+  http_parser_h2_stream_flush(session, stream);
+  return 0;
+}
+
+static int http_parser_h2_frame_handle(struct http_parser_h2 *session, int type, int flags, uint32_t id, const unsigned char *payload, size_t length) {
+  struct http_parser_h2_stream *stream;
+  uint32_t error;
+
+  // Nothing may interrupt a header block
+  if (session->_blockStream && (type != HTTP_PARSER_H2_CONTINUATION || id != session->_blockStream)) {
+    return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+  }
+
+  switch(type) {
+    case HTTP_PARSER_H2_DATA:
+      return http_parser_h2_data_frame(session, id, flags, payload, length);
+
+    case HTTP_PARSER_H2_HEADERS:
+      if (!id) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if (http_parser_h2_unpad(flags, &payload, &length)) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if (flags & _HTTP_PARSER_H2_FLAG_PRIORITY) {
+        if (length < 5) return http_parser_h2_fail(session, HTTP_PARSER_H2_FRAME_SIZE_ERROR);
+        payload += 5;
+        length  -= 5;
+      }
+      if (length > session->maxHeaderBlock) return http_parser_h2_fail(session, HTTP_PARSER_H2_ENHANCE_YOUR_CALM);
+      if (flags & _HTTP_PARSER_H2_FLAG_END_HEADERS) {
+        return http_parser_h2_headers(session, id, flags, (const char *)payload, length);
+      }
+      session->_block->len = 0;
+      if (length) buf_append(session->_block, (const char *)payload, length);
+      session->_blockStream = id;
+      session->_blockFlags  = flags;
+      return 0;
+
+    case HTTP_PARSER_H2_CONTINUATION:
+      if (!session->_blockStream) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if ((session->_block->len + length) > session->maxHeaderBlock) return http_parser_h2_fail(session, HTTP_PARSER_H2_ENHANCE_YOUR_CALM);
+      if (length) buf_append(session->_block, (const char *)payload, length);
+      if (!(flags & _HTTP_PARSER_H2_FLAG_END_HEADERS)) return 0;
+      session->_blockStream = 0;
+      return http_parser_h2_headers(session, id, session->_blockFlags, session->_block->data, session->_block->len);
+
+    case HTTP_PARSER_H2_PRIORITY:
+      if (!id) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if (length != 5) http_parser_h2_reset(session, id, HTTP_PARSER_H2_FRAME_SIZE_ERROR);
+      return 0;
+
+    case HTTP_PARSER_H2_RST_STREAM:
+      if (!id || id > session->lastStreamId) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if (length != 4) return http_parser_h2_fail(session, HTTP_PARSER_H2_FRAME_SIZE_ERROR);
+      stream = http_parser_h2_stream_get(session, id);
+      if (stream) http_parser_h2_stream_close(session, stream);
+      return 0;
+
+    case HTTP_PARSER_H2_SETTINGS:
+      if (id) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if (flags & _HTTP_PARSER_H2_FLAG_ACK) {
+        return length ? http_parser_h2_fail(session, HTTP_PARSER_H2_FRAME_SIZE_ERROR) : 0;
+      }
+      error = http_parser_h2_settings(session, payload, length);
+      if (error) return http_parser_h2_fail(session, error);
+      http_parser_h2_frame(session, HTTP_PARSER_H2_SETTINGS, _HTTP_PARSER_H2_FLAG_ACK, 0, NULL, 0);
+      http_parser_h2_flush(session);
+      return 0;
+
+    case HTTP_PARSER_H2_PING:
+      if (id) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      if (length != 8) return http_parser_h2_fail(session, HTTP_PARSER_H2_FRAME_SIZE_ERROR);
+      if (!(flags & _HTTP_PARSER_H2_FLAG_ACK)) {
+        http_parser_h2_frame(session, HTTP_PARSER_H2_PING, _HTTP_PARSER_H2_FLAG_ACK, 0, (const char *)payload, 8);
+      }
+      return 0;
+
+    case HTTP_PARSER_H2_GOAWAY:
+      if (id) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+      session->goaway = 1;
+      return 0;
+
+    case HTTP_PARSER_H2_WINDOW_UPDATE:
+      return http_parser_h2_window_update(session, id, payload, length);
+
+    case HTTP_PARSER_H2_PUSH_PROMISE:
+      return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+
+    default:
+      // Unknown frame types are ignored
+      return 0;
+  }
+}
+
+/**
+ * Initializes a server-side HTTP/2 session
+ */
+struct http_parser_h2 * http_parser_h2_init(void *udata) {
+  struct http_parser_h2 *session = calloc(1, sizeof(struct http_parser_h2));
+  session->udata          = udata;
+  session->out            = calloc(1, sizeof(struct buf));
+  session->maxFrameSize   = _HTTP_PARSER_H2_FRAME_SIZE;
+  session->initialWindow  = _HTTP_PARSER_H2_WINDOW;
+  session->window         = _HTTP_PARSER_H2_WINDOW;
+  session->maxStreams     = 100;
+  session->maxHeaderBlock = HTTP_PARSER_H2_MAX_HEADER_BLOCK;
+  session->maxBodySize    = HTTP_PARSER_H2_MAX_BODY;
+  session->_decoder       = http_parser_hpack_init(_HTTP_PARSER_HPACK_SIZE);
+  session->_encoder       = http_parser_hpack_init(_HTTP_PARSER_HPACK_SIZE);
+  session->_in            = calloc(1, sizeof(struct buf));
+  session->_block         = calloc(1, sizeof(struct buf));
+  return session;
+}
+
+/**
+ * Whether the data starts with the prior-knowledge connection preface
+ *
+ * Returns 1 if it does, 0 if it doesn't and -1 if there's too little data
+ * to tell yet
+ */
+int http_parser_h2_is_preface(const struct buf *data) {
+  size_t len = data->len < HTTP_PARSER_H2_PREFACE_LENGTH ? data->len : HTTP_PARSER_H2_PREFACE_LENGTH;
+  if (memcmp(data->data, HTTP_PARSER_H2_PREFACE, len)) return 0;
+  return len == HTTP_PARSER_H2_PREFACE_LENGTH ? 1 : -1;
+}
+
+/**
+ * Insert data received from the peer
+ *
+ * Frames to send back are appended to session->out. Returns -1 once the
+ * connection has failed, in which case out ends with a GOAWAY.
+ */
+int http_parser_h2_data(struct http_parser_h2 *session, const struct buf *data) {
+  const struct buf *source = data;
+  const unsigned char *pos;
+  const unsigned char *end;
+  size_t length;
+  size_t remainder;
+
+  if (session->_state == _HTTP_PARSER_H2_PANIC) return -1;
+  http_parser_h2_start(session);
+
+  // Only copy when a frame spans calls
+  if (session->_in->len) {
+    buf_append(session->_in, data->data, data->len);
+    source = session->_in;
+  }
+  pos = (const unsigned char *)source->data;
+  end = pos + source->len;
+
+  while(session->_preface < HTTP_PARSER_H2_PREFACE_LENGTH && pos < end) {
+    if (*pos != HTTP_PARSER_H2_PREFACE[session->_preface]) return http_parser_h2_fail(session, HTTP_PARSER_H2_PROTOCOL_ERROR);
+    session->_preface++;
+    pos++;
+  }
+
+  while((end - pos) >= 9) {
+    length = ((size_t)pos[0] << 16) | ((size_t)pos[1] << 8) | pos[2];
+    if (length > _HTTP_PARSER_H2_FRAME_SIZE) return http_parser_h2_fail(session, HTTP_PARSER_H2_FRAME_SIZE_ERROR);
+    if ((size_t)(end - pos) < (9 + length)) break;
+    if (http_parser_h2_frame_handle(session, pos[3], pos[4], http_parser_h2_u32(pos + 5) & 0x7fffffff, pos + 9, length)) return -1;
+    pos += 9 + length;
+  }
+
+  remainder = end - pos;
+  if (source == session->_in) {
+    memmove(session->_in->data, pos, remainder);
+    session->_in->len = remainder;
+  } else if (remainder) {
+    buf_append(session->_in, (const char *)pos, remainder);
+  }
+  return 0;
+}
+
+static int http_parser_h2_base64url(const char *in, unsigned char *out, size_t cap) {
+  size_t len = 0;
+  uint32_t acc = 0;
+  int bits = 0;
+  int value;
+  for(; *in && *in != '='; in++) {
+    if (*in >= 'A' && *in <= 'Z') value = *in - 'A';
+    else if (*in >= 'a' && *in <= 'z') value = *in - 'a' + 26;
+    else if (*in >= '0' && *in <= '9') value = *in - '0' + 52;
+    else if (*in == '-' || *in == '+') value = 62;
+    else if (*in == '_' || *in == '/') value = 63;
+    else return -1;
+    acc   = (acc << 6) | value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      if (len == cap) return -1;
+      out[len++] = (acc >> bits) & 0xff;
+    }
+  }
+  return (int)len;
+}
+
+/**
+ * Switches an HTTP/1.1 connection over to the session
+ *
+ * Accepts a request carrying "Upgrade: h2c" and HTTP2-Settings, queueing the
+ * 101 response. The request becomes stream 1, answer it through
+ * http_parser_h2_respond like any other stream. Also accepts the "PRI *"
+ * request the 1.1 parser makes of a prior-knowledge preface.
+ *
+ * Bytes received past the request are fed into the session. Returns -1 if
+ * the request is neither or the connection failed.
+ */
+int http_parser_h2_upgrade(struct http_parser_h2 *session, struct http_parser_pair *pair) {
+  struct http_parser_message *request = pair->request;
+  struct http_parser_h2_stream *stream;
+  const char *aUpgrade;
+  const char *aSettings;
+  unsigned char settings[256];
+  struct buf *leftover;
+  int res = 0;
+  int len;
+
+  if (session->_state != _HTTP_PARSER_H2_INIT) return -1;
+
+  if (request->method && !strcmp(request->method, "PRI") && request->path && !strcmp(request->path, "*")) {
+    if (!request->version || strcmp(request->version, "2.0")) return -1;
+    session->_preface = HTTP_PARSER_H2_PREFACE_LENGTH - 6;
+  } else {
+    aUpgrade  = http_parser_header_get(request, "upgrade");
+    aSettings = http_parser_header_get(request, "http2-settings");
+    if (!request->upgrade || !aUpgrade || !aSettings) return -1;
+    if (!http_parser_list_contains(aUpgrade, "h2c")) return -1;
+    len = http_parser_h2_base64url(aSettings, settings, sizeof(settings));
+    if (len < 0 || http_parser_h2_settings(session, settings, len)) return -1;
+
+    buf_append(session->out, "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n", 71);
+    http_parser_h2_start(session);
+    stream = http_parser_h2_stream_open(session, 1, pair);
+    stream->pair  = NULL;
+    stream->state = _HTTP_PARSER_H2_STREAM_HALF_CLOSED;
+  }
+
+  leftover = request->leftover;
+  request->leftover = NULL;
+  if (leftover) {
+    res = http_parser_h2_data(session, leftover);
+    buf_clear(leftover);
+    free(leftover);
+  }
+  return res;
+}
+
+/**
+ * Sends pair->response on the pair's stream
+ *
+ * Body data exceeding the flow-control windows is copied and sent as the
+ * peer opens them up. Returns -1 if the stream is gone, e.g. reset by the
+ * peer, or already answered.
+ */
+int http_parser_h2_respond(struct http_parser_h2 *session, struct http_parser_pair *pair) {
+  const char *aStream = http_parser_meta_get(pair->request, "stream");
+  struct http_parser_message *response = pair->response;
+  struct http_parser_h2_stream *stream;
+  struct buf block = {0};
+  size_t offset = 0;
+  size_t length = 0;
+  size_t sent;
+  size_t n;
+  int flags;
+
+  if (!aStream || session->_state == _HTTP_PARSER_H2_PANIC) return -1;
+  stream = http_parser_h2_stream_get(session, strtoul(aStream, NULL, 10));
+  if (!stream || stream->pair || stream->pending || stream->state != _HTTP_PARSER_H2_STREAM_HALF_CLOSED) return -1;
+
+  if (response->body && response->status != 204 && response->status != 304 && (!pair->request->method || strcmp(pair->request->method, "HEAD"))) {
+    length = response->body->len;
+  }
+
+  // Header block, split over CONTINUATION frames where needed
+  http_parser_hpack_encode(session->_encoder, &block, response);
+  do {
+    n     = block.len - offset;
+    flags = 0;
+    if (n > session->maxFrameSize) n = session->maxFrameSize;
+    if ((offset + n) == block.len) flags |= _HTTP_PARSER_H2_FLAG_END_HEADERS;
+    if (!offset && !length) flags |= _HTTP_PARSER_H2_FLAG_END_STREAM;
+    http_parser_h2_frame(session, offset ? HTTP_PARSER_H2_CONTINUATION : HTTP_PARSER_H2_HEADERS, flags, stream->id, block.data + offset, n);
+    offset += n;
+  } while(offset < block.len);
+  buf_clear(&block);
+
+  if (!length) {
+    http_parser_h2_stream_close(session, stream);
+    return 0;
+  }
+
+  sent = http_parser_h2_send_data(session, stream, response->body->data, length);
+  if (sent == length) {
+    http_parser_h2_stream_close(session, stream);
+    return 0;
+  }
+  stream->pending = calloc(1, sizeof(struct buf));
+  buf_append(stream->pending, response->body->data + sent, length - sent);
+  return 0;
+}
+
+void http_parser_h2_free(struct http_parser_h2 *session) {
+  while(session->_streams) http_parser_h2_stream_close(session, session->_streams);
+  http_parser_hpack_free(session->_decoder);
+  http_parser_hpack_free(session->_encoder);
+  buf_clear(session->out);
+  free(session->out);
+  buf_clear(session->_in);
+  free(session->_in);
+  buf_clear(session->_block);
+  free(session->_block);
+  free(session);
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
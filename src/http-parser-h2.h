@@ -0,0 +1,119 @@
+#ifndef _HTTP_PARSER_H2_H_
+#define _HTTP_PARSER_H2_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http-parser.h"
+
+#define HTTP_PARSER_H2_PREFACE        "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP_PARSER_H2_PREFACE_LENGTH 24
+
+#define HTTP_PARSER_H2_DATA          0x0
+#define HTTP_PARSER_H2_HEADERS       0x1
+#define HTTP_PARSER_H2_PRIORITY      0x2
+#define HTTP_PARSER_H2_RST_STREAM    0x3
+#define HTTP_PARSER_H2_SETTINGS      0x4
+#define HTTP_PARSER_H2_PUSH_PROMISE  0x5
+#define HTTP_PARSER_H2_PING          0x6
+#define HTTP_PARSER_H2_GOAWAY        0x7
+#define HTTP_PARSER_H2_WINDOW_UPDATE 0x8
+#define HTTP_PARSER_H2_CONTINUATION  0x9
+
+#define HTTP_PARSER_H2_NO_ERROR            0x0
+#define HTTP_PARSER_H2_PROTOCOL_ERROR      0x1
+#define HTTP_PARSER_H2_INTERNAL_ERROR      0x2
+#define HTTP_PARSER_H2_FLOW_CONTROL_ERROR  0x3
+#define HTTP_PARSER_H2_STREAM_CLOSED       0x5
+#define HTTP_PARSER_H2_FRAME_SIZE_ERROR    0x6
+#define HTTP_PARSER_H2_REFUSED_STREAM      0x7
+#define HTTP_PARSER_H2_COMPRESSION_ERROR   0x9
+#define HTTP_PARSER_H2_ENHANCE_YOUR_CALM   0xb
+
+// Largest request header block accepted, as received and once decoded
+#ifndef HTTP_PARSER_H2_MAX_HEADER_BLOCK
+#define HTTP_PARSER_H2_MAX_HEADER_BLOCK 65536
+#endif
+
+// Largest request body buffered for a stream
+#ifndef HTTP_PARSER_H2_MAX_BODY
+#define HTTP_PARSER_H2_MAX_BODY (8 * 1024 * 1024)
+#endif
+
+struct http_parser_hpack_entry {
+  char *name;
+  char *value;
+  size_t size;
+};
+
+struct http_parser_hpack {
+  size_t size;
+  size_t maxSize;
+  size_t limit;
+  size_t maxListSize;
+  struct http_parser_hpack_entry *_entries;
+  int _first;
+  int _count;
+  int _cap;
+  int _update;
+  struct buf *_scratch;
+};
+
+struct http_parser_h2_stream {
+  uint32_t id;
+  int state;
+  long window;
+  long receiveWindow;
+  struct http_parser_pair *pair;
+  struct buf *pending;
+  size_t pendingOffset;
+  struct http_parser_h2_stream *next;
+};
+
+struct http_parser_h2 {
+  void (*onRequest)(struct http_parser_event*);
+  void *udata;
+  struct buf *out;
+  uint32_t lastStreamId;
+  int goaway;
+  uint32_t maxFrameSize;
+  long initialWindow;
+  long window;
+  int maxStreams;
+  size_t maxHeaderBlock;
+  size_t maxBodySize;
+  struct http_parser_hpack *_decoder;
+  struct http_parser_hpack *_encoder;
+  struct http_parser_h2_stream *_streams;
+  int _streamCount;
+  struct buf *_in;
+  struct buf *_block;
+  uint32_t _blockStream;
+  int _blockFlags;
+  int _preface;
+  int _state;
+};
+
+struct http_parser_hpack * http_parser_hpack_init(size_t maxSize);
+int http_parser_hpack_resize(struct http_parser_hpack *hpack, size_t limit);
+int http_parser_hpack_decode(struct http_parser_hpack *hpack, struct http_parser_message *message, const char *data, size_t len);
+void http_parser_hpack_encode(struct http_parser_hpack *hpack, struct buf *out, struct http_parser_message *message);
+void http_parser_hpack_free(struct http_parser_hpack *hpack);
+
+struct http_parser_h2 * http_parser_h2_init(void *udata);
+int http_parser_h2_is_preface(const struct buf *data);
+int http_parser_h2_upgrade(struct http_parser_h2 *session, struct http_parser_pair *pair);
+int http_parser_h2_data(struct http_parser_h2 *session, const struct buf *data);
+int http_parser_h2_respond(struct http_parser_h2 *session, struct http_parser_pair *pair);
+void http_parser_h2_goaway(struct http_parser_h2 *session, uint32_t error);
+void http_parser_h2_free(struct http_parser_h2 *session);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_H2_H_
@@ -0,0 +1,28 @@
+#ifndef _HTTP_PARSER_INTERNAL_H_
+#define _HTTP_PARSER_INTERNAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "http-parser.h"
+
+// Shared between the library's own sources only, not installed
+
+// Header reading for other stages working on a message's body, like the
+// multipart parser
+int _http_parser_message_read_header(struct http_parser_message *message);
+
+// Bookkeeping for messages framed by another protocol, like HTTP/2 streams
+void _http_parser_message_receive(struct http_parser_message *message, size_t len);
+void _http_parser_message_complete(struct http_parser_message *message);
+
+// Response serialization leaving out the body when answering HEAD, for
+// stages that know the request but not the pair, like the cache
+void _http_parser_sprint_response(struct buf *result, struct http_parser_message *response, int head);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_INTERNAL_H_
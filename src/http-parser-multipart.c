@@ -0,0 +1,269 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "finwo/strnstr.h"
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-internal.h"
+#include "http-parser-multipart.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strncasecmp
+#define strncasecmp _strnicmp
+#endif
+#endif
+
+static const int _HTTP_PARSER_MULTIPART_PREAMBLE  = 0;
+static const int _HTTP_PARSER_MULTIPART_DELIMITER = 1;
+static const int _HTTP_PARSER_MULTIPART_HEADER    = 2;
+static const int _HTTP_PARSER_MULTIPART_DATA      = 3;
+static const int _HTTP_PARSER_MULTIPART_DONE      = 4;
+static const int _HTTP_PARSER_MULTIPART_PANIC     = 666;
+
+// Part headers beyond this size are considered malformed
+#ifndef HTTP_PARSER_MULTIPART_MAXHEADER
+#define HTTP_PARSER_MULTIPART_MAXHEADER 16384
+#endif
+
+/**
+ * Extracts the boundary parameter from a multipart Content-Type
+ *
+ * Returns a newly allocated string or NULL if not found
+ */
+static char * http_parser_multipart_boundary(const char *contentType) {
+  const char *name;
+  const char *value;
+  const char *end;
+  char *result;
+
+  while(*contentType == ' ' || *contentType == '\t') contentType++;
+  if (strncasecmp(contentType, "multipart/", 10)) return NULL;
+
+  while((contentType = strchr(contentType, ';'))) {
+    contentType++;
+    while(*contentType == ' ' || *contentType == '\t') contentType++;
+    name = contentType;
+    while(*contentType && *contentType != '=' && *contentType != ';') contentType++;
+    if (*contentType != '=') continue;
+    value = contentType + 1;
+    if (((contentType - name) != 8) || strncasecmp(name, "boundary", 8)) continue;
+
+    // Quoted or plain token
+    if (*value == '"') {
+      value++;
+      end = strchr(value, '"');
+      if (!end) return NULL;
+    } else {
+      end = value;
+      while(*end && *end != ';' && *end != ' ' && *end != '\t') end++;
+    }
+    if ((end == value) || ((end - value) > 70)) return NULL;
+
+    result = calloc(1, (end - value) + 1);
+    memcpy(result, value, end - value);
+    return result;
+  }
+
+  return NULL;
+}
+
+/**
+ * Initializes a multipart parser from a message's Content-Type header
+ *
+ * Returns NULL if the content type is not multipart or lacks a boundary
+ */
+struct http_parser_multipart * http_parser_multipart_init(const char *contentType) {
+  struct http_parser_multipart *multipart;
+  char *boundary;
+  size_t i;
+
+  if (!contentType) return NULL;
+  boundary = http_parser_multipart_boundary(contentType);
+  if (!boundary) return NULL;
+
+  multipart = calloc(1, sizeof(struct http_parser_multipart));
+  multipart->_pending = calloc(1, sizeof(struct buf));
+
+  // Delimiters are preceded by a line break, except the very first one
+  // Prefixing the data with one lets the search treat them all the same
+  multipart->_delimiterLength = strlen(boundary) + 4;
+  multipart->_delimiter       = calloc(1, multipart->_delimiterLength + 1);
+  strcpy(multipart->_delimiter, "\r\n--");
+  strcat(multipart->_delimiter, boundary);
+  free(boundary);
+  buf_append(multipart->_pending, "\r\n", 2);
+
+  // Boyer-Moore-Horspool skip table
+  for(i=0; i<256; i++) {
+    multipart->_skip[i] = multipart->_delimiterLength;
+  }
+  for(i=0; i<(multipart->_delimiterLength - 1); i++) {
+    multipart->_skip[(unsigned char)multipart->_delimiter[i]] = multipart->_delimiterLength - 1 - i;
+  }
+
+  return multipart;
+}
+
+/**
+ * Searches for the delimiter using Boyer-Moore-Horspool
+ *
+ * Returns the offset of the delimiter or -1 if not found
+ */
+static long http_parser_multipart_find(struct http_parser_multipart *multipart, const char *data, size_t len) {
+  size_t last = multipart->_delimiterLength - 1;
+  size_t i    = 0;
+  while((i + last) < len) {
+    if ((data[i + last] == multipart->_delimiter[last]) && !memcmp(data + i, multipart->_delimiter, last)) {
+      return i;
+    }
+    i += multipart->_skip[(unsigned char)data[i + last]];
+  }
+  return -1;
+}
+
+static void http_parser_multipart_emit(struct http_parser_multipart *multipart, void (*cb)(struct http_parser_event*), const char *data, size_t len) {
+  struct buf chunk = {
+    .data = (char*)data,
+    .len  = len,
+    .cap  = len,
+  };
+  struct http_parser_event ev = {
+    .request = multipart->part,
+    .chunk   = &chunk,
+    .udata   = multipart->udata,
+  };
+  if (cb) cb(&ev);
+}
+
+/**
+ * Passes body data into the multipart parser
+ *
+ * Part data is passed on to onPartData as it arrives, only a possible partial
+ * delimiter at the end of the data is held back
+ *
+ * Returns 1 once the closing delimiter is found, 0 if more data is expected or
+ * -1 if the body is malformed
+ */
+int http_parser_multipart_data(struct http_parser_multipart *multipart, const struct buf *data) {
+  struct buf *pending = multipart->_pending;
+  size_t offset = 0;
+  size_t avail;
+  long found;
+  char *cur;
+  char *index;
+
+  if (multipart->_state == _HTTP_PARSER_MULTIPART_PANIC) return -1;
+  if (multipart->_state == _HTTP_PARSER_MULTIPART_DONE) return 1;
+  buf_append(pending, data->data, data->len);
+
+  while(1) {
+    cur   = pending->data + offset;
+    avail = pending->len - offset;
+
+    if (multipart->_state == _HTTP_PARSER_MULTIPART_PREAMBLE || multipart->_state == _HTTP_PARSER_MULTIPART_DATA) {
+      found = http_parser_multipart_find(multipart, cur, avail);
+
+      // Keep what could be the start of a delimiter
+      if (found < 0) {
+        if (avail >= multipart->_delimiterLength) {
+          avail -= multipart->_delimiterLength - 1;
+          if (multipart->_state == _HTTP_PARSER_MULTIPART_DATA) {
+            http_parser_multipart_emit(multipart, multipart->onPartData, cur, avail);
+          }
+          offset += avail;
+        }
+        break;
+      }
+
+      if (multipart->_state == _HTTP_PARSER_MULTIPART_DATA) {
+        if (found) http_parser_multipart_emit(multipart, multipart->onPartData, cur, found);
+        http_parser_multipart_emit(multipart, multipart->onPartEnd, NULL, 0);
+        http_parser_message_free(multipart->part);
+        multipart->part = NULL;
+      }
+      offset += found + multipart->_delimiterLength;
+      multipart->_state = _HTTP_PARSER_MULTIPART_DELIMITER;
+
+    } else if (multipart->_state == _HTTP_PARSER_MULTIPART_DELIMITER) {
+      if (avail < 2) break;
+
+      // Closing delimiter, ignore the epilogue
+      if (cur[0] == '-' && cur[1] == '-') {
+        multipart->_state = _HTTP_PARSER_MULTIPART_DONE;
+        offset = pending->len;
+        break;
+      }
+
+      // Skip transport padding up to the line break
+      index = strnstr(cur, "\r\n", avail);
+      if (!index) {
+        if (avail > 256) multipart->_state = _HTTP_PARSER_MULTIPART_PANIC;
+        break;
+      }
+      offset += (index - cur) + 2;
+      multipart->part       = http_parser_request_init();
+      multipart->part->body = calloc(1, sizeof(struct buf));
+      multipart->_state     = _HTTP_PARSER_MULTIPART_HEADER;
+
+    } else if (multipart->_state == _HTTP_PARSER_MULTIPART_HEADER) {
+      if (avail < 2) break;
+
+      // Wait for the complete header block
+      if (cur[0] == '\r' && cur[1] == '\n') {
+        offset += 2;
+      } else {
+        index = strnstr(cur, "\r\n\r\n", avail);
+        if (!index) {
+          if (avail > HTTP_PARSER_MULTIPART_MAXHEADER) multipart->_state = _HTTP_PARSER_MULTIPART_PANIC;
+          break;
+        }
+        buf_append(multipart->part->body, cur, (index - cur) + 4);
+        offset += (index - cur) + 4;
+        while(_http_parser_message_read_header(multipart->part));
+      }
+
+      http_parser_multipart_emit(multipart, multipart->onPart, NULL, 0);
+      multipart->_state = _HTTP_PARSER_MULTIPART_DATA;
+
+    } else {
+      break;
+    }
+  }
+
+  // Drop what has been handled
+  if (offset) {
+    memmove(pending->data, pending->data + offset, pending->len - offset);
+    pending->len -= offset;
+    pending->data[pending->len] = '\0';
+  }
+
+  if (multipart->_state == _HTTP_PARSER_MULTIPART_PANIC) return -1;
+  return multipart->_state == _HTTP_PARSER_MULTIPART_DONE;
+}
+
+/**
+ * Adapter to use as a message's onChunk, with the multipart parser as the
+ * message's udata
+ */
+void http_parser_multipart_chunk(struct http_parser_event *ev) {
+  http_parser_multipart_data(ev->udata, ev->chunk);
+}
+
+void http_parser_multipart_free(struct http_parser_multipart *multipart) {
+  if (multipart->part) http_parser_message_free(multipart->part);
+  buf_clear(multipart->_pending);
+  free(multipart->_pending);
+  free(multipart->_delimiter);
+  free(multipart);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
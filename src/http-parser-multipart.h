@@ -0,0 +1,34 @@
+#ifndef _HTTP_PARSER_MULTIPART_H_
+#define _HTTP_PARSER_MULTIPART_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "http-parser.h"
+
+struct http_parser_multipart {
+  struct http_parser_message *part;
+  void (*onPart)(struct http_parser_event*);
+  void (*onPartData)(struct http_parser_event*);
+  void (*onPartEnd)(struct http_parser_event*);
+  void *udata;
+  char *_delimiter;
+  size_t _delimiterLength;
+  size_t _skip[256];
+  struct buf *_pending;
+  int _state;
+};
+
+struct http_parser_multipart * http_parser_multipart_init(const char *contentType);
+int http_parser_multipart_data(struct http_parser_multipart *multipart, const struct buf *data);
+void http_parser_multipart_chunk(struct http_parser_event *ev);
+void http_parser_multipart_free(struct http_parser_multipart *multipart);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_MULTIPART_H_
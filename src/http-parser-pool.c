@@ -0,0 +1,163 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "http-parser.h"
+#include "http-parser-pool.h"
+
+HTTP_PARSER_THREAD_LOCAL struct http_parser_pool *_http_parser_pool_current;
+
+/**
+ * Initializes an empty pool, to be attached to the thread that parses
+ */
+struct http_parser_pool * http_parser_pool_init() {
+  return calloc(1, sizeof(struct http_parser_pool));
+}
+
+/**
+ * Makes messages and pairs initialized on the calling thread come from the
+ * pool, or from the heap again when given NULL
+ */
+void http_parser_pool_attach(struct http_parser_pool *pool) {
+  _http_parser_pool_current = pool;
+}
+
+/**
+ * Takes back the messages and pairs freed on other threads, cleaning them up
+ * on the thread that allocated their contents
+ *
+ * Returns how many were taken back, must be called on the pool's thread
+ */
+int http_parser_pool_collect(struct http_parser_pool *pool) {
+  struct http_parser_message *message = __atomic_exchange_n(&(pool->_remoteMessages), NULL, __ATOMIC_ACQUIRE);
+  struct http_parser_pair *pair       = __atomic_exchange_n(&(pool->_remotePairs), NULL, __ATOMIC_ACQUIRE);
+  struct http_parser_message *nextMessage;
+  struct http_parser_pair *nextPair;
+  struct http_parser_pool *attached = _http_parser_pool_current;
+  int collected = 0;
+
+  _http_parser_pool_current = pool;
+  for(; pair; pair = nextPair) {
+    nextPair = pair->_poolNext;
+    http_parser_pair_free(pair);
+    collected++;
+  }
+  for(; message; message = nextMessage) {
+    nextMessage = message->_poolNext;
+    http_parser_message_free(message);
+    collected++;
+  }
+  _http_parser_pool_current = attached;
+  return collected;
+}
+
+/**
+ * Frees the pool and its idle entries
+ *
+ * Returns -1 without freeing anything while messages or pairs are still in
+ * use, must be called on the pool's thread
+ */
+int http_parser_pool_free(struct http_parser_pool *pool) {
+  struct http_parser_message *message;
+  struct http_parser_pair *pair;
+
+  http_parser_pool_collect(pool);
+  if (pool->outstanding) return -1;
+
+  while((message = pool->_messages)) {
+    pool->_messages = message->_poolNext;
+    free(message);
+  }
+  while((pair = pool->_pairs)) {
+    pool->_pairs = pair->_poolNext;
+    free(pair);
+  }
+  if (_http_parser_pool_current == pool) _http_parser_pool_current = NULL;
+  free(pool);
+  return 0;
+}
+
+// Parser hooks {{{
+
+struct http_parser_message * _http_parser_pool_message() {
+  struct http_parser_pool *pool = _http_parser_pool_current;
+  struct http_parser_message *message;
+
+  if (!pool->_messages) http_parser_pool_collect(pool);
+  message = pool->_messages;
+  if (message) {
+    pool->_messages = message->_poolNext;
+    pool->idle--;
+    memset(message, 0, sizeof(struct http_parser_message));
+  } else {
+    message = calloc(1, sizeof(struct http_parser_message));
+  }
+  message->_pool = pool;
+  pool->outstanding++;
+  return message;
+}
+
+struct http_parser_pair * _http_parser_pool_pair() {
+  struct http_parser_pool *pool = _http_parser_pool_current;
+  struct http_parser_pair *pair;
+
+  if (!pool->_pairs) http_parser_pool_collect(pool);
+  pair = pool->_pairs;
+  if (pair) {
+    pool->_pairs = pair->_poolNext;
+    pool->idle--;
+    memset(pair, 0, sizeof(struct http_parser_pair));
+  } else {
+    pair = calloc(1, sizeof(struct http_parser_pair));
+  }
+  pair->_pool = pool;
+  pool->outstanding++;
+  return pair;
+}
+
+/**
+ * Hands a message freed away from its pool's thread back to that thread
+ * as-is, returning 1 if it did
+ */
+int _http_parser_pool_message_remote(struct http_parser_message *message) {
+  struct http_parser_pool *pool = message->_pool;
+  if (pool == _http_parser_pool_current) return 0;
+  message->_poolNext = __atomic_load_n(&(pool->_remoteMessages), __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&(pool->_remoteMessages), &(message->_poolNext), message, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return 1;
+}
+
+int _http_parser_pool_pair_remote(struct http_parser_pair *pair) {
+  struct http_parser_pool *pool = pair->_pool;
+  if (pool == _http_parser_pool_current) return 0;
+  pair->_poolNext = __atomic_load_n(&(pool->_remotePairs), __ATOMIC_RELAXED);
+  while(!__atomic_compare_exchange_n(&(pool->_remotePairs), &(pair->_poolNext), pair, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  return 1;
+}
+
+void _http_parser_pool_message_put(struct http_parser_message *message) {
+  struct http_parser_pool *pool = message->_pool;
+  message->_poolNext = pool->_messages;
+  pool->_messages    = message;
+  pool->outstanding--;
+  pool->idle++;
+}
+
+void _http_parser_pool_pair_put(struct http_parser_pair *pair) {
+  struct http_parser_pool *pool = pair->_pool;
+  pair->_poolNext = pool->_pairs;
+  pool->_pairs    = pair;
+  pool->outstanding--;
+  pool->idle++;
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,37 @@
+#ifndef _HTTP_PARSER_POOL_H_
+#define _HTTP_PARSER_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "http-parser.h"
+
+struct http_parser_pool {
+  int outstanding;
+  int idle;
+  struct http_parser_message *_messages;
+  struct http_parser_pair *_pairs;
+  struct http_parser_message *_remoteMessages;
+  struct http_parser_pair *_remotePairs;
+};
+
+struct http_parser_pool * http_parser_pool_init();
+void http_parser_pool_attach(struct http_parser_pool *pool);
+int http_parser_pool_collect(struct http_parser_pool *pool);
+int http_parser_pool_free(struct http_parser_pool *pool);
+
+// Used by the parser to allocate and return pooled messages and pairs
+extern HTTP_PARSER_THREAD_LOCAL struct http_parser_pool *_http_parser_pool_current;
+struct http_parser_message * _http_parser_pool_message();
+struct http_parser_pair * _http_parser_pool_pair();
+int _http_parser_pool_message_remote(struct http_parser_message *message);
+int _http_parser_pool_pair_remote(struct http_parser_pair *pair);
+void _http_parser_pool_message_put(struct http_parser_message *message);
+void _http_parser_pool_pair_put(struct http_parser_pair *pair);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_POOL_H_
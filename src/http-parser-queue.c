@@ -0,0 +1,122 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "http-parser-queue.h"
+
+// Each cell's sequence tells which lap of the ring it's ready for, producers
+// claim a cell at the tail when it equals the tail and consumers at the head
+// when it equals the head plus one
+struct http_parser_queue_cell {
+  size_t sequence;
+  void *data;
+};
+
+/**
+ * Initializes a queue holding up to capacity items, rounded up to a power of
+ * two
+ *
+ * Without HTTP_PARSER_QUEUE_MULTI_PRODUCER only one thread may push at a
+ * time, without HTTP_PARSER_QUEUE_MULTI_CONSUMER only one thread may pop
+ */
+struct http_parser_queue * http_parser_queue_init(size_t capacity, int flags) {
+  struct http_parser_queue *queue;
+  size_t size = 2;
+  size_t i;
+
+  while(size < capacity) size <<= 1;
+  queue = calloc(1, sizeof(struct http_parser_queue));
+  if (!queue) return NULL;
+  queue->_cells = malloc(size * sizeof(struct http_parser_queue_cell));
+  if (!queue->_cells) {
+    free(queue);
+    return NULL;
+  }
+  for(i = 0; i < size; i++) {
+    queue->_cells[i].sequence = i;
+    queue->_cells[i].data     = NULL;
+  }
+  queue->capacity = size;
+  queue->flags    = flags;
+  return queue;
+}
+
+/**
+ * Appends an item, which may not be NULL
+ *
+ * Returns 0 on success or -1 if the queue is full
+ */
+int http_parser_queue_push(struct http_parser_queue *queue, void *item) {
+  struct http_parser_queue_cell *cell;
+  size_t mask = queue->capacity - 1;
+  size_t pos  = __atomic_load_n(&(queue->_tail), __ATOMIC_RELAXED);
+  size_t sequence;
+
+  for(;;) {
+    cell     = &(queue->_cells[pos & mask]);
+    sequence = __atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE);
+    if (sequence == pos) {
+      if (!(queue->flags & HTTP_PARSER_QUEUE_MULTI_PRODUCER)) {
+        __atomic_store_n(&(queue->_tail), pos + 1, __ATOMIC_RELAXED);
+        break;
+      }
+      if (__atomic_compare_exchange_n(&(queue->_tail), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if ((intptr_t)(sequence - pos) < 0) {
+      return -1;
+    } else {
+      pos = __atomic_load_n(&(queue->_tail), __ATOMIC_RELAXED);
+    }
+  }
+
+  cell->data = item;
+  __atomic_store_n(&(cell->sequence), pos + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+/**
+ * Takes the oldest item, or NULL if the queue is empty
+ */
+void * http_parser_queue_pop(struct http_parser_queue *queue) {
+  struct http_parser_queue_cell *cell;
+  size_t mask = queue->capacity - 1;
+  size_t pos  = __atomic_load_n(&(queue->_head), __ATOMIC_RELAXED);
+  size_t sequence;
+  void *item;
+
+  for(;;) {
+    cell     = &(queue->_cells[pos & mask]);
+    sequence = __atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE);
+    if (sequence == pos + 1) {
+      if (!(queue->flags & HTTP_PARSER_QUEUE_MULTI_CONSUMER)) {
+        __atomic_store_n(&(queue->_head), pos + 1, __ATOMIC_RELAXED);
+        break;
+      }
+      if (__atomic_compare_exchange_n(&(queue->_head), &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+    } else if ((intptr_t)(sequence - (pos + 1)) < 0) {
+      return NULL;
+    } else {
+      pos = __atomic_load_n(&(queue->_head), __ATOMIC_RELAXED);
+    }
+  }
+
+  item = cell->data;
+  __atomic_store_n(&(cell->sequence), pos + mask + 1, __ATOMIC_RELEASE);
+  return item;
+}
+
+/**
+ * Frees the queue, not the items still in it
+ */
+void http_parser_queue_free(struct http_parser_queue *queue) {
+  free(queue->_cells);
+  free(queue);
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
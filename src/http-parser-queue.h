@@ -0,0 +1,41 @@
+#ifndef _HTTP_PARSER_QUEUE_H_
+#define _HTTP_PARSER_QUEUE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+// Bounded lock-free queue of pointers, for handing pairs between threads
+
+#define HTTP_PARSER_QUEUE_MULTI_PRODUCER 1
+#define HTTP_PARSER_QUEUE_MULTI_CONSUMER 2
+
+#ifndef HTTP_PARSER_QUEUE_CACHELINE
+#define HTTP_PARSER_QUEUE_CACHELINE 64
+#endif
+
+struct http_parser_queue_cell;
+
+struct http_parser_queue {
+  size_t capacity;
+  int flags;
+  struct http_parser_queue_cell *_cells;
+  char _pad0[HTTP_PARSER_QUEUE_CACHELINE];
+  size_t _head;
+  char _pad1[HTTP_PARSER_QUEUE_CACHELINE - sizeof(size_t)];
+  size_t _tail;
+  char _pad2[HTTP_PARSER_QUEUE_CACHELINE - sizeof(size_t)];
+};
+
+struct http_parser_queue * http_parser_queue_init(size_t capacity, int flags);
+int http_parser_queue_push(struct http_parser_queue *queue, void *item);
+void * http_parser_queue_pop(struct http_parser_queue *queue);
+void http_parser_queue_free(struct http_parser_queue *queue);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_QUEUE_H_
@@ -0,0 +1,333 @@
+// vim:fdm=marker:fdl=0
+
+// File offsets past 4 GiB on 32-bit targets
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-range.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strncasecmp
+#define strncasecmp _strnicmp
+#endif
+#endif
+
+// Most bytes handed to a single write or sendfile, fits ssize_t everywhere
+static const size_t _HTTP_PARSER_RANGE_WRITE_MAX = 1 << 30;
+
+// Range header {{{
+
+static void http_parser_range_skip(const char **cursor) {
+  while(**cursor == ' ' || **cursor == '\t') (*cursor)++;
+}
+
+// Reads a decimal position, saturating instead of overflowing
+static int http_parser_range_number(const char **cursor, uint64_t *result) {
+  const char *p = *cursor;
+  uint64_t n    = 0;
+  if (*p < '0' || *p > '9') return -1;
+  for(; *p >= '0' && *p <= '9'; p++) {
+    n = (n > (UINT64_MAX - 9) / 10) ? UINT64_MAX : ((n * 10) + (*p - '0'));
+  }
+  *cursor = p;
+  *result = n;
+  return 0;
+}
+
+/**
+ * Parses a Range header into the byte ranges it selects from a resource of
+ * the given size, in the order requested
+ *
+ * Returns the number of satisfiable ranges stored, 0 if none are satisfiable
+ * (answer 416), or -1 if the header should be ignored (answer in full): it
+ * is missing, malformed, not in bytes, or lists more than max ranges
+ */
+int http_parser_range_parse(const char *value, uint64_t size, struct http_parser_range *ranges, int max) {
+  const char *cursor = value;
+  uint64_t first, last;
+  int specs = 0;
+  int count = 0;
+
+  if (!value) return -1;
+  http_parser_range_skip(&cursor);
+  if (strncasecmp(cursor, "bytes", 5)) return -1;
+  cursor += 5;
+  http_parser_range_skip(&cursor);
+  if (*(cursor++) != '=') return -1;
+
+  for(;;) {
+    http_parser_range_skip(&cursor);
+    if (*cursor == ',') {
+      cursor++;
+      continue;
+    }
+    if (!*cursor) break;
+    if (++specs > max) return -1;
+
+    if (*cursor == '-') {
+      // Suffix, the last N bytes
+      cursor++;
+      if (http_parser_range_number(&cursor, &last)) return -1;
+      if (!last || !size) {
+        first = UINT64_MAX;
+      } else {
+        first = (last > size) ? 0 : (size - last);
+        last  = size - 1;
+      }
+    } else {
+      if (http_parser_range_number(&cursor, &first)) return -1;
+      if (*(cursor++) != '-') return -1;
+      last = UINT64_MAX;
+      if (*cursor >= '0' && *cursor <= '9') {
+        http_parser_range_number(&cursor, &last);
+        if (last < first) return -1;
+      }
+      if (last >= size) last = size - 1;
+    }
+
+    // Ranges starting beyond the end can't be satisfied
+    if (first < size) {
+      ranges[count].offset = first;
+      ranges[count].length = last - first + 1;
+      count++;
+    }
+
+    http_parser_range_skip(&cursor);
+    if (*cursor && *cursor != ',') return -1;
+  }
+
+  return specs ? count : -1;
+}
+
+// }}}
+
+// Segments {{{
+
+static void http_parser_segments_add(struct http_parser_segments *segments, int fd, uint64_t offset, uint64_t length) {
+  struct http_parser_segment *last = segments->count ? &(segments->segments[segments->count - 1]) : NULL;
+  if (!length) return;
+  segments->length += length;
+
+  // Adjoining bytes of the same source go out as one
+  if (last && last->fd == fd && (last->offset + last->length) == offset) {
+    last->length += length;
+    return;
+  }
+
+  if (segments->count == segments->_cap) {
+    segments->_cap     = segments->_cap ? segments->_cap * 2 : 8;
+    segments->segments = realloc(segments->segments, segments->_cap * sizeof(struct http_parser_segment));
+  }
+  segments->segments[segments->count].fd     = fd;
+  segments->segments[segments->count].offset = offset;
+  segments->segments[segments->count].length = length;
+  segments->count++;
+}
+
+// Appends bytes to the list's data and sends them next
+static void http_parser_segments_append(struct http_parser_segments *segments, const char *data, size_t length) {
+  size_t offset = segments->data->len;
+  buf_append(segments->data, data, length);
+  http_parser_segments_add(segments, -1, offset, length);
+}
+
+static void http_parser_range_boundary(char *boundary, size_t size) {
+  static HTTP_PARSER_THREAD_LOCAL unsigned long counter = 0;
+  counter++;
+  snprintf(boundary, size, "%08lx%08lx", (unsigned long)time(NULL), (unsigned long)(counter ^ (uintptr_t)&counter));
+}
+
+/**
+ * Turns the response into the answer to a range request for the bytes of fd,
+ * size bytes long, given the result of http_parser_range_parse
+ *
+ * Sets the status to 206, or 416 when no range is satisfiable, and the
+ * Content-Range or multipart/byteranges headers. Returns the head, the
+ * multipart delimiters and the file ranges as segments to send in order. The
+ * response's own body is left out.
+ */
+struct http_parser_segments * http_parser_sprint_ranges(struct http_parser_message *response, const struct http_parser_range *ranges, int count, int fd, uint64_t size) {
+  struct http_parser_segments *segments = calloc(1, sizeof(struct http_parser_segments));
+  struct buf *body = response->body;
+  struct buf *parts;
+  const char *contentType;
+  size_t *partEnds;
+  size_t partOffset = 0;
+  uint64_t length;
+  char boundary[32];
+  char line[256];
+  int i;
+
+  segments->data = calloc(1, sizeof(struct buf));
+  response->body = NULL;
+
+  if (count <= 0) {
+    response->status = 416;
+    snprintf(line, sizeof(line), "bytes */%" PRIu64, size);
+    http_parser_header_set(response, "Content-Range", line);
+    http_parser_header_set(response, "Content-Length", "0");
+    http_parser_sprint_response_into(segments->data, response);
+    http_parser_segments_add(segments, -1, 0, segments->data->len);
+    response->body = body;
+    return segments;
+  }
+
+  response->status = 206;
+  if (count == 1) {
+    snprintf(line, sizeof(line), "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64, ranges[0].offset, ranges[0].offset + ranges[0].length - 1, size);
+    http_parser_header_set(response, "Content-Range", line);
+    snprintf(line, sizeof(line), "%" PRIu64, ranges[0].length);
+    http_parser_header_set(response, "Content-Length", line);
+    http_parser_sprint_response_into(segments->data, response);
+    http_parser_segments_add(segments, -1, 0, segments->data->len);
+    http_parser_segments_add(segments, fd, ranges[0].offset, ranges[0].length);
+    response->body = body;
+    return segments;
+  }
+
+  // Every part carries the resource's own type and its range, the body's
+  // length is known once the delimiters are written
+  contentType = http_parser_header_get_atom(response, HTTP_PARSER_ATOM_CONTENT_TYPE);
+  http_parser_range_boundary(boundary, sizeof(boundary));
+  parts    = calloc(1, sizeof(struct buf));
+  partEnds = malloc(count * sizeof(size_t));
+  length   = 0;
+  for(i = 0; i < count; i++) {
+    buf_append(parts, line, snprintf(line, sizeof(line), "\r\n--%s\r\n", boundary));
+    if (contentType) {
+      buf_append(parts, "Content-Type: ", 14);
+      buf_append(parts, contentType, strlen(contentType));
+      buf_append(parts, "\r\n", 2);
+    }
+    buf_append(parts, line, snprintf(line, sizeof(line), "Content-Range: bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64 "\r\n\r\n",
+      ranges[i].offset, ranges[i].offset + ranges[i].length - 1, size));
+    partEnds[i] = parts->len;
+    length     += ranges[i].length;
+  }
+  buf_append(parts, line, snprintf(line, sizeof(line), "\r\n--%s--\r\n", boundary));
+  length += parts->len;
+
+  snprintf(line, sizeof(line), "multipart/byteranges; boundary=%s", boundary);
+  http_parser_header_set(response, "Content-Type", line);
+  snprintf(line, sizeof(line), "%" PRIu64, length);
+  http_parser_header_set(response, "Content-Length", line);
+  http_parser_sprint_response_into(segments->data, response);
+  http_parser_segments_add(segments, -1, 0, segments->data->len);
+
+  for(i = 0; i < count; i++) {
+    http_parser_segments_append(segments, parts->data + partOffset, partEnds[i] - partOffset);
+    http_parser_segments_add(segments, fd, ranges[i].offset, ranges[i].length);
+    partOffset = partEnds[i];
+  }
+  http_parser_segments_append(segments, parts->data + partOffset, parts->len - partOffset);
+
+  buf_clear(parts);
+  free(parts);
+  free(partEnds);
+  response->body = body;
+  return segments;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(__linux__)
+// Copies a file segment through userspace where sendfile isn't available
+static ssize_t http_parser_segments_copy(int sock, int fd, off_t offset, size_t length) {
+  char chunk[16384];
+  ssize_t n = pread(fd, chunk, length < sizeof(chunk) ? length : sizeof(chunk), offset);
+  if (n <= 0) {
+    if (!n) errno = EIO;
+    return -1;
+  }
+  return write(sock, chunk, n);
+}
+#endif
+
+/**
+ * Writes the segments to a socket, with sendfile for file segments on Linux
+ *
+ * Continues where the previous call stopped. Returns 1 once everything is
+ * written, 0 when a non-blocking socket would block, or -1 with errno set
+ */
+int http_parser_segments_write(struct http_parser_segments *segments, int sock) {
+#if defined(_WIN32) || defined(_WIN64)
+  errno = ENOSYS;
+  return -1;
+#else
+  struct http_parser_segment *segment;
+  uint64_t left;
+  size_t remaining;
+  ssize_t n;
+  off_t offset;
+
+  while(segments->_current < segments->count) {
+    segment   = &(segments->segments[segments->_current]);
+    left      = segment->length - segments->_currentOffset;
+    remaining = (left > _HTTP_PARSER_RANGE_WRITE_MAX) ? _HTTP_PARSER_RANGE_WRITE_MAX : (size_t)left;
+    if (segment->fd < 0) {
+      n = write(sock, segments->data->data + segment->offset + segments->_currentOffset, remaining);
+    } else {
+      offset = (off_t)(segment->offset + segments->_currentOffset);
+#if defined(__linux__)
+      n = sendfile(sock, segment->fd, &offset, remaining);
+      if (!n) {
+        errno = EIO;
+        n     = -1;
+      }
+#else
+      n = http_parser_segments_copy(sock, segment->fd, offset, remaining);
+#endif
+    }
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+      return -1;
+    }
+
+    segments->written        += n;
+    segments->_currentOffset += n;
+    if (segments->_currentOffset == segment->length) {
+      segments->_current++;
+      segments->_currentOffset = 0;
+    }
+  }
+
+  return 1;
+#endif
+}
+
+void http_parser_segments_free(struct http_parser_segments *segments) {
+  buf_clear(segments->data);
+  free(segments->data);
+  free(segments->segments);
+  free(segments);
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,51 @@
+#ifndef _HTTP_PARSER_RANGE_H_
+#define _HTTP_PARSER_RANGE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http-parser.h"
+
+// Requests listing more ranges than this are answered in full
+#ifndef HTTP_PARSER_RANGE_MAX
+#define HTTP_PARSER_RANGE_MAX 16
+#endif
+
+// Positions are 64-bit so files over 4 GiB work on 32-bit and LLP64 targets
+struct http_parser_range {
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Bytes to send, either from the list's data (fd -1) or from a file
+struct http_parser_segment {
+  int fd;
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct http_parser_segments {
+  int count;
+  uint64_t length;
+  uint64_t written;
+  struct http_parser_segment *segments;
+  struct buf *data;
+  int _cap;
+  int _current;
+  uint64_t _currentOffset;
+};
+
+int http_parser_range_parse(const char *value, uint64_t size, struct http_parser_range *ranges, int max);
+struct http_parser_segments * http_parser_sprint_ranges(struct http_parser_message *response, const struct http_parser_range *ranges, int count, int fd, uint64_t size);
+int http_parser_segments_write(struct http_parser_segments *segments, int sock);
+void http_parser_segments_free(struct http_parser_segments *segments);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_RANGE_H_
@@ -0,0 +1,320 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-pool.h"
+#include "http-parser-replay.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+struct http_parser_replay_capture {
+  int index;
+  off_t size;
+};
+
+struct http_parser_replay_worker {
+  pthread_t thread;
+  struct http_parser_replay *replay;
+  const char *const *paths;
+  const struct http_parser_replay_capture *captures;
+  int count;
+  int *next;
+  uint64_t bytes;
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t errors;
+  uint64_t parseTime;
+};
+
+// The message being parsed from a capture
+struct http_parser_replay_conn {
+  struct http_parser_replay_worker *worker;
+  const char *path;
+  int index;
+  int isResponse;
+  struct http_parser_message *message;
+  size_t fed;
+  size_t slice;
+  uint64_t parseTime;
+};
+
+// First slice of the capture handed to a new message
+static const size_t _HTTP_PARSER_REPLAY_SLICE = 512;
+
+static uint64_t http_parser_replay_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+// Connections {{{
+
+static void http_parser_replay_finish(struct http_parser_replay_conn *conn) {
+  struct http_parser_replay_worker *worker = conn->worker;
+  struct http_parser_message *message      = conn->message;
+  struct http_parser_replay_record record  = {
+    .path        = conn->path,
+    .connection  = conn->index,
+    .isResponse  = conn->isResponse,
+    .headerCount = message->headerCount,
+    .length      = conn->fed - (message->leftover ? message->leftover->len : 0),
+    .bodyLength  = message->body ? message->body->len : 0,
+    .parseTime   = conn->parseTime,
+    .message     = message,
+  };
+
+  if (conn->isResponse) {
+    worker->responses++;
+  } else {
+    worker->requests++;
+  }
+  worker->parseTime += conn->parseTime;
+  if (worker->replay->onMessage) worker->replay->onMessage(&record, worker->replay->udata);
+}
+
+/**
+ * Feeds bytes of the capture to its messages, completing as many messages as
+ * they hold
+ *
+ * A message gets the bytes in slices that double while it's incomplete, so
+ * it receives little beyond its own end. Those bytes are fed to the next
+ * message by offset, and the parser's copy of them is dropped. Handing over
+ * the leftover instead would copy the rest of the chunk once per pipelined
+ * message.
+ *
+ * Returns -1 once the capture can no longer be framed
+ */
+static int http_parser_replay_feed(struct http_parser_replay_conn *conn, const char *data, size_t len) {
+  struct buf slice;
+  size_t offset = 0;
+  size_t size;
+  uint64_t started;
+
+  while(offset < len) {
+    if (!conn->message) {
+      conn->message   = conn->isResponse ? http_parser_response_init() : http_parser_request_init();
+      conn->fed       = 0;
+      conn->parseTime = 0;
+      conn->slice     = _HTTP_PARSER_REPLAY_SLICE;
+    }
+
+    size       = (len - offset) < conn->slice ? (len - offset) : conn->slice;
+    slice.data = (char*)data + offset;
+    slice.len  = size;
+    slice.cap  = size;
+
+    started = http_parser_replay_now();
+    if (conn->isResponse) {
+      http_parser_response_data(conn->message, &slice);
+    } else {
+      http_parser_request_data(conn->message, &slice);
+    }
+    conn->parseTime += http_parser_replay_now() - started;
+    conn->fed       += size;
+    offset          += size;
+
+    if (http_parser_message_head_complete(conn->message) < 0) return -1;
+    if (!conn->message->ready) {
+      if (conn->slice < HTTP_PARSER_REPLAY_CHUNK) conn->slice *= 2;
+      continue;
+    }
+
+    // The leftover always comes from the last slice
+    http_parser_replay_finish(conn);
+    if (conn->message->leftover) offset -= conn->message->leftover->len;
+    http_parser_message_free(conn->message);
+    conn->message = NULL;
+  }
+  return 0;
+}
+
+/**
+ * Parses one capture, responses when it starts with a status line and
+ * requests otherwise
+ */
+static void http_parser_replay_connection(struct http_parser_replay_worker *worker, int index) {
+  struct http_parser_replay_conn conn = {
+    .worker = worker,
+    .path   = worker->paths[index],
+    .index  = index,
+  };
+  const char *data;
+  size_t offset = 0;
+  size_t len;
+  struct stat st;
+  int failed = 0;
+  int fd;
+
+  fd = open(conn.path, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st)) {
+    if (fd >= 0) close(fd);
+    worker->errors++;
+    return;
+  }
+  if (!st.st_size) {
+    close(fd);
+    return;
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    worker->errors++;
+    return;
+  }
+  madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+
+  conn.isResponse = (st.st_size >= 5) && !memcmp(data, "HTTP/", 5);
+  while(offset < (size_t)st.st_size) {
+    len = (size_t)st.st_size - offset;
+    if (len > HTTP_PARSER_REPLAY_CHUNK) len = HTTP_PARSER_REPLAY_CHUNK;
+    if (http_parser_replay_feed(&conn, data + offset, len)) {
+      failed = 1;
+      break;
+    }
+    offset += len;
+  }
+  worker->bytes += st.st_size;
+
+  // Responses may be delimited by the end of the connection
+  if (conn.message && !failed && conn.isResponse) {
+    http_parser_response_eof(conn.message);
+    if (conn.message->ready) http_parser_replay_finish(&conn);
+  }
+  if (conn.message && (failed || !conn.message->ready)) worker->errors++;
+  if (conn.message) http_parser_message_free(conn.message);
+  munmap((void*)data, st.st_size);
+}
+
+static void * http_parser_replay_thread(void *udata) {
+  struct http_parser_replay_worker *worker = udata;
+  struct http_parser_pool *pool            = http_parser_pool_init();
+  int next;
+
+  http_parser_pool_attach(pool);
+  while((next = __atomic_fetch_add(worker->next, 1, __ATOMIC_RELAXED)) < worker->count) {
+    http_parser_replay_connection(worker, worker->captures[next].index);
+  }
+  http_parser_pool_attach(NULL);
+  http_parser_pool_free(pool);
+  return NULL;
+}
+
+// }}}
+
+#endif
+
+// Scheduling {{{
+
+#if !defined(_WIN32) && !defined(_WIN64)
+// Largest captures first, so no thread is left with a big one at the end
+static int http_parser_replay_compare(const void *a, const void *b) {
+  off_t sa = ((const struct http_parser_replay_capture *)a)->size;
+  off_t sb = ((const struct http_parser_replay_capture *)b)->size;
+  return (sa < sb) - (sa > sb);
+}
+#endif
+
+/**
+ * Parses capture files, each holding the bytes one side of a connection
+ * sent, on a pool of threads
+ *
+ * Captures are memory-mapped and spread over replay->threads threads, or one
+ * per processor when 0, biggest first. onMessage is called for every parsed
+ * message from the thread that parsed it. The totals of the replay are
+ * filled in when it returns, captures that can't be read or framed count as
+ * errors. Returns -1 with errno set when the threads can't be started.
+ */
+int http_parser_replay_run(struct http_parser_replay *replay, const char *const *paths, int count) {
+#if defined(_WIN32) || defined(_WIN64)
+  (void)replay;
+  (void)paths;
+  (void)count;
+  errno = ENOSYS;
+  return -1;
+#else
+  struct http_parser_replay_worker *workers;
+  struct http_parser_replay_capture *captures;
+  struct stat st;
+  int threads = replay->threads;
+  int started = 0;
+  int next    = 0;
+  int res     = 0;
+  uint64_t began;
+  int i;
+
+  if (count < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads <= 0) threads = 1;
+  if (threads > count) threads = count ? count : 1;
+
+  replay->bytes     = 0;
+  replay->requests  = 0;
+  replay->responses = 0;
+  replay->errors    = 0;
+  replay->parseTime = 0;
+
+  captures = calloc(count ? count : 1, sizeof(struct http_parser_replay_capture));
+  for(i = 0; i < count; i++) {
+    captures[i].index = i;
+    captures[i].size  = stat(paths[i], &st) ? 0 : st.st_size;
+  }
+  qsort(captures, count, sizeof(struct http_parser_replay_capture), http_parser_replay_compare);
+
+  began   = http_parser_replay_now();
+  workers = calloc(threads, sizeof(struct http_parser_replay_worker));
+  for(i = 0; i < threads; i++) {
+    workers[i].replay   = replay;
+    workers[i].paths    = paths;
+    workers[i].captures = captures;
+    workers[i].count    = count;
+    workers[i].next     = &next;
+    if (pthread_create(&(workers[i].thread), NULL, http_parser_replay_thread, &(workers[i]))) break;
+    started++;
+  }
+  if (!started) {
+    errno = EAGAIN;
+    res   = -1;
+  }
+
+  for(i = 0; i < started; i++) {
+    pthread_join(workers[i].thread, NULL);
+    replay->bytes     += workers[i].bytes;
+    replay->requests  += workers[i].requests;
+    replay->responses += workers[i].responses;
+    replay->errors    += workers[i].errors;
+    replay->parseTime += workers[i].parseTime;
+  }
+  replay->elapsed = http_parser_replay_now() - began;
+
+  free(workers);
+  free(captures);
+  return res;
+#endif
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,48 @@
+#ifndef _HTTP_PARSER_REPLAY_H_
+#define _HTTP_PARSER_REPLAY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http-parser.h"
+
+// Most bytes of a capture handed to the parser at once
+#ifndef HTTP_PARSER_REPLAY_CHUNK
+#define HTTP_PARSER_REPLAY_CHUNK 65536
+#endif
+
+// A message parsed from a capture, valid during onMessage only
+struct http_parser_replay_record {
+  const char *path;
+  int connection;
+  int isResponse;
+  int headerCount;
+  size_t length;
+  size_t bodyLength;
+  uint64_t parseTime;
+  struct http_parser_message *message;
+};
+
+struct http_parser_replay {
+  int threads;
+  void (*onMessage)(const struct http_parser_replay_record *record, void *udata);
+  void *udata;
+  uint64_t bytes;
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t errors;
+  uint64_t parseTime;
+  uint64_t elapsed;
+};
+
+int http_parser_replay_run(struct http_parser_replay *replay, const char *const *paths, int count);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_REPLAY_H_
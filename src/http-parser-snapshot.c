@@ -0,0 +1,335 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-snapshot.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strcasecmp
+#define strcasecmp _stricmp
+#endif
+#endif
+
+// Writing {{{
+
+#define HTTP_PARSER_SNAPSHOT_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+static size_t http_parser_snapshot_strlen(const char *str) {
+  return str ? strlen(str) + 1 : 0;
+}
+
+/**
+ * Bytes the snapshot of the message takes, including the padding that keeps
+ * snapshots placed back to back aligned
+ *
+ * Returns 0 when the head doesn't fit the 32-bit string offsets, only the
+ * body may extend past 4 GiB
+ */
+size_t http_parser_snapshot_size(struct http_parser_message *message) {
+  size_t size = sizeof(struct http_parser_snapshot);
+  size_t bodyLength;
+  const char *value;
+  int count = http_parser_meta_count(message);
+  int i;
+
+  size += (size_t)(message->headerCount + count) * sizeof(struct http_parser_snapshot_field);
+  size += http_parser_snapshot_strlen(message->method);
+  size += http_parser_snapshot_strlen(message->path);
+  size += http_parser_snapshot_strlen(message->query);
+  size += http_parser_snapshot_strlen(message->version);
+  size += http_parser_snapshot_strlen(message->statusMessage);
+  for(i = 0; i < message->headerCount; i++) {
+    size += strlen(message->headers[i].key) + strlen(message->headers[i].value) + 2;
+  }
+  for(i = 0; i < count; i++) {
+    size += strlen(http_parser_meta_nth(message, i, &value)) + strlen(value) + 2;
+  }
+  if (size > UINT32_MAX) return 0;
+  http_parser_message_body_map(message, &bodyLength);
+  return HTTP_PARSER_SNAPSHOT_ALIGN(size + bodyLength + 1);
+}
+
+// Copies a string to the end of the snapshot, returning its offset
+static uint32_t http_parser_snapshot_put(char *base, size_t *cursor, const char *str, size_t len) {
+  uint32_t offset = (uint32_t)*cursor;
+  memcpy(base + *cursor, str, len);
+  base[*cursor + len] = '\0';
+  *cursor += len + 1;
+  return offset;
+}
+
+static uint32_t http_parser_snapshot_put_string(char *base, size_t *cursor, const char *str) {
+  return str ? http_parser_snapshot_put(base, cursor, str, strlen(str)) : 0;
+}
+
+/**
+ * Writes the message as one flat block into out, which should be 8-byte
+ * aligned to be read in place
+ *
+ * The block holds the start line, headers, meta and body, referring to each
+ * other by offset only, so it stays valid wherever it's copied or mapped.
+ * Returns the bytes written, or 0 if size is too small or the head is too
+ * large for a snapshot.
+ */
+size_t http_parser_snapshot_write(struct http_parser_message *message, void *out, size_t size) {
+  struct http_parser_snapshot *snapshot = out;
+  struct http_parser_snapshot_field *fields;
+  size_t need = http_parser_snapshot_size(message);
+  size_t cursor;
+  size_t bodyLength;
+  const char *body;
+  const char *key;
+  const char *value;
+  char *base = out;
+  int i;
+
+  if (!need || need > size) return 0;
+  memset(snapshot, 0, sizeof(struct http_parser_snapshot));
+  snapshot->magic       = HTTP_PARSER_SNAPSHOT_MAGIC;
+  snapshot->format      = HTTP_PARSER_SNAPSHOT_FORMAT;
+  snapshot->size        = need;
+  snapshot->status      = message->status;
+  snapshot->ready       = message->ready;
+  snapshot->upgrade     = message->upgrade;
+  snapshot->headers     = sizeof(struct http_parser_snapshot);
+  snapshot->headerCount = message->headerCount;
+  snapshot->meta        = snapshot->headers + (message->headerCount * sizeof(struct http_parser_snapshot_field));
+  snapshot->metaCount   = http_parser_meta_count(message);
+
+  fields = (struct http_parser_snapshot_field *)(base + snapshot->headers);
+  cursor = snapshot->meta + (snapshot->metaCount * sizeof(struct http_parser_snapshot_field));
+
+  snapshot->method        = http_parser_snapshot_put_string(base, &cursor, message->method);
+  snapshot->path          = http_parser_snapshot_put_string(base, &cursor, message->path);
+  snapshot->query         = http_parser_snapshot_put_string(base, &cursor, message->query);
+  snapshot->version       = http_parser_snapshot_put_string(base, &cursor, message->version);
+  snapshot->statusMessage = http_parser_snapshot_put_string(base, &cursor, message->statusMessage);
+
+  for(i = 0; i < message->headerCount; i++) {
+    fields[i].atom        = message->headers[i].atom;
+    fields[i].valueLength = strlen(message->headers[i].value);
+    fields[i].key         = http_parser_snapshot_put_string(base, &cursor, message->headers[i].key);
+    fields[i].value       = http_parser_snapshot_put(base, &cursor, message->headers[i].value, fields[i].valueLength);
+  }
+  fields += message->headerCount;
+  for(i = 0; i < (int)snapshot->metaCount; i++) {
+    key                   = http_parser_meta_nth(message, i, &value);
+    fields[i].atom        = 0;
+    fields[i].valueLength = strlen(value);
+    fields[i].key         = http_parser_snapshot_put_string(base, &cursor, key);
+    fields[i].value       = http_parser_snapshot_put(base, &cursor, value, fields[i].valueLength);
+  }
+
+  body                 = http_parser_message_body_map(message, &bodyLength);
+  snapshot->body       = cursor;
+  snapshot->bodyLength = bodyLength;
+  http_parser_snapshot_put(base, &cursor, body ? body : "", body ? bodyLength : 0);
+  memset(base + cursor, 0, need - cursor);
+  return need;
+}
+
+/**
+ * Appends the snapshot of the message to a buffer, written in place
+ *
+ * Snapshots appended back to back stay aligned for reading in place, nothing
+ * is appended when the head is too large for a snapshot
+ */
+void http_parser_snapshot_into(struct buf *result, struct http_parser_message *message) {
+  size_t size = http_parser_snapshot_size(message);
+  if (!size) return;
+  if ((result->cap - result->len) < size) {
+    result->cap  = result->len + size;
+    result->data = realloc(result->data, result->cap);
+  }
+  result->len += http_parser_snapshot_write(message, result->data + result->len, size);
+}
+
+// }}}
+
+// Reading {{{
+
+// Whether a string lies within the snapshot and is terminated there
+static int http_parser_snapshot_valid_string(const char *base, uint64_t size, uint32_t offset) {
+  if (!offset) return 1;
+  if (offset < sizeof(struct http_parser_snapshot) || offset >= size) return 0;
+  return memchr(base + offset, '\0', size - offset) != NULL;
+}
+
+static int http_parser_snapshot_valid_fields(const char *base, uint64_t size, uint32_t offset, uint32_t count) {
+  const struct http_parser_snapshot_field *fields = (const struct http_parser_snapshot_field *)(base + offset);
+  uint32_t i;
+  if (offset % 4 || offset < sizeof(struct http_parser_snapshot)) return 0;
+  if ((uint64_t)offset + ((uint64_t)count * sizeof(struct http_parser_snapshot_field)) > size) return 0;
+  for(i = 0; i < count; i++) {
+    if (!fields[i].key || !fields[i].value) return 0;
+    if (!http_parser_snapshot_valid_string(base, size, fields[i].key)) return 0;
+    if ((uint64_t)fields[i].value + fields[i].valueLength >= size) return 0;
+    if (!http_parser_snapshot_valid_string(base, size, fields[i].value)) return 0;
+    if (base[fields[i].value + fields[i].valueLength]) return 0;
+  }
+  return 1;
+}
+
+/**
+ * Checks a snapshot read from shared memory or a file and returns it to be
+ * read in place, or NULL if it's not a complete and consistent snapshot
+ *
+ * Snapshots are in the writer's byte order, so they can't be exchanged
+ * between architectures that differ in it. Only the head is inspected, the
+ * cost doesn't depend on the body's size.
+ */
+const struct http_parser_snapshot * http_parser_snapshot_open(const void *data, size_t size) {
+  const struct http_parser_snapshot *snapshot = data;
+  const char *base = data;
+
+  if (!data || size < sizeof(struct http_parser_snapshot) || ((uintptr_t)data % 8)) return NULL;
+  if (snapshot->magic != HTTP_PARSER_SNAPSHOT_MAGIC || snapshot->format != HTTP_PARSER_SNAPSHOT_FORMAT) return NULL;
+  if (snapshot->size > size || snapshot->size < sizeof(struct http_parser_snapshot)) return NULL;
+
+  if (!http_parser_snapshot_valid_string(base, snapshot->size, snapshot->method)) return NULL;
+  if (!http_parser_snapshot_valid_string(base, snapshot->size, snapshot->path)) return NULL;
+  if (!http_parser_snapshot_valid_string(base, snapshot->size, snapshot->query)) return NULL;
+  if (!http_parser_snapshot_valid_string(base, snapshot->size, snapshot->version)) return NULL;
+  if (!http_parser_snapshot_valid_string(base, snapshot->size, snapshot->statusMessage)) return NULL;
+  if (!http_parser_snapshot_valid_fields(base, snapshot->size, snapshot->headers, snapshot->headerCount)) return NULL;
+  if (!http_parser_snapshot_valid_fields(base, snapshot->size, snapshot->meta, snapshot->metaCount)) return NULL;
+
+  if (snapshot->body < sizeof(struct http_parser_snapshot) || snapshot->body >= snapshot->size) return NULL;
+  if (snapshot->bodyLength >= snapshot->size - snapshot->body) return NULL;
+  if (base[snapshot->body + snapshot->bodyLength]) return NULL;
+  return snapshot;
+}
+
+/**
+ * Resolves a string offset of the snapshot, NULL for 0
+ */
+const char * http_parser_snapshot_string(const struct http_parser_snapshot *snapshot, uint32_t offset) {
+  return offset ? ((const char *)snapshot) + offset : NULL;
+}
+
+const struct http_parser_snapshot_field * http_parser_snapshot_header_nth(const struct http_parser_snapshot *snapshot, int n) {
+  if (n < 0 || (uint32_t)n >= snapshot->headerCount) return NULL;
+  return ((const struct http_parser_snapshot_field *)(((const char *)snapshot) + snapshot->headers)) + n;
+}
+
+/**
+ * Same as http_parser_header_get_atom, reading the snapshot in place
+ */
+const char * http_parser_snapshot_header_get_atom(const struct http_parser_snapshot *snapshot, int atom) {
+  const struct http_parser_snapshot_field *fields = http_parser_snapshot_header_nth(snapshot, 0);
+  uint32_t i;
+  if (!atom) return NULL;
+  for(i = 0; i < snapshot->headerCount; i++) {
+    if (fields[i].atom == atom) return http_parser_snapshot_string(snapshot, fields[i].value);
+  }
+  return NULL;
+}
+
+/**
+ * Same as http_parser_header_get, reading the snapshot in place
+ */
+const char * http_parser_snapshot_header_get(const struct http_parser_snapshot *snapshot, const char *key) {
+  const struct http_parser_snapshot_field *fields = http_parser_snapshot_header_nth(snapshot, 0);
+  int atom = http_parser_header_atom(key);
+  uint32_t i;
+  if (atom) return http_parser_snapshot_header_get_atom(snapshot, atom);
+  for(i = 0; i < snapshot->headerCount; i++) {
+    if (!fields[i].atom && !strcasecmp(http_parser_snapshot_string(snapshot, fields[i].key), key)) {
+      return http_parser_snapshot_string(snapshot, fields[i].value);
+    }
+  }
+  return NULL;
+}
+
+const char * http_parser_snapshot_meta_get(const struct http_parser_snapshot *snapshot, const char *key) {
+  const struct http_parser_snapshot_field *fields = (const struct http_parser_snapshot_field *)(((const char *)snapshot) + snapshot->meta);
+  uint32_t i;
+  for(i = 0; i < snapshot->metaCount; i++) {
+    if (!strcasecmp(http_parser_snapshot_string(snapshot, fields[i].key), key)) {
+      return http_parser_snapshot_string(snapshot, fields[i].value);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Returns the snapshot's body and its length, terminated for convenience
+ */
+const char * http_parser_snapshot_body(const struct http_parser_snapshot *snapshot, size_t *length) {
+  *length = snapshot->bodyLength;
+  return ((const char *)snapshot) + snapshot->body;
+}
+
+static char * http_parser_snapshot_strdup(const struct http_parser_snapshot *snapshot, uint32_t offset) {
+  return offset ? strdup(http_parser_snapshot_string(snapshot, offset)) : NULL;
+}
+
+// Copies path and query into one block laid out as the parser does, with the
+// query after the path's terminator, so freeing the path frees both
+static char * http_parser_snapshot_path(const struct http_parser_snapshot *snapshot, char **query) {
+  const char *path = http_parser_snapshot_string(snapshot, snapshot->path);
+  const char *tail = http_parser_snapshot_string(snapshot, snapshot->query);
+  size_t pathLength;
+  size_t queryLength;
+  char *result;
+
+  *query = NULL;
+  if (!path) return NULL;
+  pathLength  = strlen(path) + 1;
+  queryLength = tail ? strlen(tail) + 1 : 0;
+  result      = malloc(pathLength + queryLength);
+  memcpy(result, path, pathLength);
+  if (tail) {
+    *query = result + pathLength;
+    memcpy(*query, tail, queryLength);
+  }
+  return result;
+}
+
+/**
+ * Copies the snapshot back into a regular message, for when it has to be
+ * modified or passed to the rest of the API
+ */
+struct http_parser_message * http_parser_snapshot_message(const struct http_parser_snapshot *snapshot) {
+  struct http_parser_message *message = http_parser_request_init();
+  const struct http_parser_snapshot_field *fields;
+  size_t length;
+  const char *body;
+  uint32_t i;
+
+  message->status        = snapshot->status;
+  message->ready         = snapshot->ready;
+  message->upgrade       = snapshot->upgrade;
+  message->method        = http_parser_snapshot_strdup(snapshot, snapshot->method);
+  message->path          = http_parser_snapshot_path(snapshot, &message->query);
+  message->version       = http_parser_snapshot_strdup(snapshot, snapshot->version);
+  message->statusMessage = http_parser_snapshot_strdup(snapshot, snapshot->statusMessage);
+
+  for(i = 0; i < snapshot->headerCount; i++) {
+    fields = http_parser_snapshot_header_nth(snapshot, i);
+    http_parser_header_add(message, http_parser_snapshot_string(snapshot, fields->key), http_parser_snapshot_string(snapshot, fields->value));
+  }
+  fields = (const struct http_parser_snapshot_field *)(((const char *)snapshot) + snapshot->meta);
+  for(i = 0; i < snapshot->metaCount; i++) {
+    http_parser_meta_set(message, http_parser_snapshot_string(snapshot, fields[i].key), http_parser_snapshot_string(snapshot, fields[i].value));
+  }
+
+  body          = http_parser_snapshot_body(snapshot, &length);
+  message->body = calloc(1, sizeof(struct buf));
+  if (length) buf_append(message->body, body, length);
+  return message;
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
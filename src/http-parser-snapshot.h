@@ -0,0 +1,63 @@
+#ifndef _HTTP_PARSER_SNAPSHOT_H_
+#define _HTTP_PARSER_SNAPSHOT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http-parser.h"
+
+// "HPS1" when read on the architecture that wrote it
+#define HTTP_PARSER_SNAPSHOT_MAGIC  0x31535048
+#define HTTP_PARSER_SNAPSHOT_FORMAT 1
+
+// A header or meta entry, strings are offsets from the snapshot's start
+struct http_parser_snapshot_field {
+  uint32_t key;
+  uint32_t value;
+  uint32_t valueLength;
+  int32_t atom;
+};
+
+// Start of a flat snapshot, offsets of 0 stand for NULL
+struct http_parser_snapshot {
+  uint32_t magic;
+  uint32_t format;
+  uint64_t size;
+  int32_t status;
+  int32_t ready;
+  int32_t upgrade;
+  uint32_t method;
+  uint32_t path;
+  uint32_t query;
+  uint32_t version;
+  uint32_t statusMessage;
+  uint32_t headers;
+  uint32_t headerCount;
+  uint32_t meta;
+  uint32_t metaCount;
+  uint64_t body;
+  uint64_t bodyLength;
+};
+
+size_t http_parser_snapshot_size(struct http_parser_message *message);
+size_t http_parser_snapshot_write(struct http_parser_message *message, void *out, size_t size);
+void http_parser_snapshot_into(struct buf *result, struct http_parser_message *message);
+
+const struct http_parser_snapshot * http_parser_snapshot_open(const void *data, size_t size);
+const char * http_parser_snapshot_string(const struct http_parser_snapshot *snapshot, uint32_t offset);
+const struct http_parser_snapshot_field * http_parser_snapshot_header_nth(const struct http_parser_snapshot *snapshot, int n);
+const char * http_parser_snapshot_header_get(const struct http_parser_snapshot *snapshot, const char *key);
+const char * http_parser_snapshot_header_get_atom(const struct http_parser_snapshot *snapshot, int atom);
+const char * http_parser_snapshot_meta_get(const struct http_parser_snapshot *snapshot, const char *key);
+const char * http_parser_snapshot_body(const struct http_parser_snapshot *snapshot, size_t *length);
+struct http_parser_message * http_parser_snapshot_message(const struct http_parser_snapshot *snapshot);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_SNAPSHOT_H_
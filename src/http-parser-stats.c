@@ -0,0 +1,108 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include <time.h>
+
+#include "http-parser.h"
+#include "http-parser-stats.h"
+
+HTTP_PARSER_THREAD_LOCAL struct http_parser_stats _http_parser_stats_thread;
+
+/**
+ * Counters of every message parsed on the calling thread
+ */
+struct http_parser_stats * http_parser_stats_thread() {
+  return &_http_parser_stats_thread;
+}
+
+/**
+ * Zeroes the counters and histogram, keeping the hook
+ */
+void http_parser_stats_reset(struct http_parser_stats *stats) {
+  void (*onState)(struct http_parser_message*, int, int, void*) = stats->onState;
+  void *udata = stats->udata;
+  memset(stats, 0, sizeof(struct http_parser_stats));
+  stats->onState = onState;
+  stats->udata   = udata;
+}
+
+/**
+ * Adds the source's counters and histogram to the target, e.g. to total the
+ * threads of a server
+ */
+void http_parser_stats_merge(struct http_parser_stats *target, const struct http_parser_stats *source) {
+  int i;
+  target->bytes       += source->bytes;
+  target->scanned     += source->scanned;
+  target->moves       += source->moves;
+  target->moved       += source->moved;
+  target->allocs      += source->allocs;
+  target->transitions += source->transitions;
+  target->panics      += source->panics;
+  target->messages    += source->messages;
+  for(i=0; i<HTTP_PARSER_STATS_BUCKETS; i++) target->latency[i] += source->latency[i];
+}
+
+/**
+ * Upper bound in microseconds of the histogram bucket holding the given
+ * percentile (0-100), or 0 if nothing has been recorded
+ */
+uint64_t http_parser_stats_percentile(const struct http_parser_stats *stats, double percentile) {
+  uint64_t total = 0;
+  uint64_t seen  = 0;
+  int i;
+  for(i=0; i<HTTP_PARSER_STATS_BUCKETS; i++) total += stats->latency[i];
+  if (!total) return 0;
+  for(i=0; i<HTTP_PARSER_STATS_BUCKETS; i++) {
+    seen += stats->latency[i];
+    if ((seen * 100.0) >= (total * percentile)) break;
+  }
+  if (i == HTTP_PARSER_STATS_BUCKETS) i--;
+  return (uint64_t)1 << (i + 1);
+}
+
+/**
+ * Monotonic time in nanoseconds
+ */
+long long _http_parser_stats_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((long long)now.tv_sec * 1000000000LL) + now.tv_nsec;
+}
+
+static void http_parser_stats_state(struct http_parser_stats *stats, struct http_parser_message *message, int from, int to) {
+  stats->transitions++;
+  if (stats->onState) stats->onState(message, from, to, stats->udata);
+}
+
+void _http_parser_stats_transition(struct http_parser_message *message, int from, int to) {
+  http_parser_stats_state(&_http_parser_stats_thread, message, from, to);
+  if (message->stats) http_parser_stats_state(message->stats, message, from, to);
+}
+
+/**
+ * Records a completed message, bucketing the time since its first byte by
+ * powers of two microseconds
+ */
+void _http_parser_stats_finish(struct http_parser_message *message) {
+  long long elapsed;
+  int bucket = 0;
+
+  _http_parser_stats_thread.messages++;
+  if (message->stats) message->stats->messages++;
+  if (!message->_started) return;
+
+  elapsed = (_http_parser_stats_now() - message->_started) / 1000;
+  while((elapsed >>= 1) && bucket < (HTTP_PARSER_STATS_BUCKETS - 1)) bucket++;
+  _http_parser_stats_thread.latency[bucket]++;
+  if (message->stats) message->stats->latency[bucket]++;
+  message->_started = 0;
+}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,44 @@
+#ifndef _HTTP_PARSER_STATS_H_
+#define _HTTP_PARSER_STATS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "http-parser.h"
+
+#define HTTP_PARSER_STATS_BUCKETS 32
+
+struct http_parser_stats {
+  uint64_t bytes;
+  uint64_t scanned;
+  uint64_t moves;
+  uint64_t moved;
+  uint64_t allocs;
+  uint64_t transitions;
+  uint64_t panics;
+  uint64_t messages;
+  uint64_t latency[HTTP_PARSER_STATS_BUCKETS];
+  void (*onState)(struct http_parser_message *message, int from, int to, void *udata);
+  void *udata;
+};
+
+struct http_parser_stats * http_parser_stats_thread();
+void http_parser_stats_reset(struct http_parser_stats *stats);
+void http_parser_stats_merge(struct http_parser_stats *target, const struct http_parser_stats *source);
+uint64_t http_parser_stats_percentile(const struct http_parser_stats *stats, double percentile);
+const char * http_parser_state_name(int state);
+
+// Used by the parser when built with HTTP_PARSER_STATS
+extern HTTP_PARSER_THREAD_LOCAL struct http_parser_stats _http_parser_stats_thread;
+long long _http_parser_stats_now();
+void _http_parser_stats_transition(struct http_parser_message *message, int from, int to);
+void _http_parser_stats_finish(struct http_parser_message *message);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_STATS_H_
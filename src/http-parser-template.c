@@ -0,0 +1,238 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-template.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strcasecmp
+#define strcasecmp _stricmp
+#endif
+#endif
+
+// Compiling {{{
+
+/**
+ * Adds a part to the template, data being the static bytes or the header
+ * name in front of a slot's value
+ */
+static void http_parser_template_add(struct http_parser_template *tpl, int slot, const char *data, size_t length) {
+  struct http_parser_template_part *last = tpl->partCount ? &(tpl->parts[tpl->partCount - 1]) : NULL;
+
+  if (slot == HTTP_PARSER_TEMPLATE_STATIC) {
+    if (!length) return;
+    tpl->length += length;
+
+    // Adjoining static bytes are copied as one
+    if (last && last->slot == HTTP_PARSER_TEMPLATE_STATIC) {
+      buf_append(tpl->data, data, length);
+      last->length += length;
+      return;
+    }
+  }
+
+  tpl->parts = realloc(tpl->parts, (tpl->partCount + 1) * sizeof(struct http_parser_template_part));
+  tpl->parts[tpl->partCount].slot   = slot;
+  tpl->parts[tpl->partCount].offset = tpl->data->len;
+  tpl->parts[tpl->partCount].length = length;
+  tpl->partCount++;
+  buf_append(tpl->data, data, length);
+}
+
+static void http_parser_template_add_string(struct http_parser_template *tpl, int slot, const char *str) {
+  http_parser_template_add(tpl, slot, str, strlen(str));
+}
+
+// Index of the named slot, or -1
+static int http_parser_template_slot(const char *const *slots, const char *key) {
+  int i;
+  for(i = 0; slots && slots[i]; i++) {
+    if (!strcasecmp(slots[i], key)) return i;
+  }
+  return -1;
+}
+
+/**
+ * Compiles a response into a template, rendering the parts that don't change
+ * between responses once
+ *
+ * The headers named in slots, a NULL-terminated list, are filled in on every
+ * render, in place of the response's own value or after its other headers.
+ * Date is added as it is by http_parser_sprint_response when the response
+ * doesn't set it, and Content-Length follows the rendered body unless the
+ * response has a Transfer-Encoding. The response's body is not included.
+ */
+struct http_parser_template * http_parser_template_compile(struct http_parser_message *response, const char *const *slots) {
+  struct http_parser_template *tpl = calloc(1, sizeof(struct http_parser_template));
+  const char *transferEncoding     = http_parser_header_get_atom(response, HTTP_PARSER_ATOM_TRANSFER_ENCODING);
+  const char *statusMessage        = response->statusMessage ? response->statusMessage : http_parser_status_message(response->status);
+  struct http_parser_header *header;
+  char *placed;
+  char status[16];
+  int slot;
+  int i;
+
+  tpl->data = calloc(1, sizeof(struct buf));
+  while(slots && slots[tpl->slotCount]) tpl->slotCount++;
+  placed        = calloc(tpl->slotCount + 1, 1);
+  tpl->bodyless = (response->status < 200) || (response->status == 204) || (response->status == 304);
+  tpl->chunked  = transferEncoding && http_parser_list_contains(transferEncoding, "chunked");
+
+  // Status
+  http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_STATIC, "HTTP/");
+  http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_STATIC, response->version ? response->version : "1.1");
+  http_parser_template_add(tpl, HTTP_PARSER_TEMPLATE_STATIC, status, snprintf(status, sizeof(status), " %d ", response->status));
+  if (statusMessage) http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_STATIC, statusMessage);
+  http_parser_template_add(tpl, HTTP_PARSER_TEMPLATE_STATIC, "\r\n", 2);
+
+  // Headers, a slot takes the place of the first header of its name
+  for(i = 0; i < response->headerCount; i++) {
+    header = &(response->headers[i]);
+    if (header->atom == HTTP_PARSER_ATOM_CONTENT_LENGTH && !tpl->bodyless && !transferEncoding) continue;
+    slot = http_parser_template_slot(slots, header->key);
+    if (slot >= 0 && placed[slot]) continue;
+    if (slot >= 0) {
+      placed[slot] = 1;
+      http_parser_template_add_string(tpl, slot, header->key);
+      continue;
+    }
+    http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_STATIC, header->key);
+    http_parser_template_add(tpl, HTTP_PARSER_TEMPLATE_STATIC, ": ", 2);
+    http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_STATIC, header->value);
+    http_parser_template_add(tpl, HTTP_PARSER_TEMPLATE_STATIC, "\r\n", 2);
+  }
+  for(slot = 0; slot < tpl->slotCount; slot++) {
+    if (!placed[slot]) http_parser_template_add_string(tpl, slot, slots[slot]);
+  }
+  free(placed);
+
+  // Framing
+  if (!http_parser_header_get_atom(response, HTTP_PARSER_ATOM_DATE) && http_parser_template_slot(slots, "date") < 0) {
+    http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_DATE, "Date");
+  }
+  if (!tpl->bodyless && !transferEncoding && http_parser_template_slot(slots, "content-length") < 0) {
+    http_parser_template_add_string(tpl, HTTP_PARSER_TEMPLATE_CONTENT_LENGTH, "Content-Length");
+  }
+  http_parser_template_add(tpl, HTTP_PARSER_TEMPLATE_STATIC, "\r\n", 2);
+
+  return tpl;
+}
+
+void http_parser_template_free(struct http_parser_template *tpl) {
+  buf_clear(tpl->data);
+  free(tpl->data);
+  free(tpl->parts);
+  free(tpl);
+}
+
+// }}}
+
+// Rendering {{{
+
+// Grows the buffer once for the whole response
+static void http_parser_template_reserve(struct buf *result, size_t length) {
+  if ((result->cap - result->len) > length) return;
+  result->cap  = result->len + length + 1;
+  result->data = realloc(result->data, result->cap);
+}
+
+static void http_parser_template_header(struct buf *result, const struct http_parser_template *tpl, const struct http_parser_template_part *part, const char *value, size_t length) {
+  buf_append(result, tpl->data->data + part->offset, part->length);
+  buf_append(result, ": ", 2);
+  buf_append(result, value, length);
+  buf_append(result, "\r\n", 2);
+}
+
+struct buf * http_parser_template_render(const struct http_parser_template *tpl, const char *const *values, const char *body, size_t length) {
+  struct buf *result = calloc(1, sizeof(struct buf));
+  http_parser_template_render_into(result, tpl, values, body, length);
+  return result;
+}
+
+/**
+ * Appends a response rendered from the template, with the values of its
+ * named slots in order and the body
+ *
+ * A NULL value leaves its header out. The body is sent as a single chunk
+ * when the template's Transfer-Encoding is chunked, and left out for
+ * statuses that have none.
+ */
+void http_parser_template_render_into(struct buf *result, const struct http_parser_template *tpl, const char *const *values, const char *body, size_t length) {
+  const struct http_parser_template_part *part;
+  const char *date = NULL;
+  char contentLength[24];
+  char chunkline[24];
+  size_t contentLengthLength = 0;
+  size_t chunklineLength = 0;
+  size_t need = tpl->length;
+  int i;
+
+  if (tpl->bodyless) length = 0;
+
+  // Everything is measured first, so the buffer grows at most once
+  for(i = 0; i < tpl->partCount; i++) {
+    part = &(tpl->parts[i]);
+    switch(part->slot) {
+      case HTTP_PARSER_TEMPLATE_STATIC:
+        break;
+      case HTTP_PARSER_TEMPLATE_DATE:
+        date  = http_parser_date();
+        need += part->length + strlen(date) + 4;
+        break;
+      case HTTP_PARSER_TEMPLATE_CONTENT_LENGTH:
+        contentLengthLength = snprintf(contentLength, sizeof(contentLength), "%lu", (unsigned long)length);
+        need               += part->length + contentLengthLength + 4;
+        break;
+      default:
+        if (values[part->slot]) need += part->length + strlen(values[part->slot]) + 4;
+        break;
+    }
+  }
+  if (tpl->chunked) {
+    if (length) chunklineLength = snprintf(chunkline, sizeof(chunkline), "%lx\r\n", (unsigned long)length);
+    need += chunklineLength + (length ? 2 : 0) + 5;
+  }
+  need += length;
+  http_parser_template_reserve(result, need);
+
+  for(i = 0; i < tpl->partCount; i++) {
+    part = &(tpl->parts[i]);
+    switch(part->slot) {
+      case HTTP_PARSER_TEMPLATE_STATIC:
+        buf_append(result, tpl->data->data + part->offset, part->length);
+        break;
+      case HTTP_PARSER_TEMPLATE_DATE:
+        http_parser_template_header(result, tpl, part, date, strlen(date));
+        break;
+      case HTTP_PARSER_TEMPLATE_CONTENT_LENGTH:
+        http_parser_template_header(result, tpl, part, contentLength, contentLengthLength);
+        break;
+      default:
+        if (values[part->slot]) http_parser_template_header(result, tpl, part, values[part->slot], strlen(values[part->slot]));
+        break;
+    }
+  }
+
+  if (chunklineLength) buf_append(result, chunkline, chunklineLength);
+  if (length) buf_append(result, body, length);
+  if (tpl->chunked) {
+    if (length) buf_append(result, "\r\n", 2);
+    buf_append(result, "0\r\n\r\n", 5);
+  }
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
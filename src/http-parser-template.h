@@ -0,0 +1,42 @@
+#ifndef _HTTP_PARSER_TEMPLATE_H_
+#define _HTTP_PARSER_TEMPLATE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "http-parser.h"
+
+// Parts of a template, named slots are numbered from 0 in the order given
+#define HTTP_PARSER_TEMPLATE_STATIC         -1
+#define HTTP_PARSER_TEMPLATE_DATE           -2
+#define HTTP_PARSER_TEMPLATE_CONTENT_LENGTH -3
+
+struct http_parser_template_part {
+  int slot;
+  size_t offset;
+  size_t length;
+};
+
+struct http_parser_template {
+  int slotCount;
+  int partCount;
+  int bodyless;
+  int chunked;
+  size_t length;
+  struct http_parser_template_part *parts;
+  struct buf *data;
+};
+
+struct http_parser_template * http_parser_template_compile(struct http_parser_message *response, const char *const *slots);
+struct buf * http_parser_template_render(const struct http_parser_template *tpl, const char *const *values, const char *body, size_t length);
+void http_parser_template_render_into(struct buf *result, const struct http_parser_template *tpl, const char *const *values, const char *body, size_t length);
+void http_parser_template_free(struct http_parser_template *tpl);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_TEMPLATE_H_
@@ -0,0 +1,541 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(HTTP_PARSER_URING) && defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-uring.h"
+
+#if defined(HTTP_PARSER_URING) && defined(__linux__)
+
+// Operation kept in the low bits of a submission's user_data
+#define HTTP_PARSER_URING_ACCEPT 1
+#define HTTP_PARSER_URING_RECV   2
+#define HTTP_PARSER_URING_SEND   3
+#define HTTP_PARSER_URING_OPMASK 3
+
+#define HTTP_PARSER_URING_BGID 0
+
+struct http_parser_uring_ring {
+  int fd;
+  unsigned int *sqHead;
+  unsigned int *sqTail;
+  unsigned int *sqMask;
+  unsigned int *sqArray;
+  unsigned int sqEntries;
+  unsigned int sqPending;
+  struct io_uring_sqe *sqes;
+  unsigned int *cqHead;
+  unsigned int *cqTail;
+  unsigned int *cqMask;
+  struct io_uring_cqe *cqes;
+  void *sqMap;
+  size_t sqMapSize;
+  void *cqMap;
+  size_t cqMapSize;
+  size_t sqesSize;
+  struct io_uring_buf_ring *bufRing;
+  size_t bufRingSize;
+  unsigned short bufTail;
+  char *buffers;
+  size_t buffersSize;
+  int listenFd;
+};
+
+// Ring {{{
+
+static int http_parser_uring_enter(struct http_parser_uring_ring *ring, unsigned int submit, unsigned int wait) {
+  int res;
+  do {
+    res = syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  } while(res < 0 && errno == EINTR);
+  return res;
+}
+
+/**
+ * Next free submission entry, flushing the queue to the kernel when full
+ */
+static struct io_uring_sqe * http_parser_uring_sqe(struct http_parser_uring_ring *ring) {
+  struct io_uring_sqe *sqe;
+  unsigned int tail = *(ring->sqTail);
+  unsigned int index;
+
+  if ((tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)) >= ring->sqEntries) {
+    if (http_parser_uring_enter(ring, ring->sqPending, 0) < 0) return NULL;
+    ring->sqPending = 0;
+    if ((tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE)) >= ring->sqEntries) return NULL;
+  }
+
+  index = tail & *(ring->sqMask);
+  sqe   = &(ring->sqes[index]);
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sqArray[index] = index;
+  return sqe;
+}
+
+static void http_parser_uring_push(struct http_parser_uring_ring *ring) {
+  __atomic_store_n(ring->sqTail, *(ring->sqTail) + 1, __ATOMIC_RELEASE);
+  ring->sqPending++;
+}
+
+/**
+ * Hands a provided buffer back to the kernel
+ */
+static void http_parser_uring_recycle(struct http_parser_uring *uring, unsigned short bid) {
+  struct http_parser_uring_ring *ring = uring->_ring;
+  struct io_uring_buf *buf = &(ring->bufRing->bufs[ring->bufTail & (uring->bufferCount - 1)]);
+  buf->addr = (uint64_t)(uintptr_t)(ring->buffers + ((size_t)bid * uring->bufferSize));
+  buf->len  = uring->bufferSize;
+  buf->bid  = bid;
+  ring->bufTail++;
+  __atomic_store_n(&(ring->bufRing->tail), ring->bufTail, __ATOMIC_RELEASE);
+}
+
+static void http_parser_uring_unmap(struct http_parser_uring_ring *ring) {
+  if (ring->buffers) munmap(ring->buffers, ring->buffersSize);
+  if (ring->bufRing) munmap(ring->bufRing, ring->bufRingSize);
+  if (ring->sqes) munmap(ring->sqes, ring->sqesSize);
+  if (ring->cqMap && ring->cqMap != ring->sqMap) munmap(ring->cqMap, ring->cqMapSize);
+  if (ring->sqMap) munmap(ring->sqMap, ring->sqMapSize);
+  if (ring->fd >= 0) close(ring->fd);
+}
+
+static int http_parser_uring_setup(struct http_parser_uring *uring, unsigned int entries) {
+  struct http_parser_uring_ring *ring = uring->_ring;
+  struct io_uring_params params;
+  struct io_uring_buf_reg reg;
+  unsigned int i;
+
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->fd < 0) return -1;
+
+  // Submission and completion rings, a single mapping on recent kernels
+  ring->sqMapSize = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+  ring->cqMapSize = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cqMapSize > ring->sqMapSize) ring->sqMapSize = ring->cqMapSize;
+    ring->cqMapSize = ring->sqMapSize;
+  }
+  ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sqMap == MAP_FAILED) { ring->sqMap = NULL; return -1; }
+  ring->cqMap = ring->sqMap;
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqMap == MAP_FAILED) { ring->cqMap = NULL; return -1; }
+  }
+  ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes     = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) { ring->sqes = NULL; return -1; }
+
+  ring->sqHead    = (unsigned int *)((char *)ring->sqMap + params.sq_off.head);
+  ring->sqTail    = (unsigned int *)((char *)ring->sqMap + params.sq_off.tail);
+  ring->sqMask    = (unsigned int *)((char *)ring->sqMap + params.sq_off.ring_mask);
+  ring->sqArray   = (unsigned int *)((char *)ring->sqMap + params.sq_off.array);
+  ring->sqEntries = params.sq_entries;
+  ring->cqHead    = (unsigned int *)((char *)ring->cqMap + params.cq_off.head);
+  ring->cqTail    = (unsigned int *)((char *)ring->cqMap + params.cq_off.tail);
+  ring->cqMask    = (unsigned int *)((char *)ring->cqMap + params.cq_off.ring_mask);
+  ring->cqes      = (struct io_uring_cqe *)((char *)ring->cqMap + params.cq_off.cqes);
+
+  // Provided buffer ring the receives pick their buffers from
+  ring->bufRingSize = uring->bufferCount * sizeof(struct io_uring_buf);
+  ring->bufRing     = mmap(NULL, ring->bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->bufRing == MAP_FAILED) { ring->bufRing = NULL; return -1; }
+  ring->buffersSize = (size_t)uring->bufferCount * uring->bufferSize;
+  ring->buffers     = mmap(NULL, ring->buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buffers == MAP_FAILED) { ring->buffers = NULL; return -1; }
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr    = (uint64_t)(uintptr_t)ring->bufRing;
+  reg.ring_entries = uring->bufferCount;
+  reg.bgid         = HTTP_PARSER_URING_BGID;
+  if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -1;
+  for(i=0; i<uring->bufferCount; i++) http_parser_uring_recycle(uring, i);
+
+  return 0;
+}
+
+// }}}
+
+// Connections {{{
+
+static int http_parser_uring_recv(struct http_parser_uring_conn *conn) {
+  struct io_uring_sqe *sqe = http_parser_uring_sqe(conn->uring->_ring);
+  if (!sqe) return -1;
+  sqe->opcode    = IORING_OP_RECV;
+  sqe->fd        = conn->fd;
+  sqe->ioprio    = IORING_RECV_MULTISHOT;
+  sqe->flags     = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = HTTP_PARSER_URING_BGID;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | HTTP_PARSER_URING_RECV;
+  http_parser_uring_push(conn->uring->_ring);
+  conn->_receiving = 1;
+  return 0;
+}
+
+static int http_parser_uring_send(struct http_parser_uring_conn *conn) {
+  struct io_uring_sqe *sqe = http_parser_uring_sqe(conn->uring->_ring);
+  if (!sqe) return -1;
+  sqe->opcode    = IORING_OP_SEND;
+  sqe->fd        = conn->fd;
+  sqe->addr      = (uint64_t)(uintptr_t)(conn->_out->data + conn->_outOffset);
+  sqe->len       = conn->_out->len - conn->_outOffset;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | HTTP_PARSER_URING_SEND;
+  http_parser_uring_push(conn->uring->_ring);
+  conn->_sending = 1;
+  return 0;
+}
+
+/**
+ * Gives the connection a pair, idle until a request arrives
+ */
+static void http_parser_uring_pair(struct http_parser_uring_conn *conn) {
+  conn->pair            = http_parser_pair_init(conn);
+  conn->pair->onRequest = conn->uring->onRequest;
+  http_parser_pair_release(conn->pair);
+}
+
+/**
+ * Frees a closing connection once nothing refers to it anymore: no operation
+ * in flight and no request waiting for its response
+ */
+static void http_parser_uring_release(struct http_parser_uring_conn *conn) {
+  if (!conn->_closing || conn->_receiving || conn->_sending) return;
+  if (conn->pair && conn->pair->request && conn->pair->request->ready && !conn->pair->onRequest) return;
+  if (conn->_prev) conn->_prev->_next = conn->_next; else conn->uring->_conns = conn->_next;
+  if (conn->_next) conn->_next->_prev = conn->_prev;
+  conn->uring->connections--;
+  close(conn->fd);
+  if (conn->pair) http_parser_pair_free(conn->pair);
+  buf_clear(conn->_out);
+  free(conn->_out);
+  buf_clear(conn->_queued);
+  free(conn->_queued);
+  free(conn);
+}
+
+/**
+ * Whether a Connection header of the message lists the option
+ */
+static int http_parser_uring_connection_has(struct http_parser_message *message, const char *option) {
+  const struct http_parser_header *connection = NULL;
+  while((connection = http_parser_header_next_atom(message, HTTP_PARSER_ATOM_CONNECTION, connection))) {
+    if (http_parser_list_contains(connection->value, option)) return 1;
+  }
+  return 0;
+}
+
+static int http_parser_uring_keeps_alive(struct http_parser_message *request, struct http_parser_message *response) {
+  if (http_parser_uring_connection_has(request, "close")) return 0;
+  if (http_parser_uring_connection_has(response, "close")) return 0;
+  if (request->version && !strcmp(request->version, "1.0")) {
+    return http_parser_uring_connection_has(request, "keep-alive");
+  }
+  return 1;
+}
+
+static void http_parser_uring_received(struct http_parser_uring_conn *conn, struct io_uring_cqe *cqe) {
+  struct http_parser_uring *uring = conn->uring;
+  unsigned short bid;
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    // The parser copies what it keeps, the buffer goes straight back
+    // Nothing is read after a response that closes the connection
+    if (cqe->res > 0 && conn->pair && !conn->_closing) {
+      http_parser_pair_request_data(conn->pair, &((struct buf){
+        .data = uring->_ring->buffers + ((size_t)bid * uring->bufferSize),
+        .len  = cqe->res,
+        .cap  = cqe->res,
+      }));
+      if (conn->pair && conn->pair->request && http_parser_message_head_complete(conn->pair->request) < 0) http_parser_uring_close(conn);
+    }
+    http_parser_uring_recycle(uring, bid);
+  }
+
+  if (cqe->flags & IORING_CQE_F_MORE) return;
+  conn->_receiving = 0;
+
+  // Multishot ends on errors, or when the buffers ran out
+  if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS)) conn->_closing = 1;
+  if (!conn->_closing && http_parser_uring_recv(conn)) conn->_closing = 1;
+  http_parser_uring_release(conn);
+}
+
+static void http_parser_uring_sent(struct http_parser_uring_conn *conn, struct io_uring_cqe *cqe) {
+  struct buf *swap;
+  conn->_sending = 0;
+
+  if (cqe->res < 0) {
+    http_parser_uring_close(conn);
+    return;
+  }
+
+  // Continue a partial send, or move on to the responses queued meanwhile
+  conn->_outOffset += cqe->res;
+  if (conn->_outOffset < conn->_out->len) {
+    if (http_parser_uring_send(conn)) http_parser_uring_close(conn);
+    return;
+  }
+  conn->_out->len   = 0;
+  conn->_outOffset  = 0;
+  if (conn->_queued->len) {
+    swap           = conn->_out;
+    conn->_out     = conn->_queued;
+    conn->_queued  = swap;
+    if (http_parser_uring_send(conn)) http_parser_uring_close(conn);
+    return;
+  }
+
+  // Don't hold on to send buffers while the connection idles
+  buf_clear(conn->_out);
+  buf_clear(conn->_queued);
+
+  if (conn->_closeAfter) {
+    http_parser_uring_close(conn);
+    return;
+  }
+  http_parser_uring_release(conn);
+}
+
+// }}}
+
+/**
+ * Sets up a ring with the given number of entries and a ring of bufferCount
+ * provided buffers of bufferSize bytes each to receive into
+ *
+ * bufferCount must be a power of two, returns NULL with errno set on failure
+ */
+struct http_parser_uring * http_parser_uring_init(unsigned int entries, unsigned int bufferCount, unsigned int bufferSize) {
+  struct http_parser_uring *uring;
+  int err;
+
+  if (!bufferCount || (bufferCount & (bufferCount - 1)) || bufferCount > 32768 || !bufferSize) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  uring                = calloc(1, sizeof(struct http_parser_uring));
+  uring->_ring         = calloc(1, sizeof(struct http_parser_uring_ring));
+  uring->_ring->fd     = -1;
+  uring->_ring->listenFd = -1;
+  uring->bufferCount   = bufferCount;
+  uring->bufferSize    = bufferSize;
+  if (http_parser_uring_setup(uring, entries)) {
+    err = errno;
+    http_parser_uring_unmap(uring->_ring);
+    free(uring->_ring);
+    free(uring);
+    errno = err;
+    return NULL;
+  }
+  return uring;
+}
+
+/**
+ * Accepts connections on a listening socket, adding each to the ring
+ */
+int http_parser_uring_listen(struct http_parser_uring *uring, int fd) {
+  struct io_uring_sqe *sqe = http_parser_uring_sqe(uring->_ring);
+  if (!sqe) return -1;
+  sqe->opcode    = IORING_OP_ACCEPT;
+  sqe->fd        = fd;
+  sqe->ioprio    = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = HTTP_PARSER_URING_ACCEPT;
+  http_parser_uring_push(uring->_ring);
+  uring->_ring->listenFd = fd;
+  return 0;
+}
+
+/**
+ * Starts receiving requests on a connected socket, which the ring closes
+ * once the connection ends
+ */
+struct http_parser_uring_conn * http_parser_uring_add(struct http_parser_uring *uring, int fd, void *udata) {
+  struct http_parser_uring_conn *conn = calloc(1, sizeof(struct http_parser_uring_conn));
+  conn->fd      = fd;
+  conn->uring   = uring;
+  conn->udata   = udata;
+  conn->_out    = calloc(1, sizeof(struct buf));
+  conn->_queued = calloc(1, sizeof(struct buf));
+  conn->_next   = uring->_conns;
+  if (conn->_next) conn->_next->_prev = conn;
+  uring->_conns = conn;
+  uring->connections++;
+  http_parser_uring_pair(conn);
+  if (http_parser_uring_recv(conn)) {
+    conn->_closing = 1;
+    http_parser_uring_release(conn);
+    return NULL;
+  }
+  return conn;
+}
+
+/**
+ * Sends the response of the connection's current pair and starts the next
+ * exchange, passing it any pipelined data
+ */
+int http_parser_uring_respond(struct http_parser_uring_conn *conn) {
+  struct http_parser_pair *done = conn->pair;
+  struct buf *leftover;
+
+  if (!done || !done->request || !done->request->ready) return -1;
+  if (conn->_closing) {
+    conn->pair = NULL;
+    http_parser_pair_free(done);
+    http_parser_uring_release(conn);
+    return -1;
+  }
+
+  http_parser_sprint_pair_response_into(conn->_sending ? conn->_queued : conn->_out, done);
+  if (!conn->_sending && http_parser_uring_send(conn)) {
+    http_parser_uring_close(conn);
+    return -1;
+  }
+
+  if (!http_parser_uring_keeps_alive(done->request, done->response)) {
+    conn->_closeAfter = 1;
+    conn->pair        = NULL;
+    http_parser_pair_free(done);
+    return 0;
+  }
+
+  // Keep the pair idle for the next request, starting it with any pipelined
+  // data
+  leftover                = done->request->leftover;
+  done->request->leftover = NULL;
+  http_parser_pair_release(done);
+  done->onRequest = conn->uring->onRequest;
+  if (leftover) {
+    if (leftover->len) http_parser_pair_request_data(done, leftover);
+    buf_clear(leftover);
+    free(leftover);
+  }
+  return 0;
+}
+
+/**
+ * Shuts the connection down, it's freed once its operations completed
+ */
+void http_parser_uring_close(struct http_parser_uring_conn *conn) {
+  if (!conn->_closing) {
+    conn->_closing = 1;
+    shutdown(conn->fd, SHUT_RDWR);
+  }
+  http_parser_uring_release(conn);
+}
+
+/**
+ * Submits queued operations, waits for at least `wait` completions and
+ * handles every completion available
+ *
+ * Returns the number of completions handled, or -1 with errno set
+ */
+int http_parser_uring_run(struct http_parser_uring *uring, unsigned int wait) {
+  struct http_parser_uring_ring *ring = uring->_ring;
+  struct http_parser_uring_conn *conn;
+  struct io_uring_cqe *cqe;
+  unsigned int head;
+  int handled = 0;
+
+  if (http_parser_uring_enter(ring, ring->sqPending, wait) < 0) return -1;
+  ring->sqPending = 0;
+
+  head = *(ring->cqHead);
+  while(head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+    cqe  = &(ring->cqes[head & *(ring->cqMask)]);
+    conn = (struct http_parser_uring_conn *)(uintptr_t)(cqe->user_data & ~(uint64_t)HTTP_PARSER_URING_OPMASK);
+    switch(cqe->user_data & HTTP_PARSER_URING_OPMASK) {
+      case HTTP_PARSER_URING_ACCEPT:
+        if (cqe->res >= 0) http_parser_uring_add(uring, cqe->res, uring->udata);
+        if (!(cqe->flags & IORING_CQE_F_MORE) && ring->listenFd >= 0) http_parser_uring_listen(uring, ring->listenFd);
+        break;
+      case HTTP_PARSER_URING_RECV:
+        http_parser_uring_received(conn, cqe);
+        break;
+      case HTTP_PARSER_URING_SEND:
+        http_parser_uring_sent(conn, cqe);
+        break;
+    }
+    head++;
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    handled++;
+  }
+
+  return handled;
+}
+
+/**
+ * Closes the ring and every connection on it
+ */
+void http_parser_uring_free(struct http_parser_uring *uring) {
+  struct http_parser_uring_conn *conn;
+  http_parser_uring_unmap(uring->_ring);
+  while((conn = uring->_conns)) {
+    conn->_closing   = 1;
+    conn->_receiving = 0;
+    conn->_sending   = 0;
+    if (conn->pair) http_parser_pair_free(conn->pair);
+    conn->pair = NULL;
+    http_parser_uring_release(conn);
+  }
+  free(uring->_ring);
+  free(uring);
+}
+
+#else
+
+struct http_parser_uring * http_parser_uring_init(unsigned int entries, unsigned int bufferCount, unsigned int bufferSize) {
+  errno = ENOSYS;
+  return NULL;
+}
+
+int http_parser_uring_listen(struct http_parser_uring *uring, int fd) {
+  return -1;
+}
+
+struct http_parser_uring_conn * http_parser_uring_add(struct http_parser_uring *uring, int fd, void *udata) {
+  return NULL;
+}
+
+int http_parser_uring_respond(struct http_parser_uring_conn *conn) {
+  return -1;
+}
+
+void http_parser_uring_close(struct http_parser_uring_conn *conn) {
+}
+
+int http_parser_uring_run(struct http_parser_uring *uring, unsigned int wait) {
+  errno = ENOSYS;
+  return -1;
+}
+
+void http_parser_uring_free(struct http_parser_uring *uring) {
+}
+
+#endif
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,54 @@
+#ifndef _HTTP_PARSER_URING_H_
+#define _HTTP_PARSER_URING_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#include "http-parser.h"
+
+// io_uring backend, only functional on Linux when built with HTTP_PARSER_URING
+
+struct http_parser_uring_ring;
+
+struct http_parser_uring_conn {
+  int fd;
+  struct http_parser_pair *pair;
+  struct http_parser_uring *uring;
+  void *udata;
+  struct buf *_out;
+  struct buf *_queued;
+  size_t _outOffset;
+  int _receiving;
+  int _sending;
+  int _closing;
+  int _closeAfter;
+  struct http_parser_uring_conn *_prev;
+  struct http_parser_uring_conn *_next;
+};
+
+struct http_parser_uring {
+  void (*onRequest)(struct http_parser_event*);
+  void *udata;
+  unsigned int bufferCount;
+  unsigned int bufferSize;
+  int connections;
+  struct http_parser_uring_conn *_conns;
+  struct http_parser_uring_ring *_ring;
+};
+
+struct http_parser_uring * http_parser_uring_init(unsigned int entries, unsigned int bufferCount, unsigned int bufferSize);
+int http_parser_uring_listen(struct http_parser_uring *uring, int fd);
+struct http_parser_uring_conn * http_parser_uring_add(struct http_parser_uring *uring, int fd, void *udata);
+int http_parser_uring_respond(struct http_parser_uring_conn *conn);
+void http_parser_uring_close(struct http_parser_uring_conn *conn);
+int http_parser_uring_run(struct http_parser_uring *uring, unsigned int wait);
+void http_parser_uring_free(struct http_parser_uring *uring);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_URING_H_
@@ -0,0 +1,437 @@
+// vim:fdm=marker:fdl=0
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "tidwall/buf.h"
+
+#include "http-parser.h"
+#include "http-parser-websocket.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef strcasecmp
+#define strcasecmp _stricmp
+#endif
+#endif
+
+static const int _HTTP_PARSER_WEBSOCKET_HEADER  = 0;
+static const int _HTTP_PARSER_WEBSOCKET_PAYLOAD = 1;
+static const int _HTTP_PARSER_WEBSOCKET_PANIC   = 666;
+
+// Handshake {{{
+
+static uint32_t http_parser_sha1_rol(uint32_t value, int bits) {
+  return (value << bits) | (value >> (32 - bits));
+}
+
+/**
+ * Minimal SHA-1, only used for the Sec-WebSocket-Accept digest
+ */
+static void http_parser_sha1(const unsigned char *data, size_t len, unsigned char *digest) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  uint32_t w[80];
+  uint32_t a, b, c, d, e, f, k, t;
+  unsigned char block[64];
+  uint64_t bits = (uint64_t)len * 8;
+  size_t offset = 0;
+  size_t i, n;
+  int last = 0;
+
+  while(!last) {
+
+    // Fill the block, padding the final one(s)
+    if ((offset + 64) <= len) {
+      memcpy(block, data + offset, 64);
+    } else {
+      memset(block, 0, 64);
+      n = 0;
+      if (offset <= len) {
+        n = len - offset;
+        memcpy(block, data + offset, n);
+        block[n] = 0x80;
+      }
+      if (offset > len || n < 56) {
+        for(i=0; i<8; i++) block[63 - i] = (bits >> (i * 8)) & 0xff;
+        last = 1;
+      }
+    }
+    offset += 64;
+
+    for(i=0; i<16; i++) {
+      w[i] = ((uint32_t)block[i*4] << 24) | ((uint32_t)block[i*4+1] << 16) | ((uint32_t)block[i*4+2] << 8) | block[i*4+3];
+    }
+    for(i=16; i<80; i++) {
+      w[i] = http_parser_sha1_rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+    for(i=0; i<80; i++) {
+      if (i < 20) {
+        f = (b & c) | ((~b) & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      t = http_parser_sha1_rol(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = http_parser_sha1_rol(b, 30);
+      b = a;
+      a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  }
+
+  for(i=0; i<20; i++) {
+    digest[i] = (h[i / 4] >> (24 - ((i % 4) * 8))) & 0xff;
+  }
+}
+
+/**
+ * Computes the Sec-WebSocket-Accept value for a Sec-WebSocket-Key
+ *
+ * Writes 28 characters plus a null byte into out, returns 0 on success
+ */
+int http_parser_websocket_accept(const char *key, char *out) {
+  static const char *guid     = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned char digest[21] = {0};
+  unsigned char input[128];
+  size_t keylen = strlen(key);
+  int i;
+
+  if (!keylen || keylen > 64) return -1;
+  memcpy(input, key, keylen);
+  memcpy(input + keylen, guid, 36);
+  http_parser_sha1(input, keylen + 36, digest);
+
+  // Base64, 20 bytes encode to 27 characters plus one padding
+  for(i=0; i<7; i++) {
+    out[i*4+0] = alphabet[digest[i*3] >> 2];
+    out[i*4+1] = alphabet[((digest[i*3] & 0x03) << 4) | (digest[i*3+1] >> 4)];
+    out[i*4+2] = alphabet[((digest[i*3+1] & 0x0f) << 2) | (digest[i*3+2] >> 6)];
+    out[i*4+3] = alphabet[digest[i*3+2] & 0x3f];
+  }
+  out[27] = '=';
+  out[28] = '\0';
+  return 0;
+}
+
+/**
+ * Validates a WebSocket upgrade request and prepares the 101 response
+ *
+ * Returns 0 if the response has been prepared, -1 if the request is not a
+ * valid WebSocket upgrade
+ */
+int http_parser_websocket_handshake(struct http_parser_message *request, struct http_parser_message *response) {
+  const char *aUpgrade = http_parser_header_get(request, "upgrade");
+  const char *aVersion = http_parser_header_get(request, "sec-websocket-version");
+  const char *aKey     = http_parser_header_get(request, "sec-websocket-key");
+  char accept[29];
+
+  if (!request->upgrade || !request->method || strcasecmp(request->method, "GET")) return -1;
+  if (!aUpgrade || strcasecmp(aUpgrade, "websocket")) return -1;
+  if (!aVersion || strcmp(aVersion, "13")) return -1;
+  if (!aKey || http_parser_websocket_accept(aKey, accept)) return -1;
+
+  response->status = 101;
+  http_parser_header_set(response, "Upgrade", "websocket");
+  http_parser_header_set(response, "Connection", "Upgrade");
+  http_parser_header_set(response, "Sec-WebSocket-Accept", accept);
+  return 0;
+}
+
+// }}}
+
+// Masking {{{
+
+/**
+ * XORs data with the 4-byte mask in-place, starting at the given offset into
+ * the payload
+ *
+ * Works through 32 bytes at a time with AVX2, 16 with SSE2 or NEON, and 8
+ * using plain 64-bit words otherwise
+ */
+void http_parser_websocket_mask(char *data, size_t len, const unsigned char *mask, size_t offset) {
+  unsigned char key[8];
+  uint64_t key64;
+  uint64_t word;
+  size_t i = 0;
+
+  // Rotate the mask so it lines up with the start of data
+  for(i=0; i<8; i++) key[i] = mask[(offset + i) & 3];
+  memcpy(&key64, key, 8);
+  i = 0;
+
+#if defined(__AVX2__)
+  uint32_t key32;
+  memcpy(&key32, key, 4);
+  __m256i key256 = _mm256_set1_epi32((int)key32);
+  for(; (i + 32) <= len; i += 32) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+    _mm256_storeu_si256((__m256i *)(data + i), _mm256_xor_si256(chunk, key256));
+  }
+#elif defined(__SSE2__)
+  uint32_t key32;
+  memcpy(&key32, key, 4);
+  __m128i key128 = _mm_set1_epi32((int)key32);
+  for(; (i + 16) <= len; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+    _mm_storeu_si128((__m128i *)(data + i), _mm_xor_si128(chunk, key128));
+  }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+  uint8x16_t key128 = vcombine_u8(vld1_u8(key), vld1_u8(key));
+  for(; (i + 16) <= len; i += 16) {
+    vst1q_u8((uint8_t *)(data + i), veorq_u8(vld1q_u8((const uint8_t *)(data + i)), key128));
+  }
+#endif
+
+  for(; (i + 8) <= len; i += 8) {
+    memcpy(&word, data + i, 8);
+    word ^= key64;
+    memcpy(data + i, &word, 8);
+  }
+
+  for(; i < len; i++) {
+    data[i] ^= key[i & 3];
+  }
+}
+
+// }}}
+
+// Frame parser {{{
+
+struct http_parser_websocket * http_parser_websocket_init(void *udata) {
+  struct http_parser_websocket *websocket = calloc(1, sizeof(struct http_parser_websocket));
+  websocket->udata    = udata;
+  websocket->_control = calloc(1, sizeof(struct buf));
+  return websocket;
+}
+
+void http_parser_websocket_free(struct http_parser_websocket *websocket) {
+  buf_clear(websocket->_control);
+  free(websocket->_control);
+  free(websocket);
+}
+
+static void http_parser_websocket_emit(struct http_parser_websocket *websocket, void (*cb)(struct http_parser_event*), char *data, size_t len) {
+  struct buf chunk = {
+    .data = data,
+    .len  = len,
+    .cap  = len,
+  };
+  struct http_parser_event ev = {
+    .chunk = &chunk,
+    .udata = websocket,
+  };
+  if (cb) cb(&ev);
+}
+
+/**
+ * Returns the header length implied by the header bytes read so far
+ */
+static int http_parser_websocket_header_length(struct http_parser_websocket *websocket) {
+  int length = 2;
+  if (websocket->_headerLength < 2) return length;
+  if ((websocket->_header[1] & 0x7f) == 126) length += 2;
+  if ((websocket->_header[1] & 0x7f) == 127) length += 8;
+  if (websocket->_header[1] & 0x80) length += 4;
+  return length;
+}
+
+/**
+ * Validates a complete frame header and prepares for it's payload
+ */
+static int http_parser_websocket_frame_start(struct http_parser_websocket *websocket) {
+  unsigned char *header = websocket->_header;
+  int opcode = header[0] & 0x0f;
+  int offset = 2;
+  int i;
+
+  websocket->_fin         = !!(header[0] & 0x80);
+  websocket->_frameOpcode = opcode;
+  websocket->_masked      = !!(header[1] & 0x80);
+  websocket->_remaining   = header[1] & 0x7f;
+  websocket->_maskOffset  = 0;
+
+  if (websocket->_remaining == 126) {
+    websocket->_remaining = ((uint64_t)header[2] << 8) | header[3];
+    offset += 2;
+  } else if (websocket->_remaining == 127) {
+    websocket->_remaining = 0;
+    for(i=0; i<8; i++) websocket->_remaining = (websocket->_remaining << 8) | header[2 + i];
+    offset += 8;
+    if (websocket->_remaining >> 63) return -1;
+  }
+  if (websocket->_masked) memcpy(websocket->_mask, header + offset, 4);
+
+  // No extensions are negotiated, so reserved bits must be clear
+  if (header[0] & 0x70) return -1;
+  if (websocket->requireMask && !websocket->_masked) return -1;
+
+  // Control frames may not be fragmented and carry at most 125 bytes
+  if (opcode & 0x8) {
+    if (opcode > HTTP_PARSER_WEBSOCKET_PONG) return -1;
+    if (!websocket->_fin || websocket->_remaining > 125) return -1;
+    websocket->_control->len = 0;
+    return 0;
+  }
+
+  // Continuations only within a message, new messages only outside of one
+  if (opcode > HTTP_PARSER_WEBSOCKET_BINARY) return -1;
+  if ((opcode == HTTP_PARSER_WEBSOCKET_CONTINUATION) != (websocket->opcode != 0)) return -1;
+  if (opcode) websocket->opcode = opcode;
+  return 0;
+}
+
+/**
+ * Completes the current frame, passing on control frames as a whole
+ */
+static void http_parser_websocket_frame_end(struct http_parser_websocket *websocket) {
+  websocket->_state        = _HTTP_PARSER_WEBSOCKET_HEADER;
+  websocket->_headerLength = 0;
+
+  if (websocket->_frameOpcode & 0x8) {
+    websocket->control = websocket->_frameOpcode;
+    http_parser_websocket_emit(websocket, websocket->onControl, websocket->_control->data, websocket->_control->len);
+    websocket->control = 0;
+    return;
+  }
+
+  if (websocket->_fin) websocket->opcode = 0;
+}
+
+/**
+ * Passes connection data into the frame parser
+ *
+ * Payloads are unmasked in-place within data and passed to onData as they
+ * arrive, with final set on the last piece of a message. Control frames are
+ * passed to onControl once complete, with control set to their opcode.
+ *
+ * Returns 0 on success or -1 on a protocol error
+ */
+int http_parser_websocket_data(struct http_parser_websocket *websocket, struct buf *data) {
+  size_t i = 0;
+  size_t n;
+  int length;
+
+  while(i < data->len) {
+    if (websocket->_state == _HTTP_PARSER_WEBSOCKET_PANIC) return -1;
+
+    if (websocket->_state == _HTTP_PARSER_WEBSOCKET_HEADER) {
+
+      // Collect the header, which may arrive in pieces
+      length = http_parser_websocket_header_length(websocket);
+      while(websocket->_headerLength < length && i < data->len) {
+        websocket->_header[websocket->_headerLength++] = data->data[i++];
+        length = http_parser_websocket_header_length(websocket);
+      }
+      if (websocket->_headerLength < length) break;
+
+      if (http_parser_websocket_frame_start(websocket)) {
+        websocket->_state = _HTTP_PARSER_WEBSOCKET_PANIC;
+        return -1;
+      }
+      websocket->_state = _HTTP_PARSER_WEBSOCKET_PAYLOAD;
+
+      // Empty frames still mark the end of a message
+      if (!websocket->_remaining) {
+        if (!(websocket->_frameOpcode & 0x8) && websocket->_fin) {
+          websocket->final = 1;
+          http_parser_websocket_emit(websocket, websocket->onData, data->data + i, 0);
+          websocket->final = 0;
+        }
+        http_parser_websocket_frame_end(websocket);
+      }
+      continue;
+    }
+
+    n = data->len - i;
+    if (n > websocket->_remaining) n = websocket->_remaining;
+    if (websocket->_masked) {
+      http_parser_websocket_mask(data->data + i, n, websocket->_mask, websocket->_maskOffset);
+      websocket->_maskOffset += n;
+    }
+    websocket->_remaining -= n;
+
+    if (websocket->_frameOpcode & 0x8) {
+      buf_append(websocket->_control, data->data + i, n);
+    } else {
+      websocket->final = websocket->_fin && !websocket->_remaining;
+      http_parser_websocket_emit(websocket, websocket->onData, data->data + i, n);
+      websocket->final = 0;
+    }
+    i += n;
+
+    if (!websocket->_remaining) http_parser_websocket_frame_end(websocket);
+  }
+
+  return websocket->_state == _HTTP_PARSER_WEBSOCKET_PANIC ? -1 : 0;
+}
+
+// }}}
+
+// Frame writer {{{
+
+/**
+ * Appends a frame to out, masking the payload if a mask is given
+ *
+ * Servers send unmasked frames, clients must pass a random 4-byte mask
+ * Returns the number of bytes appended
+ */
+size_t http_parser_websocket_frame(struct buf *out, int opcode, int fin, const unsigned char *mask, const char *payload, size_t len) {
+  unsigned char header[14];
+  size_t start = out->len;
+  int headerLength = 2;
+  int i;
+
+  header[0] = (fin ? 0x80 : 0x00) | (opcode & 0x0f);
+  if (len < 126) {
+    header[1] = len;
+  } else if (len <= 0xffff) {
+    header[1] = 126;
+    header[2] = (len >> 8) & 0xff;
+    header[3] = len & 0xff;
+    headerLength += 2;
+  } else {
+    header[1] = 127;
+    for(i=0; i<8; i++) header[2 + i] = ((uint64_t)len >> ((7 - i) * 8)) & 0xff;
+    headerLength += 8;
+  }
+  if (mask) {
+    header[1] |= 0x80;
+    memcpy(header + headerLength, mask, 4);
+    headerLength += 4;
+  }
+
+  buf_append(out, (const char *)header, headerLength);
+  if (len) {
+    buf_append(out, payload, len);
+    if (mask) http_parser_websocket_mask(out->data + start + headerLength, len, mask, 0);
+  }
+  return out->len - start;
+}
+
+// }}}
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
@@ -0,0 +1,54 @@
+#ifndef _HTTP_PARSER_WEBSOCKET_H_
+#define _HTTP_PARSER_WEBSOCKET_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "http-parser.h"
+
+#define HTTP_PARSER_WEBSOCKET_CONTINUATION 0x0
+#define HTTP_PARSER_WEBSOCKET_TEXT         0x1
+#define HTTP_PARSER_WEBSOCKET_BINARY       0x2
+#define HTTP_PARSER_WEBSOCKET_CLOSE        0x8
+#define HTTP_PARSER_WEBSOCKET_PING         0x9
+#define HTTP_PARSER_WEBSOCKET_PONG         0xA
+
+struct http_parser_websocket {
+  int opcode;
+  int final;
+  int control;
+  int requireMask;
+  void (*onData)(struct http_parser_event*);
+  void (*onControl)(struct http_parser_event*);
+  void *udata;
+  int _state;
+  int _fin;
+  int _frameOpcode;
+  unsigned char _header[14];
+  int _headerLength;
+  uint64_t _remaining;
+  unsigned char _mask[4];
+  int _masked;
+  size_t _maskOffset;
+  struct buf *_control;
+};
+
+int http_parser_websocket_accept(const char *key, char *out);
+int http_parser_websocket_handshake(struct http_parser_message *request, struct http_parser_message *response);
+
+struct http_parser_websocket * http_parser_websocket_init(void *udata);
+int http_parser_websocket_data(struct http_parser_websocket *websocket, struct buf *data);
+void http_parser_websocket_free(struct http_parser_websocket *websocket);
+
+void http_parser_websocket_mask(char *data, size_t len, const unsigned char *mask, size_t offset);
+size_t http_parser_websocket_frame(struct buf *out, int opcode, int fin, const unsigned char *mask, const char *payload, size_t len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // _HTTP_PARSER_WEBSOCKET_H_
@@ -4,15 +4,29 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "finwo/asprintf.h"
 #include "finwo/strnstr.h"
 #include "tidwall/buf.h"
 
 #include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-encoding.h"
+#include "http-parser-internal.h"
+#include "http-parser-pool.h"
+#include "http-parser-stats.h"
 #include "http-parser-statusses.h"
 
 const int _HTTP_PARSER_STATE_INIT         = 0;
@@ -20,16 +34,40 @@ const int _HTTP_PARSER_STATE_HEADER       = 1;
 const int _HTTP_PARSER_STATE_BODY         = 2;
 const int _HTTP_PARSER_STATE_BODY_CHUNKED = 3;
 const int _HTTP_PARSER_STATE_DONE         = 4;
+const int _HTTP_PARSER_STATE_UNTIL_CLOSE  = 5;
+const int _HTTP_PARSER_STATE_TRAILER      = 6;
+const int _HTTP_PARSER_STATE_RELAY        = 7;
+const int _HTTP_PARSER_STATE_RELAY_SIZE   = 8;
+const int _HTTP_PARSER_STATE_RELAY_EXT    = 9;
+const int _HTTP_PARSER_STATE_RELAY_DATA   = 10;
+const int _HTTP_PARSER_STATE_RELAY_CRLF   = 11;
+const int _HTTP_PARSER_STATE_RELAY_LINE   = 12;
+const int _HTTP_PARSER_STATE_RELAY_FIELD  = 13;
 const int _HTTP_PARSER_STATE_PANIC        = 666;
 
+const int _HTTP_PARSER_FLAG_HEAD          = 1;
+const int _HTTP_PARSER_FLAG_CONNECT       = 2;
+
 #ifndef NULL
 #define NULL ((void*)0)
 #endif
 
+#ifdef HTTP_PARSER_STATS
+#define HTTP_PARSER_STAT(message, counter, n) do { \
+  _http_parser_stats_thread.counter += (n); \
+  if ((message)->stats) (message)->stats->counter += (n); \
+} while(0)
+#else
+#define HTTP_PARSER_STAT(message, counter, n) do {} while(0)
+#endif
+
 #if defined(_WIN32) || defined(_WIN64)
 #ifndef strcasecmp
 #define strcasecmp _stricmp
 #endif
+#ifndef strncasecmp
+#define strncasecmp _strnicmp
+#endif
 #endif
 
 // xtoi {{{
@@ -65,6 +103,30 @@ int xtoi(char *str) {
 }
 // }}}
 
+// Start-line tokens {{{
+/**
+ * Copies the next space-delimited token of the line, at most max bytes long,
+ * into an allocation of its exact size
+ *
+ * Advances the cursor past the token, returns NULL if there is none or it's
+ * too long
+ */
+static char * http_parser_token_dup(const char **cursor, size_t max) {
+  const char *start;
+  char *result;
+  size_t len;
+  while(**cursor == ' ' || **cursor == '\t') (*cursor)++;
+  start = *cursor;
+  while(**cursor && **cursor != ' ' && **cursor != '\t') (*cursor)++;
+  len = *cursor - start;
+  if (!len || len > max) return NULL;
+  result = malloc(len + 1);
+  memcpy(result, start, len);
+  result[len] = '\0';
+  return result;
+}
+// }}}
+
 // non-exported structs {{{
 struct http_parser_meta {
   char *key;
@@ -72,6 +134,85 @@ struct http_parser_meta {
 };
 // }}}
 
+// Instrumentation {{{
+
+/**
+ * Name of a parser state as passed to a stats hook
+ */
+const char * http_parser_state_name(int state) {
+  switch(state) {
+    case _HTTP_PARSER_STATE_INIT        : return "init";
+    case _HTTP_PARSER_STATE_HEADER      : return "header";
+    case _HTTP_PARSER_STATE_BODY        : return "body";
+    case _HTTP_PARSER_STATE_BODY_CHUNKED: return "body-chunked";
+    case _HTTP_PARSER_STATE_DONE        : return "done";
+    case _HTTP_PARSER_STATE_UNTIL_CLOSE : return "until-close";
+    case _HTTP_PARSER_STATE_TRAILER     : return "trailer";
+    case _HTTP_PARSER_STATE_RELAY       : return "relay";
+    case _HTTP_PARSER_STATE_RELAY_SIZE  : return "relay-size";
+    case _HTTP_PARSER_STATE_RELAY_EXT   : return "relay-ext";
+    case _HTTP_PARSER_STATE_RELAY_DATA  : return "relay-data";
+    case _HTTP_PARSER_STATE_RELAY_CRLF  : return "relay-crlf";
+    case _HTTP_PARSER_STATE_RELAY_LINE  : return "relay-line";
+    case _HTTP_PARSER_STATE_RELAY_FIELD : return "relay-field";
+    case _HTTP_PARSER_STATE_PANIC       : return "panic";
+    default                             : return NULL;
+  }
+}
+
+/**
+ * Moves a message to another state, counting the transition and calling the
+ * stats hooks when built with HTTP_PARSER_STATS
+ */
+static void http_parser_message_state(struct http_parser_message *message, int state) {
+#ifdef HTTP_PARSER_STATS
+  if (message->_state != state) {
+    if (state == _HTTP_PARSER_STATE_PANIC) HTTP_PARSER_STAT(message, panics, 1);
+    _http_parser_stats_transition(message, message->_state, state);
+  }
+#endif
+  message->_state = state;
+}
+
+/**
+ * Notes the arrival of data, timing the message from its first byte
+ */
+static void http_parser_message_received(struct http_parser_message *message, size_t len) {
+#ifdef HTTP_PARSER_STATS
+  HTTP_PARSER_STAT(message, bytes, len);
+  if (!message->_started && message->_state == _HTTP_PARSER_STATE_INIT) message->_started = _http_parser_stats_now();
+#endif
+}
+
+/**
+ * Counts a completed message and its latency
+ */
+static void http_parser_message_completed(struct http_parser_message *message) {
+#ifdef HTTP_PARSER_STATS
+  _http_parser_stats_finish(message);
+#endif
+  message->ready = 1;
+}
+
+/**
+ * Notes data of a message framed by another protocol, like HTTP/2, so it's
+ * counted and timed as HTTP/1.1 messages are
+ */
+void _http_parser_message_receive(struct http_parser_message *message, size_t len) {
+  http_parser_message_received(message, len);
+}
+
+/**
+ * Completes a message framed by another protocol, through the same state
+ * change and stats as HTTP/1.1 messages
+ */
+void _http_parser_message_complete(struct http_parser_message *message) {
+  http_parser_message_state(message, _HTTP_PARSER_STATE_DONE);
+  http_parser_message_completed(message);
+}
+
+// }}}
+
 // Meta management {{{
 
 static int fn_meta_cmp(const void *a, const void *b, void *udata) {
@@ -89,116 +230,575 @@ static void fn_meta_purge(void *item, void *udata) {
 
 struct http_parser_meta * _http_parser_meta_get(struct http_parser_message *subject, const char *key) {
   struct http_parser_meta pattern = { .key = (char*)key };
+  if (!subject->meta) return NULL;
   return mindex_get(subject->meta, &pattern);
 }
+
+/**
+ * Headers used to live in the meta map as "header:<name>"
+ * Keys in that form are forwarded to the header list for compatibility
+ */
 const char * http_parser_meta_get(struct http_parser_message *subject, const char *key) {
+  if (!strncasecmp(key, "header:", 7)) return http_parser_header_get(subject, key + 7);
   struct http_parser_meta *found = _http_parser_meta_get(subject, key);
   if (!found) return NULL;
   return found->value;
 }
 
 void _http_parser_meta_set(struct http_parser_message *subject, const char *key, const char *value) {
-  struct http_parser_meta *meta = calloc(1, sizeof(struct http_parser_meta));
+  struct http_parser_meta *meta;
+
+  // Most messages never carry meta, the index is created on first use
+  if (!subject->meta) {
+    subject->meta = mindex_init(
+        fn_meta_cmp,
+        fn_meta_purge,
+        NULL
+    );
+  }
+
+  meta        = calloc(1, sizeof(struct http_parser_meta));
   meta->key   = strdup(key);
   meta->value = strdup(value);
   mindex_set(subject->meta, meta);
 }
 void http_parser_meta_set(struct http_parser_message *subject, const char *key, const char *value) {
+  if (!strncasecmp(key, "header:", 7)) {
+    http_parser_header_set(subject, key + 7, value);
+    return;
+  }
   _http_parser_meta_set(subject, key, value);
 }
 
 void _http_parser_meta_del(struct http_parser_message *subject, const char *key) {
   struct http_parser_meta pattern = { .key = (char*)key };
+  if (!subject->meta) return;
   mindex_delete(subject->meta, &pattern);
 }
 void http_parser_meta_del(struct http_parser_message *subject, const char *key) {
+  if (!strncasecmp(key, "header:", 7)) {
+    http_parser_header_del(subject, key + 7);
+    return;
+  }
   _http_parser_meta_del(subject, key);
 }
+
+int http_parser_meta_count(struct http_parser_message *subject) {
+  return subject->meta ? (int)mindex_length(subject->meta) : 0;
+}
+
+/**
+ * Returns the key of the nth meta entry and its value through value, or NULL
+ * if out of range
+ */
+const char * http_parser_meta_nth(struct http_parser_message *subject, int n, const char **value) {
+  struct http_parser_meta *meta;
+  if (n < 0 || n >= http_parser_meta_count(subject)) return NULL;
+  meta = mindex_nth(subject->meta, n);
+  if (value) *value = meta->value;
+  return meta->key;
+}
+// }}}
+
+// Header atoms {{{
+
+// Interned header names, indexed by atom, in their canonical and lowercase
+// spelling. Shared by all messages and never written to.
+static const struct {
+  char *name;
+  char *lower;
+  size_t length;
+} http_parser_atoms[HTTP_PARSER_ATOM_COUNT] = {
+  { NULL, NULL, 0 },
+  { "Accept",                      "accept",                      6 },
+  { "Accept-Charset",              "accept-charset",              14 },
+  { "Accept-Encoding",             "accept-encoding",             15 },
+  { "Accept-Language",             "accept-language",             15 },
+  { "Accept-Ranges",               "accept-ranges",               13 },
+  { "Access-Control-Allow-Origin", "access-control-allow-origin", 27 },
+  { "Age",                         "age",                         3 },
+  { "Allow",                       "allow",                       5 },
+  { "Authorization",               "authorization",               13 },
+  { "Cache-Control",               "cache-control",               13 },
+  { "Connection",                  "connection",                  10 },
+  { "Content-Disposition",         "content-disposition",         19 },
+  { "Content-Encoding",            "content-encoding",            16 },
+  { "Content-Language",            "content-language",            16 },
+  { "Content-Length",              "content-length",              14 },
+  { "Content-Location",            "content-location",            16 },
+  { "Content-Range",               "content-range",               13 },
+  { "Content-Type",                "content-type",                12 },
+  { "Cookie",                      "cookie",                      6 },
+  { "Date",                        "date",                        4 },
+  { "ETag",                        "etag",                        4 },
+  { "Expect",                      "expect",                      6 },
+  { "Expires",                     "expires",                     7 },
+  { "Forwarded",                   "forwarded",                   9 },
+  { "From",                        "from",                        4 },
+  { "Host",                        "host",                        4 },
+  { "HTTP2-Settings",              "http2-settings",              14 },
+  { "If-Match",                    "if-match",                    8 },
+  { "If-Modified-Since",           "if-modified-since",           17 },
+  { "If-None-Match",               "if-none-match",               13 },
+  { "If-Range",                    "if-range",                    8 },
+  { "If-Unmodified-Since",         "if-unmodified-since",         19 },
+  { "Keep-Alive",                  "keep-alive",                  10 },
+  { "Last-Modified",               "last-modified",               13 },
+  { "Link",                        "link",                        4 },
+  { "Location",                    "location",                    8 },
+  { "Origin",                      "origin",                      6 },
+  { "Proxy-Authenticate",          "proxy-authenticate",          18 },
+  { "Proxy-Authorization",         "proxy-authorization",         19 },
+  { "Proxy-Connection",            "proxy-connection",            16 },
+  { "Range",                       "range",                       5 },
+  { "Referer",                     "referer",                     7 },
+  { "Retry-After",                 "retry-after",                 11 },
+  { "Sec-WebSocket-Accept",        "sec-websocket-accept",        20 },
+  { "Sec-WebSocket-Extensions",    "sec-websocket-extensions",    24 },
+  { "Sec-WebSocket-Key",           "sec-websocket-key",           17 },
+  { "Sec-WebSocket-Protocol",      "sec-websocket-protocol",      22 },
+  { "Sec-WebSocket-Version",       "sec-websocket-version",       21 },
+  { "Server",                      "server",                      6 },
+  { "Set-Cookie",                  "set-cookie",                  10 },
+  { "Strict-Transport-Security",   "strict-transport-security",   25 },
+  { "TE",                          "te",                          2 },
+  { "Trailer",                     "trailer",                     7 },
+  { "Transfer-Encoding",           "transfer-encoding",           17 },
+  { "Upgrade",                     "upgrade",                     7 },
+  { "User-Agent",                  "user-agent",                  10 },
+  { "Vary",                        "vary",                        4 },
+  { "Via",                         "via",                         3 },
+  { "WWW-Authenticate",            "www-authenticate",            16 },
+  { "X-Forwarded-For",             "x-forwarded-for",             15 },
+  { "X-Forwarded-Host",            "x-forwarded-host",            16 },
+  { "X-Forwarded-Proto",           "x-forwarded-proto",           17 },
+  { "X-Requested-With",            "x-requested-with",            16 },
+};
+
+/**
+ * Returns the atom of a header name, matched case-insensitively, or
+ * HTTP_PARSER_ATOM_NONE if the name isn't interned
+ */
+int http_parser_header_atom(const char *key) {
+  size_t length = strlen(key);
+  char first    = (key[0] >= 'A' && key[0] <= 'Z') ? (key[0] | 0x20) : key[0];
+  int atom;
+  for(atom = 1; atom < HTTP_PARSER_ATOM_COUNT; atom++) {
+    if (http_parser_atoms[atom].length != length) continue;
+    if (http_parser_atoms[atom].lower[0] != first) continue;
+    if (!strcasecmp(http_parser_atoms[atom].lower, key)) return atom;
+  }
+  return HTTP_PARSER_ATOM_NONE;
+}
+
+/**
+ * Returns the canonical spelling of an atom's header name, or NULL
+ */
+const char * http_parser_atom_name(int atom) {
+  if (atom <= HTTP_PARSER_ATOM_NONE || atom >= HTTP_PARSER_ATOM_COUNT) return NULL;
+  return http_parser_atoms[atom].name;
+}
 // }}}
 
 // Header management {{{
 
-struct http_parser_meta * _http_parser_header_get(struct http_parser_message *subject, const char *key) {
-  char *meta = calloc(strlen(key) + 8, sizeof(char));
-  strcat(meta, "header:");
-  strcat(meta, key);
-  struct http_parser_meta *result = _http_parser_meta_get(subject, meta);
-  free(meta);
-  return result;
+/**
+ * Headers are kept in a contiguous array in arrival order
+ *
+ * An interned name spelled canonically or in lowercase points into the atom
+ * table and only the value is allocated. Otherwise the key and value share a
+ * single allocation, the value directly following the key's terminating null
+ * byte.
+ */
+static void _http_parser_header_store(struct http_parser_header *header, const char *key, const char *value) {
+  size_t keylen   = strlen(key);
+  size_t valuelen = strlen(value);
+  int atom        = http_parser_header_atom(key);
+
+  header->atom = atom;
+  if (atom && (!strcmp(key, http_parser_atoms[atom].name) || !strcmp(key, http_parser_atoms[atom].lower))) {
+    header->key   = key[0] == http_parser_atoms[atom].name[0] ? http_parser_atoms[atom].name : http_parser_atoms[atom].lower;
+    header->value = malloc(valuelen + 1);
+    memcpy(header->value, value, valuelen + 1);
+    return;
+  }
+
+  header->key = malloc(keylen + valuelen + 2);
+  memcpy(header->key, key, keylen + 1);
+  memcpy(header->key + keylen + 1, value, valuelen + 1);
+  header->value = header->key + keylen + 1;
+}
+
+static void _http_parser_header_release(struct http_parser_header *header) {
+  if (header->atom && (header->key == http_parser_atoms[header->atom].name || header->key == http_parser_atoms[header->atom].lower)) {
+    free(header->value);
+  } else {
+    free(header->key);
+  }
+}
+
+static void _http_parser_header_remove(struct http_parser_message *subject, int index) {
+  _http_parser_header_release(&(subject->headers[index]));
+  subject->headerCount--;
+  memmove(
+    subject->headers + index,
+    subject->headers + index + 1,
+    (subject->headerCount - index) * sizeof(struct http_parser_header)
+  );
+}
+
+static int _http_parser_header_index_atom(struct http_parser_message *subject, int atom, int offset) {
+  int i;
+  if (!atom) return -1;
+  for(i = offset; i < subject->headerCount; i++) {
+    if (subject->headers[i].atom == atom) return i;
+  }
+  return -1;
+}
+
+// Interned names compare by atom, only other names need a string compare
+static int _http_parser_header_index(struct http_parser_message *subject, const char *key, int offset) {
+  int atom = http_parser_header_atom(key);
+  int i;
+  if (atom) return _http_parser_header_index_atom(subject, atom, offset);
+  for(i = offset; i < subject->headerCount; i++) {
+    if (!subject->headers[i].atom && !strcasecmp(subject->headers[i].key, key)) return i;
+  }
+  return -1;
 }
 
 /**
  * Searches for the given key in the list of headers
- * Returns the header's value or NULL if not found
+ * Returns the first matching header's value or NULL if not found
  */
 const char *http_parser_header_get(struct http_parser_message *subject, const char *key) {
-  struct http_parser_meta *header = _http_parser_header_get(subject, key);
-  if (!header) return NULL;
-  return header->value;
+  int index = _http_parser_header_index(subject, key, 0);
+  if (index < 0) return NULL;
+  return subject->headers[index].value;
+}
+
+/**
+ * Same as http_parser_header_get, for an interned header name
+ */
+const char *http_parser_header_get_atom(struct http_parser_message *subject, int atom) {
+  int index = _http_parser_header_index_atom(subject, atom, 0);
+  if (index < 0) return NULL;
+  return subject->headers[index].value;
 }
 
-void _http_parser_header_set(struct http_parser_message *subject, const char *key, const char *value) {
-  char *meta = calloc(strlen(key) + 8, sizeof(char));
-  strcat(meta, "header:");
-  strcat(meta, key);
-  _http_parser_meta_set(subject, meta, value);
-  free(meta);
+/**
+ * Appends a header to the subject's list of headers, keeping any existing
+ * headers with the same key
+ */
+void http_parser_header_add(struct http_parser_message *subject, const char *key, const char *value) {
+  struct http_parser_header *header;
+  if (subject->headerCount == subject->headerCap) {
+    subject->headerCap = subject->headerCap ? subject->headerCap * 2 : 8;
+    subject->headers   = realloc(subject->headers, subject->headerCap * sizeof(struct http_parser_header));
+    HTTP_PARSER_STAT(subject, allocs, 1);
+  }
+  HTTP_PARSER_STAT(subject, allocs, 1);
+  header         = &(subject->headers[subject->headerCount++]);
+  _http_parser_header_store(header, key, value);
+  header->offset = -1;
+  header->length = 0;
 }
 
 /**
  * Write a header into the subject's list of headers
+ *
+ * Replaces the value of the first header with the same key in-place and
+ * removes any further duplicates, appends the header otherwise
  */
 void http_parser_header_set(struct http_parser_message *subject, const char *key, const char *value) {
-  return _http_parser_header_set(subject, key, value);
-}
+  int index = _http_parser_header_index(subject, key, 0);
+  if (index < 0) {
+    http_parser_header_add(subject, key, value);
+    return;
+  }
 
-void _http_parser_header_del(struct http_parser_message *subject, const char *key) {
-  char *meta = calloc(strlen(key) + 8, sizeof(char));
-  strcat(meta, "header:");
-  strcat(meta, key);
-  _http_parser_meta_del(subject, meta);
-  free(meta);
+  // Keep the original key's casing, only the value changes
+  struct http_parser_header old = subject->headers[index];
+  _http_parser_header_store(&(subject->headers[index]), old.key, value);
+  subject->headers[index].offset = -1;
+  _http_parser_header_release(&old);
+
+  while((index = _http_parser_header_index(subject, key, index + 1)) >= 0) {
+    _http_parser_header_remove(subject, index--);
+  }
 }
 
+/**
+ * Removes all headers matching the key
+ */
 void http_parser_header_del(struct http_parser_message *subject, const char *key) {
-  _http_parser_header_del(subject, key);
+  int index = 0;
+  while((index = _http_parser_header_index(subject, key, index)) >= 0) {
+    _http_parser_header_remove(subject, index);
+  }
+}
+
+int http_parser_header_count(struct http_parser_message *subject) {
+  return subject->headerCount;
+}
+
+/**
+ * Returns the nth header in arrival order, or NULL if out of bounds
+ */
+const struct http_parser_header * http_parser_header_nth(struct http_parser_message *subject, int n) {
+  if (n < 0 || n >= subject->headerCount) return NULL;
+  return &(subject->headers[n]);
+}
+
+/**
+ * Returns the next header matching key after prev, or the first if prev is NULL
+ *
+ * Intended for iterating over repeated headers like Set-Cookie
+ */
+const struct http_parser_header * http_parser_header_next(struct http_parser_message *subject, const char *key, const struct http_parser_header *prev) {
+  int offset = prev ? ((int)(prev - subject->headers) + 1) : 0;
+  int index  = _http_parser_header_index(subject, key, offset);
+  if (index < 0) return NULL;
+  return &(subject->headers[index]);
+}
+
+/**
+ * Same as http_parser_header_next, for an interned header name
+ */
+const struct http_parser_header * http_parser_header_next_atom(struct http_parser_message *subject, int atom, const struct http_parser_header *prev) {
+  int offset = prev ? ((int)(prev - subject->headers) + 1) : 0;
+  int index  = _http_parser_header_index_atom(subject, atom, offset);
+  if (index < 0) return NULL;
+  return &(subject->headers[index]);
+}
+
+// }}}
+
+// List headers {{{
+
+static int http_parser_list_space(char c) {
+  return c == ' ' || c == '\t';
+}
+
+// Ends a token of a list entry, or of a token=value pair
+static int http_parser_list_delimiter(char c) {
+  return !c || c == ',' || c == ';' || c == '=' || c == ' ' || c == '\t';
+}
+
+// Skips a quoted-string, returning the position of its closing quote
+static const char * http_parser_list_quoted(const char *cursor) {
+  for(cursor++; *cursor && *cursor != '"'; cursor++) {
+    if (*cursor == '\\' && cursor[1]) cursor++;
+  }
+  return cursor;
+}
+
+// Reads a qvalue, in thousandths
+static int http_parser_list_qvalue(const char *cursor) {
+  int q = (*cursor == '1') ? 1000 : 0;
+  int scale;
+  if (*cursor != '0' && *cursor != '1') return 1000;
+  if (*(++cursor) == '.') {
+    cursor++;
+    for(scale = 100; scale && *cursor >= '0' && *cursor <= '9'; scale /= 10) {
+      q += (*(cursor++) - '0') * scale;
+    }
+  }
+  return q > 1000 ? 1000 : q;
+}
+
+/**
+ * Reads the next entry of a comma-separated header value, like Accept,
+ * Accept-Encoding, Cache-Control or Connection, without copying anything
+ *
+ * Fills in the entry's token, its value for token=value entries, its
+ * parameters after the first ';' and their q-value in thousandths (1000 when
+ * absent). Lengths are given as the strings aren't terminated. Returns the
+ * position to continue from, or NULL when the list is exhausted.
+ */
+const char * http_parser_list_next(const char *cursor, struct http_parser_list_item *item) {
+  if (!cursor) return NULL;
+  while(http_parser_list_space(*cursor) || *cursor == ',') cursor++;
+  if (!*cursor) return NULL;
+
+  memset(item, 0, sizeof(struct http_parser_list_item));
+  item->q     = 1000;
+  item->token = cursor;
+  while(!http_parser_list_delimiter(*cursor)) cursor++;
+  item->tokenLength = cursor - item->token;
+  while(http_parser_list_space(*cursor)) cursor++;
+
+  if (*cursor == '=') {
+    cursor++;
+    while(http_parser_list_space(*cursor)) cursor++;
+    if (*cursor == '"') {
+      item->value       = cursor + 1;
+      cursor            = http_parser_list_quoted(cursor);
+      item->valueLength = cursor - item->value;
+      if (*cursor) cursor++;
+    } else {
+      item->value = cursor;
+      while(!http_parser_list_delimiter(*cursor)) cursor++;
+      item->valueLength = cursor - item->value;
+    }
+  }
+
+  // Parameters run up to the next comma outside of quotes
+  while(*cursor && *cursor != ',' && *cursor != ';') cursor++;
+  if (*cursor == ';') {
+    item->params = ++cursor;
+    while(*cursor && *cursor != ',') {
+      while(http_parser_list_space(*cursor) || *cursor == ';') cursor++;
+      if ((*cursor | 0x20) == 'q' && cursor[1] == '=') item->q = http_parser_list_qvalue(cursor + 2);
+      while(*cursor && *cursor != ',' && *cursor != ';') {
+        if (*cursor == '"' && !*(cursor = http_parser_list_quoted(cursor))) break;
+        cursor++;
+      }
+    }
+    item->paramsLength = cursor - item->params;
+    while(item->paramsLength && http_parser_list_space(item->params[item->paramsLength - 1])) item->paramsLength--;
+  }
+
+  return cursor;
+}
+
+/**
+ * Whether the comma-separated list contains the token, case-insensitive
+ */
+int http_parser_list_contains(const char *list, const char *token) {
+  struct http_parser_list_item item;
+  size_t len = strlen(token);
+  while((list = http_parser_list_next(list, &item))) {
+    if (item.tokenLength == len && !strncasecmp(item.token, token, len)) return 1;
+  }
+  return 0;
+}
+
+/**
+ * How specifically a list entry's token, a range, names an offer: 3 for the
+ * exact name, 2 for a language prefix or a media range of the offer's type, 1
+ * for a wildcard and 0 if it doesn't
+ */
+static int http_parser_list_specificity(const struct http_parser_list_item *item, const char *offer) {
+  size_t len   = strcspn(offer, "; \t");
+  const char *slash;
+  if (item->tokenLength == len && !strncasecmp(item->token, offer, len)) return 3;
+  if (item->tokenLength == 1 && *item->token == '*') return 1;
+  if (item->tokenLength == 3 && !strncmp(item->token, "*/*", 3)) return 1;
+  if (item->tokenLength < 2) return 0;
+  if (!strncmp(item->token + item->tokenLength - 2, "/*", 2)) {
+    slash = memchr(offer, '/', len);
+    return (slash && (size_t)(slash - offer) == item->tokenLength - 2 && !strncasecmp(item->token, offer, item->tokenLength - 2)) ? 2 : 0;
+  }
+  if (memchr(item->token, '/', item->tokenLength)) return 0;
+  return (item->tokenLength < len && offer[item->tokenLength] == '-' && !strncasecmp(item->token, offer, item->tokenLength)) ? 2 : 0;
+}
+
+/**
+ * Picks the best of the server's offers, in order of preference, for a list
+ * like Accept, Accept-Encoding or Accept-Language
+ *
+ * Each offer takes the weight of the most specific range naming it, offers
+ * with equal weight go by the server's order. Ranges match by name only,
+ * their parameters aside from q are not considered. Returns the index of the
+ * offer, 0 when the list is NULL as anything is acceptable then, or -1 when
+ * no offer is acceptable.
+ */
+int http_parser_list_negotiate(const char *list, const char *const *offers) {
+  struct http_parser_list_item item;
+  const char *cursor;
+  int best     = -1;
+  int bestQ    = 0;
+  int q, specificity, matched, i;
+
+  if (!list) return offers[0] ? 0 : -1;
+  for(i = 0; offers[i]; i++) {
+    q       = 0;
+    matched = 0;
+    cursor  = list;
+    while((cursor = http_parser_list_next(cursor, &item))) {
+      specificity = http_parser_list_specificity(&item, offers[i]);
+      if (specificity > matched || (specificity && specificity == matched && item.q > q)) {
+        matched = specificity;
+        q       = item.q;
+      }
+    }
+    if (q > bestQ) {
+      best  = i;
+      bestQ = q;
+    }
+  }
+  return best;
 }
 
 // }}}
 
 /**
  * Frees everything in a http_message that was malloc'd by http-parser
+ *
+ * Pooled messages freed on another thread are handed back to their pool's
+ * thread, which frees their contents when collecting
  */
 void http_parser_message_free(struct http_parser_message *subject) {
+  if (subject->_pool && _http_parser_pool_message_remote(subject)) return;
   if (subject->method ) free(subject->method);
   if (subject->path   ) free(subject->path);
   if (subject->version) free(subject->version);
+  if (subject->statusMessage) free(subject->statusMessage);
   if (subject->body   ) { buf_clear(subject->body); free(subject->body); }
   if (subject->meta   ) mindex_free(subject->meta);
-  if (subject->buf    ) free(subject->buf);
-  free(subject);
+  if (subject->headers) {
+    while(subject->headerCount) _http_parser_header_release(&(subject->headers[--subject->headerCount]));
+    free(subject->headers);
+  }
+  if (subject->buf    ) { buf_clear(subject->buf); free(subject->buf); }
+  if (subject->leftover) { buf_clear(subject->leftover); free(subject->leftover); }
+  if (subject->head   ) { buf_clear(subject->head); free(subject->head); }
+  if (subject->_decoder) http_parser_zstream_free(subject->_decoder);
+#if !defined(_WIN32) && !defined(_WIN64)
+  if (subject->_bodyMap) munmap(subject->_bodyMap, subject->_spillLength);
+  if (subject->bodyFd >= 0) close(subject->bodyFd);
+#endif
+  if (subject->_pool) _http_parser_pool_message_put(subject);
+  else free(subject);
 }
 
 /**
  * Frees everything in a http pair that was malloc'd by http-parser
  */
 void http_parser_pair_free(struct http_parser_pair *pair) {
+  if (pair->_pool && _http_parser_pool_pair_remote(pair)) return;
   if (pair->request) http_parser_message_free(pair->request);
   if (pair->response) http_parser_message_free(pair->response);
-  free(pair);
+  if (pair->_pool) _http_parser_pool_pair_put(pair);
+  else free(pair);
+}
+
+/**
+ * Frees the pair's messages, keeping the pair and its handlers
+ *
+ * Leaves an idle pair of a few dozen bytes, its messages are created again
+ * when data is passed in or the pair is serialized
+ */
+void http_parser_pair_release(struct http_parser_pair *pair) {
+  if (pair->request ) http_parser_message_free(pair->request);
+  if (pair->response) http_parser_message_free(pair->response);
+  pair->request  = NULL;
+  pair->response = NULL;
 }
 
 /**
  * Initializes a http_message as request
+ *
+ * Taken from the calling thread's pool, if one is attached
  */
 struct http_parser_message * http_parser_request_init() {
-  struct http_parser_message *message = calloc(1, sizeof(struct http_parser_message));
+  struct http_parser_message *message = _http_parser_pool_current
+    ? _http_parser_pool_message()
+    : calloc(1, sizeof(struct http_parser_message));
   message->chunksize = -1;
-  message->meta      = mindex_init(
-      fn_meta_cmp,
-      fn_meta_purge,
-      NULL
-  );
+  message->bodyFd    = -1;
+  message->_contentLength = -1;
   return message;
 }
 
@@ -207,40 +807,64 @@ struct http_parser_message * http_parser_request_init() {
  */
 struct http_parser_message * http_parser_response_init() {
   struct http_parser_message *message = http_parser_request_init();
-  message->status = 200;
-  message->version = calloc(1,4);
-  strcpy(message->version, "1.1");
+  message->status  = 200;
+  message->version = strdup("1.1");
   return message;
 }
 
+/**
+ * Creates the messages of a released pair as they're needed again
+ */
+static void http_parser_pair_prepare(struct http_parser_pair *pair) {
+  if (!pair->request ) pair->request  = http_parser_request_init();
+  if (!pair->response) pair->response = http_parser_response_init();
+}
+
 /**
  * Initialize a http_pair with userdata
  */
 struct http_parser_pair * http_parser_pair_init(void *udata) {
-  struct http_parser_pair *pair = calloc(1, sizeof(struct http_parser_pair));
-  pair->request  = http_parser_request_init();
-  pair->response = http_parser_response_init();
-  pair->udata    = udata;
+  struct http_parser_pair *pair = _http_parser_pool_current
+    ? _http_parser_pool_pair()
+    : calloc(1, sizeof(struct http_parser_pair));
+  pair->udata = udata;
+  http_parser_pair_prepare(pair);
   return pair;
 }
 
 
 /**
  * Removed N bytes from the beginning of the message body
+ *
+ * Moves the remainder in-place, keeping the allocation for further data
  */
 static void http_parser_message_remove_body_bytes(struct http_parser_message *message, int bytes) {
-  struct buf *newbuf = calloc(1, sizeof(struct buf));
   int size = message->body->len - bytes;
+  if (size < 0) size = 0;
 
   if (size > 0) {
-    buf_append(newbuf, message->body->data + bytes, size);
+    memmove(message->body->data, message->body->data + bytes, size);
+    HTTP_PARSER_STAT(message, moves, 1);
+    HTTP_PARSER_STAT(message, moved, size);
   }
 
-  if (message->body) {
-    buf_clear(message->body);
-    free(message->body);
-  }
-  message->body = newbuf;
+  message->body->len = size;
+  if (message->body->data) message->body->data[size] = '\0';
+}
+
+/**
+ * Copies the first line of the body, including it's line break, into the
+ * message's raw head when it's being kept
+ *
+ * Returns the offset of the line within the raw head, or -1 if not kept
+ */
+static int http_parser_message_keep_line(struct http_parser_message *message, const char *linebreak) {
+  int offset;
+  if (!message->keepHead) return -1;
+  if (!message->head) message->head = calloc(1, sizeof(struct buf));
+  offset = message->head->len;
+  buf_append(message->head, message->body->data, (linebreak - message->body->data) + 2);
+  return offset;
 }
 
 /**
@@ -258,10 +882,15 @@ static void http_parser_message_remove_body_string(struct http_parser_message *m
  */
 static int http_parser_message_read_header(struct http_parser_message *message) {
   char *index;
+  int offset;
+  int length;
 
   // Require more data if no line break found
   index = strnstr(message->body->data, "\r\n", message->body->len);
+  HTTP_PARSER_STAT(message, scanned, index ? (size_t)(index - message->body->data) + 2 : message->body->len);
   if (!index) return 1;
+  offset = http_parser_message_keep_line(message, index);
+  length = (index - message->body->data) + 2;
   *(index) = '\0';
 
   // Detect end of headers
@@ -274,7 +903,7 @@ static int http_parser_message_read_header(struct http_parser_message *message)
   index = strstr(message->body->data, ": ");
   if (!index) {
     http_parser_message_remove_body_string(message);
-    return 1;
+    return 2;
   }
 
   // Split by the found colon & skip leading whitespace
@@ -282,8 +911,10 @@ static int http_parser_message_read_header(struct http_parser_message *message)
   index++;
   while(*(index) == ' ') index++;
 
-  // Insert the header in our map
-  _http_parser_header_set(message, message->body->data, index);
+  // Append the header, keeping arrival order and duplicates
+  http_parser_header_add(message, message->body->data, index);
+  message->headers[message->headerCount - 1].offset = offset;
+  message->headers[message->headerCount - 1].length = length;
 
   // Remove the header remainder
   // Twice, because we split the string
@@ -293,76 +924,271 @@ static int http_parser_message_read_header(struct http_parser_message *message)
 }
 
 /**
- * Reads chunked data
+ * Header reading for other stages working on a message's body, like the
+ * multipart parser
  */
-static int http_parser_message_read_chunked(struct http_parser_message *message) {
-  char *aChunkSize;
-  char *index;
-  struct http_parser_event *ev;
+int _http_parser_message_read_header(struct http_parser_message *message) {
+  return http_parser_message_read_header(message);
+}
 
-  // Attempt reading the chunk size
-  if (message->chunksize == -1) {
+/**
+ * Whether body data is passed on as it arrives instead of being buffered
+ */
+static int http_parser_message_is_streaming(struct http_parser_message *message) {
+  return message->onChunk || message->_decoder || message->spillThreshold;
+}
 
-    // Check if we have a line
-    index = strnstr(message->body->data, "\r\n", message->body->len);
-    if (!index) {
-      return 1;
-    }
-    *(index) = '\0';
+// Spilling {{{
 
-    // Empty line = skip
-    if (!strlen(message->body->data)) {
-      http_parser_message_remove_body_string(message);
-      return 2;
+static int http_parser_message_spill_write(struct http_parser_message *message, const char *data, size_t len) {
+#if defined(_WIN32) || defined(_WIN64)
+  return -1;
+#else
+  ssize_t written;
+  while(len) {
+    written = write(message->bodyFd, data, len);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
     }
+    data += written;
+    len  -= written;
+    message->_spillLength += written;
+  }
+  return 0;
+#endif
+}
 
-    // Read hex chunksize
-    aChunkSize = calloc(1, 17);
-    sscanf(message->body->data, "%16s", aChunkSize);
-    message->chunksize = xtoi(aChunkSize);
-    free(aChunkSize);
-
-    // Remove chunksize line
-    http_parser_message_remove_body_string(message);
-
-    // 0 = EOF
-    if (message->chunksize == 0) {
-      return 0;
+/**
+ * Moves the body collected so far into an unlinked temporary file, which
+ * receives the rest of the body from then on
+ *
+ * Returns -1 if no file could be created, the body stays in memory then
+ */
+static int http_parser_message_spill(struct http_parser_message *message) {
+#if defined(_WIN32) || defined(_WIN64)
+  return -1;
+#else
+  const char *dir = getenv("TMPDIR");
+  char *path;
+  int fd = -1;
+
+  if (!dir || !*dir) dir = "/tmp";
+#ifdef O_TMPFILE
+  fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+#endif
+  if (fd < 0) {
+    if (asprintf(&path, "%s/http-parser-XXXXXX", dir) < 0) return -1;
+    fd = mkstemp(path);
+    if (fd >= 0) {
+      unlink(path);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
     }
-
-    // Signal we're still reading
-    return 2;
+    free(path);
   }
-
-  // Create buffer if not present yet
-  if (!message->buf) {
-    message->buf = calloc(1,sizeof(struct buf));
+  if (fd < 0) return -1;
+
+  message->bodyFd = fd;
+  if (http_parser_message_spill_write(message, message->buf->data, message->buf->len)) {
+    close(fd);
+    message->bodyFd       = -1;
+    message->_spillLength = 0;
+    return -1;
   }
+  message->buf->len = 0;
+  if (message->buf->data) message->buf->data[0] = '\0';
+  return 0;
+#endif
+}
 
-  // Ensure the body has enough data
-  if (message->body->len < message->chunksize) {
-    return 1;
+/**
+ * Returns the message's complete body and its length, mapping a spilled
+ * body into memory read-only on first use
+ */
+const char * http_parser_message_body_map(struct http_parser_message *message, size_t *length) {
+  *length = 0;
+  if (message->bodyFd < 0) {
+    if (!message->body) return NULL;
+    *length = message->body->len;
+    return message->body->data;
   }
+#if defined(_WIN32) || defined(_WIN64)
+  return NULL;
+#else
+  if (!message->_bodyMap) {
+    message->_bodyMap = mmap(NULL, message->_spillLength, PROT_READ, MAP_PRIVATE, message->bodyFd, 0);
+    if (message->_bodyMap == MAP_FAILED) {
+      message->_bodyMap = NULL;
+      return NULL;
+    }
+  }
+  *length = message->_spillLength;
+  return message->_bodyMap;
+#endif
+}
 
-  // Either call onChunk method OR copy into message buffer
-  if (message->onChunk) {
+// }}}
+
+/**
+ * Passes decoded body data to onChunk, or collects it in the message buffer
+ * or spill file
+ */
+static void http_parser_message_emit_decoded(struct http_parser_message *message, const char *data, size_t len) {
+  struct http_parser_event ev = {0};
+  size_t limit = message->decodeLimit ? message->decodeLimit : HTTP_PARSER_DECODE_LIMIT;
+  if (!len || message->_state == _HTTP_PARSER_STATE_PANIC) return;
+  if (message->onChunk) {
     // Call onChunk if the message has that set
-    ev            = calloc(1,sizeof(struct http_parser_event));
-    ev->udata     = message->udata;
-    ev->chunk     = &((struct buf){
-      .len  = message->chunksize,
-      .cap  = message->chunksize,
-      .data = message->body->data,
+    ev.udata = message->udata;
+    ev.chunk = &((struct buf){
+      .len  = len,
+      .cap  = len,
+      .data = (char*)data,
     });
-    message->onChunk(ev);
-    free(ev);
+    message->onChunk(&ev);
+  } else if (message->bodyFd >= 0) {
+    if (http_parser_message_spill_write(message, data, len)) {
+      http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+    }
   } else {
-    buf_append(message->buf, message->body->data, message->chunksize);
+    if (!message->buf) {
+      message->buf = calloc(1, sizeof(struct buf));
+      HTTP_PARSER_STAT(message, allocs, 1);
+    }
+
+    // Bodies outgrowing the threshold continue on disk
+    if (message->spillThreshold && (message->buf->len + len) > message->spillThreshold && !http_parser_message_spill(message)) {
+      if (http_parser_message_spill_write(message, data, len)) {
+        http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+      }
+      return;
+    }
+
+    // A small encoded body can inflate enormously, memory is bounded
+    if (message->_decoder && (message->buf->len + len) > limit) {
+      http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+      return;
+    }
+    buf_append(message->buf, data, len);
+  }
+}
+
+static void http_parser_message_on_decoded(struct http_parser_event *ev) {
+  http_parser_message_emit_decoded(ev->udata, ev->chunk->data, ev->chunk->len);
+}
+
+/**
+ * Passes body data through the content decoder if present
+ */
+static void http_parser_message_emit_body(struct http_parser_message *message, const char *data, size_t len) {
+  if (message->_decoder) {
+    if (http_parser_zstream_write(message->_decoder, data, len)) {
+      http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+    }
+    return;
   }
+  http_parser_message_emit_decoded(message, data, len);
+}
 
-  // Remove chunk from receiving data and reset chunking
-  http_parser_message_remove_body_bytes(message, message->chunksize);
-  message->chunksize = -1;
+/**
+ * Sets up the content decoding stage if requested and supported
+ */
+static void http_parser_message_decoder_start(struct http_parser_message *message) {
+  const char *aContentEncoding;
+  if (!message->decodeBody) return;
+  aContentEncoding = http_parser_header_get_atom(message, HTTP_PARSER_ATOM_CONTENT_ENCODING);
+  if (!aContentEncoding) return;
+  message->_decoder = http_parser_decoder_init(aContentEncoding, http_parser_message_on_decoded, message);
+}
+
+/**
+ * Flushes and removes the content decoding stage
+ *
+ * Returns non-zero if the encoded body was incomplete or corrupt
+ */
+static int http_parser_message_decoder_finish(struct http_parser_message *message) {
+  char aContentLength[32];
+  int res;
+  if (!message->_decoder) return 0;
+  res = http_parser_zstream_finish(message->_decoder);
+  http_parser_zstream_free(message->_decoder);
+  message->_decoder = NULL;
+
+  // The body no longer carries the content coding
+  http_parser_header_del(message, "content-encoding");
+  if (message->buf && http_parser_header_get_atom(message, HTTP_PARSER_ATOM_CONTENT_LENGTH)) {
+    snprintf(aContentLength, sizeof(aContentLength), "%lu", (unsigned long)(message->buf->len + message->_spillLength));
+    http_parser_header_set(message, "Content-Length", aContentLength);
+  }
+  return res;
+}
+
+/**
+ * Reads chunked data
+ */
+static int http_parser_message_read_chunked(struct http_parser_message *message) {
+  char *aChunkSize;
+  char *index;
+  int size;
+
+  // Attempt reading the chunk size
+  if (message->chunksize == -1) {
+
+    // Check if we have a line
+    index = strnstr(message->body->data, "\r\n", message->body->len);
+    HTTP_PARSER_STAT(message, scanned, index ? (size_t)(index - message->body->data) + 2 : message->body->len);
+    if (!index) {
+      return 1;
+    }
+    *(index) = '\0';
+
+    // Empty line = skip
+    if (!strlen(message->body->data)) {
+      http_parser_message_remove_body_string(message);
+      return 2;
+    }
+
+    // Read hex chunksize
+    aChunkSize = calloc(1, 17);
+    sscanf(message->body->data, "%16s", aChunkSize);
+    message->chunksize = xtoi(aChunkSize);
+    free(aChunkSize);
+
+    // Remove chunksize line
+    http_parser_message_remove_body_string(message);
+
+    // 0 = EOF
+    if (message->chunksize == 0) {
+      return 0;
+    }
+
+    // Signal we're still reading
+    return 2;
+  }
+
+  // Create buffer if not present yet
+  if (!message->buf) {
+    message->buf = calloc(1,sizeof(struct buf));
+    HTTP_PARSER_STAT(message, allocs, 1);
+  }
+
+  // Streaming bodies pass on whatever part of the chunk has arrived
+  size = message->chunksize;
+  if (http_parser_message_is_streaming(message)) {
+    if (!message->body->len) return 1;
+    if (message->body->len < size) size = message->body->len;
+  } else if (message->body->len < size) {
+    // Ensure the body has enough data
+    return 1;
+  }
+
+  // Either call onChunk method OR copy into message buffer
+  http_parser_message_emit_body(message, message->body->data, size);
+
+  // Remove chunk from receiving data and reset chunking once complete
+  http_parser_message_remove_body_bytes(message, size);
+  message->chunksize -= size;
+  if (!message->chunksize) message->chunksize = -1;
 
   // No error or end encountered
   return 2;
@@ -378,168 +1204,709 @@ const char * http_parser_status_message(int status) {
   return NULL;
 }
 
+static HTTP_PARSER_THREAD_LOCAL time_t http_parser_date_time;
+static HTTP_PARSER_THREAD_LOCAL char http_parser_date_string[32];
+
+/**
+ * Formats a time as an IMF-fixdate into out, size bytes long, returning out
+ *
+ * Returns NULL when out holds less than 30 bytes or the time falls outside
+ * the years 0 to 9999, which IMF-fixdate can't express
+ */
+char * http_parser_date_format(time_t time, char *out, size_t size) {
+  static const char *days[]   = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+  static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+  struct tm tm;
+
+  if (!out || size < 30) return NULL;
+#if defined(_WIN32) || defined(_WIN64)
+  if (gmtime_s(&tm, &time)) return NULL;
+#else
+  if (!gmtime_r(&time, &tm)) return NULL;
+#endif
+  if (tm.tm_year < -1900 || tm.tm_year > 8099) return NULL;
+
+  // The fields are unsigned and bounded so the compiler sees they fit
+  snprintf(out, size, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+    days[tm.tm_wday % 7], (unsigned)tm.tm_mday % 100u, months[tm.tm_mon % 12], (unsigned)(tm.tm_year + 1900) % 10000u,
+    (unsigned)tm.tm_hour % 100u, (unsigned)tm.tm_min % 100u, (unsigned)tm.tm_sec % 100u
+  );
+  return out;
+}
+
+/**
+ * The current time as an IMF-fixdate, formatted at most once per second on
+ * each thread
+ */
+const char * http_parser_date() {
+  time_t now = time(NULL);
+
+  if (now == http_parser_date_time && *http_parser_date_string) {
+    return http_parser_date_string;
+  }
+
+  if (!http_parser_date_format(now, http_parser_date_string, sizeof(http_parser_date_string))) {
+    *http_parser_date_string = '\0';
+  }
+  http_parser_date_time = now;
+  return http_parser_date_string;
+}
+
 struct buf * http_parser_sprint_pair_response(struct http_parser_pair *pair) {
-  return http_parser_sprint_response(pair->response);
+  struct buf *result = calloc(1, sizeof(struct buf));
+  http_parser_sprint_pair_response_into(result, pair);
+  return result;
 }
 
 struct buf * http_parser_sprint_pair_request(struct http_parser_pair *pair) {
   return http_parser_sprint_request(pair->request);
 }
 
-// Caution: headers should fit in 64k
-struct buf * http_parser_sprint_response(struct http_parser_message *response) {
-  struct buf *result = calloc(1, sizeof(struct buf));
-  result->cap  = 65536;
-  result->data = calloc(1, result->cap);
+void http_parser_sprint_pair_response_into(struct buf *result, struct http_parser_pair *pair) {
+  http_parser_pair_prepare(pair);
+  _http_parser_sprint_response(result, pair->response, pair->request->method && !strcmp(pair->request->method, "HEAD"));
+}
 
-  // Status
-  sprintf(result->data,
-      "HTTP/%s %d %s\r\n"
-      , response->version
-      , response->status
-      , response->statusMessage ? response->statusMessage : http_parser_status_message(response->status)
-  );
+void http_parser_sprint_pair_request_into(struct buf *result, struct http_parser_pair *pair) {
+  http_parser_pair_prepare(pair);
+  http_parser_sprint_request_into(result, pair->request);
+}
 
-  // Headers
+/**
+ * Appends the headers in arrival order, without the empty line
+ */
+static void _http_parser_sprint_headers(struct buf *result, struct http_parser_message *message) {
   int i;
-  struct http_parser_meta *meta;
-  if (response->meta) {
-    for(i=0; i<mindex_length(response->meta); i++) {
-      meta = mindex_nth(response->meta, i);
-      if (strncmp("header:", meta->key, 7)) continue;
-      strcat(result->data, (meta->key + 7));
-      strcat(result->data, ": ");
-      strcat(result->data, meta->value);
-      strcat(result->data, "\r\n");
-    }
+  struct http_parser_header *header;
+  for(i=0; i<message->headerCount; i++) {
+    header = &(message->headers[i]);
+    buf_append(result, header->key, strlen(header->key));
+    buf_append(result, ": ", 2);
+    buf_append(result, header->value, strlen(header->value));
+    buf_append(result, "\r\n", 2);
   }
+}
 
-  strcat(result->data, "\r\n");
-
-  // Treat result as buffer from here
-  result->len = strlen(result->data);
+/**
+ * Adds the framing headers the caller left out, followed by the empty line
+ *
+ * Returns whether the body is to be sent chunked
+ */
+static int _http_parser_sprint_framing(struct buf *result, struct http_parser_message *message, int bodyless) {
+  const char *transferEncoding = http_parser_header_get_atom(message, HTTP_PARSER_ATOM_TRANSFER_ENCODING);
+  char line[64];
 
-  if (response->body) {
-    buf_append(result, response->body->data, response->body->len);
+  if (transferEncoding) {
+    buf_append(result, "\r\n", 2);
+    return http_parser_list_contains(transferEncoding, "chunked");
   }
 
-  return result;
+  if (!bodyless && !http_parser_header_get_atom(message, HTTP_PARSER_ATOM_CONTENT_LENGTH)) {
+    buf_append(result, line, snprintf(line, sizeof(line), "Content-Length: %lu\r\n", (unsigned long)(message->body ? message->body->len : 0)));
+  }
+  buf_append(result, "\r\n", 2);
+  return 0;
 }
 
-// Caution: headers should fit in 64k
-struct buf * http_parser_sprint_request(struct http_parser_message *request) {
-  struct buf *result = calloc(1, sizeof(struct buf));
-  result->cap  = 65536;
-  result->data = calloc(1, result->cap);
+/**
+ * Appends the body, as a single chunk and the last-chunk when chunked
+ */
+static void _http_parser_sprint_body(struct buf *result, struct http_parser_message *message, int isChunked) {
+  char chunkline[32];
+  size_t length = message->body ? message->body->len : 0;
 
-  char *tmppath;
-  char *path = request->path;
-  int isPathAllocced = 0;
-  if (!path) path = "/";
-  if (strstr(path, "/") != path) {
-    tmppath        = path;
-    path           = NULL;
-    isPathAllocced = true;
-    asprintf(&path, "/%s", tmppath);
+  if (isChunked && length) {
+    buf_append(result, chunkline, snprintf(chunkline, sizeof(chunkline), "%lx\r\n", (unsigned long)length));
   }
+  if (length) {
+    buf_append(result, message->body->data, length);
+  }
+  if (isChunked) {
+    if (length) buf_append(result, "\r\n", 2);
+    buf_append(result, "0\r\n\r\n", 5);
+  }
+}
 
-  // Status
-  sprintf(result->data,
-      "%s %s"
-      , request->method
-      , path
-  );
+static void _http_parser_sprint_status_line(struct buf *result, struct http_parser_message *response) {
+  char status[16];
+  const char *statusMessage = response->statusMessage ? response->statusMessage : http_parser_status_message(response->status);
+  buf_append(result, "HTTP/", 5);
+  buf_append(result, response->version, strlen(response->version));
+  buf_append(result, status, snprintf(status, sizeof(status), " %d ", response->status));
+  if (statusMessage) buf_append(result, statusMessage, strlen(statusMessage));
+  buf_append(result, "\r\n", 2);
+}
+
+static void _http_parser_sprint_request_line(struct buf *result, struct http_parser_message *request) {
+
+  // Method & path, ensuring a leading slash
+  const char *path = request->path;
+  if (!path) path = "/";
+  buf_append(result, request->method, strlen(request->method));
+  buf_append(result, " ", 1);
+  if (*path != '/') buf_append(result, "/", 1);
+  buf_append(result, path, strlen(path));
 
   // Query
   if (request->query) {
-    strcat(result->data, "?");
-    strcat(result->data, request->query);
+    buf_append(result, "?", 1);
+    buf_append(result, request->query, strlen(request->query));
   }
 
   // HTTP version
-  strcat(result->data, " HTTP/");
-  strcat(result->data, request->version);
-  strcat(result->data, "\r\n");
+  buf_append(result, " HTTP/", 6);
+  buf_append(result, request->version, strlen(request->version));
+  buf_append(result, "\r\n", 2);
+}
+
+struct buf * http_parser_sprint_response(struct http_parser_message *response) {
+  struct buf *result = calloc(1, sizeof(struct buf));
+  _http_parser_sprint_response(result, response, 0);
+  return result;
+}
+
+/**
+ * Appends the serialized response to a caller-owned buffer
+ */
+void http_parser_sprint_response_into(struct buf *result, struct http_parser_message *response) {
+  _http_parser_sprint_response(result, response, 0);
+}
+
+/**
+ * Serializes a response, adding the Date header and the framing headers the
+ * caller left out
+ *
+ * A response to a HEAD request leaves out the body only, its framing headers
+ * match those of the GET response
+ */
+void _http_parser_sprint_response(struct buf *result, struct http_parser_message *response, int head) {
+  const char *date;
+  int bodyless = (response->status < 200) || (response->status == 204) || (response->status == 304);
+  int isChunked;
+
+  // Status
+  _http_parser_sprint_status_line(result, response);
 
   // Headers
+  _http_parser_sprint_headers(result, response);
+  if (!http_parser_header_get_atom(response, HTTP_PARSER_ATOM_DATE)) {
+    date = http_parser_date();
+    buf_append(result, "Date: ", 6);
+    buf_append(result, date, strlen(date));
+    buf_append(result, "\r\n", 2);
+  }
+  isChunked = _http_parser_sprint_framing(result, response, bodyless);
+
+  if (!bodyless && !head) {
+    _http_parser_sprint_body(result, response, isChunked);
+  }
+}
+
+struct buf * http_parser_sprint_request(struct http_parser_message *request) {
+  struct buf *result = calloc(1, sizeof(struct buf));
+  http_parser_sprint_request_into(result, request);
+  return result;
+}
+
+/**
+ * Appends the serialized request to a caller-owned buffer
+ */
+void http_parser_sprint_request_into(struct buf *result, struct http_parser_message *request) {
+  int isChunked;
+
+  // Request line
+  _http_parser_sprint_request_line(result, request);
+
+  // Headers, only adding a length when there is a body to frame
+  _http_parser_sprint_headers(result, request);
+  isChunked = _http_parser_sprint_framing(result, request, !(request->body && request->body->len));
+
+  _http_parser_sprint_body(result, request, isChunked);
+}
+
+// Forwarding {{{
+
+static const char *http_parser_hop_by_hop[] = {
+  "connection",
+  "keep-alive",
+  "proxy-connection",
+  "proxy-authenticate",
+  "proxy-authorization",
+  "te",
+  "trailer",
+  "upgrade",
+  NULL
+};
+
+static int http_parser_forward_drops(struct http_parser_message *message, const char *key, const struct http_parser_forward *edits) {
+  const struct http_parser_header *connection = NULL;
   int i;
-  struct http_parser_meta *meta;
-  if (request->meta) {
-    for(i=0; i<mindex_length(request->meta); i++) {
-      meta = mindex_nth(request->meta, i);
-      if (strncmp("header:", meta->key, 7)) continue;
-      strcat(result->data, (meta->key + 7));
-      strcat(result->data, ": ");
-      strcat(result->data, meta->value);
-      strcat(result->data, "\r\n");
+
+  if (edits->drop) {
+    for(i=0; edits->drop[i]; i++) {
+      if (!strcasecmp(edits->drop[i], key)) return 1;
     }
   }
 
-  strcat(result->data, "\r\n");
+  if (edits->keepHopByHop) return 0;
+  for(i=0; http_parser_hop_by_hop[i]; i++) {
+    if (!strcasecmp(http_parser_hop_by_hop[i], key)) return 1;
+  }
 
-  // Handle chunked header
-  const char *aTransferEncoding = http_parser_header_get(request, "transfer-encoding");
-  int isChunked = 0;
-  if (aTransferEncoding && strcasecmp(aTransferEncoding, "chunked")) {
-    isChunked = 1;
-    sprintf(result->data + strlen(result->data), "%lx\r\n", request->body->len);
+  // Headers named by the Connection header are hop-by-hop as well
+  while((connection = http_parser_header_next_atom(message, HTTP_PARSER_ATOM_CONNECTION, connection))) {
+    if (http_parser_list_contains(connection->value, key)) return 1;
   }
 
-  // Treat result as buffer from here
-  result->len = strlen(result->data);
+  return 0;
+}
 
-  if (request->body) {
-    buf_append(result, request->body->data, request->body->len);
+static void http_parser_forward_line(struct buf *result, const char *key, const char *value) {
+  buf_append(result, key, strlen(key));
+  buf_append(result, ": ", 2);
+  buf_append(result, value, strlen(value));
+  buf_append(result, "\r\n", 2);
+}
+
+/**
+ * Renders the head of a message for forwarding, applying the given edits
+ *
+ * Unmodified headers of a message with a kept head are copied as their
+ * original bytes, adjacent ones in a single append
+ */
+struct buf * http_parser_forward_head(struct http_parser_message *message, const struct http_parser_forward *edits) {
+  struct buf *result = calloc(1, sizeof(struct buf));
+  struct http_parser_forward noedits = {0};
+  struct http_parser_header *header;
+  const char *linebreak;
+  int runOffset = -1;
+  int runLength = 0;
+  int hostDone  = 0;
+  int i;
+
+  if (!edits) edits = &noedits;
+
+  // Start line, original bytes when available
+  if (message->head && (linebreak = strstr(message->head->data, "\r\n"))) {
+    buf_append(result, message->head->data, (linebreak - message->head->data) + 2);
+  } else if (message->method) {
+    _http_parser_sprint_request_line(result, message);
+  } else {
+    _http_parser_sprint_status_line(result, message);
   }
 
-  if (isChunked) {
-    buf_append(result, "0\r\n\r\n", 5);
+  for(i=0; i<message->headerCount; i++) {
+    header = &(message->headers[i]);
+
+    if (http_parser_forward_drops(message, header->key, edits)) continue;
+    if (edits->host && !strcasecmp(header->key, "host")) {
+      if (hostDone) continue;
+      hostDone = 1;
+    } else if (message->head && header->offset >= 0) {
+
+      // Extend or start a run of original bytes
+      if (runOffset >= 0 && (runOffset + runLength) == header->offset) {
+        runLength += header->length;
+        continue;
+      }
+      if (runOffset >= 0) buf_append(result, message->head->data + runOffset, runLength);
+      runOffset = header->offset;
+      runLength = header->length;
+      continue;
+    }
+
+    // Flush pending original bytes before a rendered header
+    if (runOffset >= 0) buf_append(result, message->head->data + runOffset, runLength);
+    runOffset = -1;
+
+    http_parser_forward_line(result, header->key, hostDone && !strcasecmp(header->key, "host") ? edits->host : header->value);
   }
+  if (runOffset >= 0) buf_append(result, message->head->data + runOffset, runLength);
 
-  if (isPathAllocced) {
-    free(path);
+  if (edits->host && !hostDone) {
+    http_parser_forward_line(result, "Host", edits->host);
+  }
+
+  // Repeated X-Forwarded-For headers combine into a single list
+  if (edits->forwardedFor) {
+    http_parser_forward_line(result, "X-Forwarded-For", edits->forwardedFor);
   }
 
+  buf_append(result, "\r\n", 2);
   return result;
 }
 
+// }}}
+
+/**
+ * Whether the final transfer coding of the value is chunked
+ */
+static int http_parser_is_chunked(const char *aTransferEncoding) {
+  const char *end   = aTransferEncoding + strlen(aTransferEncoding);
+  const char *start;
+  while(end > aTransferEncoding && (end[-1] == ' ' || end[-1] == '\t')) end--;
+  start = end;
+  while(start > aTransferEncoding && start[-1] != ',' && start[-1] != ' ' && start[-1] != '\t') start--;
+  return ((end - start) == 7) && !strncasecmp(start, "chunked", 7);
+}
+
+/**
+ * Decides how the body of a message is delimited once its headers are read,
+ * following RFC 9112 section 6.3
+ *
+ * Returns the state to continue in
+ */
+static int http_parser_message_framing(struct http_parser_message *message, int isResponse) {
+  const struct http_parser_header *connection = NULL;
+  const char *aTransferEncoding;
+  const char *aContentLength;
+
+  // Protocol switches, the connection's bytes after this message belong to
+  // the new protocol and are handed over through leftover
+  if (isResponse) {
+    message->upgrade = (message->status == 101) || ((message->_flags & _HTTP_PARSER_FLAG_CONNECT) && (message->status / 100 == 2));
+  } else if (http_parser_header_get_atom(message, HTTP_PARSER_ATOM_UPGRADE)) {
+    while((connection = http_parser_header_next_atom(message, HTTP_PARSER_ATOM_CONNECTION, connection))) {
+      if (http_parser_list_contains(connection->value, "upgrade")) message->upgrade = 1;
+    }
+  }
+
+  // Responses that never carry a body
+  if (isResponse && (
+      (message->_flags & _HTTP_PARSER_FLAG_HEAD) ||
+      (message->status < 200) ||
+      (message->status == 204) ||
+      (message->status == 304) ||
+      ((message->_flags & _HTTP_PARSER_FLAG_CONNECT) && (message->status / 100 == 2))
+  )) {
+    message->_contentLength = 0;
+    return _HTTP_PARSER_STATE_DONE;
+  }
+
+  // Streamed bodies are collected in buf, leaving body for received data
+  // Relayed bodies are left untouched
+  if (!message->keepHead) {
+    http_parser_message_decoder_start(message);
+    if (http_parser_message_is_streaming(message) && !message->buf) {
+      message->buf = calloc(1, sizeof(struct buf));
+      HTTP_PARSER_STAT(message, allocs, 1);
+    }
+  }
+
+  aTransferEncoding = http_parser_header_get_atom(message, HTTP_PARSER_ATOM_TRANSFER_ENCODING);
+  if (aTransferEncoding && http_parser_is_chunked(aTransferEncoding)) {
+    if (!message->buf) {
+      message->buf = calloc(1, sizeof(struct buf));
+      HTTP_PARSER_STAT(message, allocs, 1);
+    }
+    return _HTTP_PARSER_STATE_BODY_CHUNKED;
+  }
+
+  // Responses with a non-chunked transfer coding are read until close
+  if (isResponse && aTransferEncoding) {
+    return _HTTP_PARSER_STATE_UNTIL_CLOSE;
+  }
+
+  aContentLength = http_parser_header_get_atom(message, HTTP_PARSER_ATOM_CONTENT_LENGTH);
+  if (aContentLength) {
+    message->_contentLength = atol(aContentLength);
+    if (message->_contentLength < 0) return _HTTP_PARSER_STATE_PANIC;
+    return _HTTP_PARSER_STATE_BODY;
+  }
+
+  // Requests without framing have no body, responses last until close
+  if (isResponse) {
+    return _HTTP_PARSER_STATE_UNTIL_CLOSE;
+  }
+  message->_contentLength = 0;
+  return _HTTP_PARSER_STATE_DONE;
+}
+
+/**
+ * Moves any received bytes beyond the framed body into the message's
+ * leftover buffer, so they can be passed to the next message on the
+ * connection
+ */
+static void http_parser_message_split_leftover(struct http_parser_message *message, size_t offset) {
+  if (message->body->len <= offset) return;
+  if (!message->leftover) {
+    message->leftover = calloc(1, sizeof(struct buf));
+    HTTP_PARSER_STAT(message, allocs, 1);
+  }
+
+  // Whole buffer is leftover, hand it over without copying
+  if ((!offset) && (!message->leftover->len)) {
+    buf_clear(message->leftover);
+    free(message->leftover);
+    message->leftover = message->body;
+    message->body     = calloc(1, sizeof(struct buf));
+    return;
+  }
+
+  buf_append(message->leftover, message->body->data + offset, message->body->len - offset);
+  message->body->len          = offset;
+  message->body->data[offset] = '\0';
+}
+
+/**
+ * Finalizes the body once a message is complete
+ */
+static void http_parser_message_finish(struct http_parser_message *message) {
+
+  // Flush the content decoder, an incomplete encoded body is an error
+  if (http_parser_message_decoder_finish(message)) {
+    http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+    return;
+  }
+
+  // Temporary buffer > direct buffer
+  // Whatever remains after the chunked body belongs to the next message
+  if (message->buf) {
+    http_parser_message_split_leftover(message, 0);
+    buf_clear(message->body);
+    free(message->body);
+    message->body = message->buf;
+    message->buf  = NULL;
+  } else if (message->_contentLength >= 0) {
+    http_parser_message_split_leftover(message, message->_contentLength);
+  }
+
+  // Mark the message as ready
+  http_parser_message_completed(message);
+}
+
+/**
+ * Switches a message whose head is kept into relaying mode once the head is
+ * complete, handing the head over to the caller
+ */
+static void http_parser_message_relay_start(struct http_parser_message *message) {
+  if (message->_state == _HTTP_PARSER_STATE_BODY_CHUNKED) {
+    message->chunksize = -1;
+    http_parser_message_state(message, _HTTP_PARSER_STATE_RELAY_SIZE);
+    if (message->buf) {
+      buf_clear(message->buf);
+      free(message->buf);
+      message->buf = NULL;
+    }
+  } else if (message->_state == _HTTP_PARSER_STATE_BODY) {
+    http_parser_message_state(message, message->_contentLength ? _HTTP_PARSER_STATE_RELAY : _HTTP_PARSER_STATE_DONE);
+  }
+  http_parser_message_completed(message);
+}
+
+/**
+ * Determines how many bytes at the start of data belong to the body of a
+ * message whose head was kept, without copying or decoding them
+ *
+ * Returns 1 once the body is complete, 0 if more body is expected or -1 if the
+ * chunked framing is malformed
+ */
+int http_parser_message_relay(struct http_parser_message *message, const struct buf *data, size_t *consumed) {
+  size_t i = 0;
+  size_t n;
+  int digit;
+  char c;
+
+  while(i < data->len) {
+    switch(message->_state) {
+      case _HTTP_PARSER_STATE_UNTIL_CLOSE:
+        i = data->len;
+        break;
+
+      case _HTTP_PARSER_STATE_RELAY:
+        n = data->len - i;
+        if (n > (size_t)message->_contentLength) n = message->_contentLength;
+        message->_contentLength -= n;
+        i += n;
+        if (!message->_contentLength) http_parser_message_state(message, _HTTP_PARSER_STATE_DONE);
+        break;
+
+      // Chunk size, -1 until its first digit; sizes without digits or beyond
+      // an int would frame the body differently than the next hop does
+      case _HTTP_PARSER_STATE_RELAY_SIZE:
+        c     = data->data[i++];
+        digit = -1;
+        if (c >= '0' && c <= '9') {
+          digit = c - '0';
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+          digit = 10 + ((c | 0x20) - 'a');
+        }
+        if (digit >= 0) {
+          if (message->chunksize < 0) message->chunksize = 0;
+          if (message->chunksize > (INT_MAX - 15) / 16) {
+            http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+          } else {
+            message->chunksize = (message->chunksize * 16) + digit;
+          }
+        } else if (message->chunksize < 0) {
+          http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+        } else if (c == ';' || c == ' ' || c == '\t' || c == '\r') {
+          http_parser_message_state(message, _HTTP_PARSER_STATE_RELAY_EXT);
+        } else if (c == '\n') {
+          http_parser_message_state(message, message->chunksize ? _HTTP_PARSER_STATE_RELAY_DATA : _HTTP_PARSER_STATE_RELAY_LINE);
+        } else {
+          http_parser_message_state(message, _HTTP_PARSER_STATE_PANIC);
+        }
+        break;
+
+      case _HTTP_PARSER_STATE_RELAY_EXT:
+        if (data->data[i++] == '\n') {
+          http_parser_message_state(message, message->chunksize ? _HTTP_PARSER_STATE_RELAY_DATA : _HTTP_PARSER_STATE_RELAY_LINE);
+        }
+        break;
+
+      case _HTTP_PARSER_STATE_RELAY_DATA:
+        n = data->len - i;
+        if (n > (size_t)message->chunksize) n = message->chunksize;
+        message->chunksize -= n;
+        i += n;
+        if (!message->chunksize) http_parser_message_state(message, _HTTP_PARSER_STATE_RELAY_CRLF);
+        break;
+
+      case _HTTP_PARSER_STATE_RELAY_CRLF:
+        if (data->data[i++] == '\n') {
+          message->chunksize = -1;
+          http_parser_message_state(message, _HTTP_PARSER_STATE_RELAY_SIZE);
+        }
+        break;
+
+      // Start of a trailer line, an empty one ends the body
+      case _HTTP_PARSER_STATE_RELAY_LINE:
+        c = data->data[i++];
+        if (c == '\n') {
+          http_parser_message_state(message, _HTTP_PARSER_STATE_DONE);
+        } else if (c != '\r') {
+          http_parser_message_state(message, _HTTP_PARSER_STATE_RELAY_FIELD);
+        }
+        break;
+
+      case _HTTP_PARSER_STATE_RELAY_FIELD:
+        if (data->data[i++] == '\n') http_parser_message_state(message, _HTTP_PARSER_STATE_RELAY_LINE);
+        break;
+
+      case _HTTP_PARSER_STATE_PANIC:
+        *consumed = i;
+        return -1;
+
+      default:
+        *consumed = i;
+        return 1;
+    }
+  }
+
+  *consumed = i;
+  if (message->_state == _HTTP_PARSER_STATE_PANIC) return -1;
+  return message->_state == _HTTP_PARSER_STATE_DONE;
+}
+
+/**
+ * Configures a response's framing based on the request it answers
+ *
+ * Responses to HEAD requests never carry a body, nor do successful responses
+ * to CONNECT requests
+ */
+void http_parser_response_expect(struct http_parser_message *response, const struct http_parser_message *request) {
+  response->_flags &= ~(_HTTP_PARSER_FLAG_HEAD | _HTTP_PARSER_FLAG_CONNECT);
+  if (!request || !request->method) return;
+  if (!strcasecmp(request->method, "HEAD")) response->_flags |= _HTTP_PARSER_FLAG_HEAD;
+  if (!strcasecmp(request->method, "CONNECT")) response->_flags |= _HTTP_PARSER_FLAG_CONNECT;
+}
+
+/**
+ * Whether the message's head has been parsed, so its start line and headers
+ * can be read while the body is still arriving
+ *
+ * Returns 1 once the head is complete, 0 if more data is needed or -1 if the
+ * message is malformed
+ */
+int http_parser_message_head_complete(struct http_parser_message *message) {
+  if (message->_state == _HTTP_PARSER_STATE_PANIC) return -1;
+  if (message->ready) return 1;
+  return (message->_state != _HTTP_PARSER_STATE_INIT) && (message->_state != _HTTP_PARSER_STATE_HEADER);
+}
+
+/**
+ * Signals the connection the response was read from has been closed
+ *
+ * Completes responses delimited by the connection closing and chunked ones
+ * missing the empty line after their last chunk, marks any other incomplete
+ * response as failed
+ */
+void http_parser_response_eof(struct http_parser_message *response) {
+  if (response->ready) return;
+
+  // Tolerate senders omitting the empty line after the last chunk
+  if (response->_state == _HTTP_PARSER_STATE_TRAILER && !response->body->len) {
+    http_parser_message_state(response, _HTTP_PARSER_STATE_DONE);
+    http_parser_message_finish(response);
+    return;
+  }
+  if (response->_state == _HTTP_PARSER_STATE_UNTIL_CLOSE) {
+    http_parser_message_state(response, _HTTP_PARSER_STATE_DONE);
+    http_parser_message_finish(response);
+    return;
+  }
+  http_parser_message_state(response, _HTTP_PARSER_STATE_PANIC);
+}
+
+static void http_parser_pair_emit(struct http_parser_pair *pair, void (*cb)(struct http_parser_event*)) {
+  struct http_parser_event ev = {
+    .request  = pair->request,
+    .response = pair->response,
+    .pair     = pair,
+    .udata    = pair->udata,
+  };
+  cb(&ev);
+}
+
 /**
  * Pass data into the pair's request
  *
  * Triggers onRequest if set
  */
 void http_parser_pair_request_data(struct http_parser_pair *pair, const struct buf *data) {
-  struct http_parser_event *ev;
+  void (*cb)(struct http_parser_event*);
+  http_parser_pair_prepare(pair);
   http_parser_request_data(pair->request, data);
   if (pair->request->ready && pair->onRequest) {
-    ev           = calloc(1,sizeof(struct http_parser_event));
-    ev->request  = pair->request;
-    ev->response = pair->response;
-    ev->pair     = pair;
-    ev->udata    = pair->udata;
-    pair->onRequest(ev);
-    free(ev);
+    cb              = pair->onRequest;
     pair->onRequest = NULL;
+    http_parser_pair_emit(pair, cb);
   }
 }
 
 /**
- * Pass data into the pair's request
+ * Pass data into the pair's response, framed by the pair's request
  *
  * Triggers onResponse if set
  */
 void http_parser_pair_response_data(struct http_parser_pair *pair, const struct buf *data) {
-  struct http_parser_event *ev;
+  void (*cb)(struct http_parser_event*);
+  http_parser_pair_prepare(pair);
+  if (pair->response->_state == _HTTP_PARSER_STATE_INIT) {
+    http_parser_response_expect(pair->response, pair->request);
+  }
   http_parser_response_data(pair->response, data);
   if (pair->response->ready && pair->onResponse) {
-    ev           = calloc(1,sizeof(struct http_parser_event));
-    ev->request  = pair->request;
-    ev->response = pair->response;
-    ev->pair     = pair;
-    ev->udata    = pair->udata;
-    pair->onResponse(ev);
-    free(ev);
+    cb               = pair->onResponse;
     pair->onResponse = NULL;
+    http_parser_pair_emit(pair, cb);
+  }
+}
+
+/**
+ * Signals the pair's response connection has been closed
+ *
+ * Triggers onResponse if that completed the response
+ */
+void http_parser_pair_response_eof(struct http_parser_pair *pair) {
+  void (*cb)(struct http_parser_event*);
+  http_parser_pair_prepare(pair);
+  http_parser_response_eof(pair->response);
+  if (pair->response->ready && pair->onResponse) {
+    cb               = pair->onResponse;
+    pair->onResponse = NULL;
+    http_parser_pair_emit(pair, cb);
   }
 }
 
@@ -547,14 +1914,24 @@ void http_parser_pair_response_data(struct http_parser_pair *pair, const struct
  * Insert data into a http_message, acting as if it's a request
  */
 void http_parser_request_data(struct http_parser_message *request, const struct buf *data) {
+  const char *line;
   char *index;
-  const char *aContentLength;
-  int iContentLength;
-  const char *aChunkSize;
+  size_t size;
   int res;
 
+  // Data after a completed request belongs to the next one
+  if (request->ready) {
+    if (!request->leftover) request->leftover = calloc(1, sizeof(struct buf));
+    buf_append(request->leftover, data->data, data->len);
+    return;
+  }
+
   // Add event data to buffer
-  if (!request->body) request->body = calloc(1, sizeof(struct buf));
+  http_parser_message_received(request, data->len);
+  if (!request->body) {
+    request->body = calloc(1, sizeof(struct buf));
+    HTTP_PARSER_STAT(request, allocs, 1);
+  }
   buf_append(request->body, data->data, data->len);
 
   while(1) {
@@ -565,23 +1942,36 @@ void http_parser_request_data(struct http_parser_message *request, const struct
 
         // Wait for more data if not line break found
         index = strstr(request->body->data, "\r\n");
+        HTTP_PARSER_STAT(request, scanned, index ? (size_t)(index - request->body->data) + 2 : request->body->len);
         if (!index) return;
+
+        // Ignore empty lines preceding the request line
+        if (index == request->body->data) {
+          http_parser_message_remove_body_bytes(request, 2);
+          break;
+        }
+        http_parser_message_keep_line(request, index);
         *(index) = '\0';
 
-        // Read method and path
-        request->method  = calloc(1, 16);
-        request->path    = calloc(1, 8192);
-        request->version = calloc(1, 4);
-        if (sscanf(request->body->data, "%15s %8191s HTTP/%3s", request->method, request->path, request->version) != 3) {
-          request->_state = _HTTP_PARSER_STATE_PANIC;
+        // Read method, path and version, each sized to fit
+        line             = request->body->data;
+        request->method  = http_parser_token_dup(&line, 15);
+        request->path    = request->method ? http_parser_token_dup(&line, 8191) : NULL;
+        while(*line == ' ' || *line == '\t') line++;
+        if (request->path && !strncmp(line, "HTTP/", 5)) {
+          line            += 5;
+          request->version = http_parser_token_dup(&line, 3);
+        }
+        HTTP_PARSER_STAT(request, allocs, !!request->method + !!request->path + !!request->version);
+        if (!request->version) {
+          http_parser_message_state(request, _HTTP_PARSER_STATE_PANIC);
           return;
         }
 
         // Remove method line
         http_parser_message_remove_body_string(request);
 
-        // Detect query
-        // No need to malloc, already done by sscanf
+        // Detect query, it shares the path's allocation
         index = strstr(request->path, "?");
         if (index) {
           *(index) = '\0';
@@ -589,99 +1979,106 @@ void http_parser_request_data(struct http_parser_message *request, const struct
         }
 
         // Signal we're now reading headers
-        request->_state = _HTTP_PARSER_STATE_HEADER;
+        http_parser_message_state(request, _HTTP_PARSER_STATE_HEADER);
         break;
 
       case _HTTP_PARSER_STATE_HEADER:
-        if (!http_parser_message_read_header(request)) {
-          if (
-              http_parser_header_get(request, "content-length") ||
-              http_parser_header_get(request, "transfer-encoding")
-          ) {
-            request->_state = _HTTP_PARSER_STATE_BODY;
-          } else {
-            request->_state = _HTTP_PARSER_STATE_DONE;
+        res = http_parser_message_read_header(request);
+        if (res == 0) {
+          http_parser_message_state(request, http_parser_message_framing(request, 0));
+
+          // Hand over the head, the body is relayed by the caller
+          if (request->keepHead) {
+            http_parser_message_relay_start(request);
+            return;
           }
+        } else if (res == 1) {
+          // More data needed
+          return;
         }
         break;
 
       case _HTTP_PARSER_STATE_BODY:
 
-        // Detect chunked encoding
-        if (request->chunksize == -1) {
-          aChunkSize = http_parser_header_get(request, "transfer-encoding");
-          if (aChunkSize) {
-            if (!strcasecmp(aChunkSize, "chunked")) {
-              request->_state = _HTTP_PARSER_STATE_BODY_CHUNKED;
-              break;
-            }
-          }
-        }
-
-        // Fetch the content length
-        aContentLength = http_parser_header_get(request, "content-length");
-        if (!aContentLength) {
-          request->_state = _HTTP_PARSER_STATE_DONE;
-          break;
+        // Pass on received body data while streaming
+        if (request->buf) {
+          size = request->body->len;
+          if (size > request->_contentLength) size = request->_contentLength;
+          http_parser_message_emit_body(request, request->body->data, size);
+          http_parser_message_remove_body_bytes(request, size);
+          request->_contentLength -= size;
+          if (request->_state == _HTTP_PARSER_STATE_PANIC) return;
+          if (request->_contentLength) return;
         }
-        iContentLength = atoi(aContentLength);
 
         // Not enough data = skip
-        if (request->body->len < iContentLength) {
+        if (request->body->len < request->_contentLength) {
           return;
         }
 
-        // Change size to indicated size
-        request->_state = _HTTP_PARSER_STATE_DONE;
+        http_parser_message_state(request, _HTTP_PARSER_STATE_DONE);
         break;
 
       case _HTTP_PARSER_STATE_BODY_CHUNKED:
         res = http_parser_message_read_chunked(request);
 
         if (res == 0) {
-          // Done
-          request->_state = _HTTP_PARSER_STATE_DONE;
+          // Last chunk, trailers may follow
+          http_parser_message_state(request, _HTTP_PARSER_STATE_TRAILER);
         } else if (res == 1) {
           // More data needed
           return;
         } else if (res == 2) {
           // Still reading
         }
+        if (request->_state == _HTTP_PARSER_STATE_PANIC) return;
 
         break;
 
-      case _HTTP_PARSER_STATE_DONE:
-
-        // Temporary buffer > direct buffer
-        if (request->buf) {
-          if (request->body) {
-            buf_clear(request->body);
-            free(request->body);
-          }
-          request->body = request->buf;
-          request->buf  = NULL;
+      case _HTTP_PARSER_STATE_TRAILER:
+        // A read may end right after the last chunk, trailers can follow
+        if (!request->body->len) return;
+        res = http_parser_message_read_header(request);
+        if (res == 0) {
+          http_parser_message_state(request, _HTTP_PARSER_STATE_DONE);
+        } else if (res == 1) {
+          return;
         }
+        break;
+
+      case _HTTP_PARSER_STATE_DONE:
+        http_parser_message_finish(request);
+        return;
 
-        // Mark the request as ready
-        request->ready  = 1;
+      default:
         return;
     }
   }
 }
 
 /**
- * Insert data into a http_message, acting as if it's a request
+ * Insert data into a http_message, acting as if it's a response
  */
 void http_parser_response_data(struct http_parser_message *response, const struct buf *data) {
+  const char *line;
   char *index;
   char *aStatus;
-  int iContentLength;
-  const char *aContentLength;
-  const char *aChunkSize;
+  size_t size;
   int res;
 
+  // Data after a completed response belongs to the next one
+  if (response->ready) {
+    if (!response->leftover) response->leftover = calloc(1, sizeof(struct buf));
+    buf_append(response->leftover, data->data, data->len);
+    return;
+  }
+
   // Add event data to buffer
-  if (!response->body) response->body = calloc(1, sizeof(struct buf));
+  http_parser_message_received(response, data->len);
+  if (!response->body) {
+    response->body = calloc(1, sizeof(struct buf));
+    HTTP_PARSER_STAT(response, allocs, 1);
+  }
   buf_append(response->body, data->data, data->len);
 
   while(1) {
@@ -691,99 +2088,126 @@ void http_parser_response_data(struct http_parser_message *response, const struc
       case _HTTP_PARSER_STATE_INIT:
         // Wait for more data if not line break found
         index = strstr(response->body->data, "\r\n");
+        HTTP_PARSER_STAT(response, scanned, index ? (size_t)(index - response->body->data) + 2 : response->body->len);
         if (!index) return;
+
+        // Ignore empty lines preceding the status line
+        if (index == response->body->data) {
+          http_parser_message_remove_body_bytes(response, 2);
+          break;
+        }
+        http_parser_message_keep_line(response, index);
         *(index) = '\0';
 
-        // Read version and status
-        response->version       = calloc(1, 8);
-        response->statusMessage = calloc(1, 64);
-        aStatus                 = calloc(1, 8);
-        if (sscanf(response->body->data, "HTTP/%7s %7s %63[^\r\n]", response->version, aStatus, response->statusMessage) != 3) {
-          response->_state = _HTTP_PARSER_STATE_PANIC;
+        // Read version and status, the reason phrase may be empty
+        line = response->body->data;
+        if (response->version) free(response->version);
+        response->version = NULL;
+        if (!strncmp(line, "HTTP/", 5)) {
+          line             += 5;
+          response->version = http_parser_token_dup(&line, 7);
+        }
+        aStatus = response->version ? http_parser_token_dup(&line, 7) : NULL;
+        HTTP_PARSER_STAT(response, allocs, !!response->version + !!aStatus);
+        if (!aStatus) {
+          http_parser_message_state(response, _HTTP_PARSER_STATE_PANIC);
           return;
         }
 
         // Turn the text status into a number
         response->status = atoi(aStatus);
         free(aStatus);
+        while(*line == ' ' || *line == '\t') line++;
+        response->statusMessage = strdup(line);
+        HTTP_PARSER_STAT(response, allocs, !!response->statusMessage);
 
         // Remove status line
         http_parser_message_remove_body_string(response);
 
         // Signal we're now reading headers
-        response->_state = _HTTP_PARSER_STATE_HEADER;
+        http_parser_message_state(response, _HTTP_PARSER_STATE_HEADER);
         break;
 
       case _HTTP_PARSER_STATE_HEADER:
-        if (!http_parser_message_read_header(response)) {
-          if (
-              http_parser_header_get(response, "content-length") ||
-              http_parser_header_get(response, "transfer-encoding")
-          ) {
-            response->_state = _HTTP_PARSER_STATE_BODY;
-          } else {
-            response->_state = _HTTP_PARSER_STATE_DONE;
+        res = http_parser_message_read_header(response);
+        if (res == 0) {
+          http_parser_message_state(response, http_parser_message_framing(response, 1));
+
+          // Hand over the head, the body is relayed by the caller
+          if (response->keepHead) {
+            http_parser_message_relay_start(response);
+            return;
           }
+        } else if (res == 1) {
+          // More data needed
+          return;
         }
         break;
 
       case _HTTP_PARSER_STATE_BODY:
-        // Detect chunked encoding
-        if (response->chunksize == -1) {
-          aChunkSize = http_parser_header_get(response, "transfer-encoding");
-          if (aChunkSize) {
-            if (!strcasecmp(aChunkSize, "chunked")) {
-              response->_state = _HTTP_PARSER_STATE_BODY_CHUNKED;
-              break;
-            }
-          }
-        }
 
-        // Fetch the content length
-        aContentLength = http_parser_header_get(response, "content-length");
-        if (!aContentLength) {
-          response->_state = _HTTP_PARSER_STATE_DONE;
-          break;
+        // Pass on received body data while streaming
+        if (response->buf) {
+          size = response->body->len;
+          if (size > response->_contentLength) size = response->_contentLength;
+          http_parser_message_emit_body(response, response->body->data, size);
+          http_parser_message_remove_body_bytes(response, size);
+          response->_contentLength -= size;
+          if (response->_state == _HTTP_PARSER_STATE_PANIC) return;
+          if (response->_contentLength) return;
         }
-        iContentLength = atoi(aContentLength);
 
         // Not enough data = skip
-        if (response->body->len < iContentLength) {
+        if (response->body->len < response->_contentLength) {
           return;
         }
 
-        // Change size to indicated size
-        response->_state = _HTTP_PARSER_STATE_DONE;
+        http_parser_message_state(response, _HTTP_PARSER_STATE_DONE);
         break;
 
+      case _HTTP_PARSER_STATE_UNTIL_CLOSE:
+
+        // Pass on received body data while streaming
+        if (response->buf) {
+          http_parser_message_emit_body(response, response->body->data, response->body->len);
+          http_parser_message_remove_body_bytes(response, response->body->len);
+        }
+
+        // Completed by http_parser_response_eof
+        return;
+
       case _HTTP_PARSER_STATE_BODY_CHUNKED:
         res = http_parser_message_read_chunked(response);
 
         if (res == 0) {
-          // Done
-          response->_state = _HTTP_PARSER_STATE_DONE;
+          // Last chunk, trailers may follow
+          http_parser_message_state(response, _HTTP_PARSER_STATE_TRAILER);
         } else if (res == 1) {
           // More data needed
           return;
         } else if (res == 2) {
           // Still reading
         }
+        if (response->_state == _HTTP_PARSER_STATE_PANIC) return;
 
         break;
 
-      case _HTTP_PARSER_STATE_DONE:
-        // Temporary buffer > direct buffer
-        if (response->buf) {
-          if (response->body) {
-            buf_clear(response->body);
-            free(response->body);
-          }
-          response->body = response->buf;
-          response->buf  = NULL;
+      case _HTTP_PARSER_STATE_TRAILER:
+        // A read may end right after the last chunk, trailers can follow
+        if (!response->body->len) return;
+        res = http_parser_message_read_header(response);
+        if (res == 0) {
+          http_parser_message_state(response, _HTTP_PARSER_STATE_DONE);
+        } else if (res == 1) {
+          return;
         }
+        break;
+
+      case _HTTP_PARSER_STATE_DONE:
+        http_parser_message_finish(response);
+        return;
 
-        // Mark the request as ready
-        response->ready = 1;
+      default:
         return;
     }
   }
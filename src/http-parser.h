@@ -5,9 +5,26 @@
 extern "C" {
 #endif
 
+#include <time.h>
+
 #include "finwo/mindex.h"
 #include "tidwall/buf.h"
 
+#if defined(_MSC_VER)
+#define HTTP_PARSER_THREAD_LOCAL __declspec(thread)
+#else
+#define HTTP_PARSER_THREAD_LOCAL __thread
+#endif
+
+// Default bound on a decoded body collected in memory, see decodeLimit
+#ifndef HTTP_PARSER_DECODE_LIMIT
+#define HTTP_PARSER_DECODE_LIMIT (64 * 1024 * 1024)
+#endif
+
+struct http_parser_zstream;
+struct http_parser_stats;
+struct http_parser_pool;
+
 struct http_parser_event {
   struct http_parser_message *request;
   struct http_parser_message *response;
@@ -16,8 +33,17 @@ struct http_parser_event {
   void *udata;
 };
 
+struct http_parser_header {
+  char *key;
+  char *value;
+  int atom;
+  int offset;
+  int length;
+};
+
 struct http_parser_message {
   int ready;
+  int upgrade;
   int status;
   char *statusMessage;
   char *method;
@@ -25,31 +51,87 @@ struct http_parser_message {
   char *query;
   char *version;
   struct mindex_t *meta;
+  struct http_parser_header *headers;
+  int headerCount;
+  int headerCap;
   struct buf *body;
   struct buf *buf;
+  struct buf *leftover;
+  struct buf *head;
+  int keepHead;
+  int decodeBody;
+  size_t decodeLimit;
+  size_t spillThreshold;
+  int bodyFd;
   int chunksize;
+  long _contentLength;
+  int _flags;
   int _state;
+  long long _started;
+  size_t _spillLength;
+  void *_bodyMap;
+  struct http_parser_zstream *_decoder;
+  struct http_parser_stats *stats;
+  struct http_parser_pool *_pool;
+  struct http_parser_message *_poolNext;
   void (*onChunk)(struct http_parser_event*);
   void *udata;
 };
 
+struct http_parser_forward {
+  const char *host;
+  const char *forwardedFor;
+  const char *const *drop;
+  int keepHopByHop;
+};
+
+// An entry of a comma-separated header value, pointing into the value
+struct http_parser_list_item {
+  const char *token;
+  size_t tokenLength;
+  const char *value;
+  size_t valueLength;
+  const char *params;
+  size_t paramsLength;
+  int q;
+};
+
 struct http_parser_pair {
   struct http_parser_message *request;
   struct http_parser_message *response;
   void *udata;
   void (*onRequest)(struct http_parser_event*);
   void (*onResponse)(struct http_parser_event*);
+  struct http_parser_pool *_pool;
+  struct http_parser_pair *_poolNext;
 };
 
 // Meta management
 const char * http_parser_meta_get(struct http_parser_message *subject, const char *key);
 void http_parser_meta_set(struct http_parser_message *subject, const char *key, const char *value);
 void http_parser_meta_del(struct http_parser_message *subject, const char *key);
+int http_parser_meta_count(struct http_parser_message *subject);
+const char * http_parser_meta_nth(struct http_parser_message *subject, int n, const char **value);
 
 // Header management
 const char * http_parser_header_get(struct http_parser_message *subject, const char *key);
 void http_parser_header_set(struct http_parser_message *subject ,const char *key, const char *value);
+void http_parser_header_add(struct http_parser_message *subject, const char *key, const char *value);
 void http_parser_header_del(struct http_parser_message *subject, const char *key);
+int http_parser_header_count(struct http_parser_message *subject);
+const struct http_parser_header * http_parser_header_nth(struct http_parser_message *subject, int n);
+const struct http_parser_header * http_parser_header_next(struct http_parser_message *subject, const char *key, const struct http_parser_header *prev);
+
+// Interned header names, atoms are listed in http-parser-atoms.h
+int http_parser_header_atom(const char *key);
+const char * http_parser_atom_name(int atom);
+const char * http_parser_header_get_atom(struct http_parser_message *subject, int atom);
+const struct http_parser_header * http_parser_header_next_atom(struct http_parser_message *subject, int atom, const struct http_parser_header *prev);
+
+// Comma-separated header values
+const char * http_parser_list_next(const char *cursor, struct http_parser_list_item *item);
+int http_parser_list_contains(const char *list, const char *token);
+int http_parser_list_negotiate(const char *list, const char *const *offers);
 
 struct http_parser_pair    * http_parser_pair_init(void *udata);
 struct http_parser_message * http_parser_request_init();
@@ -58,17 +140,34 @@ struct http_parser_message * http_parser_response_init();
 void http_parser_request_data(struct http_parser_message *request, const struct buf *data);
 void http_parser_response_data(struct http_parser_message *response, const struct buf *data);
 
+void http_parser_response_expect(struct http_parser_message *response, const struct http_parser_message *request);
+void http_parser_response_eof(struct http_parser_message *response);
+
+const char * http_parser_message_body_map(struct http_parser_message *message, size_t *length);
+
+int http_parser_message_head_complete(struct http_parser_message *message);
+int http_parser_message_relay(struct http_parser_message *message, const struct buf *data, size_t *consumed);
+
 void http_parser_pair_request_data(struct http_parser_pair *pair, const struct buf *data);
 void http_parser_pair_response_data(struct http_parser_pair *pair, const struct buf *data);
+void http_parser_pair_response_eof(struct http_parser_pair *pair);
 
 void http_parser_pair_free(struct http_parser_pair *pair);
+void http_parser_pair_release(struct http_parser_pair *pair);
 void http_parser_message_free(struct http_parser_message *subject);
 
 const char * http_parser_status_message(int status);
+const char * http_parser_date();
+char * http_parser_date_format(time_t time, char *out, size_t size);
 struct buf * http_parser_sprint_pair_response(struct http_parser_pair *pair);
 struct buf * http_parser_sprint_pair_request(struct http_parser_pair *pair);
 struct buf * http_parser_sprint_response(struct http_parser_message *response);
 struct buf * http_parser_sprint_request(struct http_parser_message *request);
+void http_parser_sprint_response_into(struct buf *result, struct http_parser_message *response);
+void http_parser_sprint_request_into(struct buf *result, struct http_parser_message *request);
+void http_parser_sprint_pair_response_into(struct buf *result, struct http_parser_pair *pair);
+void http_parser_sprint_pair_request_into(struct buf *result, struct http_parser_pair *pair);
+struct buf * http_parser_forward_head(struct http_parser_message *message, const struct http_parser_forward *edits);
 
 #ifdef __cplusplus
 } // extern "C"
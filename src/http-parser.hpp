@@ -0,0 +1,269 @@
+#ifndef _HTTP_PARSER_HPP_
+#define _HTTP_PARSER_HPP_
+
+// Header-only C++17 layer over http-parser.h
+//
+// Messages, pairs and buffers own their C counterparts and are move-only.
+// Accessors return string_views into the parsed message, valid until the
+// message is modified or freed.
+
+#include <cstddef>
+#include <cstdlib>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "http-parser.h"
+
+namespace http_parser {
+
+  /**
+   * Owns a struct buf, appended to by serialization
+   */
+  class buffer {
+    public:
+      buffer() noexcept : _buf{} {}
+
+      // Adopts a buffer returned by http_parser_sprint_*
+      explicit buffer(struct buf *adopt) noexcept : _buf(*adopt) { std::free(adopt); }
+
+      buffer(const buffer&) = delete;
+      buffer& operator=(const buffer&) = delete;
+      buffer(buffer &&other) noexcept : _buf(other._buf) { other._buf = {}; }
+      buffer& operator=(buffer &&other) noexcept {
+        if (this != &other) {
+          reset();
+          _buf       = other._buf;
+          other._buf = {};
+        }
+        return *this;
+      }
+      ~buffer() { reset(); }
+
+      const char * data() const noexcept { return _buf.data; }
+      std::size_t size() const noexcept { return _buf.len; }
+      bool empty() const noexcept { return !_buf.len; }
+      std::string_view view() const noexcept { return { _buf.data, _buf.len }; }
+
+      // Empties the buffer, keeping its allocation for the next message
+      void clear() noexcept { _buf.len = 0; }
+
+      // Releases the allocation
+      void reset() noexcept { if (_buf.data) buf_clear(&_buf); _buf = {}; }
+
+      struct buf * get() noexcept { return &_buf; }
+
+    private:
+      struct buf _buf;
+  };
+
+  /**
+   * Non-owning access to a request or response
+   */
+  class message_view {
+    public:
+      message_view() noexcept = default;
+      message_view(struct http_parser_message *message, bool isRequest) noexcept : _message(message), _request(isRequest) {}
+
+      bool ready() const noexcept { return _message->ready; }
+      bool is_request() const noexcept { return _request; }
+      int status() const noexcept { return _message->status; }
+      std::string_view status_message() const noexcept { return _str(_message->statusMessage); }
+      std::string_view method() const noexcept { return _str(_message->method); }
+      std::string_view path() const noexcept { return _str(_message->path); }
+      std::string_view query() const noexcept { return _str(_message->query); }
+      std::string_view version() const noexcept { return _str(_message->version); }
+      std::string_view body() const noexcept {
+        if (!_message->body) return {};
+        return { _message->body->data, _message->body->len };
+      }
+
+      // First header with the name, case-insensitive, or an empty view
+      std::string_view header(std::string_view key) const noexcept {
+        for (int i = 0; i < _message->headerCount; i++) {
+          if (_iequals(_message->headers[i].key, key)) return _message->headers[i].value;
+        }
+        return {};
+      }
+
+      bool has_header(std::string_view key) const noexcept {
+        for (int i = 0; i < _message->headerCount; i++) {
+          if (_iequals(_message->headers[i].key, key)) return true;
+        }
+        return false;
+      }
+
+      // Calls fn(key, value) for every header in arrival order
+      template<class F>
+      void for_each_header(F &&fn) const {
+        for (int i = 0; i < _message->headerCount; i++) {
+          fn(std::string_view(_message->headers[i].key), std::string_view(_message->headers[i].value));
+        }
+      }
+
+      void set_status(int status) noexcept { _message->status = status; }
+      void set_header(const char *key, const char *value) { http_parser_header_set(_message, key, value); }
+      void add_header(const char *key, const char *value) { http_parser_header_add(_message, key, value); }
+      void del_header(const char *key) { http_parser_header_del(_message, key); }
+
+      void set_body(std::string_view data) {
+        if (!_message->body) _message->body = static_cast<struct buf *>(std::calloc(1, sizeof(struct buf)));
+        _message->body->len = 0;
+        buf_append(_message->body, data.data(), data.size());
+      }
+
+      void feed(std::string_view data) {
+        struct buf chunk = { const_cast<char *>(data.data()), data.size(), data.size() };
+        if (_request) http_parser_request_data(_message, &chunk);
+        else http_parser_response_data(_message, &chunk);
+      }
+
+      // Appends the serialized message to the buffer
+      void serialize(buffer &out) const {
+        if (_request) http_parser_sprint_request_into(out.get(), _message);
+        else http_parser_sprint_response_into(out.get(), _message);
+      }
+
+      struct http_parser_message * get() const noexcept { return _message; }
+      explicit operator bool() const noexcept { return _message != nullptr; }
+
+    protected:
+      struct http_parser_message *_message = nullptr;
+      bool _request = false;
+
+    private:
+      static std::string_view _str(const char *str) noexcept {
+        return str ? std::string_view(str) : std::string_view();
+      }
+
+      static char _lower(char c) noexcept {
+        return (c >= 'A' && c <= 'Z') ? (c | 0x20) : c;
+      }
+
+      static bool _iequals(const char *str, std::string_view key) noexcept {
+        std::size_t i = 0;
+        for (; str[i] && i < key.size(); i++) {
+          if (_lower(str[i]) != _lower(key[i])) return false;
+        }
+        return !str[i] && i == key.size();
+      }
+  };
+
+  /**
+   * Owning request or response, freed on destruction
+   */
+  class message : public message_view {
+    public:
+      static message request() { return message(http_parser_request_init(), true); }
+      static message response() { return message(http_parser_response_init(), false); }
+
+      message(struct http_parser_message *adopt, bool isRequest) noexcept : message_view(adopt, isRequest) {}
+      message(const message&) = delete;
+      message& operator=(const message&) = delete;
+      message(message &&other) noexcept : message_view(other.release(), other._request) {}
+      message& operator=(message &&other) noexcept {
+        if (this != &other) {
+          if (_message) http_parser_message_free(_message);
+          _request = other._request;
+          _message = other.release();
+        }
+        return *this;
+      }
+      ~message() { if (_message) http_parser_message_free(_message); }
+
+      struct http_parser_message * release() noexcept { return std::exchange(_message, nullptr); }
+  };
+
+  struct event {
+    message_view request;
+    message_view response;
+    struct http_parser_pair *pair;
+  };
+
+  struct no_handler {
+    void operator()(event&) const noexcept {}
+  };
+
+  /**
+   * Owning request/response pair
+   *
+   * The handlers are stored by value and called through a trampoline per
+   * handler type, so lambdas are inlined rather than called indirectly. As
+   * with the C callbacks, each handler fires once.
+   */
+  template<class OnRequest = no_handler, class OnResponse = no_handler>
+  class pair {
+    public:
+      explicit pair(OnRequest onRequest = OnRequest(), OnResponse onResponse = OnResponse())
+        : _pair(http_parser_pair_init(nullptr)), _onRequest(std::move(onRequest)), _onResponse(std::move(onResponse)) {
+        _pair->udata = this;
+        if constexpr (!std::is_same_v<OnRequest, no_handler>) _pair->onRequest = &pair::_emitRequest;
+        if constexpr (!std::is_same_v<OnResponse, no_handler>) _pair->onResponse = &pair::_emitResponse;
+      }
+
+      pair(const pair&) = delete;
+      pair& operator=(const pair&) = delete;
+      pair(pair &&other) noexcept
+        : _pair(std::exchange(other._pair, nullptr)), _onRequest(std::move(other._onRequest)), _onResponse(std::move(other._onResponse)) {
+        if (_pair) _pair->udata = this;
+      }
+      pair& operator=(pair &&other) noexcept {
+        if (this != &other) {
+          if (_pair) http_parser_pair_free(_pair);
+          _pair       = std::exchange(other._pair, nullptr);
+          _onRequest  = std::move(other._onRequest);
+          _onResponse = std::move(other._onResponse);
+          if (_pair) _pair->udata = this;
+        }
+        return *this;
+      }
+      ~pair() { if (_pair) http_parser_pair_free(_pair); }
+
+      message_view request() const noexcept { return { _pair->request, true }; }
+      message_view response() const noexcept { return { _pair->response, false }; }
+
+      void request_data(std::string_view data) {
+        struct buf chunk = { const_cast<char *>(data.data()), data.size(), data.size() };
+        http_parser_pair_request_data(_pair, &chunk);
+      }
+
+      void response_data(std::string_view data) {
+        struct buf chunk = { const_cast<char *>(data.data()), data.size(), data.size() };
+        http_parser_pair_response_data(_pair, &chunk);
+      }
+
+      void response_eof() { http_parser_pair_response_eof(_pair); }
+
+      // Appends the response, without a body when answering a HEAD request
+      void serialize_response(buffer &out) const { http_parser_sprint_pair_response_into(out.get(), _pair); }
+      void serialize_request(buffer &out) const { http_parser_sprint_pair_request_into(out.get(), _pair); }
+
+      struct http_parser_pair * get() const noexcept { return _pair; }
+
+    private:
+      struct http_parser_pair *_pair;
+      OnRequest _onRequest;
+      OnResponse _onResponse;
+
+      static void _emitRequest(struct http_parser_event *ev) {
+        pair *self = static_cast<pair *>(ev->udata);
+        event e{ { ev->request, true }, { ev->response, false }, ev->pair };
+        self->_onRequest(e);
+      }
+
+      static void _emitResponse(struct http_parser_event *ev) {
+        pair *self = static_cast<pair *>(ev->udata);
+        event e{ { ev->request, true }, { ev->response, false }, ev->pair };
+        self->_onResponse(e);
+      }
+  };
+
+  template<class OnRequest>
+  pair(OnRequest) -> pair<OnRequest>;
+
+  template<class OnRequest, class OnResponse>
+  pair(OnRequest, OnResponse) -> pair<OnRequest, OnResponse>;
+
+}
+
+#endif // _HTTP_PARSER_HPP_
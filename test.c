@@ -1,7 +1,26 @@
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "http-parser.h"
+#include "http-parser-atoms.h"
+#include "http-parser-cache.h"
+#include "http-parser-conditional.h"
+#include "http-parser-encoding.h"
+#include "http-parser-h2.h"
+#include "http-parser-multipart.h"
+#include "http-parser-pool.h"
+#include "http-parser-range.h"
+#include "http-parser-replay.h"
+#include "http-parser-snapshot.h"
+#include "http-parser-queue.h"
+#include "http-parser-stats.h"
+#include "http-parser-template.h"
+#include "http-parser-uring.h"
+#include "http-parser-websocket.h"
 
 #ifndef NULL
 #define NULL ((void*)0)
@@ -64,12 +83,13 @@ char *postMessage =
   "Hello World\r\n"
 ;
 
-char *postOrderedMessage = 
-  "POST /foobar HTTP/1.1\r\n"
-  "Content-Length: 13\r\n"
-  "Host: localhost\r\n"
+char *duplicateHeaderMessage =
+  "HTTP/1.1 200 OK\r\n"
+  "Set-Cookie: a=1\r\n"
+  "Via: 1.1 alpha\r\n"
+  "Set-Cookie: b=2\r\n"
+  "Content-Length: 0\r\n"
   "\r\n"
-  "Hello World\r\n"
 ;
 
 char *postChunkedMessage =
@@ -123,16 +143,292 @@ char *responseNotFoundExtendedMessage =
   "Not Found\r\n"
 ;
 
+char *headRequest =
+  "HEAD /foobar HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "\r\n"
+;
+
+char *headResponse =
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Length: 13\r\n"
+  "\r\n"
+;
+
+char *untilCloseResponse =
+  "HTTP/1.0 200 OK\r\n"
+  "Content-Type: text/plain\r\n"
+  "\r\n"
+  "Hello"
+;
+
+char *pipelinedResponses =
+  "HTTP/1.1 204 No Content\r\n"
+  "\r\n"
+  "HTTP/1.1 200 OK\r\n"
+  "Content-Length: 2\r\n"
+  "\r\n"
+  "OK"
+;
+char *proxyRequest =
+  "POST /upload HTTP/1.1\r\n"
+  "Host: example.com\r\n"
+  "Connection: keep-alive, X-Secret\r\n"
+  "X-Secret: hunter2\r\n"
+  "Content-Length: 5\r\n"
+  "X-Custom:   spaced\r\n"
+  "\r\n"
+  "hello"
+  "GET / HTTP/1.1\r\n"
+;
+
+char *proxyForwarded =
+  "POST /upload HTTP/1.1\r\n"
+  "Host: backend:8080\r\n"
+  "Content-Length: 5\r\n"
+  "X-Custom:   spaced\r\n"
+  "X-Forwarded-For: 10.0.0.1\r\n"
+  "\r\n"
+;
+
+char *proxyChunkedResponse =
+  "HTTP/1.1 200 OK\r\n"
+  "Transfer-Encoding: chunked\r\n"
+  "\r\n"
+  "5;ext=1\r\n"
+  "hello\r\n"
+  "0\r\n"
+  "X-Trailer: yes\r\n"
+  "\r\n"
+  "HTTP/1.1"
+;
+
+char *streamedRequest =
+  "POST /upload HTTP/1.1\r\n"
+  "Content-Length: 11\r\n"
+  "\r\n"
+  "Hello World"
+;
+
+static int chunkCount = 0;
+static struct buf chunkData = {0};
+static void onChunk(struct http_parser_event *ev) {
+  chunkCount++;
+  buf_append(&chunkData, ev->chunk->data, ev->chunk->len);
+}
+
+static int idleRequests = 0;
+static void onIdleRequest(struct http_parser_event *ev) {
+  idleRequests++;
+}
+
+char *multipartRequest =
+  "POST /upload HTTP/1.1\r\n"
+  "Content-Type: multipart/form-data; boundary=\"xyz\"\r\n"
+  "Content-Length: 188\r\n"
+  "\r\n"
+  "preamble\r\n"
+  "--xyz\r\n"
+  "Content-Disposition: form-data; name=\"a\"\r\n"
+  "\r\n"
+  "first\r\n--xy\r\n"
+  "--xyz  \r\n"
+  "Content-Disposition: form-data; name=\"b\"; filename=\"b.txt\"\r\n"
+  "Content-Type: text/plain\r\n"
+  "\r\n"
+  "second\r\n"
+  "--xyz--\r\n"
+;
+
+static int partCount = 0;
+static struct buf partData = {0};
+static void onPart(struct http_parser_event *ev) {
+  partCount++;
+  buf_append(&partData, "[", 1);
+  buf_append(&partData, http_parser_header_get(ev->request, "content-disposition"), -1);
+  buf_append(&partData, "]", 1);
+}
+static void onPartData(struct http_parser_event *ev) {
+  buf_append(&partData, ev->chunk->data, ev->chunk->len);
+}
+static void onPartEnd(struct http_parser_event *ev) {
+  buf_append(&partData, "|", 1);
+}
+
+char *upgradeRequest =
+  "GET /chat HTTP/1.1\r\n"
+  "Host: server.example.com\r\n"
+  "Upgrade: websocket\r\n"
+  "Connection: keep-alive, Upgrade\r\n"
+  "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+  "Sec-WebSocket-Version: 13\r\n"
+  "\r\n"
+  "\x81\x85\x37\xfa\x21\x3d\x7f\x9f\x4d\x51\x58"
+;
+
+static struct buf wsData = {0};
+static int wsMessages = 0;
+static int wsControl = 0;
+static void onWebsocketData(struct http_parser_event *ev) {
+  struct http_parser_websocket *websocket = ev->udata;
+  buf_append(&wsData, ev->chunk->data, ev->chunk->len);
+  if (websocket->final) wsMessages++;
+}
+static void onWebsocketControl(struct http_parser_event *ev) {
+  struct http_parser_websocket *websocket = ev->udata;
+  wsControl = websocket->control;
+}
+
+// Preface, empty SETTINGS, then RFC 7541 C.4.1 and C.4.2 as streams 1 and 3
+#define H2_PRIOR_KNOWLEDGE \
+  "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n" \
+  "\x00\x00\x00\x04\x00\x00\x00\x00\x00" \
+  "\x00\x00\x11\x01\x05\x00\x00\x00\x01" \
+  "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xff" \
+  "\x00\x00\x0c\x01\x04\x00\x00\x00\x03" \
+  "\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf" \
+  "\x00\x00\x05\x00\x01\x00\x00\x00\x03" \
+  "Hello"
+
+char *h2UpgradeRequest =
+  "GET /upgrade HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "Connection: Upgrade, HTTP2-Settings\r\n"
+  "Upgrade: h2c\r\n"
+  "HTTP2-Settings: AAQAAAAK\r\n"
+  "\r\n"
+  "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+  "\x00\x00\x00\x04\x00\x00\x00\x00\x00"
+;
+
+static int h2Requests = 0;
+static struct buf h2Body = {0};
+static void onH2Request(struct http_parser_event *ev) {
+  struct http_parser_h2 *session = ev->udata;
+  h2Requests++;
+  if (ev->request->body) buf_append(&h2Body, ev->request->body->data, ev->request->body->len);
+  http_parser_header_set(ev->response, "Content-Type", "text/plain");
+  ev->response->body = calloc(1, sizeof(struct buf));
+  buf_append(ev->response->body, "Hello World", 11);
+  http_parser_h2_respond(session, ev->pair);
+  http_parser_pair_free(ev->pair);
+}
+
+/**
+ * Finds the next frame of the given type in the session output
+ */
+static const char * h2Find(struct buf *out, size_t *offset, int type, uint32_t *stream, int *flags, size_t *length) {
+  const unsigned char *frame;
+  while((*offset + 9) <= out->len) {
+    frame    = (const unsigned char *)out->data + *offset;
+    *length  = (frame[0] << 16) | (frame[1] << 8) | frame[2];
+    *offset += 9 + *length;
+    if (frame[3] != type) continue;
+    *flags  = frame[4];
+    *stream = ((uint32_t)frame[5] << 24) | (frame[6] << 16) | (frame[7] << 8) | frame[8];
+    return (const char *)frame + 9;
+  }
+  return NULL;
+}
+
+#ifdef HTTP_PARSER_STATS
+static int statsHooks = 0;
+static const char *statsLastState = NULL;
+static void onStatsState(struct http_parser_message *message, int from, int to, void *udata) {
+  statsHooks++;
+  statsLastState = http_parser_state_name(to);
+}
+#endif
 
 /* // Passing network data into it */
 /* http_parser_request_data(request, message, strlen(message)); */
 
+// Answers the pairs it's handed with their path until told to stop
+struct handoff {
+  struct http_parser_queue *requests;
+  struct http_parser_queue *responses;
+  int stop;
+};
+static int replayMessages = 0;
+static size_t replayPostLength = 0;
+static size_t replayPostBody = 0;
+static void onReplayMessage(const struct http_parser_replay_record *record, void *udata) {
+  (void)udata;
+  __atomic_fetch_add(&replayMessages, 1, __ATOMIC_RELAXED);
+  if (!record->isResponse && !strcmp(record->message->method, "POST")) {
+    replayPostLength = record->length;
+    replayPostBody   = record->bodyLength;
+  }
+}
+
+static void * handoffWorker(void *udata) {
+  struct handoff *handoff = udata;
+  struct http_parser_pair *pair;
+  for(;;) {
+    pair = http_parser_queue_pop(handoff->requests);
+    if (!pair) {
+      if (__atomic_load_n(&(handoff->stop), __ATOMIC_ACQUIRE)) break;
+      sched_yield();
+      continue;
+    }
+    pair->response->body = calloc(1, sizeof(struct buf));
+    buf_append(pair->response->body, pair->request->path, strlen(pair->request->path));
+    while(http_parser_queue_push(handoff->responses, pair)) sched_yield();
+  }
+  return NULL;
+}
+static void * handoffFree(void *udata) {
+  http_parser_pair_free(udata);
+  return NULL;
+}
+
+#ifdef HTTP_PARSER_URING
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int uringRequests = 0;
+static void onUringRequest(struct http_parser_event *ev) {
+  struct http_parser_uring_conn *conn = ev->udata;
+  uringRequests++;
+  http_parser_header_set(ev->response, "Date", "Thu, 01 Jan 1970 00:00:00 GMT");
+  ev->response->body = calloc(1, sizeof(struct buf));
+  buf_append(ev->response->body, ev->request->path, strlen(ev->request->path));
+  http_parser_uring_respond(conn);
+}
+#endif
+
+// RFC 9110's example date, as a fixed Date to compare serializations with
+static const time_t testTime = 784111777;
+static const char *testDate = "Sun, 06 Nov 1994 08:49:37 GMT";
+
+// Whether the response serializes to the message followed by a Date header
+static int sprintMatches(struct http_parser_message *response, const char *message) {
+  const char *end = strstr(message, "\r\n\r\n") + 2;
+  char *expected  = calloc(1, strlen(message) + 64);
+  struct buf *serialized;
+  int matches;
+
+  memcpy(expected, message, end - message);
+  sprintf(expected + (end - message), "Date: %s\r\n%s", testDate, end);
+  http_parser_header_set(response, "Date", testDate);
+  serialized = http_parser_sprint_response(response);
+  http_parser_header_del(response, "Date");
+  matches = strcmp(expected, serialized->data) == 0;
+
+  free(expected);
+  buf_clear(serialized);
+  free(serialized);
+  return matches;
+}
+
 int main() {
   struct http_parser_message *request  = http_parser_request_init();
   struct http_parser_message *response = http_parser_response_init();
   struct buf *msgbuf;
 
   int err = 0;
+  int res;
+  size_t i;
 
   printf("# Pre-loaded request\n");
   ASSERT("request->method is null", request->method == NULL);
@@ -170,7 +466,7 @@ int main() {
   ASSERT("request->path is /foobar", strcmp(request->path, "/foobar") == 0);
   ASSERT("request->body is \"Hello World\\r\\n\"", strcmp(request->body->data, "Hello World\r\n") == 0);
   msgbuf = http_parser_sprint_request(request);
-  ASSERT("request->toString matches", strcmp(postOrderedMessage, msgbuf->data) == 0);
+  ASSERT("request->toString matches in arrival order", strcmp(postMessage, msgbuf->data) == 0);
 
   http_parser_message_free(request);
   request  = http_parser_request_init();
@@ -179,12 +475,16 @@ int main() {
     .len  = strlen(postChunkedMessage),
     .cap  = strlen(postChunkedMessage)
   }));
+  ASSERT("chunked request waits for the line after the last chunk", !request->ready);
+  http_parser_request_data(request, &((struct buf){ .data = "\r\n", .len = 2, .cap = 2 }));
 
   printf("# POST request (chunked)\n");
   ASSERT("request->version is 1.1", strcmp(request->version, "1.1") == 0);
   ASSERT("request->method is POST", strcmp(request->method, "POST") == 0);
   ASSERT("request->path is /foobar", strcmp(request->path, "/foobar") == 0);
   ASSERT("request->body is \"Hello World\\r\\n\"", strcmp(request->body->data, "Hello World\r\n") == 0);
+  msgbuf = http_parser_sprint_request(request);
+  ASSERT("request->toString is chunked", strcmp(msgbuf->data, "POST /foobar?token=pizza HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\nd\r\nHello World\r\n\r\n0\r\n\r\n") == 0);
 
   http_parser_message_free(request);
   request = http_parser_request_init();
@@ -199,6 +499,42 @@ int main() {
   ASSERT("request->method is OPTIONS", strcmp(request->method, "OPTIONS") == 0);
   ASSERT("request->path is /hello/world", strcmp(request->path, "/hello/world") == 0);
 
+  printf("# Partial request\n");
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  http_parser_request_data(request, &((struct buf){ .data = postMessage, .len = 40, .cap = 40 }));
+  ASSERT("head is incomplete", http_parser_message_head_complete(request) == 0);
+  http_parser_request_data(request, &((struct buf){ .data = postMessage + 40, .len = 30, .cap = 30 }));
+  ASSERT("head completes before the body", http_parser_message_head_complete(request) == 1 && !request->ready);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  http_parser_request_data(request, &((struct buf){ .data = "garbage\r\n", .len = 9, .cap = 9 }));
+  ASSERT("malformed head is reported", http_parser_message_head_complete(request) == -1);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  http_parser_request_data(request, &((struct buf){ .data = "GET / HTTP/1.10\r\n", .len = 17, .cap = 17 }));
+  ASSERT("overlong version is rejected", http_parser_message_head_complete(request) == -1);
+
+  printf("# Idle pairs\n");
+  struct http_parser_pair *idlePair = http_parser_pair_init(NULL);
+  ASSERT("meta is created on first use", idlePair->request->meta == NULL && http_parser_meta_get(idlePair->request, "x") == NULL);
+  http_parser_pair_release(idlePair);
+  ASSERT("released pair holds no messages", idlePair->request == NULL && idlePair->response == NULL);
+  idlePair->onRequest = onIdleRequest;
+  http_parser_pair_request_data(idlePair, &((struct buf){
+    .data = getMessage,
+    .len  = strlen(getMessage),
+    .cap  = strlen(getMessage)
+  }));
+  ASSERT("released pair parses the next request", idleRequests == 1 && idlePair->request->ready);
+  ASSERT("request line is kept at its exact size", strcmp(idlePair->request->path, "/foobar") == 0 && strlen(idlePair->request->version) == 3);
+  http_parser_pair_release(idlePair);
+  msgbuf = http_parser_sprint_pair_response(idlePair);
+  ASSERT("released pair serializes a default response", strncmp(msgbuf->data, "HTTP/1.1 200 OK\r\n", 17) == 0);
+  buf_clear(msgbuf);
+  free(msgbuf);
+  http_parser_pair_free(idlePair);
+
   printf("# Pre-loaded response\n");
   ASSERT("response->status = 200", response->status == 200);
 
@@ -214,7 +550,7 @@ int main() {
   ASSERT("response->status = 200", response->status == 200);
   ASSERT("response->statusmessage = \"OK\"", strcmp(response->statusMessage, "OK") == 0);
   ASSERT("response->body = \"Hello World\\r\\n\"", strcmp(response->body->data, "Hello World\r\n") == 0);
-  ASSERT("response->toString matches", strcmp(responseMessage, http_parser_sprint_response(response)->data) == 0);
+  ASSERT("response->toString matches", sprintMatches(response, responseMessage));
 
   http_parser_message_free(response);
   response = http_parser_response_init();
@@ -223,12 +559,33 @@ int main() {
     .len  = strlen(responseChunkedMessage),
     .cap  = strlen(responseChunkedMessage)
   }));
+  http_parser_response_eof(response);
 
   printf("# 200 OK response (chunked)\n");
+  ASSERT("closing completes a response without the final empty line", response->ready);
   ASSERT("response->status = 200", response->status == 200);
   ASSERT("response->statusmessage = \"OK\"", strcmp(response->statusMessage, "OK") == 0);
   ASSERT("response->body = \"Hello World\\r\\n\"", strcmp(response->body->data, "Hello World\r\n") == 0);
 
+  // Trailers arriving in a later read than the last chunk
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  char *trailerFirst  = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nHello\r\n0\r\n";
+  char *trailerSecond = "X-Trailer: yes\r\n\r\nGET /next HTTP/1.1\r\n\r\n";
+  http_parser_request_data(request, &((struct buf){
+    .data = trailerFirst,
+    .len  = strlen(trailerFirst),
+    .cap  = strlen(trailerFirst)
+  }));
+  ASSERT("last chunk at the end of a read waits for trailers", !request->ready);
+  http_parser_request_data(request, &((struct buf){
+    .data = trailerSecond,
+    .len  = strlen(trailerSecond),
+    .cap  = strlen(trailerSecond)
+  }));
+  ASSERT("split trailer completes the message", request->ready && strcmp(request->body->data, "Hello") == 0);
+  ASSERT("split trailer is not left over", request->leftover && strcmp(request->leftover->data, "GET /next HTTP/1.1\r\n\r\n") == 0);
+
   http_parser_message_free(response);
   response = http_parser_response_init();
   http_parser_response_data(response, &((struct buf){
@@ -241,11 +598,1117 @@ int main() {
   ASSERT("response->status = 404", response->status == 404);
   ASSERT("response->statusmessage = \"Not Found\"", strcmp(response->statusMessage, "Not Found") == 0);
   ASSERT("response->body = \"Not Found\\r\\n\"", strcmp(response->body->data, "Not Found\r\n") == 0);
-  ASSERT("response->toString matches", strcmp(responseNotFoundMessage, http_parser_sprint_response(response)->data) == 0);
+  ASSERT("response->toString matches", sprintMatches(response, responseNotFoundMessage));
+
+  http_parser_header_set(response, "Content-Type", "text/plain");
+
+  ASSERT("response->toString matches after header modification", sprintMatches(response, responseNotFoundExtendedMessage));
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_response_data(response, &((struct buf){
+    .data = duplicateHeaderMessage,
+    .len  = strlen(duplicateHeaderMessage),
+    .cap  = strlen(duplicateHeaderMessage)
+  }));
+
+  printf("# Duplicate headers\n");
+  const struct http_parser_header *header;
+  ASSERT("response->headerCount is 4", http_parser_header_count(response) == 4);
+  ASSERT("first header is Set-Cookie", strcmp(http_parser_header_nth(response, 0)->key, "Set-Cookie") == 0);
+  header = http_parser_header_next(response, "set-cookie", NULL);
+  ASSERT("first set-cookie is a=1", header && strcmp(header->value, "a=1") == 0);
+  header = http_parser_header_next(response, "set-cookie", header);
+  ASSERT("second set-cookie is b=2", header && strcmp(header->value, "b=2") == 0);
+  ASSERT("no third set-cookie", http_parser_header_next(response, "set-cookie", header) == NULL);
+  ASSERT("response->toString keeps order and duplicates", sprintMatches(response, duplicateHeaderMessage));
+  http_parser_header_set(response, "set-cookie", "c=3");
+  ASSERT("header_set collapses duplicates", http_parser_header_count(response) == 3);
+  ASSERT("header_set keeps position", strcmp(http_parser_header_nth(response, 0)->value, "c=3") == 0);
+  http_parser_header_del(response, "Via");
+  ASSERT("header_del removes the header", http_parser_header_get(response, "via") == NULL);
+
+  printf("# Header atoms\n");
+  ASSERT("header names are interned case-insensitively", http_parser_header_atom("cOnTeNt-LeNgTh") == HTTP_PARSER_ATOM_CONTENT_LENGTH);
+  ASSERT("other header names have no atom", http_parser_header_atom("X-Custom") == HTTP_PARSER_ATOM_NONE);
+  ASSERT("atoms have a canonical name", strcmp(http_parser_atom_name(HTTP_PARSER_ATOM_ETAG), "ETag") == 0);
+  http_parser_header_add(response, "Content-Type", "text/plain");
+  http_parser_header_add(response, "cache-control", "no-store");
+  http_parser_header_add(response, "X-FORWARDED-for", "127.0.0.1");
+  header = http_parser_header_next(response, "content-type", NULL);
+  ASSERT("canonical names share the atom table", header && header->atom == HTTP_PARSER_ATOM_CONTENT_TYPE && header->key == http_parser_atom_name(HTTP_PARSER_ATOM_CONTENT_TYPE));
+  header = http_parser_header_next_atom(response, HTTP_PARSER_ATOM_CACHE_CONTROL, NULL);
+  ASSERT("lowercase names keep their spelling", header && strcmp(header->key, "cache-control") == 0);
+  header = http_parser_header_next_atom(response, HTTP_PARSER_ATOM_X_FORWARDED_FOR, NULL);
+  ASSERT("other spellings are kept as received", header && strcmp(header->key, "X-FORWARDED-for") == 0 && strcmp(header->value, "127.0.0.1") == 0);
+  http_parser_header_set(response, "CONTENT-TYPE", "text/html");
+  ASSERT("header_set on an interned name keeps its key", strcmp(http_parser_header_get_atom(response, HTTP_PARSER_ATOM_CONTENT_TYPE), "text/html") == 0 && http_parser_header_next(response, "content-type", NULL)->key == http_parser_atom_name(HTTP_PARSER_ATOM_CONTENT_TYPE));
+  http_parser_header_del(response, "x-forwarded-for");
+  ASSERT("interned headers are removed by atom", http_parser_header_get(response, "X-Forwarded-For") == NULL);
+
+  printf("# Serializer framing\n");
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->body = calloc(1, sizeof(struct buf));
+  buf_append(response->body, "Hello World", 11);
+  msgbuf = http_parser_sprint_response(response);
+  ASSERT("content-length is added", strstr(msgbuf->data, "\r\nContent-Length: 11\r\n\r\nHello World") != NULL);
+  ASSERT("date is added", strstr(msgbuf->data, "\r\nDate: ") && strlen(http_parser_date()) == 29);
+  char dateString[32];
+  ASSERT("date is formatted as IMF-fixdate", strcmp(http_parser_date_format(testTime, dateString, sizeof(dateString)), testDate) == 0);
+  ASSERT("date needs room for IMF-fixdate", http_parser_date_format(testTime, dateString, 29) == NULL);
+  ASSERT("dates past 9999 are rejected", sizeof(time_t) < 8 || http_parser_date_format((time_t)253402300800LL, dateString, sizeof(dateString)) == NULL);
+  buf_clear(msgbuf);
+  free(msgbuf);
+  http_parser_header_set(response, "Transfer-Encoding", "chunked");
+  msgbuf = http_parser_sprint_response(response);
+  ASSERT("chunked body is framed", strstr(msgbuf->data, "\r\n\r\nb\r\nHello World\r\n0\r\n\r\n") != NULL && strstr(msgbuf->data, "Content-Length") == NULL);
+  buf_clear(msgbuf);
+  free(msgbuf);
+  http_parser_header_del(response, "Transfer-Encoding");
+  struct http_parser_pair *headPair = http_parser_pair_init(NULL);
+  http_parser_pair_request_data(headPair, &((struct buf){
+    .data = headRequest,
+    .len  = strlen(headRequest),
+    .cap  = strlen(headRequest)
+  }));
+  headPair->response->body = calloc(1, sizeof(struct buf));
+  buf_append(headPair->response->body, "Hello World", 11);
+  msgbuf = http_parser_sprint_pair_response(headPair);
+  ASSERT("HEAD keeps the length but not the body", strstr(msgbuf->data, "\r\nContent-Length: 11\r\n") && strcmp(msgbuf->data + msgbuf->len - 4, "\r\n\r\n") == 0);
+  buf_clear(msgbuf);
+  free(msgbuf);
+  http_parser_pair_free(headPair);
+  response->status = 304;
+  msgbuf = http_parser_sprint_response(response);
+  ASSERT("304 has no body nor length", strstr(msgbuf->data, "Content-Length") == NULL && strcmp(msgbuf->data + msgbuf->len - 4, "\r\n\r\n") == 0);
+  buf_clear(msgbuf);
+  free(msgbuf);
+
+  printf("# Response framing\n");
+  struct http_parser_pair *pair = http_parser_pair_init(NULL);
+  http_parser_pair_request_data(pair, &((struct buf){
+    .data = headRequest,
+    .len  = strlen(headRequest),
+    .cap  = strlen(headRequest)
+  }));
+  http_parser_pair_response_data(pair, &((struct buf){
+    .data = headResponse,
+    .len  = strlen(headResponse),
+    .cap  = strlen(headResponse)
+  }));
+  ASSERT("HEAD response is ready without body", pair->response->ready && pair->response->body->len == 0);
+  http_parser_pair_free(pair);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_response_data(response, &((struct buf){
+    .data = untilCloseResponse,
+    .len  = strlen(untilCloseResponse),
+    .cap  = strlen(untilCloseResponse)
+  }));
+  ASSERT("unframed response waits for close", !response->ready);
+  http_parser_response_eof(response);
+  ASSERT("unframed response completes on close", response->ready && strcmp(response->body->data, "Hello") == 0);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_response_data(response, &((struct buf){
+    .data = headResponse,
+    .len  = strlen(headResponse),
+    .cap  = strlen(headResponse)
+  }));
+  http_parser_response_eof(response);
+  ASSERT("truncated response panics on close", !response->ready);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_response_data(response, &((struct buf){
+    .data = pipelinedResponses,
+    .len  = 20,
+    .cap  = 20
+  }));
+  ASSERT("partial head waits for more data", !response->ready);
+  http_parser_response_data(response, &((struct buf){
+    .data = pipelinedResponses + 20,
+    .len  = strlen(pipelinedResponses) - 20,
+    .cap  = strlen(pipelinedResponses) - 20
+  }));
+  ASSERT("204 response is ready without body", response->ready && response->status == 204 && response->body->len == 0);
+  ASSERT("next response is kept as leftover", response->leftover && strncmp(response->leftover->data, "HTTP/1.1 200 OK", 15) == 0);
+  msgbuf = response->leftover;
+  response->leftover = NULL;
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_response_data(response, msgbuf);
+  ASSERT("leftover parses as the next response", response->ready && strcmp(response->body->data, "OK") == 0);
+
+  printf("# Pass-through forwarding\n");
+  size_t consumed;
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->keepHead = 1;
+  http_parser_request_data(request, &((struct buf){
+    .data = proxyRequest,
+    .len  = strlen(proxyRequest),
+    .cap  = strlen(proxyRequest)
+  }));
+  ASSERT("head is ready before the body is read", request->ready);
+  msgbuf = http_parser_forward_head(request, &((struct http_parser_forward){
+    .host         = "backend:8080",
+    .forwardedFor = "10.0.0.1",
+  }));
+  ASSERT("forwarded head drops hop-by-hop and keeps original bytes", strcmp(proxyForwarded, msgbuf->data) == 0);
+  res = http_parser_message_relay(request, request->body, &consumed);
+  ASSERT("relay claims the content-length body", res == 1 && consumed == 5);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->keepHead = 1;
+  http_parser_response_data(response, &((struct buf){
+    .data = proxyChunkedResponse,
+    .len  = 48,
+    .cap  = 48
+  }));
+  ASSERT("chunked head is ready", response->ready);
+  res = http_parser_message_relay(response, response->body, &consumed);
+  ASSERT("relay claims partial chunked body", res == 0 && consumed == response->body->len);
+  res = http_parser_message_relay(response, &((struct buf){
+    .data = proxyChunkedResponse + 48,
+    .len  = strlen(proxyChunkedResponse) - 48,
+    .cap  = strlen(proxyChunkedResponse) - 48
+  }), &consumed);
+  ASSERT("relay finds the end of the chunked body", res == 1 && strcmp(proxyChunkedResponse + 48 + consumed, "HTTP/1.1") == 0);
+
+  const char *proxyBadSizes[] = { "100000005\r\nhello\r\n0\r\n\r\n", "\r\n", ";ext\r\n", "5\r\nhello\r\n\r\n" };
+  for(i = 0; i < 4; i++) {
+    http_parser_message_free(response);
+    response = http_parser_response_init();
+    response->keepHead = 1;
+    http_parser_response_data(response, &((struct buf){
+      .data = proxyChunkedResponse,
+      .len  = 47,
+      .cap  = 47
+    }));
+    res = http_parser_message_relay(response, &((struct buf){
+      .data = (char*)proxyBadSizes[i],
+      .len  = strlen(proxyBadSizes[i]),
+      .cap  = strlen(proxyBadSizes[i])
+    }), &consumed);
+    ASSERT(i ? "relay rejects chunk sizes without digits" : "relay rejects chunk sizes beyond an int", res == -1);
+  }
+
+  printf("# Streaming body\n");
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->onChunk = onChunk;
+  for(i=0; i<strlen(streamedRequest); i+=7) {
+    http_parser_request_data(request, &((struct buf){
+      .data = streamedRequest + i,
+      .len  = MIN(7, strlen(streamedRequest) - i),
+      .cap  = MIN(7, strlen(streamedRequest) - i)
+    }));
+  }
+  ASSERT("streamed request is ready", request->ready);
+  ASSERT("content-length body is passed on as it arrives", chunkCount > 1 && strcmp(chunkData.data, "Hello World") == 0);
+  ASSERT("streamed body is not buffered", request->body->len == 0);
+
+  printf("# Spilled body\n");
+  const char *mapped;
+  size_t mappedLength;
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->spillThreshold = 4;
+  for(i=0; i<strlen(streamedRequest); i+=7) {
+    http_parser_request_data(request, &((struct buf){
+      .data = streamedRequest + i,
+      .len  = MIN(7, strlen(streamedRequest) - i),
+      .cap  = MIN(7, strlen(streamedRequest) - i)
+    }));
+  }
+  ASSERT("body over the threshold is spilled", request->ready && request->bodyFd >= 0 && request->body->len == 0);
+  mapped = http_parser_message_body_map(request, &mappedLength);
+  ASSERT("spilled body is mapped", mapped && mappedLength == 11 && memcmp(mapped, "Hello World", 11) == 0);
+
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->spillThreshold = 4;
+  for(i=0; i<strlen(postChunkedMessage); i++) {
+    http_parser_request_data(request, &((struct buf){
+      .data = postChunkedMessage + i,
+      .len  = 1,
+      .cap  = 1
+    }));
+  }
+  http_parser_request_data(request, &((struct buf){ .data = "\r\n", .len = 2, .cap = 2 }));
+  mapped = http_parser_message_body_map(request, &mappedLength);
+  ASSERT("chunked body is spilled", request->ready && request->bodyFd >= 0 && mappedLength == 13 && memcmp(mapped, "Hello World\r\n", 13) == 0);
+
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->spillThreshold = 64;
+  http_parser_request_data(request, &((struct buf){
+    .data = streamedRequest,
+    .len  = strlen(streamedRequest),
+    .cap  = strlen(streamedRequest)
+  }));
+  mapped = http_parser_message_body_map(request, &mappedLength);
+  ASSERT("body under the threshold stays in memory", request->ready && request->bodyFd == -1 && mappedLength == 11 && strcmp(mapped, "Hello World") == 0);
+
+  printf("# Multipart\n");
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  struct http_parser_multipart *multipart = NULL;
+  for(i=0; i<strlen(multipartRequest); i++) {
+    http_parser_request_data(request, &((struct buf){
+      .data = multipartRequest + i,
+      .len  = 1,
+      .cap  = 1
+    }));
+
+    // Attach the multipart stage once the headers are known
+    if (!multipart && http_parser_header_get(request, "content-length")) {
+      multipart = http_parser_multipart_init(http_parser_header_get(request, "content-type"));
+      multipart->onPart     = onPart;
+      multipart->onPartData = onPartData;
+      multipart->onPartEnd  = onPartEnd;
+      request->udata        = multipart;
+      request->onChunk      = http_parser_multipart_chunk;
+    }
+  }
+  ASSERT("multipart request is ready", request->ready);
+  ASSERT("multipart found both parts", partCount == 2);
+  ASSERT("multipart data is streamed per part", strcmp(partData.data,
+    "[form-data; name=\"a\"]first\r\n--xy|"
+    "[form-data; name=\"b\"; filename=\"b.txt\"]second|"
+  ) == 0);
+  res = http_parser_multipart_data(multipart, &((struct buf){ .data = "", .len = 0 }));
+  ASSERT("multipart saw the closing delimiter", res == 1);
+  http_parser_multipart_free(multipart);
+  ASSERT("non-multipart content type is rejected", http_parser_multipart_init("text/plain") == NULL);
+
+  printf("# WebSocket\n");
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  http_parser_request_data(request, &((struct buf){
+    .data = upgradeRequest,
+    .len  = strlen(upgradeRequest),
+    .cap  = strlen(upgradeRequest)
+  }));
+  ASSERT("upgrade request is ready", request->ready && request->upgrade);
+  ASSERT("bytes after the upgrade are handed over", request->leftover && request->leftover->len == 11);
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  res = http_parser_websocket_handshake(request, response);
+  ASSERT("handshake is accepted", res == 0 && response->status == 101);
+  ASSERT("handshake accept key matches", strcmp(http_parser_header_get(response, "sec-websocket-accept"), "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0);
+
+  struct http_parser_websocket *websocket = http_parser_websocket_init(NULL);
+  websocket->requireMask = 1;
+  websocket->onData      = onWebsocketData;
+  websocket->onControl   = onWebsocketControl;
+  res = http_parser_websocket_data(websocket, request->leftover);
+  ASSERT("masked frame is unmasked", res == 0 && wsMessages == 1 && strcmp(wsData.data, "Hello") == 0);
+
+  // Fragmented masked message with an interleaved ping, fed byte by byte
+  struct buf *frames = calloc(1, sizeof(struct buf));
+  char payload[100];
+  for(i=0; i<sizeof(payload); i++) payload[i] = 'a' + (i % 26);
+  http_parser_websocket_frame(frames, HTTP_PARSER_WEBSOCKET_BINARY, 0, (const unsigned char *)"\x01\x02\x03\x04", payload, 60);
+  http_parser_websocket_frame(frames, HTTP_PARSER_WEBSOCKET_PING, 1, (const unsigned char *)"\x05\x06\x07\x08", "ping", 4);
+  http_parser_websocket_frame(frames, HTTP_PARSER_WEBSOCKET_CONTINUATION, 1, (const unsigned char *)"\xff\x00\xaa\x55", payload + 60, 40);
+  wsData.len = 0;
+  for(i=0; i<frames->len && !res; i++) {
+    res = http_parser_websocket_data(websocket, &((struct buf){
+      .data = frames->data + i,
+      .len  = 1,
+      .cap  = 1
+    }));
+  }
+  ASSERT("fragmented message is streamed", res == 0 && wsMessages == 2 && wsData.len == 100 && memcmp(wsData.data, payload, 100) == 0);
+  ASSERT("control frame interleaves", wsControl == HTTP_PARSER_WEBSOCKET_PING);
+  frames->len = 0;
+  wsData.len  = 0;
+  http_parser_websocket_frame(frames, HTTP_PARSER_WEBSOCKET_BINARY, 1, (const unsigned char *)"\x01\x02\x03\x04", payload, 100);
+  res = http_parser_websocket_data(websocket, frames);
+  ASSERT("long payload is unmasked in one pass", res == 0 && wsMessages == 3 && wsData.len == 100 && memcmp(wsData.data, payload, 100) == 0);
+  frames->len = 0;
+  http_parser_websocket_frame(frames, HTTP_PARSER_WEBSOCKET_TEXT, 1, NULL, "x", 1);
+  res = http_parser_websocket_data(websocket, frames);
+  ASSERT("unmasked client frame is rejected", res == -1);
+  http_parser_websocket_free(websocket);
+
+  printf("# HTTP/2\n");
+  struct http_parser_hpack *hpack = http_parser_hpack_init(4096);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\x41\x8c\xf1\xe3\xc2\xe5\xf2\x3a\x6b\xa0\xab\x90\xf4\xff", 17);
+  ASSERT("huffman header block decodes", res == 0 && strcmp(request->method, "GET") == 0 && strcmp(request->path, "/") == 0);
+  ASSERT(":authority becomes the host header", strcmp(http_parser_header_get(request, "host"), "www.example.com") == 0);
+  ASSERT("dynamic table holds the indexed literal", hpack->size == 57);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xbf", 12);
+  ASSERT("dynamic table entries are referenced", res == 0 && strcmp(http_parser_header_get(request, "host"), "www.example.com") == 0);
+  ASSERT("dynamic table grows", hpack->size == 110 && strcmp(http_parser_header_get(request, "cache-control"), "no-cache") == 0);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\xbe\x58\x86\xa8\xeb\x10\x64\x9c\xfe", 12);
+  ASSERT("invalid huffman padding is a compression error", res == -1);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\x82", 4);
+  ASSERT("repeated pseudo-header is malformed", res == 1);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\x01\x09" "localhost" "\x0f\x17\x09" "localhost", 26);
+  ASSERT("host repeating :authority is kept once", res == 0 && http_parser_header_count(request) == 1);
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\x01\x09" "localhost" "\x0f\x17\x07" "example", 24);
+  ASSERT("host differing from :authority is malformed", res == 1);
+  hpack->maxListSize = 100;
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  res = http_parser_hpack_decode(hpack, request, "\x82\x86\x84\x82\x86\x84", 6);
+  ASSERT("header list over the limit is a compression error", res == -1);
+  http_parser_hpack_free(hpack);
+
+  struct http_parser_hpack *encoder = http_parser_hpack_init(4096);
+  struct http_parser_hpack *decoder = http_parser_hpack_init(4096);
+  struct buf *block = calloc(1, sizeof(struct buf));
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->status = 404;
+  http_parser_header_set(response, "Content-Type", "text/html");
+  http_parser_header_set(response, "X-Request-Id", "abcdef");
+  http_parser_header_set(response, "Connection", "keep-alive");
+  http_parser_hpack_encode(encoder, block, response);
+  i = block->len;
+  http_parser_hpack_encode(encoder, block, response);
+  ASSERT("repeated fields are encoded as indexes", (block->len - i) == 3);
+  struct http_parser_message *decoded = http_parser_response_init();
+  res = http_parser_hpack_decode(decoder, decoded, block->data, i);
+  ASSERT("encoded response decodes", res == 0 && decoded->status == 404 && strcmp(http_parser_header_get(decoded, "x-request-id"), "abcdef") == 0);
+  ASSERT("encoded names are lowercase", strcmp(http_parser_header_nth(decoded, 0)->key, "content-type") == 0);
+  ASSERT("connection-specific headers are dropped", http_parser_header_get(decoded, "connection") == NULL);
+  http_parser_message_free(decoded);
+  http_parser_hpack_free(encoder);
+  http_parser_hpack_free(decoder);
+
+  // Prior knowledge, two requests answered from within onRequest
+  struct http_parser_h2 *session = http_parser_h2_init(NULL);
+  session->udata     = session;
+  session->onRequest = onH2Request;
+  ASSERT("preface is detected", http_parser_h2_is_preface(&((struct buf){ .data = H2_PRIOR_KNOWLEDGE, .len = 30, .cap = 30 })) == 1);
+  ASSERT("partial preface needs more data", http_parser_h2_is_preface(&((struct buf){ .data = "PRI * HT", .len = 8, .cap = 8 })) == -1);
+  ASSERT("http/1.1 is no preface", http_parser_h2_is_preface(&((struct buf){ .data = getMessage, .len = 8, .cap = 8 })) == 0);
+  res = 0;
+  for(i=0; i<(sizeof(H2_PRIOR_KNOWLEDGE) - 1) && !res; i+=7) {
+    res = http_parser_h2_data(session, &((struct buf){
+      .data = H2_PRIOR_KNOWLEDGE + i,
+      .len  = MIN(7, sizeof(H2_PRIOR_KNOWLEDGE) - 1 - i),
+      .cap  = MIN(7, sizeof(H2_PRIOR_KNOWLEDGE) - 1 - i)
+    }));
+  }
+  ASSERT("both streams reach onRequest", res == 0 && h2Requests == 2);
+  ASSERT("request body is collected from data frames", h2Body.len == 5 && memcmp(h2Body.data, "Hello", 5) == 0);
 
+  uint32_t h2Stream;
+  int h2Flags;
+  size_t h2Offset = 0;
+  size_t h2Length;
+  const char *h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_SETTINGS, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("server settings come first", h2Payload == session->out->data + 9 && h2Flags == 0);
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_SETTINGS, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("client settings are acknowledged", h2Payload && h2Flags == 1 && h2Length == 0);
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_HEADERS, &h2Stream, &h2Flags, &h2Length);
+  decoder = http_parser_hpack_init(4096);
+  decoded = http_parser_response_init();
+  res = h2Payload ? http_parser_hpack_decode(decoder, decoded, h2Payload, h2Length) : -1;
+  ASSERT("response headers are sent on stream 1", res == 0 && h2Stream == 1 && h2Flags == 4 && decoded->status == 200);
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_DATA, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("response body ends stream 1", h2Payload && h2Stream == 1 && h2Flags == 1 && h2Length == 11);
+  http_parser_message_free(decoded);
+  http_parser_hpack_free(decoder);
+
+  // Flow control holds back what doesn't fit the peer's window
+  session->out->len = 0;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = "\x00\x00\x06\x04\x00\x00\x00\x00\x00" "\x00\x04\x00\x00\x00\x04"
+            "\x00\x00\x03\x01\x05\x00\x00\x00\x05" "\x82\x86\x84",
+    .len  = 27,
+    .cap  = 27
+  }));
+  h2Offset  = 0;
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_DATA, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("data is limited to the stream window", res == 0 && h2Payload && h2Stream == 5 && h2Length == 4 && h2Flags == 0);
+  session->out->len = 0;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = "\x00\x00\x04\x08\x00\x00\x00\x00\x05" "\x00\x00\x00\x10",
+    .len  = 13,
+    .cap  = 13
+  }));
+  h2Offset  = 0;
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_DATA, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("window update releases the remainder", res == 0 && h2Payload && h2Length == 7 && h2Flags == 1 && memcmp(h2Payload, "o World", 7) == 0);
+  session->out->len = 0;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = "\x00\x00\x01\x01\x05\x00\x00\x00\x02" "\x82",
+    .len  = 10,
+    .cap  = 10
+  }));
+  ASSERT("even stream ids fail the connection", res == -1 && session->goaway && session->out->data[3] == HTTP_PARSER_H2_GOAWAY);
+  http_parser_h2_free(session);
+
+  // Upgrade from an HTTP/1.1 request
+  struct http_parser_pair *h2Pair = http_parser_pair_init(NULL);
+  http_parser_pair_request_data(h2Pair, &((struct buf){
+    .data = h2UpgradeRequest,
+    .len  = strlen(h2UpgradeRequest) + 9,
+    .cap  = strlen(h2UpgradeRequest) + 9
+  }));
+  session = http_parser_h2_init(NULL);
+  res = http_parser_h2_upgrade(session, h2Pair);
+  ASSERT("h2c upgrade is accepted", res == 0 && strncmp(session->out->data, "HTTP/1.1 101 ", 13) == 0);
+  ASSERT("upgraded request is stream 1", strcmp(http_parser_meta_get(h2Pair->request, "stream"), "1") == 0);
+  http_parser_header_set(h2Pair->response, "Content-Type", "text/plain");
+  h2Pair->response->body = calloc(1, sizeof(struct buf));
+  buf_append(h2Pair->response->body, "Hello World", 11);
+  res = http_parser_h2_respond(session, h2Pair);
+  h2Offset  = 71;
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_DATA, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("upgrade settings limit the window", res == 0 && h2Payload && h2Stream == 1 && h2Length == 10);
+  res = http_parser_h2_respond(session, h2Pair);
+  ASSERT("answered stream can't be answered twice", res == -1);
+  http_parser_pair_free(h2Pair);
+  http_parser_h2_free(session);
+
+  // Prior knowledge picked up by the 1.1 parser
+  h2Pair = http_parser_pair_init(NULL);
+  http_parser_pair_request_data(h2Pair, &((struct buf){
+    .data = H2_PRIOR_KNOWLEDGE,
+    .len  = sizeof(H2_PRIOR_KNOWLEDGE) - 1,
+    .cap  = sizeof(H2_PRIOR_KNOWLEDGE) - 1
+  }));
+  session = http_parser_h2_init(NULL);
+  session->udata     = session;
+  session->onRequest = onH2Request;
+  h2Requests = 0;
+  res = http_parser_h2_upgrade(session, h2Pair);
+  ASSERT("PRI request continues as prior knowledge", res == 0 && h2Requests == 2);
+  http_parser_pair_free(h2Pair);
+  http_parser_h2_free(session);
+
+  // Request bodies are bounded, the stream window stays within the bound
+  session = http_parser_h2_init(NULL);
+  session->udata       = session;
+  session->onRequest   = onH2Request;
+  session->maxBodySize = 4;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = H2_PRIOR_KNOWLEDGE,
+    .len  = 33,
+    .cap  = 33
+  }));
+  session->out->len = 0;
+  res |= http_parser_h2_data(session, &((struct buf){
+    .data = "\x00\x00\x03\x01\x04\x00\x00\x00\x01" "\x82\x86\x84"
+            "\x00\x00\x03\x00\x00\x00\x00\x00\x01" "Hel",
+    .len  = 24,
+    .cap  = 24
+  }));
+  h2Offset  = 0;
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_WINDOW_UPDATE, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("connection window is restored", res == 0 && h2Payload && h2Stream == 0);
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_WINDOW_UPDATE, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("stream window isn't opened past the body limit", h2Payload == NULL);
+  session->out->len = 0;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = "\x00\x00\x02\x00\x00\x00\x00\x00\x01" "lo",
+    .len  = 11,
+    .cap  = 11
+  }));
+  h2Offset  = 0;
+  h2Payload = h2Find(session->out, &h2Offset, HTTP_PARSER_H2_RST_STREAM, &h2Stream, &h2Flags, &h2Length);
+  ASSERT("body over the limit resets the stream", res == 0 && h2Payload && h2Stream == 1 && h2Payload[3] == HTTP_PARSER_H2_ENHANCE_YOUR_CALM);
+  http_parser_h2_free(session);
+
+  // Header blocks continued beyond the limit fail the connection
+  session = http_parser_h2_init(NULL);
+  session->maxHeaderBlock = 8;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = H2_PRIOR_KNOWLEDGE,
+    .len  = 33,
+    .cap  = 33
+  }));
+  res |= http_parser_h2_data(session, &((struct buf){
+    .data = "\x00\x00\x03\x01\x00\x00\x00\x00\x01" "\x82\x86\x84"
+            "\x00\x00\x06\x09\x00\x00\x00\x00\x01" "\x84\x84\x84\x84\x84\x84",
+    .len  = 27,
+    .cap  = 27
+  }));
+  ASSERT("oversized header block fails the connection", res == -1 && session->out->data[session->out->len - 1] == HTTP_PARSER_H2_ENHANCE_YOUR_CALM);
+  http_parser_h2_free(session);
+
+  printf("# Response cache\n");
+  struct http_parser_cache *cache = http_parser_cache_init(4096);
+  const struct buf *cached;
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  http_parser_request_data(request, &((struct buf){ .data = getMessage, .len = strlen(getMessage), .cap = strlen(getMessage) }));
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->status = 200;
+  response->body   = calloc(1, sizeof(struct buf));
+  buf_append(response->body, "Hello World", 11);
+  http_parser_header_set(response, "Content-Length", "11");
+  http_parser_header_set(response, "Date", "Sun, 06 Nov 1994 08:49:37 GMT");
+  http_parser_header_set(response, "Vary", "Accept-Language");
+  res = http_parser_cache_store(cache, request, response);
+  msgbuf = http_parser_sprint_response(response);
+  cached = http_parser_cache_lookup(cache, request);
+  ASSERT("stored response is served", res == 0 && cached && cached->len == msgbuf->len && memcmp(cached->data, msgbuf->data, msgbuf->len) == 0);
+  http_parser_header_set(request, "Accept-Language", "nl");
+  cached = http_parser_cache_lookup(cache, request);
+  ASSERT("varying header misses", cached == NULL && cache->hits == 1 && cache->misses == 1);
+  res = http_parser_cache_store(cache, request, response);
+  ASSERT("variants are stored apart", res == 0 && cache->count == 2);
+  res = http_parser_cache_invalidate(cache, request->path);
+  ASSERT("invalidation removes every variant", res == 2 && cache->count == 0 && cache->size == 0);
+  http_parser_header_set(response, "Vary", "*");
+  res = http_parser_cache_store(cache, request, response);
+  ASSERT("vary * is not stored", res == -1);
+  http_parser_header_del(response, "Vary");
+  for(i=0; i<100; i++) {
+    free(request->path);
+    request->path = calloc(1, 16);
+    snprintf(request->path, 16, "/%d", (int)i);
+    http_parser_cache_store(cache, request, response);
+  }
+  ASSERT("size is capped", cache->size <= cache->maxSize && cache->count < 100);
+  cached = http_parser_cache_lookup(cache, request);
+  ASSERT("newest survives eviction", cached != NULL);
+  free(request->path);
+  request->path = strdup("/0");
+  cached = http_parser_cache_lookup(cache, request);
+  ASSERT("oldest is evicted", cached == NULL);
+  http_parser_cache_clear(cache);
+  http_parser_header_del(response, "Date");
+  res = http_parser_cache_store(cache, request, response);
+  memcpy(cache->_newest->data->data + cache->_newest->dateOffset, "Thu, 01 Jan 1970 00:00:00 GMT", 29);
+  cached = http_parser_cache_lookup(cache, request);
+  ASSERT("added date is refreshed when served", res == 0 && cached && !strstr(cached->data, "1970") && strstr(cached->data, "\r\nDate: "));
+  http_parser_header_set(response, "Cache-Control", "public, no-store");
+  res = http_parser_cache_store(cache, request, response);
+  ASSERT("no-store is not stored", res == -1);
+  http_parser_header_set(response, "Cache-Control", "private, max-age=60");
+  res = http_parser_cache_store(cache, request, response);
+  ASSERT("private is not stored", res == -1);
+  http_parser_header_del(response, "Cache-Control");
+  http_parser_header_set(response, "Set-Cookie", "session=1");
+  res = http_parser_cache_store(cache, request, response);
+  ASSERT("setting a cookie is not stored", res == -1);
+  http_parser_header_del(response, "Set-Cookie");
+  free(request->method);
+  request->method = strdup("HEAD");
+  res = http_parser_cache_store(cache, request, response);
+  cached = http_parser_cache_lookup(cache, request);
+  ASSERT("HEAD is stored without the body", res == 0 && cached && strstr(cached->data, "\r\nContent-Length: 11\r\n") && !strstr(cached->data, "Hello World") &&
+    cached->len >= 4 && memcmp(cached->data + cached->len - 4, "\r\n\r\n", 4) == 0);
+  buf_clear(msgbuf);
+  free(msgbuf);
+  http_parser_cache_free(cache);
+
+  printf("# Range requests\n");
+  struct http_parser_range ranges[HTTP_PARSER_RANGE_MAX];
+  res = http_parser_range_parse("bytes=0-9", 100, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("single range is parsed", res == 1 && ranges[0].offset == 0 && ranges[0].length == 10);
+  res = http_parser_range_parse("bytes=90-, -5 ,, 50-200", 100, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("open, suffix and overlong ranges are clamped", res == 3 &&
+    ranges[0].offset == 90 && ranges[0].length == 10 &&
+    ranges[1].offset == 95 && ranges[1].length == 5 &&
+    ranges[2].offset == 50 && ranges[2].length == 50);
+  res = http_parser_range_parse("bytes=-500", 100, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("suffix longer than the resource selects all of it", res == 1 && ranges[0].offset == 0 && ranges[0].length == 100);
+  res = http_parser_range_parse("bytes=100-, -0", 100, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("ranges beyond the end are unsatisfiable", res == 0);
+  res = http_parser_range_parse("bytes=10-5", 100, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("backwards range invalidates the header", res == -1);
+  res = http_parser_range_parse("items=0-5", 100, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("other units are ignored", res == -1);
+  res = http_parser_range_parse("bytes=0-1,2-3,4-5", 100, ranges, 2);
+  ASSERT("too many ranges are ignored", res == -1);
+
+  char rangePath[] = "/tmp/http-parser-range-XXXXXX";
+  int rangeFd = mkstemp(rangePath);
+  int rangePipe[2];
+  char rangeOut[1024];
+  ssize_t rangeLen;
+  struct http_parser_segments *segments;
+  unlink(rangePath);
+  write(rangeFd, "0123456789abcdefghijklmnopqrstuvwxyz", 36);
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_header_set(response, "Date", "Thu, 01 Jan 1970 00:00:00 GMT");
+  http_parser_header_set(response, "Content-Type", "text/plain");
+  res = http_parser_range_parse("bytes=10-15", 36, ranges, HTTP_PARSER_RANGE_MAX);
+  segments = http_parser_sprint_ranges(response, ranges, res, rangeFd, 36);
+  ASSERT("single range is a head and a file segment", segments->count == 2 && segments->segments[1].fd == rangeFd && segments->segments[1].offset == 10);
+  pipe(rangePipe);
+  res = http_parser_segments_write(segments, rangePipe[1]);
+  rangeLen = read(rangePipe[0], rangeOut, sizeof(rangeOut) - 1);
+  rangeOut[rangeLen > 0 ? rangeLen : 0] = '\0';
+  ASSERT("single range is sent as 206", res == 1 && strcmp(rangeOut,
+    "HTTP/1.1 206 Partial Content\r\nDate: Thu, 01 Jan 1970 00:00:00 GMT\r\nContent-Type: text/plain\r\n"
+    "Content-Range: bytes 10-15/36\r\nContent-Length: 6\r\n\r\nabcdef") == 0);
+  http_parser_segments_free(segments);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
   http_parser_header_set(response, "Content-Type", "text/plain");
+  res = http_parser_range_parse("bytes=0-1,-2", 36, ranges, HTTP_PARSER_RANGE_MAX);
+  segments = http_parser_sprint_ranges(response, ranges, res, rangeFd, 36);
+  ASSERT("multiple ranges alternate delimiters and file segments", segments->count == 5 && segments->segments[1].fd == rangeFd && segments->segments[3].offset == 34);
+  res = http_parser_segments_write(segments, rangePipe[1]);
+  rangeLen = read(rangePipe[0], rangeOut, sizeof(rangeOut) - 1);
+  rangeOut[rangeLen > 0 ? rangeLen : 0] = '\0';
+  const char *rangeBoundary = strstr(http_parser_header_get(response, "Content-Type"), "boundary=") + 9;
+  char rangeExpect[512];
+  sprintf(rangeExpect,
+    "\r\n--%s\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-1/36\r\n\r\n01"
+    "\r\n--%s\r\nContent-Type: text/plain\r\nContent-Range: bytes 34-35/36\r\n\r\nyz"
+    "\r\n--%s--\r\n", rangeBoundary, rangeBoundary, rangeBoundary);
+  ASSERT("multiple ranges are sent as multipart/byteranges", res == 1 && strstr(rangeOut, "HTTP/1.1 206 Partial Content\r\n") == rangeOut && strcmp(strstr(rangeOut, "\r\n\r\n") + 4, rangeExpect) == 0);
+  ASSERT("multipart length covers the whole body", (size_t)atoi(http_parser_header_get(response, "Content-Length")) == strlen(rangeExpect) && segments->length == segments->written);
+  http_parser_segments_free(segments);
+
+  res = http_parser_range_parse("bytes=40-", 36, ranges, HTTP_PARSER_RANGE_MAX);
+  segments = http_parser_sprint_ranges(response, ranges, res, rangeFd, 36);
+  ASSERT("unsatisfiable ranges answer 416", response->status == 416 && segments->count == 1 && strcmp(http_parser_header_get(response, "Content-Range"), "bytes */36") == 0);
+  http_parser_segments_free(segments);
 
-  ASSERT("response->toString matches after header modification", strcmp(responseNotFoundExtendedMessage, http_parser_sprint_response(response)->data) == 0);
+  res = http_parser_range_parse("bytes=4294967296-", 5368709120ULL, ranges, HTTP_PARSER_RANGE_MAX);
+  ASSERT("ranges past 4 GiB are parsed", res == 1 && ranges[0].offset == 4294967296ULL && ranges[0].length == 1073741824ULL);
+  segments = http_parser_sprint_ranges(response, ranges, res, rangeFd, 5368709120ULL);
+  ASSERT("ranges past 4 GiB are printed", strcmp(http_parser_header_get(response, "Content-Range"), "bytes 4294967296-5368709119/5368709120") == 0 &&
+    strcmp(http_parser_header_get(response, "Content-Length"), "1073741824") == 0 && segments->segments[1].offset == 4294967296ULL);
+  http_parser_segments_free(segments);
+  close(rangePipe[0]);
+  close(rangePipe[1]);
+  close(rangeFd);
+
+  printf("# List headers\n");
+  struct http_parser_list_item listItem;
+  const char *listCursor = http_parser_list_next("text/html;level=1 ; q=0.5 ,, no-cache=\"Set-Cookie, X\", max-age=60", &listItem);
+  ASSERT("list token is read", listCursor && listItem.tokenLength == 9 && strncmp(listItem.token, "text/html", 9) == 0);
+  ASSERT("list parameters are kept raw", listItem.paramsLength == 15 && strncmp(listItem.params, "level=1 ; q=0.5", 15) == 0);
+  ASSERT("list q-value is read", listItem.q == 500);
+  listCursor = http_parser_list_next(listCursor, &listItem);
+  ASSERT("list skips empty entries", listCursor && listItem.tokenLength == 8 && strncmp(listItem.token, "no-cache", 8) == 0);
+  ASSERT("list value may be quoted", listItem.valueLength == 13 && strncmp(listItem.value, "Set-Cookie, X", 13) == 0 && listItem.q == 1000);
+  listCursor = http_parser_list_next(listCursor, &listItem);
+  ASSERT("list value follows =", listCursor && listItem.valueLength == 2 && strncmp(listItem.value, "60", 2) == 0);
+  listCursor = http_parser_list_next(listCursor, &listItem);
+  ASSERT("list ends", listCursor == NULL);
+  ASSERT("list contains tokens case-insensitive", http_parser_list_contains("keep-alive, Upgrade", "upgrade") == 1);
+  ASSERT("list contains whole tokens only", http_parser_list_contains("keep-alive-ish", "keep-alive") == 0);
+  const char *const listTypes[] = { "application/json", "text/html", "text/plain", NULL };
+  ASSERT("negotiation prefers the exact range", http_parser_list_negotiate("text/*;q=0.2, text/plain, */*;q=0.1", listTypes) == 2);
+  ASSERT("negotiation takes the server's order on ties", http_parser_list_negotiate("text/*, application/json", listTypes) == 0);
+  ASSERT("negotiation excludes q=0 over wildcards", http_parser_list_negotiate("*/*, application/json;q=0, text/html;q=0", listTypes) == 2);
+  ASSERT("negotiation fails without acceptable offers", http_parser_list_negotiate("image/png", listTypes) == -1);
+  ASSERT("negotiation accepts anything without a list", http_parser_list_negotiate(NULL, listTypes) == 0);
+  const char *const listLanguages[] = { "nl", "en-US", NULL };
+  ASSERT("language ranges match by prefix", http_parser_list_negotiate("en;q=0.8, fr", listLanguages) == 1);
+
+  printf("# Conditional requests\n");
+  time_t conditionalDate = http_parser_date_parse("Sun, 06 Nov 1994 08:49:37 GMT");
+  ASSERT("IMF-fixdate is parsed", conditionalDate == 784111777);
+  conditionalDate = http_parser_date_parse("Sunday, 06-Nov-94 08:49:37 GMT");
+  ASSERT("RFC 850 date is parsed", conditionalDate == 784111777);
+  conditionalDate = http_parser_date_parse("Sun Nov  6 08:49:37 1994");
+  ASSERT("asctime date is parsed", conditionalDate == 784111777);
+  conditionalDate = http_parser_date_parse("Sun, 06 Nov 1994 08:49:37 CET");
+  ASSERT("dates outside GMT are invalid", conditionalDate == -1);
+  char conditionalFormatted[32];
+  ASSERT("dates are formatted as IMF-fixdate", strcmp(http_parser_date_format(784111777, conditionalFormatted, sizeof(conditionalFormatted)), "Sun, 06 Nov 1994 08:49:37 GMT") == 0);
+  ASSERT("weak comparison ignores W/", http_parser_etag_match("\"a\", W/\"b\"", "\"b\"", 1) == 1);
+  ASSERT("strong comparison rejects weak tags", http_parser_etag_match("\"a\", W/\"b\"", "\"b\"", 0) == 0);
+  ASSERT("star matches any etag", http_parser_etag_match(" *", "W/\"c\"", 0) == 1);
+  ASSERT("missing etag matches only star", http_parser_etag_match("\"a\"", NULL, 1) == 0);
+
+  struct http_parser_validators validators = { .etag = "\"v2\"", .lastModified = 784111777 };
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  const char *conditionalRequest = "GET /doc HTTP/1.1\r\nIf-None-Match: \"v1\", W/\"v2\"\r\nIf-Modified-Since: Sat, 01 Jan 2000 00:00:00 GMT\r\n\r\n";
+  http_parser_request_data(request, &((struct buf){ .data = (char*)conditionalRequest, .len = strlen(conditionalRequest), .cap = strlen(conditionalRequest) }));
+  res = http_parser_conditional_evaluate(request, &validators);
+  ASSERT("matching If-None-Match answers 304", res == 304);
+  validators.etag = "\"v3\"";
+  res = http_parser_conditional_evaluate(request, &validators);
+  ASSERT("If-None-Match takes precedence over If-Modified-Since", res == 0);
+  http_parser_header_del(request, "If-None-Match");
+  res = http_parser_conditional_evaluate(request, &validators);
+  ASSERT("unmodified since the date answers 304", res == 304);
+  http_parser_header_set(request, "If-Match", "\"v1\"");
+  res = http_parser_conditional_evaluate(request, &validators);
+  ASSERT("failing If-Match answers 412", res == 412);
+  http_parser_header_del(request, "If-Match");
+  http_parser_header_set(request, "If-Range", "Sun, 06 Nov 1994 08:49:37 GMT");
+  res = http_parser_conditional_range(request, &validators);
+  ASSERT("If-Range with the exact date honors the range", res == 1);
+  http_parser_header_set(request, "If-Range", "Wed, 09 Nov 1994 08:49:37 GMT");
+  res = http_parser_conditional_range(request, &validators);
+  ASSERT("If-Range with another date sends everything", res == 0);
+  http_parser_header_set(request, "If-Range", "\"v2\"");
+  res = http_parser_conditional_range(request, &validators);
+  ASSERT("If-Range with another etag sends everything", res == 0);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  http_parser_header_set(response, "Date", "Thu, 01 Jan 1970 00:00:00 GMT");
+  http_parser_header_set(response, "Content-Type", "text/html");
+  http_parser_header_set(response, "Cache-Control", "max-age=60");
+  msgbuf = http_parser_sprint_not_modified(response, &validators);
+  ASSERT("304 carries the validators and cache headers only", strcmp(msgbuf->data,
+    "HTTP/1.1 304 Not Modified\r\nDate: Thu, 01 Jan 1970 00:00:00 GMT\r\nETag: \"v3\"\r\n"
+    "Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\nCache-Control: max-age=60\r\n\r\n") == 0);
+  buf_clear(msgbuf);
+  free(msgbuf);
+
+  printf("# Replay\n");
+  char replayRequests[]  = "/tmp/http-parser-replay-XXXXXX";
+  char replayResponses[] = "/tmp/http-parser-replay-XXXXXX";
+  char replayBroken[]    = "/tmp/http-parser-replay-XXXXXX";
+  size_t replayBytes = 0;
+  ssize_t replayWritten;
+  int replayFd = mkstemp(replayRequests);
+  const char *replayData = "GET /a HTTP/1.1\r\nHost: x\r\n\r\nPOST /b HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\n\r\nhelloGET /c HTTP/1.1\r\n\r\n";
+  replayBytes += strlen(replayData);
+  replayWritten = write(replayFd, replayData, strlen(replayData));
+  ASSERT("request capture is written", replayWritten == (ssize_t)strlen(replayData));
+  close(replayFd);
+  replayFd   = mkstemp(replayResponses);
+  replayData = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nokHTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n3\r\nabc\r\n0\r\n\r\nHTTP/1.0 200 OK\r\n\r\nuntil close";
+  replayBytes += strlen(replayData);
+  replayWritten = write(replayFd, replayData, strlen(replayData));
+  ASSERT("response capture is written", replayWritten == (ssize_t)strlen(replayData));
+  close(replayFd);
+  replayFd   = mkstemp(replayBroken);
+  replayData = "GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n";
+  replayBytes += strlen(replayData);
+  replayWritten = write(replayFd, replayData, strlen(replayData));
+  ASSERT("broken capture is written", replayWritten == (ssize_t)strlen(replayData));
+  close(replayFd);
+  const char *replayPaths[] = { replayRequests, replayResponses, replayBroken, "/tmp/http-parser-replay-missing" };
+  struct http_parser_replay replay = { .threads = 2, .onMessage = onReplayMessage };
+  int replayRes = http_parser_replay_run(&replay, replayPaths, 4);
+  ASSERT("replay runs", replayRes == 0);
+  ASSERT("replay parses pipelined requests", replay.requests == 3);
+  ASSERT("replay parses responses up to the end of the capture", replay.responses == 3);
+  ASSERT("replay counts unreadable and unframable captures", replay.errors == 2);
+  ASSERT("replay reports every message", replayMessages == 6);
+  ASSERT("replay records message lengths", replayPostLength == 53 && replayPostBody == 5);
+  ASSERT("replay counts every byte", replay.bytes == replayBytes);
+  unlink(replayRequests);
+  unlink(replayResponses);
+  unlink(replayBroken);
+
+  printf("# Snapshots\n");
+  struct http_parser_message *snapshotSource = http_parser_request_init();
+  struct buf snapshotIn = {
+    .data = "POST /submit?id=7 HTTP/1.1\r\nHost: example.com\r\nX-Custom: yes\r\nContent-Length: 5\r\n\r\nhello",
+    .len  = 88,
+  };
+  http_parser_request_data(snapshotSource, &snapshotIn);
+  http_parser_meta_set(snapshotSource, "route", "submit");
+  struct buf snapshotBuf = {0};
+  http_parser_snapshot_into(&snapshotBuf, snapshotSource);
+  size_t snapshotFirst = snapshotBuf.len;
+  http_parser_snapshot_into(&snapshotBuf, snapshotSource);
+  ASSERT("snapshots are padded to stay aligned", snapshotFirst % 8 == 0 && snapshotBuf.len == snapshotFirst * 2);
+  ASSERT("snapshot size is known upfront", http_parser_snapshot_size(snapshotSource) == snapshotFirst);
+  char *snapshotCopy = malloc(snapshotFirst);
+  memcpy(snapshotCopy, snapshotBuf.data + snapshotFirst, snapshotFirst);
+  buf_clear(&snapshotBuf);
+  const struct http_parser_snapshot *snapshot = http_parser_snapshot_open(snapshotCopy, snapshotFirst);
+  ASSERT("relocated snapshot opens", snapshot != NULL);
+  ASSERT("snapshot holds the start line", strcmp(http_parser_snapshot_string(snapshot, snapshot->method), "POST") == 0 && strcmp(http_parser_snapshot_string(snapshot, snapshot->path), "/submit") == 0 && strcmp(http_parser_snapshot_string(snapshot, snapshot->query), "id=7") == 0);
+  ASSERT("snapshot header lookup by atom", strcmp(http_parser_snapshot_header_get_atom(snapshot, HTTP_PARSER_ATOM_HOST), "example.com") == 0);
+  ASSERT("snapshot header lookup by name", strcmp(http_parser_snapshot_header_get(snapshot, "x-custom"), "yes") == 0 && strcmp(http_parser_snapshot_header_get(snapshot, "HOST"), "example.com") == 0);
+  ASSERT("snapshot holds meta", strcmp(http_parser_snapshot_meta_get(snapshot, "route"), "submit") == 0);
+  size_t snapshotBodyLength;
+  const char *snapshotBody = http_parser_snapshot_body(snapshot, &snapshotBodyLength);
+  ASSERT("snapshot holds the body", snapshotBodyLength == 5 && strcmp(snapshotBody, "hello") == 0);
+  struct http_parser_message *snapshotMessage = http_parser_snapshot_message(snapshot);
+  struct buf *snapshotExpected = http_parser_sprint_request(snapshotSource);
+  struct buf *snapshotActual   = http_parser_sprint_request(snapshotMessage);
+  ASSERT("snapshot converts back to the same message", snapshotExpected->len == snapshotActual->len && memcmp(snapshotExpected->data, snapshotActual->data, snapshotExpected->len) == 0);
+  ASSERT("snapshot converts back with meta", strcmp(http_parser_meta_get(snapshotMessage, "route"), "submit") == 0);
+  ASSERT("snapshot query shares the path's allocation", snapshotMessage->query == snapshotMessage->path + strlen(snapshotMessage->path) + 1);
+  ASSERT("truncated snapshot is rejected", http_parser_snapshot_open(snapshotCopy, snapshotFirst - 8) == NULL);
+  ((struct http_parser_snapshot *)snapshotCopy)->path = (uint32_t)snapshotFirst;
+  ASSERT("snapshot offsets are checked", http_parser_snapshot_open(snapshotCopy, snapshotFirst) == NULL);
+  buf_clear(snapshotExpected);
+  free(snapshotExpected);
+  buf_clear(snapshotActual);
+  free(snapshotActual);
+  http_parser_message_free(snapshotMessage);
+  http_parser_message_free(snapshotSource);
+  free(snapshotCopy);
+
+  printf("# Response templates\n");
+  struct http_parser_message *templateResponse = http_parser_response_init();
+  http_parser_header_set(templateResponse, "Server", "http-parser");
+  http_parser_header_set(templateResponse, "Content-Type", "text/plain");
+  http_parser_header_set(templateResponse, "X-Request-Id", "placeholder");
+  http_parser_header_set(templateResponse, "Access-Control-Allow-Origin", "*");
+  http_parser_header_set(templateResponse, "Date", "Sun, 06 Nov 1994 08:49:37 GMT");
+  const char *const templateSlots[] = { "X-Request-Id", "ETag", NULL };
+  struct http_parser_template *tpl = http_parser_template_compile(templateResponse, templateSlots);
+  ASSERT("template counts its slots", tpl->slotCount == 2);
+  const char *templateValues[] = { "r-1", NULL };
+  struct buf *templateOut = http_parser_template_render(tpl, templateValues, "hello", 5);
+  http_parser_header_set(templateResponse, "X-Request-Id", "r-1");
+  templateResponse->body = calloc(1, sizeof(struct buf));
+  buf_append(templateResponse->body, "hello", 5);
+  struct buf *templateExpected = http_parser_sprint_response(templateResponse);
+  ASSERT("template renders like sprint", templateOut->len == templateExpected->len && memcmp(templateOut->data, templateExpected->data, templateOut->len) == 0);
+  templateValues[1] = "\"v2\"";
+  templateOut->len  = 0;
+  http_parser_template_render_into(templateOut, tpl, templateValues, "hi", 2);
+  buf_append(templateOut, "", 1);
+  ASSERT("template fills slots missing from the response", strstr(templateOut->data, "\r\nETag: \"v2\"\r\nContent-Length: ") != NULL);
+  ASSERT("template sizes the body", strstr(templateOut->data, "Content-Length: 2\r\n\r\nhi") != NULL);
+  ASSERT("template keeps static headers", strstr(templateOut->data, "\r\nAccess-Control-Allow-Origin: *\r\n") != NULL);
+  http_parser_template_free(tpl);
+  buf_clear(templateOut);
+  free(templateOut);
+  buf_clear(templateExpected);
+  free(templateExpected);
+  http_parser_message_free(templateResponse);
+
+  templateResponse = http_parser_response_init();
+  http_parser_header_set(templateResponse, "Transfer-Encoding", "chunked");
+  http_parser_header_set(templateResponse, "Date", "Sun, 06 Nov 1994 08:49:37 GMT");
+  tpl = http_parser_template_compile(templateResponse, NULL);
+  templateOut = http_parser_template_render(tpl, NULL, "abc", 3);
+  buf_append(templateOut, "", 1);
+  ASSERT("chunked template sends the body as a chunk", strcmp(templateOut->data, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nDate: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n3\r\nabc\r\n0\r\n\r\n") == 0);
+  http_parser_template_free(tpl);
+  buf_clear(templateOut);
+  free(templateOut);
+  templateResponse->status = 304;
+  http_parser_header_del(templateResponse, "Transfer-Encoding");
+  http_parser_header_del(templateResponse, "Date");
+  tpl = http_parser_template_compile(templateResponse, NULL);
+  templateOut = http_parser_template_render(tpl, NULL, "abc", 3);
+  buf_append(templateOut, "", 1);
+  ASSERT("template dates every response", strncmp(templateOut->data, "HTTP/1.1 304 Not Modified\r\nDate: ", 33) == 0);
+  ASSERT("bodyless template drops body and length", strlen(templateOut->data) == 33 + 29 + 4 && strcmp(templateOut->data + 62, "\r\n\r\n") == 0);
+  http_parser_template_free(tpl);
+  buf_clear(templateOut);
+  free(templateOut);
+  http_parser_message_free(templateResponse);
+
+  printf("# Worker handoff\n");
+  struct http_parser_queue *queue = http_parser_queue_init(3, 0);
+  int queueItems[5];
+  void *queueItem;
+  ASSERT("queue capacity is a power of two", queue->capacity == 4);
+  for(i=0; i<4; i++) http_parser_queue_push(queue, &queueItems[i]);
+  ASSERT("full queue rejects items", http_parser_queue_push(queue, &queueItems[4]) == -1);
+  queueItem = http_parser_queue_pop(queue);
+  ASSERT("queue pops in order", queueItem == &queueItems[0]);
+  http_parser_queue_push(queue, &queueItems[4]);
+  for(i=1; i<5; i++) {
+    if (http_parser_queue_pop(queue) != &queueItems[i]) break;
+  }
+  ASSERT("queue wraps around", i == 5);
+  queueItem = http_parser_queue_pop(queue);
+  ASSERT("empty queue pops NULL", queueItem == NULL);
+  http_parser_queue_free(queue);
+
+  struct http_parser_pool *pool = http_parser_pool_init();
+  struct handoff handoff = {
+    .requests  = http_parser_queue_init(16, HTTP_PARSER_QUEUE_MULTI_CONSUMER),
+    .responses = http_parser_queue_init(16, HTTP_PARSER_QUEUE_MULTI_PRODUCER),
+  };
+  struct http_parser_pair *handoffPair;
+  pthread_t workers[3];
+  char handoffRequest[64];
+  int handoffSent = 0, handoffAnswered = 0, handoffCorrect = 0;
+  http_parser_pool_attach(pool);
+  for(i=0; i<3; i++) pthread_create(&workers[i], NULL, handoffWorker, &handoff);
+  while(handoffAnswered < 256) {
+    if (handoffSent < 256) {
+      handoffPair = http_parser_pair_init(NULL);
+      sprintf(handoffRequest, "GET /%d HTTP/1.1\r\nHost: localhost\r\n\r\n", handoffSent);
+      http_parser_pair_request_data(handoffPair, &((struct buf){
+        .data = handoffRequest,
+        .len  = strlen(handoffRequest),
+        .cap  = strlen(handoffRequest)
+      }));
+      if (http_parser_queue_push(handoff.requests, handoffPair)) {
+        http_parser_pair_free(handoffPair);
+      } else {
+        handoffSent++;
+      }
+    }
+    while((handoffPair = http_parser_queue_pop(handoff.responses))) {
+      handoffAnswered++;
+      if (
+        handoffPair->response->body &&
+        handoffPair->response->body->len == strlen(handoffPair->request->path) &&
+        strncmp(handoffPair->response->body->data, handoffPair->request->path, handoffPair->response->body->len) == 0
+      ) handoffCorrect++;
+      http_parser_pair_free(handoffPair);
+    }
+  }
+  __atomic_store_n(&(handoff.stop), 1, __ATOMIC_RELEASE);
+  for(i=0; i<3; i++) pthread_join(workers[i], NULL);
+  ASSERT("workers answer every request", handoffCorrect == 256);
+  ASSERT("pairs freed on the parsing thread return to the pool", pool->outstanding == 0 && pool->idle > 0);
+  res = pool->idle;
+  handoffPair = http_parser_pair_init(NULL);
+  ASSERT("pairs are taken from the pool", pool->idle == res - 3 && pool->outstanding == 3);
+  pthread_create(&workers[0], NULL, handoffFree, handoffPair);
+  pthread_join(workers[0], NULL);
+  ASSERT("pairs freed on other threads wait for collection", pool->outstanding == 3);
+  res = http_parser_pool_collect(pool);
+  ASSERT("collecting takes back remote pairs", res == 1 && pool->outstanding == 0);
+  handoffPair = http_parser_pair_init(NULL);
+  res = http_parser_pool_free(pool);
+  ASSERT("pool refuses to be freed while in use", res == -1);
+  http_parser_pair_free(handoffPair);
+  res = http_parser_pool_free(pool);
+  ASSERT("idle pool is freed", res == 0);
+  http_parser_queue_free(handoff.requests);
+  http_parser_queue_free(handoff.responses);
+
+#ifdef HTTP_PARSER_URING
+  printf("# io_uring\n");
+  int uringPair[2];
+  char uringReply[512];
+  size_t uringReceived = 0;
+  ssize_t n;
+  struct http_parser_uring *uring = http_parser_uring_init(64, 4, 16);
+  ASSERT("ring is set up", uring != NULL);
+  uring->onRequest = onUringRequest;
+  socketpair(AF_UNIX, SOCK_STREAM, 0, uringPair);
+  http_parser_uring_add(uring, uringPair[0], NULL);
+  http_parser_uring_run(uring, 0);
+  const char *uringRequest =
+    "GET /one HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    "GET /two HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+  write(uringPair[1], uringRequest, strlen(uringRequest));
+  while(uring->connections && http_parser_uring_run(uring, 1) >= 0);
+  while((n = read(uringPair[1], uringReply + uringReceived, sizeof(uringReply) - 1 - uringReceived)) > 0) {
+    uringReceived += n;
+  }
+  uringReply[uringReceived] = '\0';
+  ASSERT("requests span several small buffers", uringRequests == 2);
+  ASSERT("pipelined responses are sent in order", strcmp(uringReply,
+    "HTTP/1.1 200 OK\r\nDate: Thu, 01 Jan 1970 00:00:00 GMT\r\nContent-Length: 4\r\n\r\n/one"
+    "HTTP/1.1 200 OK\r\nDate: Thu, 01 Jan 1970 00:00:00 GMT\r\nContent-Length: 4\r\n\r\n/two") == 0);
+  ASSERT("connection: close ends the connection", uring->connections == 0);
+  close(uringPair[1]);
+  http_parser_uring_free(uring);
+#endif
+
+#ifdef HTTP_PARSER_STATS
+  printf("# Stats\n");
+  struct http_parser_stats stats = {0};
+  stats.onState = onStatsState;
+  http_parser_stats_reset(http_parser_stats_thread());
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->stats = &stats;
+  for(i=0; i<strlen(getMessage); i++) {
+    http_parser_request_data(request, &((struct buf){
+      .data = getMessage + i,
+      .len  = 1,
+      .cap  = 1
+    }));
+  }
+  ASSERT("request is counted once complete", request->ready && stats.messages == 1);
+  ASSERT("received bytes are counted", stats.bytes == strlen(getMessage));
+  ASSERT("partial lines are scanned again", stats.scanned > stats.bytes);
+  ASSERT("body compactions are counted", stats.moves > 0 && stats.moved > 0 && stats.allocs > 0);
+  ASSERT("hook sees every transition", stats.transitions == 2 && statsHooks == 2 && strcmp(statsLastState, "done") == 0);
+  ASSERT("latency is recorded", http_parser_stats_percentile(&stats, 50) > 0);
+  ASSERT("thread counters include the request", http_parser_stats_thread()->messages == 1 && http_parser_stats_thread()->bytes == stats.bytes);
+
+  http_parser_message_free(request);
+  request = http_parser_request_init();
+  request->stats = &stats;
+  http_parser_request_data(request, &((struct buf){ .data = "garbage\r\n", .len = 9, .cap = 9 }));
+  ASSERT("panics are counted", stats.panics == 1 && strcmp(statsLastState, "panic") == 0);
+  struct http_parser_stats total = {0};
+  http_parser_stats_merge(&total, &stats);
+  http_parser_stats_merge(&total, http_parser_stats_thread());
+  ASSERT("stats merge", total.messages == 2 && total.panics == 2);
+  http_parser_stats_reset(&stats);
+  ASSERT("reset keeps the hook", stats.bytes == 0 && stats.onState == onStatsState);
+
+  http_parser_stats_reset(http_parser_stats_thread());
+  statsHooks = 0;
+  http_parser_stats_thread()->onState = onStatsState;
+  h2Requests = 0;
+  session = http_parser_h2_init(NULL);
+  session->udata     = session;
+  session->onRequest = onH2Request;
+  res = http_parser_h2_data(session, &((struct buf){
+    .data = H2_PRIOR_KNOWLEDGE,
+    .len  = sizeof(H2_PRIOR_KNOWLEDGE) - 1,
+    .cap  = sizeof(H2_PRIOR_KNOWLEDGE) - 1
+  }));
+  ASSERT("h2 requests are counted once complete", res == 0 && h2Requests == 2 && http_parser_stats_thread()->messages == 2);
+  ASSERT("h2 requests are timed and hooked", http_parser_stats_thread()->bytes > 0 && http_parser_stats_percentile(http_parser_stats_thread(), 50) > 0 && statsHooks == 2 && strcmp(statsLastState, "done") == 0);
+  http_parser_stats_thread()->onState = NULL;
+  http_parser_h2_free(session);
+#endif
+
+#ifdef HTTP_PARSER_ZLIB
+  printf("# Content-Encoding\n");
+  struct http_parser_message *encodeRequest = http_parser_request_init();
+  http_parser_header_set(encodeRequest, "Accept-Encoding", "deflate;q=0.5, gzip;q=0.8, br");
+  ASSERT("negotiation prefers the highest weight", strcmp(http_parser_encoding_negotiate(http_parser_header_get(encodeRequest, "accept-encoding")), "gzip") == 0);
+  ASSERT("negotiation honours q=0", http_parser_encoding_negotiate("gzip;q=0, deflate") && strcmp(http_parser_encoding_negotiate("gzip;q=0, deflate"), "deflate") == 0);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->body = calloc(1, sizeof(struct buf));
+  for(i=0; i<200; i++) buf_append(response->body, "{\"hello\":\"world\"},", 18);
+  http_parser_header_set(response, "Content-Length", "3600");
+  res = http_parser_response_encode(response, encodeRequest);
+  ASSERT("response body is encoded", res == 1 && response->body->len < 3600);
+  ASSERT("response is marked as gzip", strcmp(http_parser_header_get(response, "content-encoding"), "gzip") == 0);
+  ASSERT("response varies on accept-encoding", strcmp(http_parser_header_get(response, "vary"), "Accept-Encoding") == 0);
+
+  msgbuf = http_parser_sprint_response(response);
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->decodeBody = 1;
+  chunkCount = 0;
+  for(i=0; i<msgbuf->len; i+=13) {
+    http_parser_response_data(response, &((struct buf){
+      .data = msgbuf->data + i,
+      .len  = MIN(13, msgbuf->len - i),
+      .cap  = MIN(13, msgbuf->len - i)
+    }));
+  }
+  ASSERT("encoded response is ready", response->ready);
+  ASSERT("encoded response is decoded", response->body->len == 3600 && strncmp(response->body->data, "{\"hello\":\"world\"},", 18) == 0);
+  ASSERT("decoded response drops content-encoding", http_parser_header_get(response, "content-encoding") == NULL);
+
+  http_parser_message_free(response);
+  response = http_parser_response_init();
+  response->decodeBody  = 1;
+  response->decodeLimit = 1000;
+  http_parser_response_data(response, msgbuf);
+  ASSERT("decoded body over the limit fails", !response->ready && http_parser_message_head_complete(response) < 0);
+#endif
 
   return err;
 }
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "http-parser.hpp"
+#if __cplusplus >= 202002L
+#include "http-parser-coro.hpp"
+#endif
+
+#define T_RED "\e[31m"
+#define T_LIME "\e[32m"
+#define T_NORMAL "\e[00m"
+
+#define ASSERT(M,c) (printf(((err|=!(c),(c)) ? (T_LIME " PASS " T_NORMAL " %s\n") : (T_RED " FAIL " T_NORMAL " %s\n")),M))
+
+static const char *postMessage =
+  "POST /foobar?token=pizza HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "Content-Type: text/plain\r\n"
+  "Content-Length: 11\r\n"
+  "\r\n"
+  "Hello World"
+;
+
+static const char *headRequest =
+  "HEAD /foobar HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "\r\n"
+;
+
+#if __cplusplus >= 202002L
+static const char *chunkedRequest =
+  "POST /upload HTTP/1.1\r\n"
+  "Host: localhost\r\n"
+  "Transfer-Encoding: chunked\r\n"
+  "\r\n"
+  "5\r\n"
+  "Hello\r\n"
+  "6\r\n"
+  " World\r\n"
+  "0\r\n"
+  "\r\n"
+;
+
+static std::string coroLog;
+
+static http_parser::task serve(http_parser::connection &conn) {
+  while (auto request = co_await conn.request()) {
+    coroLog += std::string(request.method()) + " " + std::string(request.path()) + ":";
+    if (request.method() == "POST") {
+      while (true) {
+        std::string_view chunk = co_await conn.chunk();
+        if (chunk.empty()) break;
+        coroLog += "[" + std::string(chunk) + "]";
+      }
+    } else {
+      coroLog += std::string(co_await conn.body());
+    }
+    coroLog += ";";
+  }
+}
+#endif
+
+int main() {
+  int err = 0;
+
+  printf("# C++ message\n");
+  auto request = http_parser::message::request();
+  request.feed(postMessage);
+  ASSERT("request is ready", request.ready());
+  ASSERT("fields are views", request.method() == "POST" && request.path() == "/foobar" && request.query() == "token=pizza");
+  ASSERT("headers are case-insensitive", request.header("content-type") == "text/plain" && request.header("HOST") == "localhost");
+  ASSERT("missing header is empty", request.header("accept").empty() && !request.has_header("accept"));
+  ASSERT("body is a view", request.body() == "Hello World");
+  int headers = 0;
+  request.for_each_header([&](std::string_view, std::string_view) { headers++; });
+  ASSERT("headers are iterated", headers == 3);
+
+  http_parser::buffer out;
+  request.serialize(out);
+  ASSERT("request serializes into the buffer", out.view() == postMessage);
+  auto moved = std::move(request);
+  ASSERT("moved message keeps ownership", moved.get() && !request.get() && moved.path() == "/foobar");
+
+  printf("# C++ pair\n");
+  int requests = 0;
+  http_parser::pair pair([&](http_parser::event &ev) {
+    requests++;
+    ev.response.set_status(200);
+    ev.response.set_header("Content-Type", "text/plain");
+    ev.response.set_body("Hello World");
+  });
+  auto served = std::move(pair);
+  served.request_data(headRequest);
+  ASSERT("handler runs once the request is complete", requests == 1);
+  out.clear();
+  served.serialize_response(out);
+  ASSERT("head response has no body", out.view().find("Content-Length: 11\r\n") != std::string_view::npos && out.view().substr(out.size() - 4) == "\r\n\r\n");
+  out.clear();
+  served.response().serialize(out);
+  ASSERT("response has length and body", out.view().find("\r\nContent-Length: 11\r\n") != std::string_view::npos && out.view().substr(out.size() - 11) == "Hello World");
+
+  http_parser::buffer adopted(http_parser_sprint_request(moved.get()));
+  ASSERT("sprint results are adopted", adopted.view() == postMessage);
+
+#if __cplusplus >= 202002L
+  printf("# C++ coroutines\n");
+  {
+    http_parser::connection conn;
+    std::size_t pooled = conn.frames().available();
+    auto handler = serve(conn);
+    ASSERT("frame comes from the connection's pool", conn.frames().available() == pooled - 1);
+    ASSERT("task waits for a request", !handler.done() && coroLog.empty());
+    std::string_view stream = chunkedRequest;
+    for (std::size_t i = 0; i < stream.size(); i += 7) conn.feed(stream.substr(i, 7));
+    ASSERT("chunks are awaited as they arrive", coroLog.rfind("POST /upload:[", 0) == 0 && coroLog.find("]") != std::string::npos);
+    std::string body;
+    for (std::size_t i = 0; i < coroLog.size(); i++) if (coroLog[i] != '[' && coroLog[i] != ']') body += coroLog[i];
+    ASSERT("chunks make up the body", body == "POST /upload:Hello World;");
+    coroLog.clear();
+    conn.feed(std::string(headRequest) + postMessage);
+    ASSERT("pipelined requests are awaited in order", coroLog == "HEAD /foobar:;POST /foobar:[Hello World];");
+    conn.close();
+    ASSERT("task ends when the connection closes", handler.done());
+  }
+#endif
+
+  return err;
+}